@@ -6,10 +6,75 @@
 #include "imgtool_mpcomputestatistics.hpp"
 #include "imgtool_mpsingmultmodel.hpp"
 #include "mattool_common.h"
+#include "rstool_memstore.h"
+#include "rstool_kernels.h"
+#include "rstool_memo.h"
 #include "gdal_priv.h"
+#include <algorithm>
 
 namespace ImgAlgo {
 
+    namespace {
+
+        /**
+         * 计算数据块中各像素的 RX 值，即去均值后光谱的马氏距离 d'*C*d
+         * @tparam N        波段数，为 0 时按运行时的 bandCount 计算（按指令集分派的计算核心）
+         * @param stride    相邻两个像素的间隔（元素个数）
+         * @param covarInv  协方差矩阵的逆（bandCount x bandCount，按行存储）
+         * @param memo      光谱相同的像素只计算一次（为 nullptr 时逐像素计算）
+         */
+        template <int N, typename T>
+        void RxScoreBlock(const T *buf, int pixels, int stride, int bandCount,
+                const double *mean, const double *covarInv, float *out,
+                RSTool::SpectrumMemo<T, float> *memo) {
+            if (N == 0) {
+                const RSTool::KernelTable &kernels = RSTool::Kernels();
+                std::vector<double> centered(bandCount);
+                auto score = [&](const T *pTmp) {
+                    for (int k = 0; k < bandCount; k++) {
+                        centered[k] = pTmp[k] - mean[k];
+                    }
+                    return static_cast<float>(kernels.quadForm(covarInv, centered.data(), bandCount));
+                };
+
+                for (int j = 0; j < pixels; j++) {
+                    const T *pTmp = buf + static_cast<size_t>(j)*stride;
+                    out[j] = memo ? memo->eval(pTmp, score) : score(pTmp);
+                }
+                return;
+            }
+
+            // 波段数为编译期常量：均值与矩阵复制到局部数组，循环完全展开
+            const int n = N > 0 ? N : 1;
+            double m[n], c[n*n];
+            std::copy(mean, mean + n, m);
+            std::copy(covarInv, covarInv + n*n, c);
+
+            auto score = [&](const T *pTmp) {
+                double d[n];
+                for (int k = 0; k < n; k++) {
+                    d[k] = pTmp[k] - m[k];
+                }
+
+                double sum = 0;
+                for (int i = 0; i < n; i++) {
+                    double temp = 0;
+                    for (int k = 0; k < n; k++) {
+                        temp += c[i*n + k]*d[k];
+                    }
+                    sum += temp*d[i];
+                }
+                return static_cast<float>(sum);
+            };
+
+            for (int j = 0; j < pixels; j++) {
+                const T *pTmp = buf + static_cast<size_t>(j)*stride;
+                out[j] = memo ? memo->eval(pTmp, score) : score(pTmp);
+            }
+        }
+
+    } // namespace
+
     RXAnomalyDetection::RXAnomalyDetection(const std::string &inFile,
             const std::string &outFile, const std::string &outFormat,
             ImgAlgo::RXType rxtType/* = RXD */) {
@@ -28,8 +93,10 @@ namespace ImgAlgo {
     bool RXAnomalyDetection::init() {
         GDALAllRegister();
 
-        GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(outFileFormat_.c_str());
-        if (poDriver == nullptr) {
+        bool toMemory = RSTool::Mp::IsMemoryFormat(outFileFormat_);
+        GDALDriver *poDriver = toMemory ? nullptr :
+                GetGDALDriverManager()->GetDriverByName(outFileFormat_.c_str());
+        if (!toMemory && poDriver == nullptr) {
             // TODO: 添加错误信息
             setErrorMsg(ERR_DRIVER_MSG);
             return false;
@@ -45,8 +112,13 @@ namespace ImgAlgo {
         imgYSize_ = poInDS_->GetRasterYSize();
         imgBandCount_ = poInDS_->GetRasterCount();
 
-        // 创建输出图像，输出图像是1个波段
-        poOutDS_ = poDriver->Create(outFile_.c_str(), imgXSize_, imgYSize_, 1, GDT_Float32, nullptr);
+        // 创建输出图像，输出图像是1个波段（输出格式为 MEM 时写到内存中间结果）
+        if (toMemory) {
+            result_ = RSTool::Mp::MemoryStore::instance().create(outFile_, imgXSize_, imgYSize_, 1, GDT_Float32);
+            poOutDS_ = result_ ? (GDALDataset *)GDALOpen(result_->path().c_str(), GA_Update) : nullptr;
+        } else {
+            poOutDS_ = poDriver->Create(outFile_.c_str(), imgXSize_, imgYSize_, 1, GDT_Float32, nullptr);
+        }
         if (poOutDS_ == nullptr) {
             GDALClose((GDALDatasetH)poOutDS_);
             setErrorMsg(ERR_CREATE_DATASET_MSG);
@@ -66,6 +138,7 @@ namespace ImgAlgo {
 
         pMean_ = new double[imgBandCount_]{};
         pCovariance_ = new double[imgBandCount_*imgBandCount_]{};
+        return true;
     }
 
     bool RXAnomalyDetection::run() {
@@ -150,29 +223,25 @@ namespace ImgAlgo {
 
                 // 使用多线程处理
                 ImgTool::Mp::MpSingleMultiModel<T> mpRxd(4, 4, poInDS_);
+                // 每个像素的光谱补齐到 SIMD 宽度，均从对齐的地址开始
+                mpRxd.setAllocPolicy(RSTool::AllocPolicy(true));
                 if (progress_) mpRxd.setProgress(progress_,
                         std::placeholders::_1); // , "Anomaly Detection(RXD)"
 
+                // 每个处理线程一个光谱记忆化缓存（第 i 个处理函数只在第 i 个线程中调用）
+                std::vector<std::unique_ptr<RSTool::SpectrumMemo<T, float>>> memos;
+                for (int i = 0; i < 4; i++) {
+                    memos.emplace_back(memoize_ ? new RSTool::SpectrumMemo<T, float>(imgBandCount_) : nullptr);
+                }
+
                 for (int i = 0; i < 4; i++) {
-                    mpRxd.addProcessBlockData(std::bind( [this, &pCovarInv] (ImgTool::ImgBlockData<T> &data) {
+                    RSTool::SpectrumMemo<T, float> *memo = memos[i].get();
+                    mpRxd.addProcessBlockData(std::bind( [this, &pCovarInv, memo] (ImgTool::ImgBlockData<T> &data) {
                         float *pOutBuf = new float[data.bufXSize()*data.bufYSize()]{};
 
                         int size = data.spatial().xSize()*data.spatial().ySize();
-                        for (int j = 0; j < size; j++) {
-                            T *pTmp = data.bufData() + j*imgBandCount_;
-
-                            for (int i = 0; i < imgBandCount_; i++) {
-                                double *pCovarInvTmp = pCovarInv + i*imgBandCount_;
-
-                                double temp = 0;
-                                for (int k = 0; k < imgBandCount_; k++) {
-                                    temp += (pTmp[k] - pMean_[k]) * pCovarInvTmp[k];
-                                }
-
-                                pOutBuf[j] += temp*(pTmp[i] - pMean_[i]);
-                            } // end i
-
-                        } // end j
+                        RSToolSwitchBandCount(imgBandCount_, RxScoreBlock, data.bufData(), size, data.bufStride(),
+                                imgBandCount_, pMean_, pCovarInv, pOutBuf, memo)
 
                         // 输出文件
                         // TODO: 需要上锁吗？
@@ -8,10 +8,13 @@
 #include "imgtool_progress.hpp"
 #include "imgtool_error.h"
 #include <string>
+#include <memory>
 
 
 class GDALDataset;
 
+namespace RSTool { namespace Mp { class MemResult; } }
+
 namespace ImgAlgo {
 
     enum RXType {
@@ -23,6 +26,9 @@ namespace ImgAlgo {
     class RXAnomalyDetection : public ImgTool::ProgressFunctor,
             public ImgTool::ErrorBase {
     public:
+        /**
+         * @param outFormat     输出文件格式；为 MEM 时结果写到内存中间结果（outFile 仅作为名称），由 result() 获取
+         */
         RXAnomalyDetection(const std::string &inFile,
                 const std::string &outFile,
                 const std::string &outFormat,
@@ -35,6 +41,14 @@ namespace ImgAlgo {
 
         bool run();
 
+        /**
+         * 是否对光谱相同的像素只计算一次 RX 值（默认开启；各线程的缓存在命中率低时自动关闭）
+         */
+        void setMemoization(bool enable) { memoize_ = enable; }
+
+        // 输出格式为 MEM 时的中间结果（run() 之后有效）
+        std::shared_ptr<RSTool::Mp::MemResult> result() const { return result_; }
+
     private:
         bool init();
 
@@ -59,6 +73,9 @@ namespace ImgAlgo {
         double *pCovariance_;
 
         RXType rxdType_;
+        bool memoize_ = true;
+
+        std::shared_ptr<RSTool::Mp::MemResult> result_;
     };
 
 }
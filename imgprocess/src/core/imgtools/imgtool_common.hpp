@@ -14,6 +14,7 @@
 #include <functional>
 #include "gdal/gdal.h"
 #include "gdal/gdal_priv.h"
+#include "rstool_rawio.h"
 
 class GDALDataset;
 
@@ -30,9 +31,22 @@ namespace ImgTool {
     enum ImgInterleaveType {
         IIT_BSQ,
         IIT_BIL,
-        IIT_BIP
+        IIT_BIP,
+        IIT_BIP8,   /* 像素分组：每 8 个像素为一组，组内按波段存放（见 RSTool::PixelTileWidth） */
+        IIT_BIP16   /* 像素分组：每 16 个像素为一组 */
     };
 
+    // 对应的 RSTool::Interleave
+    inline RSTool::Interleave ToInterleave(ImgInterleaveType intl) {
+        switch (intl) {
+            case IIT_BSQ : return RSTool::Interleave::BSQ;
+            case IIT_BIL : return RSTool::Interleave::BIL;
+            case IIT_BIP8 : return RSTool::Interleave::BIP8;
+            case IIT_BIP16 : return RSTool::Interleave::BIP16;
+            default : return RSTool::Interleave::BIP;
+        }
+    }
+
     enum ImgBlockType {
         IBT_LINE,   /* 以行为基本单位进行分块 */
         IBT_SQUARE  /* 以方形进行分块 */
@@ -155,13 +169,18 @@ namespace ImgTool {
 
     template <typename T>
     struct ImgBlockData {
-        ImgBlockData() : m_blkBufData(nullptr) {}
+        ImgBlockData() : m_blkBufStride(0), m_blkBufData(nullptr) {}
 
+        /**
+         * @param policy    内存分配策略，BIP 缓冲区按策略补齐时像素间隔为 bufStride()（大于波段数）
+         */
         ImgBlockData(ImgSpatialSubset blkSpat, ImgSpectralSubset blkSpec,
-                     int bufXSize, int bufYSize, ImgInterleaveType blkInterl = IIT_BIP)
+                     int bufXSize, int bufYSize, ImgInterleaveType blkInterl = IIT_BIP,
+                     const RSTool::AllocPolicy &policy = RSTool::AllocPolicy())
                 : m_spatial(blkSpat), m_spectral(blkSpec),
+                  m_blkBufInterleave(blkInterl),
                   m_blkBufXSize(bufXSize), m_blkBufYSize(bufYSize),
-                  m_blkBufInterleave(blkInterl), m_blkBufData(nullptr) {
+                  m_blkBufPolicy(policy), m_blkBufData(nullptr) {
             allocateBuffer();
         }
 
@@ -169,6 +188,7 @@ namespace ImgTool {
                 : m_spatial(other.m_spatial),
                   m_spectral(other.m_spectral),
                   m_blkBufInterleave(other.m_blkBufInterleave),
+                  m_blkBufPolicy(other.m_blkBufPolicy),
                   m_blkBufData(nullptr) {
             m_blkBufXSize = other.m_blkBufXSize;
             m_blkBufYSize = other.m_blkBufYSize;
@@ -192,6 +212,7 @@ namespace ImgTool {
             m_spectral = other.m_spectral;
             m_blkBufXSize = other.m_blkBufXSize;
             m_blkBufYSize = other.m_blkBufYSize;
+            m_blkBufPolicy = other.m_blkBufPolicy;
 
             allocateBuffer();
             memcpy(m_blkBufData, other.m_blkBufData, sizeof(T)*bufDims());
@@ -201,12 +222,14 @@ namespace ImgTool {
         }
 
         void init(ImgSpatialSubset blkSpat, ImgSpectralSubset blkSpec,
-                  int bufXSize, int bufYSize, ImgInterleaveType blkInterl = IIT_BIP) {
+                  int bufXSize, int bufYSize, ImgInterleaveType blkInterl = IIT_BIP,
+                  const RSTool::AllocPolicy &policy = RSTool::AllocPolicy()) {
             m_spatial = blkSpat;
             m_spectral = blkSpec;
             m_blkBufXSize = bufXSize;
             m_blkBufYSize = bufYSize;
             m_blkBufInterleave = blkInterl;
+            m_blkBufPolicy = policy;
 
             allocateBuffer();
         }
@@ -228,11 +251,16 @@ namespace ImgTool {
         int bufXSize() { return m_blkBufXSize; }
         int bufYSize() { return m_blkBufYSize; }
 
-        // 参照 ENVI 的 Dims 意义
+        // 参照 ENVI 的 Dims 意义（包括光谱补齐及像素分组的补齐部分）
         int bufDims() {
-            return m_blkBufXSize*m_blkBufYSize*m_spectral.count();
+            return static_cast<int>(RSTool::InterleaveSize(ToInterleave(m_blkBufInterleave),
+                    static_cast<size_t>(m_blkBufXSize)*m_blkBufYSize, m_spectral.count(), m_blkBufStride));
         }
 
+        // BIP 缓冲区中相邻两个像素的间隔（元素个数），第 j 个像素的光谱为 bufData() + j*bufStride()；
+        // 光谱补齐时大于波段数，其他组织方式等于波段数
+        int bufStride() const { return m_blkBufStride; }
+
         const ImgInterleaveType& interleave() const { return m_blkBufInterleave; }
 
     public:
@@ -244,11 +272,13 @@ namespace ImgTool {
     private:
         void allocateBuffer() {
             freeBuffer();
-            m_blkBufData = new T[bufDims()]{};
+            m_blkBufStride = m_blkBufInterleave == IIT_BIP ?
+                    RSTool::PaddedStride<T>(m_spectral.count(), m_blkBufPolicy) : m_spectral.count();
+            m_blkBufData = RSTool::AlignedAllocZero<T>(static_cast<size_t>(bufDims()), m_blkBufPolicy);
         }
         void freeBuffer() {
             if (m_blkBufData) {
-                delete[](m_blkBufData);
+                RSTool::AlignedFree(m_blkBufData);
                 m_blkBufData = nullptr;
             }
         }
@@ -261,6 +291,8 @@ namespace ImgTool {
         ImgInterleaveType m_blkBufInterleave;
         int m_blkBufXSize;
         int m_blkBufYSize;
+        int m_blkBufStride;                 // BIP 方式时相邻两个像素的间隔
+        RSTool::AllocPolicy m_blkBufPolicy;
 
     private:
         T *m_blkBufData;
@@ -277,6 +309,10 @@ namespace ImgTool {
 
             imgDataset_ = dataset;
             imgDT_ = toGDALDataType<T>();
+
+            // 未压缩的 ENVI 文件使用内存映射方式读取
+            raw_ = RSTool::RawMappedImage::Open(dataset);
+            fileIntl_ = RSTool::DetectInterleave(dataset);
         }
 
         bool operator() (ImgBlockData<T> &data) {
@@ -285,6 +321,50 @@ namespace ImgTool {
             int xSize = data.spatial().xSize();
             int ySize = data.spatial().ySize();
 
+            RSTool::Interleave intl = ToInterleave(data.interleave());
+
+            int stride = data.bufStride();
+            if (raw_) {
+                if (raw_->read(xOff, yOff, xSize, ySize,
+                        data.spectral().count(), data.spectral().map(), intl, data.bufData())) {
+                    if (intl == RSTool::Interleave::BIP) {
+                        RSTool::PadSpectra(data.bufData(), static_cast<size_t>(xSize)*ySize,
+                                data.spectral().count(), stride);
+                    }
+                    return true;
+                }
+            }
+
+            // 与文件的组织方式不同时，先按文件的组织方式整段读取，再在内存中转置，
+            // 避免 GDAL 逐元素跨步复制
+            if (fileIntl_ != intl) {
+                int bandCount = data.spectral().count();
+                static thread_local std::vector<T> staging;
+                staging.resize(static_cast<size_t>(xSize)*ySize*bandCount);
+
+                GSpacing pixelSpace = 0, lineSpace = 0, bandSpace = 0;
+                if (fileIntl_ == RSTool::Interleave::BIP) {
+                    pixelSpace = sizeof(T)*bandCount;
+                    lineSpace = sizeof(T)*bandCount*xSize;
+                    bandSpace = sizeof(T);
+                } else if (fileIntl_ == RSTool::Interleave::BIL) {
+                    pixelSpace = sizeof(T);
+                    lineSpace = sizeof(T)*bandCount*xSize;
+                    bandSpace = sizeof(T)*xSize;
+                }
+
+                if ( CPLErr::CE_Failure == imgDataset_->RasterIO(GF_Read,
+                        xOff, yOff, xSize, ySize, staging.data(), xSize, ySize,
+                        imgDT_, bandCount, data.spectral().map(),
+                        pixelSpace, lineSpace, bandSpace) ) {
+                    return false;
+                }
+
+                RSTool::ConvertInterleave(staging.data(), fileIntl_, data.bufData(), intl,
+                        xSize, ySize, bandCount, stride);
+                return true;
+            }
+
             switch (data.interleave()) {
                 case ImgInterleaveType::IIT_BIP :
                 {
@@ -292,8 +372,8 @@ namespace ImgTool {
                     if ( CPLErr::CE_Failure == imgDataset_->RasterIO(GF_Read,
                             xOff, yOff, xSize, ySize, data.bufData(), xSize, ySize,
                             imgDT_, data.spectral().count(), data.spectral().map(),
-                            sizeof(T)*data.spectral().count(),
-                            sizeof(T)*data.spectral().count()*xSize,
+                            sizeof(T)*stride,
+                            sizeof(T)*stride*xSize,
                             sizeof(T)) ) {
                         return false;
                     }
@@ -324,12 +404,19 @@ namespace ImgTool {
                     break;
                 }
 
+                default :
+                    // 像素分组方式不是文件的存储格式，已在上面经中间缓冲区转换
+                    return false;
             }// end switch
+
+            return true;
         }
 
     private:
         GDALDataset *imgDataset_;
         GDALDataType imgDT_;
+        std::shared_ptr<RSTool::RawMappedImage> raw_;   // 内存映射的数据文件
+        RSTool::Interleave fileIntl_;                   // 影像文件在磁盘中的存储格式
     };
 
 
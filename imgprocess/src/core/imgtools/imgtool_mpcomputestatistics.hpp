@@ -7,6 +7,9 @@
 
 #include "imgtool_mpsingmultmodel.hpp"
 #include "imgtool_progress.hpp"
+#include <thread>
+#include <algorithm>
+#include <cmath>
 
 class GDALDataset;
 
@@ -19,8 +22,12 @@ namespace ImgTool {
             blkSize_ = blkSize;
             imgBandCount_ = dataset->GetRasterCount();
 
-            // todo 根据当前机器 CPU 核数以及需要处理的数据量去设置
-            threadCount_ = 4;
+            // 根据当前机器 CPU 核数以及需要处理的数据量去设置，
+            // 预留一个核给读数据线程，且每个线程至少处理一个数据块
+            int xNums = (dataset->GetRasterXSize() + blkSize_ - 1) / blkSize_;
+            int yNums = (dataset->GetRasterYSize() + blkSize_ - 1) / blkSize_;
+            int hardThreads = std::thread::hardware_concurrency();
+            threadCount_ = std::max(1, std::min(hardThreads - 1, xNums*yNums));
         }
 
         virtual ~MpComputeStatistics() {
@@ -42,9 +49,8 @@ namespace ImgTool {
                  double *covariance, double *correlation = nullptr) {
 
             // step 1: 创建一个 “单-多” 模型对象
-            // todo 线程数和缓冲区队列数量的控制
-            // todo 根据实际硬件条件（CPU核数）及任务量去决定
-            ImgTool::Mp::MpSingleMultiModel<T> mp(threadCount_, threadCount_,
+            // 缓冲区队列数量取消费者线程数的 2 倍
+            ImgTool::Mp::MpSingleMultiModel<T> mp(threadCount_, 2*threadCount_,
                     imgDataset_, blkSize_);
             mp.setProgress(progress_, std::placeholders::_1);
 
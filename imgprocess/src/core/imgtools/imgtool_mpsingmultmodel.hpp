@@ -7,6 +7,8 @@
 
 #include "imgtool_common.hpp"
 #include "imgtool_progress.hpp"
+#include "rstool_gridplan.h"
+#include "rstool_executor.h"
 #include <vector>
 #include <thread>
 #include <mutex>
@@ -36,6 +38,8 @@ namespace ImgTool {
             std::mutex mutexConsumedItemCount_;
 
             int produceItemCount_;
+
+            bool aborted_;  // 读数据或处理数据出错后置位，缓冲区两端的等待均不再继续
         };
 
         template <typename T>
@@ -47,7 +51,7 @@ namespace ImgTool {
                                int blockSize = 128,
                                ImgBlockType blockType = IBT_SQUARE,
                                ImgInterleaveType dataInterleave = IIT_BIP)
-                    : readFunc_(dataset){
+                    : plan_(0, 0, 1, 1), readFunc_(dataset) {
                 consumeCount_ = consumerThreadsCount;
                 bufItemCount_ = std::max(2, bufItemCount); // 最少两个缓冲区
 
@@ -59,69 +63,54 @@ namespace ImgTool {
                 blkType_ = blockType;
                 dataInterleave_ = dataInterleave;
 
+                // 按原生块（瓦片或条带）对齐分块，数据块占用的内存与原来的方形块（或行块）相当
+                size_t pixelBytes = sizeof(T)*imgBandCount_;
+                size_t targetBytes = blkType_ == IBT_LINE ?
+                        static_cast<size_t>(imgXSize_)*blkSize_*pixelBytes :
+                        RSTool::TargetChunkBytes(blkSize_, pixelBytes);
+                plan_ = RSTool::PlanChunkGrid(imgDataset_, pixelBytes, targetBytes, blkType_ == IBT_LINE);
+
             }
 
             virtual ~MpSingleMultiModel() {}
 
-            // 读数据线程 "main()"
-            void producerTask() {
-
-                int pos = 0;
-                switch (blkType_) {
+            /**
+             * 缓冲区的内存分配策略，需在 run() 之前设置；开启光谱补齐（policy.padSpectra）时，
+             * 处理函数须按 ImgBlockData::bufStride() 访问每个像素的光谱
+             */
+            void setAllocPolicy(const RSTool::AllocPolicy &policy) { allocPolicy_ = policy; }
 
-                    case ImgBlockType::IBT_SQUARE :
-                    {
-                        for (int i = 0; i < imgYSize_; i += blkSize_) {
-                            for (int j = 0; j < imgXSize_; j += blkSize_) {
-                                int xBlockSize = blkSize_;
-                                int yBlockSize = blkSize_;
-
-                                // 如果最下面和最右面的块不够 m_blockSize, 剩下多少读多少
-                                if (i + blkSize_ > imgYSize_) // 最下面的剩余块
-                                    yBlockSize = imgYSize_ - i;
-                                if (j + blkSize_ > imgXSize_) // 最右侧的剩余块
-                                    xBlockSize = imgXSize_ - j;
-
-                                produceBlockData(j, i, xBlockSize, yBlockSize);
-                                if (progress_) progress_((pos++)*100.0/bufQueue_.produceItemCount_);
-                            }
-                        }
-
-                        break;
-                    }
-
-                    case ImgBlockType::IBT_LINE :
-                    {
-                        int blockNums = imgYSize_ / blkSize_;
-                        int leftLines = imgYSize_ % blkSize_;
-
-                        // 处理完整块
-                        for (int i = 0; i < blockNums; i++) {
-                            produceBlockData(0, i*blkSize_, imgXSize_, blkSize_);
-                            if (progress_) progress_((pos++)*100.0/bufQueue_.produceItemCount_);
-                        }
+            // 读数据线程 "main()"，出错时中止缓冲区队列并将异常传递给 run()
+            void producerTask() {
+                try {
+                    produce();
+                } catch (...) {
+                    abort();
+                    throw;
+                }
+            }
 
-                        // 处理剩余的最后一块（非完整块）
-                        if (leftLines > 0) {
-                            produceBlockData(0, blockNums*blkSize_, imgXSize_, leftLines);
-                            if (progress_) progress_((pos++)*100.0/bufQueue_.produceItemCount_);
-                        }
+            void produce() {
 
-                        break;
-                    }
-                }// end switch
+                // 按分块方案依次读取（方形块和行块均已按原生块对齐）
+                for (int pos = 0; pos < plan_.count(); pos++) {
+                    RSTool::SpatialDims dims = plan_.chunk(pos);
+                    if (!produceBlockData(dims.xOff(), dims.yOff(), dims.xSize(), dims.ySize())) return;
+                    if (progress_) progress_(pos*100.0/bufQueue_.produceItemCount_);
+                }
 
                 if (progress_) progress_(100);
             }
 
-            // 生产块数据
-            void produceBlockData(int xOff, int yOff, int xSize, int ySize) {
+            // 生产块数据，缓冲区队列已中止时返回 false
+            bool produceBlockData(int xOff, int yOff, int xSize, int ySize) {
                 std::unique_lock<std::mutex> lock(bufQueue_.mutex_);
 
                 while ( ((bufQueue_.writePos_ + 1) % bufItemCount_)
-                        == bufQueue_.readPos_ ) {
+                        == bufQueue_.readPos_ && !bufQueue_.aborted_ ) {
                     (bufQueue_.bufNotFull_).wait(lock);
                 }
+                if (bufQueue_.aborted_) return false;
 
                 // todo 从影像文件读取数据
                 // $1 从文件中读取一块数据
@@ -136,11 +125,21 @@ namespace ImgTool {
 
                 bufQueue_.bufNotEmpty_.notify_all();
                 lock.unlock();
+                return true;
             }
 
             // 块数据处理线程 “main()”
-            // 可根据需要，向每个处理线程传递不同的参数
+            // 可根据需要，向每个处理线程传递不同的参数；出错时中止缓冲区队列并将异常传递给 run()
             void consumerTask(std::function<void(ImgBlockData<T> &)> &&funcProcessDataCore) {
+                try {
+                    consume(std::forward<std::function<void(ImgBlockData<T> &)>>(funcProcessDataCore));
+                } catch (...) {
+                    abort();
+                    throw;
+                }
+            }
+
+            void consume(std::function<void(ImgBlockData<T> &)> &&funcProcessDataCore) {
                 bool readyToExit = false;
 
                 auto funcCore = std::forward<std::function<void(ImgBlockData<T> &)>>(funcProcessDataCore);
@@ -153,11 +152,13 @@ namespace ImgTool {
                     std::unique_lock<std::mutex> lock(bufQueue_.mutexConsumedItemCount_);
                     if (bufQueue_.consumedItemCount_ < bufQueue_.produceItemCount_) {
 
-                        consumeBlockData(data); // 从缓冲区中复制一块数据
+                        if (!consumeBlockData(data)) break; // 从缓冲区中复制一块数据
                         ++bufQueue_.consumedItemCount_;
                         lock.unlock();
 
                         // todo 处理每一块数据的核心函数
+                        // 计算期间持有共享执行器的计算槽，多个作业同时运行时总的计算并行度不超过 CPU 核数
+                        RSTool::Mp::ComputeSlot slot;
                         funcCore(data);
 
                     } else {
@@ -169,12 +170,14 @@ namespace ImgTool {
                 }// end while
             }
 
-            void consumeBlockData(ImgBlockData<T> &data) {
+            // 从缓冲区中取走一块数据，缓冲区队列已中止时返回 false
+            bool consumeBlockData(ImgBlockData<T> &data) {
                 std::unique_lock<std::mutex> lock(bufQueue_.mutex_);
 
-                while ( bufQueue_.writePos_ == bufQueue_.readPos_ ) {
+                while ( bufQueue_.writePos_ == bufQueue_.readPos_ && !bufQueue_.aborted_ ) {
                     bufQueue_.bufNotEmpty_.wait(lock);
                 }
+                if (bufQueue_.aborted_) return false;
 
                 // $1 从缓冲区中取走一个数据
                 // todo 只需更新 空间范围以及缓冲区内的内容，无需重新分配内存
@@ -187,6 +190,17 @@ namespace ImgTool {
 
                 bufQueue_.bufNotFull_.notify_all();
                 lock.unlock();
+                return true;
+            }
+
+            // 中止缓冲区队列：唤醒在缓冲区两端等待的线程，使其退出
+            void abort() {
+                {
+                    std::unique_lock<std::mutex> lock(bufQueue_.mutex_);
+                    bufQueue_.aborted_ = true;
+                }
+                bufQueue_.bufNotFull_.notify_all();
+                bufQueue_.bufNotEmpty_.notify_all();
             }
 
             template <class Fn, class... Args>
@@ -211,61 +225,51 @@ namespace ImgTool {
                 bufQueue_.readPos_ = 0;
                 bufQueue_.writePos_ = 0;
                 bufQueue_.consumedItemCount_ = 0;
-
-                if (blkType_ == IBT_SQUARE) {
-                    int xNums = imgXSize_ / blkSize_;
-                    int yNums = imgYSize_ / blkSize_;
-                    int xLeftLines = imgXSize_ % blkSize_;
-                    int yLeftLines = imgYSize_ % blkSize_;
-
-                    if (xLeftLines > 0) xNums++;
-                    if (yLeftLines > 0) yNums++;
-
-                    bufQueue_.produceItemCount_ = xNums*yNums;
-
-                    // 创建缓冲区
-                    for (int i = 0; i < bufItemCount_; i++) {
-                        bufQueue_.items_.emplace_back(
-                                ImgBlockData<T>(ImgSpatialSubset(),
-                                        ImgSpectralSubset(imgBandCount_),
-                                        blkSize_,
-                                        blkSize_,
-                                        dataInterleave_));
-                    }
-
-                } else {
-                    bufQueue_.produceItemCount_ = imgYSize_ / blkSize_;
-                    int leftLines = imgYSize_ % blkSize_;
-                    if (leftLines > 0)  bufQueue_.produceItemCount_++;
-
-                    for (int i = 0; i < bufItemCount_; i++) {
-                        bufQueue_.items_.emplace_back(
-                                ImgBlockData<T>(ImgSpatialSubset(),
-                                        ImgSpectralSubset(imgBandCount_),
-                                        imgXSize_,
-                                        blkSize_,
-                                        dataInterleave_));
-                    }
+                bufQueue_.aborted_ = false;
+
+                bufQueue_.produceItemCount_ = plan_.count();
+
+                // 创建缓冲区
+                for (int i = 0; i < bufItemCount_; i++) {
+                    bufQueue_.items_.emplace_back(
+                            ImgBlockData<T>(ImgSpatialSubset(),
+                                    ImgSpectralSubset(imgBandCount_),
+                                    plan_.xChunkSize(),
+                                    plan_.yChunkSize(),
+                                    dataInterleave_,
+                                    allocPolicy_));
                 }
                 // $1
 
-                // $2 创建线程并启动
-                std::thread producer(&MpSingleMultiModel<T>::producerTask, this);
+                // $2 在共享执行器上启动读数据线程和处理线程
+                auto &executor = RSTool::Mp::Executor::instance();
+                std::future<void> producer = executor.submit(&MpSingleMultiModel<T>::producerTask, this);
 
                 for (int i = 0; i < consumeCount_; i++) {
-                    consumeThreads_.emplace_back(std::thread(&MpSingleMultiModel<T>::consumerTask,
-                            this, consumeTasks_[i]));
+                    consumeThreads_.emplace_back(executor.submit([this, i] {
+                        consumerTask(std::function<void(ImgBlockData<T> &)>(consumeTasks_[i]));
+                    }));
                 }
                 // $2
 
-                // $3 等待线程结束
+                // $3 等待线程结束，并将第一个异常传递给调用者
                 // 同步各个处理线程和主线程
                 // 主线程需要等待各线程处理的结果
-                // todo 如果不需要和主线程进行同步，是否可以分离线程？？？
-                producer.join();
-                for (int i = 0; i < consumeCount_; i++) {
-                    consumeThreads_[i].join();
+                std::exception_ptr error;
+                for (auto &consumer : consumeThreads_) {
+                    try {
+                        consumer.get();
+                    } catch (...) {
+                        if (!error) error = std::current_exception();
+                    }
+                }
+                consumeThreads_.clear();
+                try {
+                    producer.get();
+                } catch (...) {
+                    if (!error) error = std::current_exception();
                 }
+                if (error) std::rethrow_exception(error);
                 // $3
             }
 
@@ -281,6 +285,8 @@ namespace ImgTool {
             int blkSize_;   // 块大小（块高，块宽度由 blkType_ 类型决定）
             ImgBlockType blkType_;  // 块类型（行或方形）
             ImgInterleaveType dataInterleave_;  // 数据在缓冲区的组织方式（BSQ、BIL、BIP）
+            RSTool::GridPlan plan_;             // 分块方案
+            RSTool::AllocPolicy allocPolicy_;   // 缓冲区的内存分配策略
 
         private:
             DataBufferQueue<T> bufQueue_;   // 数据缓冲区队列
@@ -291,7 +297,7 @@ namespace ImgTool {
             ImgBlockDataRead<T> readFunc_;  // 读取块数据的函数对象
 
         private:
-            std::vector<std::thread> consumeThreads_;   // 消费者线程（块数据处理线程）
+            std::vector<std::future<void>> consumeThreads_;   // 消费者线程（块数据处理线程）
 
             // 每个消费者线程所处理的核心函数对象
             // 可以从主线程中接收不同的参数（主要是为了将主线程的任务并行化）
@@ -14,7 +14,8 @@
 #include <future>
 #include <chrono>
 #include <string>
-#include "ThreadPool.h"
+#include "rstool_executor.h"
+#include "rstool_datasetpool.h"
 
 class GDALDataset;
 
@@ -59,12 +60,12 @@ namespace ImgTool {
 
         public:
             MpThreadIO(const std::string &infile, const std::string &outfile)
-                    : infile_(infile), outfile_(outfile), poolThreadsCount_(4), pool_(1),
+                    : infile_(infile), outfile_(outfile), poolThreadsCount_(4),
                     pools_(poolThreadsCount_) {
 
                 GDALAllRegister();
 
-                poInDS_ = (GDALDataset*)GDALOpen(infile_.c_str(), GA_ReadOnly);
+                poInDS_ = RSTool::Mp::DatasetPool::instance().acquire(infile_);
                 imgXSize_ = poInDS_->GetRasterXSize();
                 imgYSize_ = poInDS_->GetRasterYSize();
                 imgBandCount_ = poInDS_->GetRasterCount();
@@ -113,10 +114,10 @@ namespace ImgTool {
 //                    queue_.items_.emplace_back(ImgBlockData<T>(ImgSpatialSubset(),
 //                            ImgSpectralSubset(imgBandCount_), blkSize_, blkSize_));
 
-                // 初始化线程池
+                // 初始化线程池，句柄从共享句柄池中租借
                 for (int i = 0; i < poolThreadsCount_; i++) {
-                    GDALDataset * ds = (GDALDataset*)GDALOpen(infile.c_str(), GA_ReadOnly);
-                    datasets_.push_back(ds);
+                    datasets_.emplace_back(RSTool::Mp::DatasetPool::instance().acquire(infile));
+                    datasets_.back().cacheBudget(sizeof(T)*blkSize_*blkSize_*imgBandCount_);
                 }
             }
 
@@ -160,7 +161,7 @@ namespace ImgTool {
                 for (int i = 0; i < size; i++) {
 
                     for (int j = 0; j < poolThreadsCount_; j++) {
-                        GDALDataset *ds = datasets_[j];
+                        GDALDataset *ds = datasets_[j].get();
                         Dims & dim = dims[j*blkSize+i];
                         int xOff = dim.xOff_;
                         int yOff = dim.yOff_;
@@ -193,7 +194,7 @@ namespace ImgTool {
 
                 int leftSize = lefts*xNUms;
                 for (int i = 0; i < leftSize; i++) {
-                    GDALDataset *ds = datasets_[poolThreadsCount_-1];
+                    GDALDataset *ds = datasets_[poolThreadsCount_-1].get();
                     Dims & dim = dims[poolThreadsCount_*size+i];
                     int xOff = dim.xOff_;
                     int yOff = dim.yOff_;
@@ -416,7 +417,7 @@ namespace ImgTool {
 
                     int size = data.spatial().xSize()*data.spatial().ySize();
                     int blockSize = size / numThreads;
-                    std::vector<std::thread> threads(numThreads);
+                    std::vector<std::future<void>> threads(numThreads);
 
                     int blockStart = 0;
                     T *buf = data.bufData();
@@ -424,7 +425,7 @@ namespace ImgTool {
                     for (int i = 0; i < numThreads; i++) {
                         int end = blockStart + blockSize;
 
-                        threads[i] = std::thread([this, buf, blockStart, end]{
+                        threads[i] = RSTool::Mp::Executor::instance().submit([this, buf, blockStart, end]{
                             double *mean = new double[imgBandCount_]{};
                             double *stdDev = new double[imgBandCount_]{};
                             double *covariance = new double[imgBandCount_*imgBandCount_]{};
@@ -462,6 +463,10 @@ namespace ImgTool {
                         blockStart = end;
                     }// end for
 
+                    for (auto &thread : threads) {
+                        thread.get();
+                    }
+
                     auto end = std::chrono::high_resolution_clock::now();
                     std::chrono::duration<double, std::milli> elapsed = end-start;
                     std::cout << elapsed.count() << std::endl;
@@ -481,8 +486,7 @@ namespace ImgTool {
 
                 //std::cout << "------------------begin assignment task-----------------" << std::endl;
                 //auto start = std::chrono::high_resolution_clock::now();
-                std::thread producer(&MpThreadIO<T>::produceTask, this);
-                producer.join();
+                RSTool::Mp::Executor::instance().submit(&MpThreadIO<T>::produceTask, this).get();
 
                 //produceTask();
 
@@ -492,7 +496,8 @@ namespace ImgTool {
                 //std::cout << "------------------end assignment task-----------------\n" << std::endl;
 
                 for (int i = 0; i < consumers_; i++) {
-                    consumerThreads_.emplace_back(std::thread(&MpThreadIO<T>::consumeTask, this,
+                    consumerThreads_.emplace_back(RSTool::Mp::Executor::instance().submit(
+                            &MpThreadIO<T>::consumeTask, this,
                             std::ref(producerRets_[i]), consumerItemsCount_[i]));
                 }
 
@@ -503,7 +508,7 @@ namespace ImgTool {
                 //consumer.join();
                 //
                 for (auto &&consumer : consumerThreads_) {
-                    consumer.join();
+                    consumer.get();
                 }
             }
 
@@ -512,18 +517,19 @@ namespace ImgTool {
 
             std::vector< VecThreadRet > producerRets_; // 线程池返回的结果
             int consumers_;
-            std::vector<std::thread> consumerThreads_;
+            std::vector<std::future<void>> consumerThreads_;
             std::vector<int> consumerItemsCount_;
 
             double time_;
 
             size_t poolThreadsCount_;
-            ThreadPool pool_;
-            std::vector<ThreadPool> pools_;
-            std::vector<GDALDataset*> datasets_;
+            std::vector<RSTool::Mp::DatasetLease> datasets_; // 在线程池之后析构，任务执行完后才归还句柄
+            // 线程池均由共享执行器提供，每个 IO线程 的任务串行执行
+            RSTool::Mp::SerialQueue pool_;
+            std::vector<RSTool::Mp::SerialQueue> pools_;
 
         private:
-            GDALDataset *poInDS_;
+            RSTool::Mp::DatasetLease poInDS_;
             GDALDataset *poOutDS_;
 
             int imgBandCount_;
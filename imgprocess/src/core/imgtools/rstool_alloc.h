@@ -0,0 +1,110 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 数据块内存的分配策略：按缓存行（64 字节）对齐；大块内存按 2MB 对齐并建议内核使用透明大页，减少 TLB 缺失；
+// BIP 数据块可将每个像素的光谱补齐到 SIMD 宽度的整数倍（如 330 个 float 波段补齐为 336 个），
+// 使每条光谱都从对齐的地址开始，向量加载不会跨越缓存行
+
+#ifndef IMGPROCESS_RSTOOL_ALLOC_H
+#define IMGPROCESS_RSTOOL_ALLOC_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace RSTool {
+
+    const size_t CacheLineBytes = 64;
+    const size_t HugePageBytes = 2 << 20;
+
+    // 光谱补齐的单位：AVX 寄存器宽度（运行时可能选用 AVX 指令，补齐到 32 字节对 SSE 同样对齐）
+    const size_t SimdBytes = 32;
+
+    /**
+     * 内存分配策略
+     */
+    struct AllocPolicy {
+        AllocPolicy() = default;
+        explicit AllocPolicy(bool padSpectra) : padSpectra(padSpectra) {}
+
+        size_t alignment = CacheLineBytes;      // 起始地址的对齐字节数（2 的幂，不小于 sizeof(void*)）
+        bool padSpectra = false;                // BIP 数据块的像素间隔是否补齐到 SimdBytes 的整数倍
+        bool hugePages = true;                  // 大块内存是否使用透明大页
+        size_t hugePageThreshold = 4*HugePageBytes; // 不小于该字节数的内存视为大块内存
+    };
+
+    /**
+     * 按分配策略分配内存（不初始化），失败时抛出 std::bad_alloc，用 AlignedFree 释放
+     * @param bytes     字节数
+     */
+    inline void* AlignedAlloc(size_t bytes, const AllocPolicy &policy = AllocPolicy()) {
+        size_t alignment = policy.alignment < sizeof(void*) ? sizeof(void*) : policy.alignment;
+        bool huge = policy.hugePages && bytes >= policy.hugePageThreshold;
+        if (huge) {
+            // 大页要求地址与长度均按 2MB 对齐
+            alignment = alignment < HugePageBytes ? HugePageBytes : alignment;
+            bytes = (bytes + HugePageBytes - 1) / HugePageBytes * HugePageBytes;
+        }
+
+        void *p = nullptr;
+        if (posix_memalign(&p, alignment, bytes == 0 ? alignment : bytes) != 0) {
+            throw std::bad_alloc();
+        }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (huge) {
+            // 仅为建议，内核未开启透明大页时忽略
+            madvise(p, bytes, MADV_HUGEPAGE);
+        }
+#endif
+        return p;
+    }
+
+    inline void AlignedFree(void *p) {
+        free(p);
+    }
+
+    /**
+     * 分配 count 个元素并置 0（由调用线程首次写入，内存页落在该线程所在的 NUMA 节点上）
+     */
+    template <typename T>
+    inline T* AlignedAllocZero(size_t count, const AllocPolicy &policy = AllocPolicy()) {
+        T *p = static_cast<T*>(AlignedAlloc(sizeof(T)*count, policy));
+        memset(p, 0, sizeof(T)*count);
+        return p;
+    }
+
+    /**
+     * BIP 数据块中相邻两个像素的间隔（元素个数）：补齐时为 bandCount 向上取整到 SimdBytes/sizeof(T) 的整数倍
+     * @param bandCount 波段数
+     */
+    template <typename T>
+    inline int PaddedStride(int bandCount, const AllocPolicy &policy) {
+        if (!policy.padSpectra || SimdBytes % sizeof(T) != 0) return bandCount;
+        const int unit = static_cast<int>(SimdBytes / sizeof(T));
+        return (bandCount + unit - 1) / unit * unit;
+    }
+
+    /**
+     * 将按紧凑方式（像素间隔为 bandCount）写入的 BIP 数据就地展开为像素间隔为 stride 的布局，
+     * 补齐部分置 0；用于读取函数只能写紧凑数据的情况（如内存映射文件的复制）
+     * @param pixels    像素个数
+     */
+    template <typename T>
+    inline void PadSpectra(T *data, size_t pixels, int bandCount, int stride) {
+        if (stride == bandCount || pixels == 0) return;
+        // 从最后一个像素向前移动，目标位置总在源位置之后，不会覆盖未移动的数据
+        for (size_t i = pixels; i-- > 0; ) {
+            memmove(data + i*stride, data + i*bandCount, sizeof(T)*bandCount);
+            memset(data + i*stride + bandCount, 0, sizeof(T)*(stride - bandCount));
+        }
+    }
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_ALLOC_H
@@ -0,0 +1,251 @@
+//
+// Created by penglei on 18-10-20.
+//
+// 运行时自动调节读线程数、消费者线程数以及读缓冲队列大小
+
+#ifndef IMGPROCESS_RSTOOL_AUTOTUNE_H
+#define IMGPROCESS_RSTOOL_AUTOTUNE_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <future>
+#include "rstool_executor.h"
+
+namespace RSTool {
+
+    namespace Mp {
+
+        // 取值范围 [min, max]，init 为初始值
+        struct TuneRange {
+            TuneRange(int min, int max, int init)
+                    : min_(std::max(1, min)), max_(std::max(min_, max)),
+                    init_(std::min(std::max(init, min_), max_)) {}
+
+            int min_;
+            int max_;
+            int init_;
+        };
+
+        // 流水线运行时的统计量，由各读线程和消费者线程累加
+        struct PipelineStats {
+            std::atomic<long long> readerWaitNs{0};     // 读线程因读缓冲队列已满而等待的时间
+            std::atomic<long long> consumerWaitNs{0};   // 消费者线程因读缓冲队列为空而等待的时间
+            std::atomic<long long> consumerBusyNs{0};   // 消费者线程处理数据块的时间
+        };
+
+        // 用于统计一段代码的耗时（纳秒），析构时累加到指定的计数器上
+        class ScopedNs {
+        public:
+            explicit ScopedNs(std::atomic<long long> &counter)
+                    : counter_(counter), start_(std::chrono::steady_clock::now()) {}
+
+            ~ScopedNs() {
+                counter_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_).count();
+            }
+
+        private:
+            std::atomic<long long> &counter_;
+            std::chrono::steady_clock::time_point start_;
+        };
+
+        /**
+         * 根据运行时的统计量，周期性地调整“读-处理”流水线的并行度：
+         *  1. 消费者经常等待数据（读是瓶颈）：激活更多读线程，读线程已满则加大缓冲队列，
+         *     消费者空闲过多时挂起部分消费者线程，把 CPU 让给读线程；
+         *  2. 读线程经常等待队列空位（处理是瓶颈）：激活更多消费者线程，
+         *     消费者线程已满则挂起部分读线程。
+         * 线程编号 >= 当前激活数的线程会被挂起，直到被重新激活或作业结束
+         */
+        class AutoTuner {
+        public:
+            /**
+             * @param readers   读线程数范围
+             * @param consumers 消费者线程数范围
+             * @param queue     读缓冲队列大小范围
+             * @param interval  调整周期（毫秒），默认 100
+             */
+            AutoTuner(const TuneRange &readers, const TuneRange &consumers,
+                    const TuneRange &queue, int interval = 100)
+                    : readers_(readers), consumers_(consumers), queue_(queue),
+                    interval_(interval), activeReaders_(readers.init_),
+                    activeConsumers_(consumers.init_), queueMaxSize_(queue.init_),
+                    finished_(false), stop_(false) {}
+
+            ~AutoTuner() { stop(); }
+
+            AutoTuner(const AutoTuner &) = delete;
+            AutoTuner& operator= (const AutoTuner &) = delete;
+
+            /**
+             * 在共享执行器上启动调优任务
+             * @param queueSize     返回读缓冲队列当前大小
+             * @param setQueueMax   设置读缓冲队列的最大大小
+             */
+            void start(std::function<int()> queueSize,
+                    std::function<void(int)> setQueueMax) {
+                queueSize_ = std::move(queueSize);
+                setQueueMax_ = std::move(setQueueMax);
+                setQueueMax_(queueMaxSize_);
+                loop_ = Executor::instance().submit(&AutoTuner::loop, this);
+            }
+
+            // 停止调优任务，并唤醒所有被挂起的线程
+            void stop() {
+                finish();
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    stop_ = true;
+                }
+                condStop_.notify_all();
+                if (loop_.valid()) loop_.get();
+            }
+
+            // 作业的所有数据块均已领取完毕，唤醒所有被挂起的线程使其退出
+            void finish() {
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    finished_ = true;
+                }
+                condActive_.notify_all();
+            }
+
+            /**
+             * 若第 i 个读线程当前被挂起，则等待其被激活
+             * @return 作业结束时返回 false
+             */
+            bool waitReaderActive(int i) { return waitActive(i, activeReaders_); }
+
+            // 同上，用于消费者线程
+            bool waitConsumerActive(int i) { return waitActive(i, activeConsumers_); }
+
+            int activeReaders() const { return activeReaders_; }
+            int activeConsumers() const { return activeConsumers_; }
+            int queueMaxSize() const { return queueMaxSize_; }
+
+            PipelineStats& stats() { return stats_; }
+
+        private:
+            bool waitActive(int i, const std::atomic<int> &active) {
+                if (i < active) return true;
+
+                std::unique_lock<std::mutex> lk(mutex_);
+                while (i >= active && !finished_) {
+                    condActive_.wait(lk);
+                }
+                return !finished_;
+            }
+
+            void loop() {
+                long long lastReaderWait = 0, lastConsumerWait = 0, lastConsumerBusy = 0;
+                long long intervalNs = static_cast<long long>(interval_)*1000000;
+                int hold = 0; // 每次调整后观察一个周期，避免来回震荡
+
+                std::unique_lock<std::mutex> lk(mutex_);
+                while (!stop_) {
+                    // 一个周期内多次采样队列占用率
+                    double occupancy = 0;
+                    const int samples = 5;
+                    for (int s = 0; s < samples && !stop_; s++) {
+                        condStop_.wait_for(lk, std::chrono::milliseconds(interval_ / samples));
+                        occupancy += static_cast<double>(queueSize_()) / queueMaxSize_;
+                    }
+                    if (stop_) break;
+                    occupancy /= samples;
+
+                    long long readerWait = stats_.readerWaitNs;
+                    long long consumerWait = stats_.consumerWaitNs;
+                    long long consumerBusy = stats_.consumerBusyNs;
+
+                    double dReaderWait = readerWait - lastReaderWait;
+                    double dConsumerWait = consumerWait - lastConsumerWait;
+                    double dConsumerBusy = consumerBusy - lastConsumerBusy;
+                    lastReaderWait = readerWait;
+                    lastConsumerWait = consumerWait;
+                    lastConsumerBusy = consumerBusy;
+
+                    if (hold > 0) {
+                        --hold;
+                        continue;
+                    }
+
+                    // 消费者等待数据的时间占比
+                    double consumerStarve = dConsumerWait + dConsumerBusy > 0 ?
+                            dConsumerWait / (dConsumerWait + dConsumerBusy) : 0;
+
+                    // 读线程等待队列空位的时间占比
+                    double readerBlock = dReaderWait / (intervalNs*activeReaders_);
+
+                    if (consumerStarve > 0.25 && occupancy < 0.25) {
+                        // 读是瓶颈
+                        if (activeReaders_ < readers_.max_) {
+                            ++activeReaders_;
+                            hold = 1;
+                        } else if (queueMaxSize_ < queue_.max_) {
+                            queueMaxSize_ = std::min(queue_.max_, queueMaxSize_*2);
+                            setQueueMax_(queueMaxSize_);
+                            hold = 1;
+                        }
+
+                        if (consumerStarve > 0.5 && activeConsumers_ > consumers_.min_) {
+                            --activeConsumers_;
+                            hold = 1;
+                        }
+                    } else if (readerBlock > 0.25 && occupancy > 0.75) {
+                        // 处理是瓶颈
+                        if (activeConsumers_ < consumers_.max_) {
+                            ++activeConsumers_;
+                            hold = 1;
+                        } else if (activeReaders_ > readers_.min_) {
+                            --activeReaders_;
+                            hold = 1;
+                        }
+                    }
+
+                    if (hold > 0) {
+                        condActive_.notify_all();
+                    }
+                } // end while
+            } // end loop()
+
+        private:
+            TuneRange readers_;
+            TuneRange consumers_;
+            TuneRange queue_;
+            int interval_;
+
+            std::atomic<int> activeReaders_;
+            std::atomic<int> activeConsumers_;
+            int queueMaxSize_;
+
+            PipelineStats stats_;
+            std::function<int()> queueSize_;
+            std::function<void(int)> setQueueMax_;
+
+            std::mutex mutex_;
+            std::condition_variable condActive_;
+            std::condition_variable condStop_;
+            bool finished_;
+            bool stop_;
+            std::future<void> loop_;
+        };
+
+        /**
+         * 未指定读线程数时，读线程数的上限（本地磁盘一般 1~2 个足够，
+         * NFS 等高延迟存储需要更多读线程来掩盖延迟）
+         */
+        inline int DefaultMaxReadThreads() {
+            int hardThreads = std::thread::hardware_concurrency();
+            return std::max(2, std::min(8, hardThreads / 2));
+        }
+
+    } // namespace Mp
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_AUTOTUNE_H
@@ -7,7 +7,15 @@
 
 #include "gdal/gdal.h"
 #include "gdal/gdal_priv.h"
+#include "rstool_transpose.h"
+#include "rstool_alloc.h"
+#include "rstool_convert.h"
 #include <vector>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
 #include <type_traits>
 #include <iostream>
 
@@ -78,7 +86,7 @@ namespace RSTool {
         const std::vector<int>& bands() const { return bands_; }
 
         // 返回波段数
-        int bandCount() { return static_cast<int>(bands_.size()); }
+        int bandCount() const { return static_cast<int>(bands_.size()); }
 
         // 返回波段索引
         int* bandMap() { return bands_.data(); }
@@ -116,9 +124,37 @@ namespace RSTool {
     enum class Interleave : char {
         BSQ,
         BIL,
-        BIP
+        BIP,
+        BIP8,       /* 像素分组（只用于内存）：每 8 个像素为一组，组内按波段存放 */
+        BIP16       /* 像素分组：每 16 个像素为一组 */
     };
 
+    /**
+     * 像素分组（BIP-N）组织方式中每组的像素个数，其他组织方式返回 0。
+     * 数据块中的像素按行优先的顺序每 N 个分为一组，每组内第 b 个波段的 N 个值连续存放，
+     * 处理若干像素 x 全部波段的计算核心可在像素方向上以单位步长向量加载；最后一组不足 N 个像素时补 0
+     */
+    inline int PixelTileWidth(Interleave intl) {
+        switch (intl) {
+            case Interleave::BIP8 : return 8;
+            case Interleave::BIP16 : return 16;
+            default : return 0;
+        }
+    }
+
+    /**
+     * 数据块的元素个数（包括光谱补齐部分及最后一个像素分组的补齐部分）
+     * @param pixels    像素个数
+     * @param stride    BIP 方式时相邻两个像素的间隔（元素个数）
+     */
+    inline size_t InterleaveSize(Interleave intl, size_t pixels, int bandCount, int stride) {
+        const int tile = PixelTileWidth(intl);
+        if (tile > 0) {
+            return (pixels + tile - 1) / tile * tile * bandCount;
+        }
+        return pixels*(intl == Interleave::BIP ? stride : bandCount);
+    }
+
     // 数据块，里面存放数据块空间和光谱范围信息以及数据块内容
     template <typename T>
     struct DataChunk {
@@ -154,41 +190,59 @@ namespace RSTool {
             allocMemory();
         }
 
+        /**
+         * @param policy    内存分配策略，BIP 数据块按策略补齐时像素间隔为 stride()（大于波段数）
+         */
         DataChunk(const SpatialDims &spatDims, const SpectralDimes &specDims,
-                Interleave intl = Interleave::BIP)
-                : dims_(spatDims, specDims), intl_(intl) {
+                Interleave intl = Interleave::BIP, const AllocPolicy &policy = AllocPolicy())
+                : dims_(spatDims, specDims), intl_(intl), policy_(policy) {
             allocMemory();
         }
 
-        DataChunk(const DataDims &dims, Interleave intl = Interleave::BIP)
-                : dims_(dims), intl_(intl) {
+        DataChunk(const DataDims &dims, Interleave intl = Interleave::BIP,
+                const AllocPolicy &policy = AllocPolicy())
+                : dims_(dims), intl_(intl), policy_(policy) {
             allocMemory();
         }
 
+        /**
+         * 不拥有内存的数据块，只读地使用外部内存（如内存映射文件中的数据），无论 holder 是否为空，都不会释放外部内存；
+         * 以可写方式访问数据（data()）时先复制为自己的内存，只读访问请使用 cdata()
+         * @param data      外部内存，元素个数不少于 dims.elemCount()
+         * @param holder    外部内存的持有者，数据块存在期间保证外部内存有效，可为空（由调用者保证）
+         */
+        DataChunk(const DataDims &dims, Interleave intl, const T *data, std::shared_ptr<void> holder)
+                : dims_(dims), intl_(intl), stride_(dims_.bandCount()), owned_(false),
+                  holder_(std::move(holder)), data_(const_cast<T*>(data)) {}
+
         // 拷贝构造函数
         DataChunk(const DataChunk &other)
-            : dims_(other.dims_), intl_(other.intl_){
+            : dims_(other.dims_), intl_(other.intl_), policy_(other.policy_) {
             allocMemory();
-            mempcpy(data_, other.data_, sizeof(T)*dims_.elemCount());
+            memcpy(data_, other.data_, sizeof(T)*size());
         }
 
-        // 拷贝赋值函数
+        // 拷贝赋值函数（拷贝得到的数据块总是拥有自己的内存）
         DataChunk& operator= (const DataChunk &other) {
             if (this == &other) {
                 return *this;
             }
 
-            ReleaseArray(data_);
+            releaseMemory();
 
             dims_ = other.dims_;
             intl_ = other.intl_;
+            policy_ = other.policy_;
             allocMemory();
-            mempcpy(data_, other.data_, sizeof(T)*dims_.elemCount());
+            memcpy(data_, other.data_, sizeof(T)*size());
+            return *this;
         }
 
         // 移动构造函数
         DataChunk(DataChunk &&rother) noexcept
-            : dims_(rother.dims_), intl_(rother.intl_) {
+            : dims_(rother.dims_), intl_(rother.intl_), policy_(rother.policy_),
+              stride_(rother.stride_), node_(rother.node_), owned_(rother.owned_),
+              holder_(std::move(rother.holder_)) {
 
             // 偷取
             data_ = rother.data_;
@@ -201,15 +255,21 @@ namespace RSTool {
                 return *this;
             }
 
-            ReleaseArray(data_);
+            releaseMemory();
             dims_ = rother.dims_;
             intl_ = rother.intl_;
+            policy_ = rother.policy_;
+            stride_ = rother.stride_;
+            node_ = rother.node_;
+            owned_ = rother.owned_;
+            holder_ = std::move(rother.holder_);
             data_ = rother.data_;
             rother.data_ = nullptr;
+            return *this;
         }
 
         virtual ~DataChunk() {
-            ReleaseArray(data_);
+            releaseMemory();
         }
 
     public:
@@ -219,27 +279,100 @@ namespace RSTool {
         Interleave &interleave() { return intl_; }
         const Interleave &interleave() const { return intl_; }
 
-        T* data() { return data_; }
+        // 可写地访问数据：外部内存的视图先复制为自己的内存（写时复制），不会修改外部内存
+        T* data() {
+            detach();
+            return data_;
+        }
+
+        // 只读地访问数据，外部内存的视图不复制
+        const T* data() const { return data_; }
+        const T* cdata() const { return data_; }
+
+        /**
+         * BIP 数据块中相邻两个像素的间隔（元素个数），光谱补齐时大于波段数，否则等于波段数；
+         * 第 i 个像素的光谱为 data() + i*stride()，补齐部分为 0。其他组织方式不补齐（像素分组方式见 PixelTileWidth()）
+         */
+        int stride() const { return stride_; }
+
+        // 是否补齐了光谱
+        bool padded() const { return stride_ != dims_.bandCount(); }
+
+        // 数据块的元素个数（包括补齐部分）
+        size_t size() const {
+            return InterleaveSize(intl_, static_cast<size_t>(dims_.spatialSize()), dims_.bandCount(), stride_);
+        }
+
+        /**
+         * 数据按紧凑方式（像素间隔为波段数）写入后，就地展开为补齐后的布局
+         */
+        void padSpectra() {
+            PadSpectra(data_, static_cast<size_t>(dims_.spatialSize()),
+                    dims_.bandCount(), stride_);
+        }
+
+        // 是否拥有数据块内存（否则为外部内存的视图）
+        bool ownsMemory() const { return owned_; }
+
+        // 数据块内存所在的 NUMA 节点（由分配并首次写入内存的线程决定），-1 表示未知
+        int numaNode() const { return node_; }
+        void numaNode(int value) { node_ = value; }
 
         void update(int xOff, int yOff, int xSize, int ySize, T *data) {
             dims_.updateSpatial(xOff, yOff, xSize, ySize);
-            mempcpy(data_, data, sizeof(T)*dims_.elemCount());
+            memcpy(data_, data, sizeof(T)*size());
         }
 
         void swap(DataChunk<T> &other) {
             std::swap(dims_, other.dims_);
             std::swap(intl_, other.intl_);
+            std::swap(policy_, other.policy_);
+            std::swap(stride_, other.stride_);
+            std::swap(node_, other.node_);
+            std::swap(owned_, other.owned_);
+            std::swap(holder_, other.holder_);
             std::swap(data_, other.data_);
         }
 
     private:
+        // 置 0 会写入全部内存，内存页按“首次写入”原则落在分配线程所在的 NUMA 节点上
         void allocMemory() {
-            data_ = new T[dims_.elemCount()]{};
+            stride_ = intl_ == Interleave::BIP ?
+                    PaddedStride<T>(dims_.bandCount(), policy_) : dims_.bandCount();
+            data_ = AlignedAllocZero<T>(size(), policy_);
+            owned_ = true;
+        }
+
+        // 外部内存只释放其持有者，自己的内存才会释放
+        void releaseMemory() {
+            if (owned_ && data_) {
+                AlignedFree(data_);
+            }
+            holder_.reset();
+            data_ = nullptr;
+        }
+
+        // 外部内存的视图复制为自己的内存（布局不变）
+        void detach() {
+            if (owned_) return;
+            T *copy = nullptr;
+            if (data_) {
+                copy = static_cast<T*>(AlignedAlloc(sizeof(T)*size(), policy_));
+                memcpy(copy, data_, sizeof(T)*size());
+            }
+            holder_.reset();
+            data_ = copy;
+            owned_ = true;
         }
 
     private:
         DataDims dims_;
         Interleave intl_;
+        AllocPolicy policy_;
+        int stride_;
+        int node_ = -1;
+        bool owned_ = true;                 // 是否拥有数据块内存（否则为外部内存的只读视图）
+        std::shared_ptr<void> holder_;
         T *data_;
     };
 
@@ -261,11 +394,214 @@ namespace RSTool {
         } else if ( std::is_same<T, double>::value ) {
             return GDALDataType::GDT_Float64;
         }
+        // 半精度等 GDAL 不支持的存储类型
+        return GDALDataType::GDT_Unknown;
+    }
+
+    /**
+     * 获取影像文件在磁盘中的存储格式：优先读取 IMAGE_STRUCTURE 元数据域中的 INTERLEAVE 项
+     * （BAND/LINE/PIXEL），其次读取 ENVI 元数据域中的 interleave 项（bsq/bil/bip），
+     * 均没有时按 BSQ 处理（按波段读取不会重复读取同一段数据）
+     * @param dataset   数据集
+     * @return          存储格式
+     */
+    inline Interleave DetectInterleave(GDALDataset *dataset) {
+        const char *value = dataset->GetMetadataItem("INTERLEAVE", "IMAGE_STRUCTURE");
+        if (value == nullptr) {
+            value = dataset->GetMetadataItem("interleave", "ENVI");
+        }
+        if (value == nullptr) {
+            return Interleave::BSQ;
+        }
+
+        std::string intl(value);
+        std::transform(intl.begin(), intl.end(), intl.begin(), ::toupper);
+        if (intl == "PIXEL" || intl == "BIP") {
+            return Interleave::BIP;
+        } else if (intl == "LINE" || intl == "BIL") {
+            return Interleave::BIL;
+        }
+        return Interleave::BSQ;
     }
 
-    // 读/写分块数据
+    /**
+     * 计算像素 (x, y) 第 b 个波段在数据块中的偏移量（元素个数）
+     */
+    inline size_t InterleaveOffset(Interleave intl, int xSize, int ySize, int bandCount,
+            int x, int y, int b) {
+        switch (intl) {
+            case Interleave::BSQ : return (static_cast<size_t>(b)*ySize + y)*xSize + x;
+            case Interleave::BIL : return (static_cast<size_t>(y)*bandCount + b)*xSize + x;
+            case Interleave::BIP8 :
+            case Interleave::BIP16 : {
+                const size_t tile = PixelTileWidth(intl);
+                const size_t p = static_cast<size_t>(y)*xSize + x;
+                return (p/tile*bandCount + b)*tile + p%tile;
+            }
+            default : return (static_cast<size_t>(y)*xSize + x)*bandCount + b;
+        }
+    }
+
+    namespace Detail {
+
+        /**
+         * 像素分组（BIP-N）与其他组织方式之间的转换：与 BIP 之间每组为一次 N x 波段数的转置，
+         * 与 BSQ/BIL 之间每组的每个波段为一段（或跨行时的几段）连续复制；两者均为像素分组时逐元素复制。
+         * 目标为像素分组时最后一组的补齐部分置 0
+         */
+        template <typename T>
+        inline void ConvertPixelTiled(const T *src, Interleave srcIntl, T *dst, Interleave dstIntl,
+                int xSize, int ySize, int bandCount, int stride) {
+            const size_t pixels = static_cast<size_t>(xSize)*ySize;
+            const int srcTile = PixelTileWidth(srcIntl);
+            const int dstTile = PixelTileWidth(dstIntl);
+
+            if (srcTile > 0 && dstTile > 0) {
+                memset(dst, 0, sizeof(T)*InterleaveSize(dstIntl, pixels, bandCount, stride));
+                for (int y = 0; y < ySize; y++) {
+                    for (int x = 0; x < xSize; x++) {
+                        for (int b = 0; b < bandCount; b++) {
+                            dst[InterleaveOffset(dstIntl, xSize, ySize, bandCount, x, y, b)] =
+                                    src[InterleaveOffset(srcIntl, xSize, ySize, bandCount, x, y, b)];
+                        }
+                    }
+                }
+                return;
+            }
+
+            const bool toTiled = dstTile > 0;
+            const int tile = toTiled ? dstTile : srcTile;
+            const Interleave other = toTiled ? srcIntl : dstIntl;
+            const size_t tileSize = static_cast<size_t>(tile)*bandCount;
+
+            for (size_t p0 = 0, g = 0; p0 < pixels; p0 += tile, g++) {
+                const int m = static_cast<int>(std::min<size_t>(tile, pixels - p0));
+                const T *srcTileData = src + g*tileSize;
+                T *dstTileData = dst + g*tileSize;
+
+                if (other == Interleave::BIP) {
+                    // 组内：波段 x 像素 <-> 像素 x 波段
+                    if (toTiled) {
+                        Transpose(src + p0*stride, stride, dstTileData, tile, m, bandCount);
+                    } else {
+                        Transpose(srcTileData, tile, dst + p0*stride, stride, bandCount, m);
+                    }
+                } else {
+                    for (int b = 0; b < bandCount; b++) {
+                        // 一组像素可能跨越多行，BIL 方式时按行分段复制
+                        for (int k = 0; k < m; ) {
+                            const size_t p = p0 + k;
+                            const int y = static_cast<int>(p / xSize);
+                            const int x = static_cast<int>(p % xSize);
+                            const int len = std::min(m - k, xSize - x);
+                            const size_t offset = InterleaveOffset(other, xSize, ySize, bandCount, x, y, b);
+                            if (toTiled) {
+                                memcpy(dstTileData + static_cast<size_t>(b)*tile + k, src + offset, sizeof(T)*len);
+                            } else {
+                                memcpy(dst + offset, srcTileData + static_cast<size_t>(b)*tile + k, sizeof(T)*len);
+                            }
+                            k += len;
+                        }
+                    }
+                }
+
+                if (toTiled && m < tile) {
+                    for (int b = 0; b < bandCount; b++) {
+                        memset(dstTileData + static_cast<size_t>(b)*tile + m, 0, sizeof(T)*(tile - m));
+                    }
+                }
+            }
+        }
+
+    } // namespace Detail
+
+    /**
+     * 转换数据块在内存中的组织方式：BSQ 与 BIL 之间逐行复制，
+     * 涉及 BIP 的转换为矩阵转置（BSQ/BIP 之间整块转置，BIL/BIP 之间逐行转置），使用分块的寄存器转置；
+     * 像素分组（BIP-N）方式见 Detail::ConvertPixelTiled()
+     * @param src       源数据
+     * @param srcIntl   源数据的组织方式
+     * @param dst       目标数据（与源数据不能重叠）
+     * @param dstIntl   目标数据的组织方式
+     * @param pixelStride   BIP 数据中相邻两个像素的间隔（元素个数，光谱补齐时大于波段数），0 表示等于波段数
+     */
+    template <typename T>
+    inline void ConvertInterleave(const T *src, Interleave srcIntl, T *dst, Interleave dstIntl,
+            int xSize, int ySize, int bandCount, int pixelStride = 0) {
+        const size_t planeSize = static_cast<size_t>(xSize)*ySize;
+        const int stride = pixelStride > 0 ? pixelStride : bandCount;
+        if (srcIntl == dstIntl) {
+            memcpy(dst, src, sizeof(T)*InterleaveSize(srcIntl, planeSize, bandCount, stride));
+            return;
+        }
+
+        if (PixelTileWidth(srcIntl) > 0 || PixelTileWidth(dstIntl) > 0) {
+            Detail::ConvertPixelTiled(src, srcIntl, dst, dstIntl, xSize, ySize, bandCount, stride);
+            return;
+        }
+
+        if (srcIntl != Interleave::BIP && dstIntl != Interleave::BIP) {
+            // BSQ <-> BIL：每个波段的一行都是连续的
+            for (int y = 0; y < ySize; y++) {
+                for (int b = 0; b < bandCount; b++) {
+                    memcpy(dst + InterleaveOffset(dstIntl, xSize, ySize, bandCount, 0, y, b),
+                           src + InterleaveOffset(srcIntl, xSize, ySize, bandCount, 0, y, b),
+                           sizeof(T)*xSize);
+                }
+            }
+            return;
+        }
+
+        // BIL 的一行与 BIP 的一行（含补齐部分）
+        const size_t lineSize = static_cast<size_t>(xSize)*bandCount;
+        const size_t bipLineSize = static_cast<size_t>(xSize)*stride;
+        if (srcIntl == Interleave::BSQ) {
+            // 波段 x 像素 -> 像素 x 波段
+            Transpose(src, planeSize, dst, stride, bandCount, static_cast<int>(planeSize));
+        } else if (dstIntl == Interleave::BSQ) {
+            Transpose(src, stride, dst, planeSize, static_cast<int>(planeSize), bandCount);
+        } else if (srcIntl == Interleave::BIL) {
+            for (int y = 0; y < ySize; y++) {
+                Transpose(src + y*lineSize, xSize, dst + y*bipLineSize, stride, bandCount, xSize);
+            }
+        } else {
+            for (int y = 0; y < ySize; y++) {
+                Transpose(src + y*bipLineSize, stride, dst + y*lineSize, xSize, xSize, bandCount);
+            }
+        }
+    }
+
+    /**
+     * 将像素分组（BIP-N）或光谱补齐的 BIP 数据转换为紧凑的 BIP（线程局部的缓冲区，下次调用前有效），
+     * 供按行、按固定像素间隔（波段数）访问数据的写出函数使用；其他情况直接返回原数据
+     * @param intl      数据的组织方式，返回转换后的组织方式
+     * @param stride    BIP 数据中相邻两个像素的间隔（见 DataChunk::stride()），0 表示等于波段数
+     */
+    template <typename T>
+    inline const T* UntilePixels(const T *data, Interleave &intl, int xSize, int ySize, int bandCount,
+            int stride = 0) {
+        bool padded = intl == Interleave::BIP && bandCount > 0 && stride > bandCount;
+        if (PixelTileWidth(intl) == 0 && !padded) return data;
+
+        static thread_local std::vector<T> staging;
+        const size_t pixels = static_cast<size_t>(xSize)*ySize;
+        staging.resize(pixels*bandCount);
+        if (padded) {
+            for (size_t i = 0; i < pixels; i++) {
+                memcpy(staging.data() + i*bandCount, data + i*stride, sizeof(T)*bandCount);
+            }
+        } else {
+            ConvertInterleave(data, intl, staging.data(), Interleave::BIP, xSize, ySize, bandCount);
+        }
+        intl = Interleave::BIP;
+        return staging.data();
+    }
+
+    // 读/写分块数据，半精度数据块（DataChunk<Half> 等）按 float 读写后转换
     template <typename T>
     class DataChunkIO {
+        using IOType = typename StorageTraits<T>::IOType;
+
     protected:
         // 与 operator() (DataChunk<T> &data) 配合使用
         DataChunkIO(GDALDataset *dataset, GDALRWFlag rwFlag) : specDims_(0) {
@@ -275,61 +611,17 @@ namespace RSTool {
 
             dataset_ = dataset;
             rwFlag_ = rwFlag;
-            dataType_ = toGDALDataType<T>();
+            dataType_ = toGDALDataType<IOType>();
+            fileIntl_ = DetectInterleave(dataset);
             bandCount_ = 0;
             bandMap_ = nullptr;
         }
 
     public:
         bool operator() (DataChunk<T> &data) {
-            int xOff = data.dims().xOff();
-            int yOff = data.dims().yOff();
-            int xSize = data.dims().xSize();
-            int ySize = data.dims().ySize();
-
-            switch (data.interleave()) {
-                case Interleave::BIP :
-                {
-                    // todo 将全波段处理和部分波段处理分开
-                    if ( CPLErr::CE_Failure == dataset_->RasterIO(rwFlag_,
-                            xOff, yOff, xSize, ySize, data.data(), xSize, ySize,
-                            dataType_, data.dims().bandCount(), data.dims().bandMap(),
-                            sizeof(T)*data.dims().bandCount(),
-                            sizeof(T)*data.dims().bandCount()*xSize,
-                            sizeof(T)) ) {
-                        return false;
-                    }
-                    break;
-                }
-
-                case Interleave::BSQ :
-                {
-                    if ( CPLErr::CE_Failure == dataset_->RasterIO(rwFlag_,
-                            xOff, yOff, xSize, ySize, data.data(), xSize, ySize,
-                            dataType_, data.dims().bandCount(), data.dims().bandMap(),
-                            0, 0, 0) ) {
-                        return false;
-                    }
-                    break;
-                }
-
-                case Interleave::BIL :
-                {
-                    if ( CPLErr::CE_Failure == dataset_->RasterIO(rwFlag_,
-                            xOff, yOff, xSize, ySize, data.data(), xSize, ySize,
-                            dataType_, data.dims().bandCount(), data.dims().bandMap(),
-                            sizeof(T),
-                            sizeof(T)*data.dims().bandCount()*xSize,
-                            sizeof(T)*xSize) ) {
-                        return false;
-                    }
-                    break;
-                }
-
-
-            }// end switch
-
-            return true;
+            return transfer(data.dims().xOff(), data.dims().yOff(),
+                    data.dims().xSize(), data.dims().ySize(), data.data(), data.interleave(),
+                    data.dims().bandCount(), data.dims().bandMap(), data.stride());
         }
 
     protected:
@@ -344,7 +636,8 @@ namespace RSTool {
 
             dataset_ = dataset;
             rwFlag_ = rwFlag;
-            dataType_ = toGDALDataType<T>();
+            dataType_ = toGDALDataType<IOType>();
+            fileIntl_ = DetectInterleave(dataset);
         }
 
         // 波段子集处理
@@ -359,55 +652,104 @@ namespace RSTool {
 
             dataset_ = dataset;
             rwFlag_ = rwFlag;
-            dataType_ = toGDALDataType<T>();
+            dataType_ = toGDALDataType<IOType>();
+            fileIntl_ = DetectInterleave(dataset);
             bandCount_ = specDims_.bandCount();
             bandMap_ = specDims_.bandMap();
         }
 
     public:
-        bool operator() (int xOff, int yOff, int xSize, int ySize, T *data) {
-            switch (intl_) {
+        /**
+         * @param stride    BIP 数据中相邻两个像素的间隔（元素个数，见 DataChunk::stride()），0 表示等于波段数
+         */
+        bool operator() (int xOff, int yOff, int xSize, int ySize, T *data, int stride = 0) {
+            return transfer(xOff, yOff, xSize, ySize, data, intl_, bandCount_, bandMap_,
+                    stride > 0 ? stride : bandCount_);
+        }
+
+        // 影像文件在磁盘中的存储格式
+        Interleave fileInterleave() const { return fileIntl_; }
+
+    private:
+        /**
+         * 读/写一个数据块：若内存中要求的组织方式与文件不同，则先按文件的组织方式读/写
+         * （GDAL 可整段连续读写，不必逐元素跨步复制），再在内存中以分块转置转换组织方式
+         */
+        bool transfer(int xOff, int yOff, int xSize, int ySize, T *data,
+                Interleave intl, int bandCount, int *bandMap, int stride) {
+            if (!IsHalfType<T>::value) {
+                return transferIO(xOff, yOff, xSize, ySize, reinterpret_cast<IOType*>(data),
+                        intl, bandCount, bandMap, stride);
+            }
+
+            // 半精度：经 float 缓冲区读写（布局不变，包括光谱补齐部分）
+            size_t n = InterleaveSize(intl, static_cast<size_t>(xSize)*ySize, bandCount, stride);
+            expanded_.resize(n);
+            if (rwFlag_ == GF_Write) {
+                ConvertSaturate(data, expanded_.data(), n);
+            }
+
+            if (!transferIO(xOff, yOff, xSize, ySize, expanded_.data(), intl, bandCount, bandMap, stride)) {
+                return false;
+            }
+
+            if (rwFlag_ == GF_Read) {
+                ConvertSaturate(expanded_.data(), data, n);
+            }
+            return true;
+        }
+
+        bool transferIO(int xOff, int yOff, int xSize, int ySize, IOType *data,
+                Interleave intl, int bandCount, int *bandMap, int stride) {
+            if (fileIntl_ == intl) {
+                return rasterIO(xOff, yOff, xSize, ySize, data, intl, bandCount, bandMap, stride);
+            }
+
+            staging_.resize(static_cast<size_t>(xSize)*ySize*bandCount);
+            if (rwFlag_ == GF_Write) {
+                ConvertInterleave(data, intl, staging_.data(), fileIntl_, xSize, ySize, bandCount, stride);
+            }
+
+            if (!rasterIO(xOff, yOff, xSize, ySize, staging_.data(), fileIntl_, bandCount, bandMap, bandCount)) {
+                return false;
+            }
+
+            if (rwFlag_ == GF_Read) {
+                ConvertInterleave(staging_.data(), fileIntl_, data, intl, xSize, ySize, bandCount, stride);
+            }
+            return true;
+        }
+
+        // 按指定的内存组织方式调用 RasterIO，BIP 方式时相邻两个像素的间隔为 stride 个元素
+        bool rasterIO(int xOff, int yOff, int xSize, int ySize, IOType *data,
+                Interleave intl, int bandCount, int *bandMap, int stride) {
+            GSpacing pixelSpace = 0, lineSpace = 0, bandSpace = 0;
+            switch (intl) {
                 case Interleave::BIP :
-                {
                     // todo 将全波段处理和部分波段处理分开
-                    if ( CPLErr::CE_Failure == dataset_->RasterIO(rwFlag_,
-                            xOff, yOff, xSize, ySize, data, xSize, ySize,
-                            dataType_, bandCount_, bandMap_,
-                            sizeof(T)*bandCount_,
-                            sizeof(T)*bandCount_*xSize,
-                            sizeof(T)) ) {
-                        return false;
-                    }
+                    pixelSpace = sizeof(IOType)*stride;
+                    lineSpace = sizeof(IOType)*stride*xSize;
+                    bandSpace = sizeof(IOType);
                     break;
-                }
 
                 case Interleave::BSQ :
-                {
-                    if ( CPLErr::CE_Failure == dataset_->RasterIO(rwFlag_,
-                            xOff, yOff, xSize, ySize, data, xSize, ySize,
-                            dataType_, bandCount_, bandMap_,
-                            0, 0, 0) ) {
-                        return false;
-                    }
                     break;
-                }
 
                 case Interleave::BIL :
-                {
-                    if ( CPLErr::CE_Failure == dataset_->RasterIO(rwFlag_,
-                            xOff, yOff, xSize, ySize, data, xSize, ySize,
-                            dataType_, bandCount_, bandMap_,
-                            sizeof(T),
-                            sizeof(T)*bandCount_*xSize,
-                            sizeof(T)*xSize) ) {
-                        return false;
-                    }
+                    pixelSpace = sizeof(IOType);
+                    lineSpace = sizeof(IOType)*bandCount*xSize;
+                    bandSpace = sizeof(IOType)*xSize;
                     break;
-                }
 
+                default :
+                    // 像素分组方式不是文件的存储格式，经 transferIO() 的中间缓冲区转换，不会到达此处
+                    return false;
             }// end switch
 
-            return true;
+            return CPLErr::CE_Failure != dataset_->RasterIO(rwFlag_,
+                    xOff, yOff, xSize, ySize, data, xSize, ySize,
+                    dataType_, bandCount, bandMap,
+                    pixelSpace, lineSpace, bandSpace);
         }
 
     private:
@@ -418,6 +760,10 @@ namespace RSTool {
         Interleave intl_;
         int bandCount_;
         int *bandMap_;
+
+        Interleave fileIntl_;               // 影像文件在磁盘中的存储格式
+        std::vector<IOType> staging_;       // 按文件组织方式读写时的中间缓冲区
+        std::vector<IOType> expanded_;      // 半精度数据块按 float 读写时的缓冲区
     };
 
     // 读取分块数据
@@ -0,0 +1,166 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 饱和类型转换：浮点数转换为整数时四舍五入（远离零），超出目标类型范围时取边界值，NaN 转换为 0，
+// 与 GDAL 写出时的转换规则一致；float 转换为 8/16/32 位整数时使用 SSE 按 16/8/4 个元素一组转换。
+// 半精度存储类型（Half/BFloat16）按浮点数处理，与其他类型之间经 float 转换
+
+#ifndef IMGPROCESS_RSTOOL_CONVERT_H
+#define IMGPROCESS_RSTOOL_CONVERT_H
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include "rstool_half.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RSTOOL_CONVERT_SSE2 1
+#else
+#define RSTOOL_CONVERT_SSE2 0
+#endif
+
+namespace RSTool {
+
+    template <typename D, typename S>
+    inline D SaturateCast(S v);
+
+    namespace Detail {
+
+        template <typename D, typename S>
+        inline D SaturateCastImpl(S v, std::false_type) {
+            if (std::is_floating_point<D>::value) {
+                return static_cast<D>(v);
+            }
+
+            if (std::is_floating_point<S>::value) {
+                if (v != v) return D(0);
+                // 在源类型中计算，与 SSE 的结果一致
+                S r = v < 0 ? v - S(0.5) : v + S(0.5);
+                if (r <= static_cast<S>(std::numeric_limits<D>::lowest())) return std::numeric_limits<D>::lowest();
+                if (r >= static_cast<S>(std::numeric_limits<D>::max())) return std::numeric_limits<D>::max();
+                return static_cast<D>(r);
+            }
+
+            // 整数之间：本项目用到的整数类型均不超过 32 位
+            long long x = static_cast<long long>(v);
+            if (x < static_cast<long long>(std::numeric_limits<D>::lowest())) return std::numeric_limits<D>::lowest();
+            if (x > static_cast<long long>(std::numeric_limits<D>::max())) return std::numeric_limits<D>::max();
+            return static_cast<D>(x);
+        }
+
+        // 涉及半精度类型时经 float 转换：转换为半精度时按浮点数舍入，否则按 float 饱和转换
+        template <typename D, typename S>
+        inline D SaturateCastImpl(S v, std::true_type) {
+            return IsHalfType<D>::value ? D(static_cast<float>(v)) : SaturateCast<D>(static_cast<float>(v));
+        }
+
+    } // namespace Detail
+
+    /**
+     * 将一个值饱和转换为类型 D
+     */
+    template <typename D, typename S>
+    inline D SaturateCast(S v) {
+        return Detail::SaturateCastImpl<D>(v, std::integral_constant<bool,
+                IsHalfType<D>::value || IsHalfType<S>::value>());
+    }
+
+#if RSTOOL_CONVERT_SSE2
+    namespace Detail {
+
+        // 四舍五入（远离零）并截断到 [lo, hi]，NaN 置为 0
+        inline __m128 RoundClamp(__m128 v, __m128 lo, __m128 hi) {
+            const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(0x80000000u)));
+            __m128 half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(v, sign));
+            v = _mm_and_ps(_mm_add_ps(v, half), _mm_cmpord_ps(v, v));
+            return _mm_min_ps(_mm_max_ps(v, lo), hi);
+        }
+
+        inline __m128i LoadRound(const float *src, __m128 lo, __m128 hi) {
+            return _mm_cvttps_epi32(RoundClamp(_mm_loadu_ps(src), lo, hi));
+        }
+
+    } // namespace Detail
+#endif
+
+    /**
+     * 将 n 个元素饱和转换到 dst（dst 由调用者分配，可重复使用）
+     */
+    template <typename S, typename D>
+    inline void ConvertSaturate(const S *src, D *dst, size_t n) {
+        if (std::is_same<S, D>::value) {
+            memcpy(dst, src, sizeof(D)*n);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = SaturateCast<D>(src[i]);
+        }
+    }
+
+    inline void ConvertSaturate(const float *src, Half *dst, size_t n) { ConvertHalf(src, dst, n); }
+    inline void ConvertSaturate(const Half *src, float *dst, size_t n) { ConvertHalf(src, dst, n); }
+    inline void ConvertSaturate(const float *src, BFloat16 *dst, size_t n) { ConvertHalf(src, dst, n); }
+    inline void ConvertSaturate(const BFloat16 *src, float *dst, size_t n) { ConvertHalf(src, dst, n); }
+
+#if RSTOOL_CONVERT_SSE2
+    inline void ConvertSaturate(const float *src, unsigned char *dst, size_t n) {
+        const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(255.0f);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_packs_epi32(Detail::LoadRound(src + i, lo, hi), Detail::LoadRound(src + i + 4, lo, hi));
+            __m128i b = _mm_packs_epi32(Detail::LoadRound(src + i + 8, lo, hi), Detail::LoadRound(src + i + 12, lo, hi));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(a, b));
+        }
+        for (; i < n; i++) {
+            dst[i] = SaturateCast<unsigned char>(src[i]);
+        }
+    }
+
+    inline void ConvertSaturate(const float *src, unsigned short *dst, size_t n) {
+        // SSE2 没有无符号的 32->16 位饱和打包，先平移到有符号范围，打包后再平移回来
+        const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(65535.0f);
+        const __m128i bias32 = _mm_set1_epi32(32768);
+        const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_sub_epi32(Detail::LoadRound(src + i, lo, hi), bias32);
+            __m128i b = _mm_sub_epi32(Detail::LoadRound(src + i + 4, lo, hi), bias32);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(_mm_packs_epi32(a, b), bias16));
+        }
+        for (; i < n; i++) {
+            dst[i] = SaturateCast<unsigned short>(src[i]);
+        }
+    }
+
+    inline void ConvertSaturate(const float *src, short *dst, size_t n) {
+        const __m128 lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_packs_epi32(Detail::LoadRound(src + i, lo, hi), Detail::LoadRound(src + i + 4, lo, hi));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+        }
+        for (; i < n; i++) {
+            dst[i] = SaturateCast<short>(src[i]);
+        }
+    }
+
+    inline void ConvertSaturate(const float *src, int *dst, size_t n) {
+        // 2^31 不能表示为 int，正向溢出时 cvttps 得到 0x80000000，与溢出掩码异或后为 0x7fffffff
+        const __m128 lo = _mm_set1_ps(-2147483648.0f), hi = _mm_set1_ps(2147483648.0f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = Detail::RoundClamp(_mm_loadu_ps(src + i), lo, hi);
+            __m128i overflow = _mm_castps_si128(_mm_cmpge_ps(v, hi));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(_mm_cvttps_epi32(v), overflow));
+        }
+        for (; i < n; i++) {
+            dst[i] = SaturateCast<int>(src[i]);
+        }
+    }
+#endif
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_CONVERT_H
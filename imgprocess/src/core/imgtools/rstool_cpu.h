@@ -0,0 +1,112 @@
+//
+// Created by penglei on 18-10-30.
+//
+// CPU 指令集检测：同一个可执行文件在不同的节点上运行（从只支持 SSE4.2 到支持 AVX-512），
+// 启动时检测 CPU 支持的指令集，计算核心（rstool_kernels.h）据此选择对应的实现；
+// 环境变量 RSTOOL_ISA（scalar/sse2/sse4.2/avx2/avx512）或 SetIsaLevel() 可指定更低的指令集，用于性能对比
+
+#ifndef IMGPROCESS_RSTOOL_CPU_H
+#define IMGPROCESS_RSTOOL_CPU_H
+
+#include <string>
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
+#include <cctype>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RSTOOL_X86_DISPATCH 1
+#else
+#define RSTOOL_X86_DISPATCH 0
+#endif
+
+namespace RSTool {
+
+    // 指令集级别，后者包含前者
+    enum class IsaLevel : char {
+        Scalar,     /* 不使用 SIMD 指令 */
+        SSE2,
+        SSE42,
+        AVX2,       /* AVX2 + FMA */
+        AVX512      /* AVX-512F */
+    };
+
+    inline const char* IsaName(IsaLevel isa) {
+        switch (isa) {
+            case IsaLevel::SSE2 : return "sse2";
+            case IsaLevel::SSE42 : return "sse4.2";
+            case IsaLevel::AVX2 : return "avx2";
+            case IsaLevel::AVX512 : return "avx512";
+            default : return "scalar";
+        }
+    }
+
+    /**
+     * 解析指令集名称（不区分大小写），无法识别时返回 false
+     */
+    inline bool ParseIsaName(const std::string &name, IsaLevel &isa) {
+        std::string s(name);
+        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+        if (s == "scalar" || s == "none") isa = IsaLevel::Scalar;
+        else if (s == "sse2") isa = IsaLevel::SSE2;
+        else if (s == "sse4.2" || s == "sse42") isa = IsaLevel::SSE42;
+        else if (s == "avx2") isa = IsaLevel::AVX2;
+        else if (s == "avx512" || s == "avx512f") isa = IsaLevel::AVX512;
+        else return false;
+        return true;
+    }
+
+    /**
+     * CPU（及操作系统）支持的最高指令集级别，进程内只检测一次
+     */
+    inline IsaLevel DetectIsaLevel() {
+        static const IsaLevel detected = [] {
+#if RSTOOL_X86_DISPATCH
+            __builtin_cpu_init();
+            // __builtin_cpu_supports 已检查操作系统是否保存 AVX/AVX-512 寄存器状态
+            if (__builtin_cpu_supports("avx512f")) return IsaLevel::AVX512;
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return IsaLevel::AVX2;
+            if (__builtin_cpu_supports("sse4.2")) return IsaLevel::SSE42;
+            if (__builtin_cpu_supports("sse2")) return IsaLevel::SSE2;
+#endif
+            return IsaLevel::Scalar;
+        }();
+        return detected;
+    }
+
+    namespace Detail {
+
+        // 当前使用的指令集级别，初始为检测结果与环境变量 RSTOOL_ISA 中的较低者
+        inline std::atomic<int>& ActiveIsa() {
+            static std::atomic<int> active([] {
+                IsaLevel isa = DetectIsaLevel();
+                IsaLevel wanted;
+                const char *env = getenv("RSTOOL_ISA");
+                if (env != nullptr && ParseIsaName(env, wanted) && wanted < isa) {
+                    isa = wanted;
+                }
+                return static_cast<int>(isa);
+            }());
+            return active;
+        }
+
+    } // namespace Detail
+
+    // 计算核心当前使用的指令集级别
+    inline IsaLevel ActiveIsaLevel() {
+        return static_cast<IsaLevel>(Detail::ActiveIsa().load(std::memory_order_relaxed));
+    }
+
+    /**
+     * 指定计算核心使用的指令集级别（不超过 CPU 支持的级别），用于性能对比，应在处理开始前调用
+     * @return  实际使用的级别
+     */
+    inline IsaLevel SetIsaLevel(IsaLevel isa) {
+        isa = std::min(isa, DetectIsaLevel());
+        Detail::ActiveIsa().store(static_cast<int>(isa), std::memory_order_relaxed);
+        return isa;
+    }
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_CPU_H
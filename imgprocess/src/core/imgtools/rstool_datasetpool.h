@@ -0,0 +1,302 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 进程内共享的数据集句柄池：按路径租借只读句柄，归还后保持打开状态供后续作业复用，
+// 并根据租借者声明的工作集大小调整 GDAL 块缓存（GDAL_CACHEMAX）
+
+#ifndef IMGPROCESS_RSTOOL_DATASETPOOL_H
+#define IMGPROCESS_RSTOOL_DATASETPOOL_H
+
+#include "gdal/gdal_priv.h"
+#include <string>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include <sys/stat.h>
+
+namespace RSTool {
+
+    namespace Mp {
+
+        class DatasetPool;
+
+        /**
+         * 租借的数据集句柄（只能移动），析构时归还给句柄池。
+         * 同一时刻一个句柄只会被租借给一个使用者，可在一个线程中独占使用
+         */
+        class DatasetLease {
+        public:
+            DatasetLease() = default;
+
+            DatasetLease(DatasetLease &&other) noexcept { swap(other); }
+
+            DatasetLease& operator= (DatasetLease &&other) noexcept {
+                if (this != &other) {
+                    release();
+                    swap(other);
+                }
+                return *this;
+            }
+
+            DatasetLease(const DatasetLease &) = delete;
+            DatasetLease& operator= (const DatasetLease &) = delete;
+
+            ~DatasetLease() { release(); }
+
+            GDALDataset* get() const { return ds_; }
+            GDALDataset* operator-> () const { return ds_; }
+            explicit operator bool() const { return ds_ != nullptr; }
+
+            /**
+             * 声明该句柄的块缓存需求（字节），一般为一个数据块所覆盖的原生块的大小，
+             * 所有租借中的句柄的需求之和用于调整 GDAL 块缓存的大小
+             */
+            inline void cacheBudget(size_t bytes);
+
+            // 提前归还句柄
+            inline void release();
+
+        private:
+            friend class DatasetPool;
+
+            DatasetLease(DatasetPool *pool, GDALDataset *ds, const std::string &path,
+                    GDALAccess access, long long stamp)
+                    : pool_(pool), ds_(ds), path_(path), access_(access), stamp_(stamp) {}
+
+            void swap(DatasetLease &other) {
+                std::swap(pool_, other.pool_);
+                std::swap(ds_, other.ds_);
+                std::swap(path_, other.path_);
+                std::swap(access_, other.access_);
+                std::swap(stamp_, other.stamp_);
+                std::swap(budget_, other.budget_);
+            }
+
+        private:
+            DatasetPool *pool_ = nullptr;
+            GDALDataset *ds_ = nullptr;
+            std::string path_;
+            GDALAccess access_ = GA_ReadOnly;
+            long long stamp_ = 0;   // 打开句柄时文件的修改时间及大小
+            size_t budget_ = 0;
+        };
+
+        /**
+         * 数据集句柄池（进程内唯一）：
+         *  1. 只读句柄归还后保持打开（最多 maxIdle 个，最久未用的先关闭），
+         *     后续作业租借同一文件时直接复用，省去打开文件、解析头信息的开销，且块缓存仍然有效；
+         *  2. 文件被修改（修改时间或大小变化）或以更新方式打开后，该文件的空闲只读句柄会被关闭，不会读到旧数据；
+         *  3. 更新方式的句柄不复用，归还时即关闭；
+         *  4. GDAL 的块缓存是全局的，无法为单个句柄设置上限，因此将所有租借中的句柄的缓存需求之和
+         *     作为块缓存大小（不小于原有大小，不超过 cacheLimit），所有句柄归还后恢复原有大小
+         */
+        class DatasetPool {
+        public:
+            // 返回进程内唯一的句柄池（不析构，空闲句柄可调用 clear() 关闭）
+            static DatasetPool& instance() {
+                static DatasetPool *pool = new DatasetPool();
+                return *pool;
+            }
+
+            DatasetPool(const DatasetPool &) = delete;
+            DatasetPool& operator= (const DatasetPool &) = delete;
+
+            /**
+             * 租借一个数据集句柄
+             * @param path      文件路径
+             * @param access    访问方式，只有只读句柄会被复用
+             * @return          打开失败时返回空的租借（operator bool 为 false）
+             */
+            DatasetLease acquire(const std::string &path, GDALAccess access = GA_ReadOnly) {
+                GDALAllRegister();
+                long long stamp = fileStamp(path);
+
+                if (access == GA_ReadOnly) {
+                    std::vector<GDALDataset*> stale;
+                    GDALDataset *ds = nullptr;
+                    {
+                        std::unique_lock<std::mutex> lk(mutex_);
+                        for (auto it = idle_.begin(); it != idle_.end(); ) {
+                            if (it->path != path) {
+                                ++it;
+                            } else if (it->stamp != stamp) {
+                                stale.push_back(it->ds);
+                                it = idle_.erase(it);
+                            } else {
+                                ds = it->ds;
+                                idle_.erase(it);
+                                break;
+                            }
+                        }
+                    }
+                    closeAll(stale);
+                    if (ds) return DatasetLease(this, ds, path, access, stamp);
+                } else {
+                    invalidate(path);
+                }
+
+                GDALDataset *ds = (GDALDataset*)GDALOpen(path.c_str(), access);
+                if (ds == nullptr) return DatasetLease();
+                return DatasetLease(this, ds, path, access, stamp);
+            }
+
+            // 关闭指定文件的所有空闲句柄（如文件即将被其他方式改写）
+            void invalidate(const std::string &path) {
+                std::vector<GDALDataset*> stale;
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    for (auto it = idle_.begin(); it != idle_.end(); ) {
+                        if (it->path == path) {
+                            stale.push_back(it->ds);
+                            it = idle_.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                }
+                closeAll(stale);
+            }
+
+            // 关闭所有空闲句柄
+            void clear() {
+                std::vector<GDALDataset*> stale;
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    for (auto &item : idle_) stale.push_back(item.ds);
+                    idle_.clear();
+                }
+                closeAll(stale);
+            }
+
+            // 最多保留的空闲句柄数，默认 32，为 0 时不复用句柄
+            void setMaxIdle(int value) {
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    maxIdle_ = std::max(0, value);
+                }
+                trim();
+            }
+
+            // 块缓存大小的上限（字节），默认 2GB
+            void setCacheLimit(long long bytes) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                cacheLimit_ = bytes;
+                applyCache();
+            }
+
+            // 当前空闲句柄数
+            int idleCount() {
+                std::unique_lock<std::mutex> lk(mutex_);
+                return static_cast<int>(idle_.size());
+            }
+
+        private:
+            friend class DatasetLease;
+
+            struct Idle {
+                std::string path;
+                long long stamp;
+                GDALDataset *ds;
+            };
+
+            DatasetPool() = default;
+
+            // 文件的修改时间及大小的组合，无法获取时（如 /vsimem/ 等虚拟路径）为 0
+            static long long fileStamp(const std::string &path) {
+                struct stat st;
+                if (stat(path.c_str(), &st) != 0) return 0;
+                return static_cast<long long>(st.st_mtim.tv_sec)*1000000000LL + st.st_mtim.tv_nsec +
+                       static_cast<long long>(st.st_size)*31;
+            }
+
+            static void closeAll(std::vector<GDALDataset*> &datasets) {
+                for (auto ds : datasets) {
+                    GDALClose((GDALDatasetH)ds);
+                }
+            }
+
+            void giveBack(GDALDataset *ds, const std::string &path, GDALAccess access, long long stamp) {
+                if (access != GA_ReadOnly) {
+                    // 文件已被改写，同一文件的空闲只读句柄中缓存的数据已过期
+                    GDALClose((GDALDatasetH)ds);
+                    invalidate(path);
+                    return;
+                }
+
+                if (fileStamp(path) != stamp) {
+                    GDALClose((GDALDatasetH)ds);
+                    return;
+                }
+
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    idle_.push_front(Idle{path, stamp, ds});
+                }
+                trim();
+            }
+
+            // 关闭超出数量的最久未用的空闲句柄
+            void trim() {
+                std::vector<GDALDataset*> stale;
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    while (static_cast<int>(idle_.size()) > maxIdle_) {
+                        stale.push_back(idle_.back().ds);
+                        idle_.pop_back();
+                    }
+                }
+                closeAll(stale);
+            }
+
+            void adjustBudget(long long delta) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                if (budget_ == 0 && delta > 0) {
+                    baseCache_ = GDALGetCacheMax64();
+                }
+                budget_ += delta;
+                applyCache();
+            }
+
+            // 调用者需持有 mutex_
+            void applyCache() {
+                if (baseCache_ < 0) return; // 尚未调整过
+                if (budget_ <= 0) {
+                    GDALSetCacheMax64(baseCache_);
+                    baseCache_ = -1;
+                    budget_ = 0;
+                    return;
+                }
+                GDALSetCacheMax64(std::max(baseCache_, std::min(budget_, cacheLimit_)));
+            }
+
+        private:
+            std::mutex mutex_;
+            std::list<Idle> idle_;      // 空闲句柄，最近归还的在前
+            int maxIdle_ = 32;
+
+            long long budget_ = 0;      // 租借中的句柄的缓存需求之和
+            long long baseCache_ = -1;  // 调整前的块缓存大小，-1 表示未调整
+            long long cacheLimit_ = 2LL << 30;
+        };
+
+        inline void DatasetLease::cacheBudget(size_t bytes) {
+            if (pool_ == nullptr) return;
+            pool_->adjustBudget(static_cast<long long>(bytes) - static_cast<long long>(budget_));
+            budget_ = bytes;
+        }
+
+        inline void DatasetLease::release() {
+            if (pool_ == nullptr || ds_ == nullptr) return;
+            if (budget_ > 0) cacheBudget(0);
+            pool_->giveBack(ds_, path_, access_, stamp_);
+            pool_ = nullptr;
+            ds_ = nullptr;
+        }
+
+    } // namespace Mp
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_DATASETPOOL_H
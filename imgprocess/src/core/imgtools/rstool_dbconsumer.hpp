@@ -51,15 +51,24 @@ namespace RSTool {
             // 启动所有消费者线程，会阻塞调用者线程，直到所有消费者线程处理完成
             void run() {
 
+                // 消费者线程由共享执行器提供
                 for (int i = 0; i < consumerCount_; i++) {
-                    consumerThreads_.emplace_back(std::thread(&MpRPModelDB<T>::consumerTask,
-                            this, consumerTasks_[i], tasks_[i]));
+                    consumerThreads_.emplace_back(Executor::instance().submit([this, i] {
+                        consumerTask(std::function<void(DataChunk<T> &)>(consumerTasks_[i]), tasks_[i]);
+                    }));
                 }
 
-                // todo 如果不需要和主线程进行同步，是否可以分离线程？？？
+                // 等待所有消费者线程完成，并将消费者线程中抛出的异常传递给调用者
+                std::exception_ptr error;
                 for (auto &consumer : consumerThreads_) {
-                    consumer.join();
+                    try {
+                        consumer.get();
+                    } catch (...) {
+                        if (!error) error = std::current_exception();
+                    }
                 }
+                consumerThreads_.clear();
+                if (error) std::rethrow_exception(error);
             }
 
         private:
@@ -141,6 +150,7 @@ namespace RSTool {
 
                             // TODO 核心操作，由用户实现
                             // 对于“读-处理”模型算法，函数内部不涉及写数据
+                            ComputeSlot slot;
                             func(data);
                             break;
                         }
@@ -186,7 +196,7 @@ namespace RSTool {
             std::vector<int> tasks_;
         private:
             int consumerCount_; // 消费者线程数量
-            std::vector<std::thread> consumerThreads_;   // 消费者线程（块数据处理线程）
+            std::vector<std::future<void>> consumerThreads_;   // 消费者线程（块数据处理线程）
 
             // 每个消费者线程所处理的核心函数对象
             // 可以从主线程中接收不同的参数（主要是为了将主线程的任务并行化）
@@ -40,14 +40,12 @@ namespace RSTool {
                       poolsCount_(poolsCount), pools_(poolsCount_), datasets_(poolsCount_) {
 
                 for (auto &ds : datasets_) {
-                    ds = (GDALDataset*)GDALOpen(infile.c_str(), GA_ReadOnly);
+                    ds = DatasetPool::instance().acquire(infile);
                 }
             }
 
             ~MpGDALReadT() {
-                for (auto &ds : datasets_) {
-                    GDALClose((GDALDatasetH)ds);
-                }
+                datasets_.clear();
             }
 
             /**
@@ -56,7 +54,7 @@ namespace RSTool {
              * @param spatDims  数据块的空间范围
              */
             void enqueue(int i, const SpatialDims &spatDims) {
-                GDALDataset *ds = datasets_[i];
+                GDALDataset *ds = datasets_[i].get();
                 pools_[i].enqueue([this, ds, spatDims] {
 
                     DataChunk<T> data(spatDims, specDims_, intl_);
@@ -110,8 +108,8 @@ namespace RSTool {
 
         private:
             int poolsCount_; // 读线程 数量
-            std::vector<ThreadPool> pools_;
-            std::vector<GDALDataset*> datasets_;
+            std::vector<SerialQueue> pools_;    // 每个读线程的任务在共享执行器上串行执行
+            std::vector<DatasetLease> datasets_;
         };
 
         // $1
@@ -0,0 +1,241 @@
+//
+// Created by penglei on 18-10-24.
+//
+// 进程内共享的线程执行器，所有多线程模型（读线程、写线程、消费者线程等）均向其提交任务，
+// 避免每个模型对象各自创建线程，同时运行多个作业时导致 CPU 过载
+
+#ifndef IMGPROCESS_RSTOOL_EXECUTOR_H
+#define IMGPROCESS_RSTOOL_EXECUTOR_H
+
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+namespace RSTool {
+
+    namespace Mp {
+
+        /**
+         * 共享线程执行器（进程内唯一）：
+         *  1. 空闲线程会被复用，空闲超过 keepAlive 后自动退出，避免每次作业都创建线程；
+         *  2. 没有空闲线程时创建新线程，因为读线程、消费者线程之间会相互等待（阻塞式任务），
+         *     若限制线程总数可能导致死锁；
+         *  3. 真正占用 CPU 的计算（消费者线程的核心函数）需持有一个计算槽（ComputeSlot），
+         *     计算槽总数为 CPU 核数，多个作业同时运行时总的计算并行度不超过 CPU 核数
+         */
+        class Executor {
+        public:
+            // 返回进程内唯一的执行器（不析构，工作线程可能在进程退出时仍处于空闲等待中）
+            static Executor& instance() {
+                static Executor *executor = new Executor();
+                return *executor;
+            }
+
+            Executor(const Executor &) = delete;
+            Executor& operator= (const Executor &) = delete;
+
+            /**
+             * 提交一个任务
+             * @return  用于获取任务返回值（或任务抛出的异常）的 future
+             */
+            template<class F, class... Args>
+            auto submit(F&& f, Args&&... args)
+            -> std::future<typename std::result_of<F(Args...)>::type> {
+                using return_type = typename std::result_of<F(Args...)>::type;
+
+                auto task = std::make_shared< std::packaged_task<return_type()> >(
+                        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+                std::future<return_type> res = task->get_future();
+                post([task]() { (*task)(); });
+                return res;
+            }
+
+            // 提交一个不需要返回值的任务，任务不能抛出异常
+            void post(std::function<void()> task) {
+                bool spawn = false;
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    tasks_.emplace(std::move(task));
+
+                    // 空闲线程不足以处理所有排队的任务时，创建新线程
+                    if (static_cast<int>(tasks_.size()) > idleThreads_) {
+                        ++threads_;
+                        spawn = true;
+                    }
+                }
+
+                if (spawn) {
+                    std::thread(&Executor::worker, this).detach();
+                } else {
+                    cond_.notify_one();
+                }
+            }
+
+            // 计算槽总数，即同时进行计算的线程数上限
+            int computeSlots() const { return computeSlots_; }
+
+            // 当前线程总数（包括空闲线程）
+            int threadsCount() {
+                std::unique_lock<std::mutex> lk(mutex_);
+                return threads_;
+            }
+
+            // 空闲线程的存活时间（毫秒），默认 30s
+            void setKeepAlive(int ms) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                keepAlive_ = ms;
+            }
+
+            // 获取一个计算槽，没有空闲的计算槽时等待
+            void acquireCompute() {
+                std::unique_lock<std::mutex> lk(mutexCompute_);
+                while (usedCompute_ >= computeSlots_) {
+                    condCompute_.wait(lk);
+                }
+                ++usedCompute_;
+            }
+
+            // 释放一个计算槽
+            void releaseCompute() {
+                {
+                    std::unique_lock<std::mutex> lk(mutexCompute_);
+                    --usedCompute_;
+                }
+                condCompute_.notify_one();
+            }
+
+        private:
+            Executor() {
+                int hardThreads = std::thread::hardware_concurrency();
+                computeSlots_ = std::max(1, hardThreads);
+            }
+
+            void worker() {
+                std::unique_lock<std::mutex> lk(mutex_);
+                for (;;) {
+                    while (tasks_.empty()) {
+                        ++idleThreads_;
+                        auto status = cond_.wait_for(lk, std::chrono::milliseconds(keepAlive_));
+                        --idleThreads_;
+                        if (status == std::cv_status::timeout && tasks_.empty()) {
+                            --threads_;
+                            return;
+                        }
+                    }
+
+                    std::function<void()> task = std::move(tasks_.front());
+                    tasks_.pop();
+
+                    lk.unlock();
+                    task();
+                    lk.lock();
+                }
+            }
+
+        private:
+            std::queue<std::function<void()>> tasks_;
+            std::mutex mutex_;
+            std::condition_variable cond_;
+            int threads_ = 0;
+            int idleThreads_ = 0;
+            int keepAlive_ = 30000;
+
+            int computeSlots_;
+            int usedCompute_ = 0;
+            std::mutex mutexCompute_;
+            std::condition_variable condCompute_;
+        };
+
+        // 在作用域内持有一个计算槽（持有期间不要等待其他需要计算槽的任务，否则可能死锁）
+        class ComputeSlot {
+        public:
+            ComputeSlot() { Executor::instance().acquireCompute(); }
+            ~ComputeSlot() { Executor::instance().releaseCompute(); }
+
+            ComputeSlot(const ComputeSlot &) = delete;
+            ComputeSlot& operator= (const ComputeSlot &) = delete;
+        };
+
+        /**
+         * 串行任务队列：提交的任务按先后顺序依次在共享执行器上执行（同一时刻最多执行一个），
+         * 用于代替单线程的线程池，例如每个读线程独占一个 GDALDataset 句柄。
+         * 析构时等待所有已提交的任务执行完成
+         */
+        class SerialQueue {
+        public:
+            SerialQueue() = default;
+
+            ~SerialQueue() {
+                std::unique_lock<std::mutex> lk(mutex_);
+                while (running_) {
+                    condIdle_.wait(lk);
+                }
+            }
+
+            SerialQueue(const SerialQueue &) = delete;
+            SerialQueue& operator= (const SerialQueue &) = delete;
+
+            // 提交一个任务
+            template<class F, class... Args>
+            auto enqueue(F&& f, Args&&... args)
+            -> std::future<typename std::result_of<F(Args...)>::type> {
+                using return_type = typename std::result_of<F(Args...)>::type;
+
+                auto task = std::make_shared< std::packaged_task<return_type()> >(
+                        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+                std::future<return_type> res = task->get_future();
+                bool start = false;
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    tasks_.emplace([task]() { (*task)(); });
+                    if (!running_) {
+                        running_ = true;
+                        start = true;
+                    }
+                }
+
+                if (start) {
+                    Executor::instance().post(std::bind(&SerialQueue::drain, this));
+                }
+                return res;
+            }
+
+        private:
+            // 依次执行队列中的任务，直至队列为空
+            void drain() {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lk(mutex_);
+                        if (tasks_.empty()) {
+                            running_ = false;
+                            condIdle_.notify_all();
+                            return;
+                        }
+                        task = std::move(tasks_.front());
+                        tasks_.pop();
+                    }
+                    task();
+                }
+            }
+
+        private:
+            std::queue<std::function<void()>> tasks_;
+            std::mutex mutex_;
+            std::condition_variable condIdle_;
+            bool running_ = false;
+        };
+
+    } // namespace Mp
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_EXECUTOR_H
@@ -0,0 +1,157 @@
+//
+// Created by penglei on 18-10-26.
+//
+// 分块方案：根据影像的原生块（GDALRasterBand::GetBlockSize）布局及期望的数据块大小确定分块，
+// 使每个数据块都由整数个原生块组成，读取时每个原生块（瓦片或条带）只需解码一次
+
+#ifndef IMGPROCESS_RSTOOL_GRIDPLAN_H
+#define IMGPROCESS_RSTOOL_GRIDPLAN_H
+
+#include "rstool_common.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace RSTool {
+
+    // 未指定分块大小时，期望的数据块大小（字节）
+    const size_t DEFAULT_CHUNK_BYTES = size_t(8) << 20;
+
+    // BSQ 文件每个数据块在每个波段上连续读取的最小字节数，使按波段的读取接近顺序读
+    const size_t BSQ_MIN_RUN_BYTES = size_t(1) << 20;
+
+    // BSQ 文件按波段读取时，一个读取轮次（若干个相邻的整行数据块）的默认大小（字节），见 MpGDALRead::setBandMajorPass()
+    const size_t BSQ_PASS_BYTES = size_t(64) << 20;
+
+    // 规则分块方案，数据块按文件顺序（行优先）编号
+    class GridPlan {
+    public:
+        GridPlan(int imgXSize, int imgYSize, int xChunkSize, int yChunkSize)
+                : imgXSize_(imgXSize), imgYSize_(imgYSize),
+                xChunkSize_(std::max(1, std::min(xChunkSize, imgXSize))),
+                yChunkSize_(std::max(1, std::min(yChunkSize, imgYSize))) {
+            xCount_ = (imgXSize_ + xChunkSize_ - 1) / xChunkSize_;
+            yCount_ = (imgYSize_ + yChunkSize_ - 1) / yChunkSize_;
+        }
+
+        // 数据块的最大尺寸（最右侧和最下面的数据块可能更小）
+        int xChunkSize() const { return xChunkSize_; }
+        int yChunkSize() const { return yChunkSize_; }
+
+        // 水平、垂直方向上的块数以及总块数
+        int xCount() const { return xCount_; }
+        int yCount() const { return yCount_; }
+        int count() const { return xCount_*yCount_; }
+
+        // 第 index 个数据块的空间范围
+        SpatialDims chunk(int index) const {
+            int xOff = (index % xCount_)*xChunkSize_;
+            int yOff = (index / xCount_)*yChunkSize_;
+            return SpatialDims(xOff, yOff,
+                    std::min(xChunkSize_, imgXSize_ - xOff),
+                    std::min(yChunkSize_, imgYSize_ - yOff));
+        }
+
+        // 所有数据块，按文件顺序排列
+        std::vector<SpatialDims> chunks() const {
+            std::vector<SpatialDims> result;
+            result.reserve(count());
+            for (int i = 0; i < count(); i++) {
+                result.emplace_back(chunk(i));
+            }
+            return result;
+        }
+
+    private:
+        int imgXSize_;
+        int imgYSize_;
+        int xChunkSize_;
+        int yChunkSize_;
+        int xCount_;
+        int yCount_;
+    };
+
+    /**
+     * 根据原生块布局确定分块方案：
+     *  1. 条带（原生块宽度等于影像宽度，如 ENVI 文件或未分块的 GTiff）：
+     *     数据块为整行，高度为条带高度的整数倍；
+     *  2. 瓦片（如 256x256 分块的 GTiff）：数据块由 nx*ny 个瓦片组成，并尽量接近方形
+     * @param imgXSize      影像宽度
+     * @param imgYSize      影像高度
+     * @param xBlockSize    原生块宽度
+     * @param yBlockSize    原生块高度
+     * @param pixelBytes    一个像素（所有待处理的波段）所占字节数
+     * @param targetBytes   期望的数据块大小（字节），数据块至少包含一个原生块
+     * @param fullWidth     是否强制数据块为整行
+     * @return              分块方案
+     */
+    inline GridPlan PlanChunkGrid(int imgXSize, int imgYSize, int xBlockSize, int yBlockSize,
+            size_t pixelBytes, size_t targetBytes = DEFAULT_CHUNK_BYTES, bool fullWidth = false) {
+
+        int bx = std::max(1, std::min(xBlockSize, imgXSize));
+        int by = std::max(1, std::min(yBlockSize, imgYSize));
+        size_t pixels = std::max<size_t>(1, targetBytes / std::max<size_t>(1, pixelBytes));
+
+        if (fullWidth || bx >= imgXSize) {
+            // 整行，高度取条带高度的整数倍
+            size_t rows = pixels / imgXSize;
+            int strips = static_cast<int>(std::max<size_t>(1, rows / by));
+            return GridPlan(imgXSize, imgYSize, imgXSize, strips*by);
+        }
+
+        // 若干个瓦片，宽高尽量接近
+        int xTiles = (imgXSize + bx - 1) / bx;
+        int yTiles = (imgYSize + by - 1) / by;
+        size_t tiles = std::max<size_t>(1, pixels / (static_cast<size_t>(bx)*by));
+
+        int nx = static_cast<int>(std::lround(std::sqrt(static_cast<double>(tiles)*by / bx)));
+        nx = std::max(1, std::min(nx, xTiles));
+        int ny = static_cast<int>(std::max<size_t>(1, tiles / nx));
+        ny = std::min(ny, yTiles);
+
+        return GridPlan(imgXSize, imgYSize, nx*bx, ny*by);
+    }
+
+    /**
+     * 根据数据集第一个波段的原生块布局及存储格式确定分块方案，
+     * 对于按条带存储的 BSQ 文件，适当增加数据块的高度（不超过期望大小的 4 倍），
+     * 使每个波段连续读取的数据不少于 BSQ_MIN_RUN_BYTES
+     * @param dataset       数据集
+     * @param pixelBytes    一个像素（所有待处理的波段）所占字节数
+     * @param targetBytes   期望的数据块大小（字节）
+     * @param fullWidth     是否强制数据块为整行
+     */
+    inline GridPlan PlanChunkGrid(GDALDataset *dataset, size_t pixelBytes,
+            size_t targetBytes = DEFAULT_CHUNK_BYTES, bool fullWidth = false) {
+        int imgXSize = dataset->GetRasterXSize();
+        int imgYSize = dataset->GetRasterYSize();
+
+        int xBlockSize = imgXSize, yBlockSize = 1;
+        GDALRasterBand *band = dataset->GetRasterBand(1);
+        if (band) band->GetBlockSize(&xBlockSize, &yBlockSize);
+
+        if (band && xBlockSize >= imgXSize && dataset->GetRasterCount() > 1 &&
+                DetectInterleave(dataset) == Interleave::BSQ) {
+            size_t lineBytes = static_cast<size_t>(imgXSize)*
+                    GDALGetDataTypeSizeBytes(band->GetRasterDataType());
+            size_t minRows = (BSQ_MIN_RUN_BYTES + lineBytes - 1) / std::max<size_t>(1, lineBytes);
+            size_t runTarget = minRows*imgXSize*pixelBytes;
+            targetBytes = std::max(targetBytes, std::min(runTarget, 4*targetBytes));
+        }
+
+        return PlanChunkGrid(imgXSize, imgYSize, xBlockSize, yBlockSize,
+                pixelBytes, targetBytes, fullWidth);
+    }
+
+    /**
+     * 将以往的“分块大小”换算为期望的数据块大小，使数据块占用的内存与原来的方形块相当
+     * @param blkSize       方形块的边长，不大于 0 时使用 DEFAULT_CHUNK_BYTES
+     * @param pixelBytes    一个像素（所有待处理的波段）所占字节数
+     */
+    inline size_t TargetChunkBytes(int blkSize, size_t pixelBytes) {
+        return blkSize > 0 ? static_cast<size_t>(blkSize)*blkSize*pixelBytes : DEFAULT_CHUNK_BYTES;
+    }
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_GRIDPLAN_H
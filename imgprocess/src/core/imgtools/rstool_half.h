@@ -0,0 +1,243 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 半精度存储类型：浮点反射率等数据的处理瓶颈在内存带宽，数据块/数据立方体可按 fp16（Half）或
+// bf16（BFloat16）存储，占用的内存与带宽减半；读写影像时按 float 与 GDAL 交换，
+// 计算时在寄存器中转换为 float，累加仍使用 float/double。
+// Half 精度约 3 位有效数字、最大值 65504；BFloat16 与 float 的取值范围相同、精度约 2 位有效数字。
+// fp16 的批量转换在支持 AVX2 的 CPU 上使用 F16C 指令（函数级 target 属性，按 ActiveIsaLevel() 选择）
+
+#ifndef IMGPROCESS_RSTOOL_HALF_H
+#define IMGPROCESS_RSTOOL_HALF_H
+
+#include "rstool_kernels.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RSTOOL_HALF_SSE2 1
+#else
+#define RSTOOL_HALF_SSE2 0
+#endif
+
+namespace RSTool {
+
+    namespace Detail {
+
+        inline uint32_t FloatBits(float v) {
+            uint32_t x;
+            memcpy(&x, &v, sizeof(x));
+            return x;
+        }
+
+        inline float BitsFloat(uint32_t x) {
+            float v;
+            memcpy(&v, &x, sizeof(v));
+            return v;
+        }
+
+        // float 转换为 fp16（就近舍入到偶数，溢出为无穷大，NaN 保持为 NaN）
+        inline uint16_t FloatToHalfBits(float v) {
+            uint32_t x = FloatBits(v);
+            uint32_t sign = (x >> 16) & 0x8000u;
+            x &= 0x7fffffffu;
+
+            uint32_t h;
+            if (x >= 0x47800000u) {
+                // 不小于 65536、无穷大或 NaN
+                h = x > 0x7f800000u ? 0x7e00u : 0x7c00u;
+            } else if (x < 0x38800000u) {
+                // 非规格化数：加上 0.5 后尾数的低位即为舍入后的结果
+                h = FloatBits(BitsFloat(x) + 0.5f) - 0x3f000000u;
+            } else {
+                uint32_t odd = (x >> 13) & 1u;
+                x += (static_cast<uint32_t>(15 - 127) << 23) + 0xfffu + odd;
+                h = x >> 13;
+            }
+            return static_cast<uint16_t>(h | sign);
+        }
+
+        inline float HalfBitsToFloat(uint16_t h) {
+            uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+            uint32_t em = h & 0x7fffu;
+            if (em >= 0x7c00u) {
+                return BitsFloat(sign | 0x7f800000u | ((em & 0x3ffu) << 13));
+            }
+            if (em >= 0x400u) {
+                return BitsFloat(sign | ((em << 13) + 0x38000000u));
+            }
+            // 非规格化数：em * 2^-24
+            return BitsFloat(sign | FloatBits(static_cast<float>(em)*5.9604644775390625e-8f));
+        }
+
+        // float 转换为 bf16（就近舍入到偶数，NaN 保持为 NaN）
+        inline uint16_t FloatToBFloat16Bits(float v) {
+            uint32_t x = FloatBits(v);
+            if ((x & 0x7fffffffu) > 0x7f800000u) {
+                return static_cast<uint16_t>((x >> 16) | 0x40u);
+            }
+            x += 0x7fffu + ((x >> 16) & 1u);
+            return static_cast<uint16_t>(x >> 16);
+        }
+
+        inline float BFloat16BitsToFloat(uint16_t h) {
+            return BitsFloat(static_cast<uint32_t>(h) << 16);
+        }
+
+    } // namespace Detail
+
+    /**
+     * fp16 存储类型（IEEE 754 binary16），只用于存储，运算前转换为 float
+     */
+    struct Half {
+        Half() = default;
+        explicit Half(float v) : bits(Detail::FloatToHalfBits(v)) {}
+        explicit operator float() const { return Detail::HalfBitsToFloat(bits); }
+
+        uint16_t bits;
+    };
+
+    /**
+     * bf16 存储类型（float 的高 16 位），只用于存储，运算前转换为 float
+     */
+    struct BFloat16 {
+        BFloat16() = default;
+        explicit BFloat16(float v) : bits(Detail::FloatToBFloat16Bits(v)) {}
+        explicit operator float() const { return Detail::BFloat16BitsToFloat(bits); }
+
+        uint16_t bits;
+    };
+
+    // 是否为半精度存储类型
+    template <typename T>
+    struct IsHalfType : std::integral_constant<bool,
+            std::is_same<T, Half>::value || std::is_same<T, BFloat16>::value> {};
+
+    /**
+     * 存储类型与 GDAL 读写时使用的类型：半精度类型按 float 读写，其他类型按自身读写
+     */
+    template <typename T>
+    struct StorageTraits {
+        using IOType = typename std::conditional<IsHalfType<T>::value, float, T>::type;
+    };
+
+    namespace Detail {
+
+#if RSTOOL_X86_DISPATCH
+        // F16C 转换前 n/8*8 个元素，返回已转换的个数（AVX2 的 CPU 均支持 F16C）
+        RSTOOL_TARGET("avx2,f16c")
+        inline size_t ConvertHalfF16C(const float *src, Half *dst, size_t n) {
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+            }
+            return i;
+        }
+
+        RSTOOL_TARGET("avx2,f16c")
+        inline size_t ConvertHalfF16C(const Half *src, float *dst, size_t n) {
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+            }
+            return i;
+        }
+#endif
+
+    } // namespace Detail
+
+    /**
+     * 半精度与 float 之间的批量转换，dst 由调用者分配
+     */
+    inline void ConvertHalf(const float *src, Half *dst, size_t n) {
+        size_t i = 0;
+#if RSTOOL_X86_DISPATCH
+        if (ActiveIsaLevel() >= IsaLevel::AVX2) {
+            i = Detail::ConvertHalfF16C(src, dst, n);
+        }
+#endif
+        for (; i < n; i++) {
+            dst[i] = Half(src[i]);
+        }
+    }
+
+    inline void ConvertHalf(const Half *src, float *dst, size_t n) {
+        size_t i = 0;
+#if RSTOOL_X86_DISPATCH
+        if (ActiveIsaLevel() >= IsaLevel::AVX2) {
+            i = Detail::ConvertHalfF16C(src, dst, n);
+        }
+#endif
+        for (; i < n; i++) {
+            dst[i] = static_cast<float>(src[i]);
+        }
+    }
+
+    inline void ConvertHalf(const float *src, BFloat16 *dst, size_t n) {
+        size_t i = 0;
+#if RSTOOL_HALF_SSE2
+        const __m128i one = _mm_set1_epi32(1), bias = _mm_set1_epi32(0x7fff), quiet = _mm_set1_epi32(0x400000);
+        for (; i + 8 <= n; i += 8) {
+            __m128i r[2];
+            for (int k = 0; k < 2; k++) {
+                __m128 v = _mm_loadu_ps(src + i + 4*k);
+                __m128i x = _mm_castps_si128(v);
+                __m128i lsb = _mm_and_si128(_mm_srli_epi32(x, 16), one);
+                __m128i rounded = _mm_add_epi32(x, _mm_add_epi32(bias, lsb));
+                // NaN 不舍入（避免进位为无穷大），置静默位
+                __m128i nan = _mm_castps_si128(_mm_cmpunord_ps(v, v));
+                x = _mm_or_si128(_mm_and_si128(nan, _mm_or_si128(x, quiet)), _mm_andnot_si128(nan, rounded));
+                // 算术右移后高 16 位在 int16 范围内，有符号饱和打包不会改变其值
+                r[k] = _mm_srai_epi32(x, 16);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(r[0], r[1]));
+        }
+#endif
+        for (; i < n; i++) {
+            dst[i] = BFloat16(src[i]);
+        }
+    }
+
+    inline void ConvertHalf(const BFloat16 *src, float *dst, size_t n) {
+        size_t i = 0;
+#if RSTOOL_HALF_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= n; i += 8) {
+            __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(zero, h));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(zero, h));
+        }
+#endif
+        for (; i < n; i++) {
+            dst[i] = static_cast<float>(src[i]);
+        }
+    }
+
+    /**
+     * 在计算核心中按 float 访问一段数据：半精度数据转换到调用者提供的缓冲区（如一条光谱，位于 L1 缓存中），
+     * 其他类型直接返回原地址
+     * @param scratch   不少于 n 个元素的缓冲区，非半精度类型时不使用
+     */
+    template <typename T>
+    inline const T* WidenSpan(const T *src, size_t, T *) {
+        return src;
+    }
+
+    inline const float* WidenSpan(const Half *src, size_t n, float *scratch) {
+        ConvertHalf(src, scratch, n);
+        return scratch;
+    }
+
+    inline const float* WidenSpan(const BFloat16 *src, size_t n, float *scratch) {
+        ConvertHalf(src, scratch, n);
+        return scratch;
+    }
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_HALF_H
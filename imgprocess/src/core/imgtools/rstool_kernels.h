@@ -0,0 +1,398 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 计算核心的运行时分派：每个核心按标量、SSE2、AVX2（含 FMA）、AVX-512 分别编译（函数级 target 属性，
+// 不需要改变编译选项），按 ActiveIsaLevel() 选择实现；同一个可执行文件可在不同指令集的节点上运行。
+// 使用方式：const KernelTable &k = Kernels(); k.axpy(...)，在循环外取一次即可
+
+#ifndef IMGPROCESS_RSTOOL_KERNELS_H
+#define IMGPROCESS_RSTOOL_KERNELS_H
+
+#include "rstool_cpu.h"
+#include <cstddef>
+
+#if RSTOOL_X86_DISPATCH
+#include <immintrin.h>
+#define RSTOOL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// 按波段数选择逐像素计算核心：常用的小波段数（多光谱影像，如 GF-1/GF-2 的 4、8 波段）调用 func<N>(...)，
+// 波段数为编译期常量，循环可完全展开、中间结果保存在寄存器中；其他波段数调用 func<0>(...)，按运行时波段数计算
+#define RSToolSwitchBandCount(bandCount, func, ...) switch (bandCount) {\
+    case 3: func<3>(__VA_ARGS__); break;\
+    case 4: func<4>(__VA_ARGS__); break;\
+    case 8: func<8>(__VA_ARGS__); break;\
+    case 10: func<10>(__VA_ARGS__); break;\
+    case 16: func<16>(__VA_ARGS__); break;\
+    default: func<0>(__VA_ARGS__); break;\
+    }
+
+namespace RSTool {
+
+    /**
+     * 计算核心
+     */
+    struct KernelTable {
+        // acc[i] += s*x[i]，i = 0..n-1（协方差等的累加，累加使用 double）
+        void (*axpy)(double *acc, const float *x, double s, int n);
+
+        // d'*C*d，C 为 n x n 的矩阵（按行存储）（RX 等的马氏距离）
+        double (*quadForm)(const double *c, const double *d, int n);
+
+        // sum[j] += data[i*ld + j]，按行累加 rows x cols 矩阵的各列（累加使用 double，列很长时也不丢失精度）
+        void (*columnSum)(const float *data, size_t ld, int rows, int cols, double *sum);
+
+        // data[i*ld + j] -= mean[j]，同时 sumSq[j] += 去均值后的平方（平方及累加使用 double）
+        void (*columnCenter)(float *data, size_t ld, int rows, int cols, const float *mean, double *sumSq);
+
+        // dst[i*dstLd + j] = scale[j]*src[i*srcLd + j] + offset[j]
+        void (*columnAffine)(const float *src, size_t srcLd, float *dst, size_t dstLd,
+                int rows, int cols, const float *scale, const float *offset);
+
+        IsaLevel isa;
+    };
+
+    namespace Detail {
+
+        namespace ScalarKernel {
+
+            inline void axpy(double *acc, const float *x, double s, int n) {
+                for (int i = 0; i < n; i++) acc[i] += s*x[i];
+            }
+
+            inline double quadForm(const double *c, const double *d, int n) {
+                double total = 0;
+                for (int i = 0; i < n; i++) {
+                    const double *row = c + static_cast<size_t>(i)*n;
+                    double dot = 0;
+                    for (int k = 0; k < n; k++) dot += row[k]*d[k];
+                    total += dot*d[i];
+                }
+                return total;
+            }
+
+            inline void columnSum(const float *data, size_t ld, int rows, int cols, double *sum) {
+                for (int i = 0; i < rows; i++) {
+                    const float *row = data + i*ld;
+                    for (int j = 0; j < cols; j++) sum[j] += row[j];
+                }
+            }
+
+            inline void columnCenter(float *data, size_t ld, int rows, int cols, const float *mean, double *sumSq) {
+                for (int i = 0; i < rows; i++) {
+                    float *row = data + i*ld;
+                    for (int j = 0; j < cols; j++) {
+                        row[j] -= mean[j];
+                        sumSq[j] += static_cast<double>(row[j])*row[j];
+                    }
+                }
+            }
+
+            inline void columnAffine(const float *src, size_t srcLd, float *dst, size_t dstLd,
+                    int rows, int cols, const float *scale, const float *offset) {
+                for (int i = 0; i < rows; i++) {
+                    const float *s = src + i*srcLd;
+                    float *d = dst + i*dstLd;
+                    for (int j = 0; j < cols; j++) d[j] = scale[j]*s[j] + offset[j];
+                }
+            }
+
+        } // namespace ScalarKernel
+
+#if RSTOOL_X86_DISPATCH
+        namespace SSE2Kernel {
+
+            RSTOOL_TARGET("sse2")
+            inline void axpy(double *acc, const float *x, double s, int n) {
+                const __m128d vs = _mm_set1_pd(s);
+                int i = 0;
+                for (; i + 4 <= n; i += 4) {
+                    __m128 v = _mm_loadu_ps(x + i);
+                    __m128d lo = _mm_cvtps_pd(v);
+                    __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+                    _mm_storeu_pd(acc + i, _mm_add_pd(_mm_loadu_pd(acc + i), _mm_mul_pd(vs, lo)));
+                    _mm_storeu_pd(acc + i + 2, _mm_add_pd(_mm_loadu_pd(acc + i + 2), _mm_mul_pd(vs, hi)));
+                }
+                for (; i < n; i++) acc[i] += s*x[i];
+            }
+
+            RSTOOL_TARGET("sse2")
+            inline double quadForm(const double *c, const double *d, int n) {
+                double total = 0;
+                for (int i = 0; i < n; i++) {
+                    const double *row = c + static_cast<size_t>(i)*n;
+                    __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+                    int k = 0;
+                    for (; k + 4 <= n; k += 4) {
+                        a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_loadu_pd(row + k), _mm_loadu_pd(d + k)));
+                        a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_loadu_pd(row + k + 2), _mm_loadu_pd(d + k + 2)));
+                    }
+                    a0 = _mm_add_pd(a0, a1);
+                    double dot = _mm_cvtsd_f64(_mm_add_sd(a0, _mm_unpackhi_pd(a0, a0)));
+                    for (; k < n; k++) dot += row[k]*d[k];
+                    total += dot*d[i];
+                }
+                return total;
+            }
+
+            RSTOOL_TARGET("sse2")
+            inline void columnSum(const float *data, size_t ld, int rows, int cols, double *sum) {
+                for (int i = 0; i < rows; i++) {
+                    const float *row = data + i*ld;
+                    int j = 0;
+                    for (; j + 4 <= cols; j += 4) {
+                        __m128 v = _mm_loadu_ps(row + j);
+                        _mm_storeu_pd(sum + j, _mm_add_pd(_mm_loadu_pd(sum + j), _mm_cvtps_pd(v)));
+                        _mm_storeu_pd(sum + j + 2, _mm_add_pd(_mm_loadu_pd(sum + j + 2),
+                                _mm_cvtps_pd(_mm_movehl_ps(v, v))));
+                    }
+                    for (; j < cols; j++) sum[j] += row[j];
+                }
+            }
+
+            RSTOOL_TARGET("sse2")
+            inline void columnCenter(float *data, size_t ld, int rows, int cols, const float *mean, double *sumSq) {
+                for (int i = 0; i < rows; i++) {
+                    float *row = data + i*ld;
+                    int j = 0;
+                    for (; j + 4 <= cols; j += 4) {
+                        __m128 v = _mm_sub_ps(_mm_loadu_ps(row + j), _mm_loadu_ps(mean + j));
+                        _mm_storeu_ps(row + j, v);
+                        __m128d lo = _mm_cvtps_pd(v);
+                        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+                        _mm_storeu_pd(sumSq + j, _mm_add_pd(_mm_loadu_pd(sumSq + j), _mm_mul_pd(lo, lo)));
+                        _mm_storeu_pd(sumSq + j + 2, _mm_add_pd(_mm_loadu_pd(sumSq + j + 2), _mm_mul_pd(hi, hi)));
+                    }
+                    for (; j < cols; j++) {
+                        row[j] -= mean[j];
+                        sumSq[j] += static_cast<double>(row[j])*row[j];
+                    }
+                }
+            }
+
+            RSTOOL_TARGET("sse2")
+            inline void columnAffine(const float *src, size_t srcLd, float *dst, size_t dstLd,
+                    int rows, int cols, const float *scale, const float *offset) {
+                for (int i = 0; i < rows; i++) {
+                    const float *s = src + i*srcLd;
+                    float *d = dst + i*dstLd;
+                    int j = 0;
+                    for (; j + 4 <= cols; j += 4) {
+                        __m128 v = _mm_mul_ps(_mm_loadu_ps(scale + j), _mm_loadu_ps(s + j));
+                        _mm_storeu_ps(d + j, _mm_add_ps(v, _mm_loadu_ps(offset + j)));
+                    }
+                    for (; j < cols; j++) d[j] = scale[j]*s[j] + offset[j];
+                }
+            }
+
+        } // namespace SSE2Kernel
+
+        namespace AVX2Kernel {
+
+            RSTOOL_TARGET("avx2,fma")
+            inline void axpy(double *acc, const float *x, double s, int n) {
+                const __m256d vs = _mm256_set1_pd(s);
+                int i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    __m256d lo = _mm256_cvtps_pd(_mm_loadu_ps(x + i));
+                    __m256d hi = _mm256_cvtps_pd(_mm_loadu_ps(x + i + 4));
+                    _mm256_storeu_pd(acc + i, _mm256_fmadd_pd(vs, lo, _mm256_loadu_pd(acc + i)));
+                    _mm256_storeu_pd(acc + i + 4, _mm256_fmadd_pd(vs, hi, _mm256_loadu_pd(acc + i + 4)));
+                }
+                for (; i < n; i++) acc[i] += s*x[i];
+            }
+
+            RSTOOL_TARGET("avx2,fma")
+            inline double quadForm(const double *c, const double *d, int n) {
+                double total = 0;
+                for (int i = 0; i < n; i++) {
+                    const double *row = c + static_cast<size_t>(i)*n;
+                    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+                    int k = 0;
+                    for (; k + 8 <= n; k += 8) {
+                        a0 = _mm256_fmadd_pd(_mm256_loadu_pd(row + k), _mm256_loadu_pd(d + k), a0);
+                        a1 = _mm256_fmadd_pd(_mm256_loadu_pd(row + k + 4), _mm256_loadu_pd(d + k + 4), a1);
+                    }
+                    a0 = _mm256_add_pd(a0, a1);
+                    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(a0), _mm256_extractf128_pd(a0, 1));
+                    double dot = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+                    for (; k < n; k++) dot += row[k]*d[k];
+                    total += dot*d[i];
+                }
+                return total;
+            }
+
+            RSTOOL_TARGET("avx2,fma")
+            inline void columnSum(const float *data, size_t ld, int rows, int cols, double *sum) {
+                for (int i = 0; i < rows; i++) {
+                    const float *row = data + i*ld;
+                    int j = 0;
+                    for (; j + 8 <= cols; j += 8) {
+                        __m256d lo = _mm256_cvtps_pd(_mm_loadu_ps(row + j));
+                        __m256d hi = _mm256_cvtps_pd(_mm_loadu_ps(row + j + 4));
+                        _mm256_storeu_pd(sum + j, _mm256_add_pd(_mm256_loadu_pd(sum + j), lo));
+                        _mm256_storeu_pd(sum + j + 4, _mm256_add_pd(_mm256_loadu_pd(sum + j + 4), hi));
+                    }
+                    for (; j < cols; j++) sum[j] += row[j];
+                }
+            }
+
+            RSTOOL_TARGET("avx2,fma")
+            inline void columnCenter(float *data, size_t ld, int rows, int cols, const float *mean, double *sumSq) {
+                for (int i = 0; i < rows; i++) {
+                    float *row = data + i*ld;
+                    int j = 0;
+                    for (; j + 8 <= cols; j += 8) {
+                        __m256 v = _mm256_sub_ps(_mm256_loadu_ps(row + j), _mm256_loadu_ps(mean + j));
+                        _mm256_storeu_ps(row + j, v);
+                        __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+                        __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+                        _mm256_storeu_pd(sumSq + j, _mm256_fmadd_pd(lo, lo, _mm256_loadu_pd(sumSq + j)));
+                        _mm256_storeu_pd(sumSq + j + 4, _mm256_fmadd_pd(hi, hi, _mm256_loadu_pd(sumSq + j + 4)));
+                    }
+                    for (; j < cols; j++) {
+                        row[j] -= mean[j];
+                        sumSq[j] += static_cast<double>(row[j])*row[j];
+                    }
+                }
+            }
+
+            RSTOOL_TARGET("avx2,fma")
+            inline void columnAffine(const float *src, size_t srcLd, float *dst, size_t dstLd,
+                    int rows, int cols, const float *scale, const float *offset) {
+                for (int i = 0; i < rows; i++) {
+                    const float *s = src + i*srcLd;
+                    float *d = dst + i*dstLd;
+                    int j = 0;
+                    for (; j + 8 <= cols; j += 8) {
+                        _mm256_storeu_ps(d + j, _mm256_fmadd_ps(_mm256_loadu_ps(scale + j),
+                                _mm256_loadu_ps(s + j), _mm256_loadu_ps(offset + j)));
+                    }
+                    for (; j < cols; j++) d[j] = scale[j]*s[j] + offset[j];
+                }
+            }
+
+        } // namespace AVX2Kernel
+
+        namespace AVX512Kernel {
+
+            RSTOOL_TARGET("avx512f")
+            inline void axpy(double *acc, const float *x, double s, int n) {
+                const __m512d vs = _mm512_set1_pd(s);
+                int i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    __m512d v = _mm512_cvtps_pd(_mm256_loadu_ps(x + i));
+                    _mm512_storeu_pd(acc + i, _mm512_fmadd_pd(vs, v, _mm512_loadu_pd(acc + i)));
+                }
+                for (; i < n; i++) acc[i] += s*x[i];
+            }
+
+            RSTOOL_TARGET("avx512f")
+            inline double quadForm(const double *c, const double *d, int n) {
+                double total = 0;
+                for (int i = 0; i < n; i++) {
+                    const double *row = c + static_cast<size_t>(i)*n;
+                    __m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd();
+                    int k = 0;
+                    for (; k + 16 <= n; k += 16) {
+                        a0 = _mm512_fmadd_pd(_mm512_loadu_pd(row + k), _mm512_loadu_pd(d + k), a0);
+                        a1 = _mm512_fmadd_pd(_mm512_loadu_pd(row + k + 8), _mm512_loadu_pd(d + k + 8), a1);
+                    }
+                    for (; k + 8 <= n; k += 8) {
+                        a0 = _mm512_fmadd_pd(_mm512_loadu_pd(row + k), _mm512_loadu_pd(d + k), a0);
+                    }
+                    double dot = _mm512_reduce_add_pd(_mm512_add_pd(a0, a1));
+                    for (; k < n; k++) dot += row[k]*d[k];
+                    total += dot*d[i];
+                }
+                return total;
+            }
+
+            RSTOOL_TARGET("avx512f")
+            inline void columnSum(const float *data, size_t ld, int rows, int cols, double *sum) {
+                for (int i = 0; i < rows; i++) {
+                    const float *row = data + i*ld;
+                    int j = 0;
+                    for (; j + 16 <= cols; j += 16) {
+                        __m512d lo = _mm512_cvtps_pd(_mm256_loadu_ps(row + j));
+                        __m512d hi = _mm512_cvtps_pd(_mm256_loadu_ps(row + j + 8));
+                        _mm512_storeu_pd(sum + j, _mm512_add_pd(_mm512_loadu_pd(sum + j), lo));
+                        _mm512_storeu_pd(sum + j + 8, _mm512_add_pd(_mm512_loadu_pd(sum + j + 8), hi));
+                    }
+                    for (; j < cols; j++) sum[j] += row[j];
+                }
+            }
+
+            RSTOOL_TARGET("avx512f")
+            inline void columnCenter(float *data, size_t ld, int rows, int cols, const float *mean, double *sumSq) {
+                for (int i = 0; i < rows; i++) {
+                    float *row = data + i*ld;
+                    int j = 0;
+                    for (; j + 16 <= cols; j += 16) {
+                        __m512 v = _mm512_sub_ps(_mm512_loadu_ps(row + j), _mm512_loadu_ps(mean + j));
+                        _mm512_storeu_ps(row + j, v);
+                        __m512d lo = _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+                        __m512d hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+                        _mm512_storeu_pd(sumSq + j, _mm512_fmadd_pd(lo, lo, _mm512_loadu_pd(sumSq + j)));
+                        _mm512_storeu_pd(sumSq + j + 8, _mm512_fmadd_pd(hi, hi, _mm512_loadu_pd(sumSq + j + 8)));
+                    }
+                    for (; j < cols; j++) {
+                        row[j] -= mean[j];
+                        sumSq[j] += static_cast<double>(row[j])*row[j];
+                    }
+                }
+            }
+
+            RSTOOL_TARGET("avx512f")
+            inline void columnAffine(const float *src, size_t srcLd, float *dst, size_t dstLd,
+                    int rows, int cols, const float *scale, const float *offset) {
+                for (int i = 0; i < rows; i++) {
+                    const float *s = src + i*srcLd;
+                    float *d = dst + i*dstLd;
+                    int j = 0;
+                    for (; j + 16 <= cols; j += 16) {
+                        _mm512_storeu_ps(d + j, _mm512_fmadd_ps(_mm512_loadu_ps(scale + j),
+                                _mm512_loadu_ps(s + j), _mm512_loadu_ps(offset + j)));
+                    }
+                    for (; j < cols; j++) d[j] = scale[j]*s[j] + offset[j];
+                }
+            }
+
+        } // namespace AVX512Kernel
+#endif
+
+#define RSTOOL_KERNEL_TABLE(ns, isa) \
+        { &ns::axpy, &ns::quadForm, &ns::columnSum, &ns::columnCenter, &ns::columnAffine, isa }
+
+        inline const KernelTable& KernelTableOf(IsaLevel isa) {
+            static const KernelTable scalar = RSTOOL_KERNEL_TABLE(ScalarKernel, IsaLevel::Scalar);
+#if RSTOOL_X86_DISPATCH
+            // SSE4.2 对这些核心没有额外的指令，使用 SSE2 的实现
+            static const KernelTable sse2 = RSTOOL_KERNEL_TABLE(SSE2Kernel, IsaLevel::SSE2);
+            static const KernelTable avx2 = RSTOOL_KERNEL_TABLE(AVX2Kernel, IsaLevel::AVX2);
+            static const KernelTable avx512 = RSTOOL_KERNEL_TABLE(AVX512Kernel, IsaLevel::AVX512);
+            switch (isa) {
+                case IsaLevel::AVX512 : return avx512;
+                case IsaLevel::AVX2 : return avx2;
+                case IsaLevel::SSE42 :
+                case IsaLevel::SSE2 : return sse2;
+                default : break;
+            }
+#endif
+            return scalar;
+        }
+
+#undef RSTOOL_KERNEL_TABLE
+
+    } // namespace Detail
+
+    /**
+     * 当前指令集级别（ActiveIsaLevel()）对应的计算核心
+     */
+    inline const KernelTable& Kernels() {
+        return Detail::KernelTableOf(ActiveIsaLevel());
+    }
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_KERNELS_H
@@ -0,0 +1,266 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 查找表：Byte 及 12 位 UInt16 数据的逐像素函数（定标曲线、拉伸、灰度系数、按列的增益等）只与输入值有关，
+// 对每个波段（或每个波段的每一列）预先计算 256 或 4096 个表项，处理时逐像素查表，
+// 超越函数的计算变为访存；支持 AVX2 时按 8 个像素一组以 gather 指令查表（见 rstool_kernels.h）
+
+#ifndef IMGPROCESS_RSTOOL_LUT_H
+#define IMGPROCESS_RSTOOL_LUT_H
+
+#include "rstool_common.h"
+#include "rstool_kernels.h"
+#include <vector>
+#include <stdexcept>
+
+namespace RSTool {
+
+    // Byte 数据的表项个数
+    const int LutEntries8 = 256;
+    // 12 位数据（存放在 UInt16 中）的表项个数
+    const int LutEntries12 = 4096;
+
+    // 一组查找表的建议大小上限：超过后表不能常驻缓存，查表不如直接计算
+    const size_t LutMaxBytes = 4 << 20;
+
+    /**
+     * 数据适用的查找表表项个数：Byte 数据为 256，取值不超过 12 位的 UInt16 数据为 4096，其他情况返回 0（不适用）
+     * @param maxValue  数据的最大值
+     */
+    template <typename T>
+    inline int LutEntries(double maxValue) {
+        if (std::is_same<T, unsigned char>::value) return LutEntries8;
+        if (std::is_same<T, unsigned short>::value && maxValue < LutEntries12) return LutEntries12;
+        return 0;
+    }
+
+    namespace Detail {
+
+        // 输入值转换为表项索引，超出范围时取最近的表项（浮点输入按整数编码处理，截断小数部分）
+        template <typename In>
+        inline int LutIndex(In v, int entries) {
+            if (!(v > 0)) return 0;
+            return v >= entries - 1 ? entries - 1 : static_cast<int>(v);
+        }
+
+        /**
+         * 查一行：dst[i] = table[i*tableStride + index(src[i])]
+         * @param tableStride   相邻两个元素所用的表的间隔（元素个数），0 表示使用同一张表
+         */
+        template <typename In, typename Out>
+        inline void LutRowScalar(const Out *table, int entries, int tableStride,
+                const In *src, Out *dst, int n) {
+            for (int i = 0; i < n; i++) {
+                dst[i] = table[static_cast<size_t>(i)*tableStride + LutIndex(src[i], entries)];
+            }
+        }
+
+#if RSTOOL_X86_DISPATCH
+        // 载入 8 个输入值并转换为表项索引，结果与 LutIndex() 相同
+        RSTOOL_TARGET("avx2,fma")
+        inline __m256i LutLoadIndex(const unsigned char *src, int entries) {
+            return _mm256_min_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src))),
+                    _mm256_set1_epi32(entries - 1));
+        }
+
+        RSTOOL_TARGET("avx2,fma")
+        inline __m256i LutLoadIndex(const unsigned short *src, int entries) {
+            return _mm256_min_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))),
+                    _mm256_set1_epi32(entries - 1));
+        }
+
+        RSTOOL_TARGET("avx2,fma")
+        inline __m256i LutLoadIndex(const float *src, int entries) {
+            // 先在浮点数中截断到 [0, entries - 1]（直接转换时不小于 2^31 的值会溢出为 INT_MIN），NaN 取为 0
+            __m256 x = _mm256_loadu_ps(src);
+            __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+            x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(static_cast<float>(entries - 1)));
+            return _mm256_cvttps_epi32(_mm256_andnot_ps(nan, x));
+        }
+
+        template <typename In>
+        RSTOOL_TARGET("avx2,fma")
+        inline void LutRowAVX2(const float *table, int entries, int tableStride,
+                const In *src, float *dst, int n) {
+            const __m256i lane = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                    _mm256_set1_epi32(tableStride));
+            const __m256i step = _mm256_set1_epi32(8*tableStride);
+
+            __m256i base = lane;
+            int i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m256i idx = LutLoadIndex(src + i, entries);
+                _mm256_storeu_ps(dst + i, _mm256_i32gather_ps(table, _mm256_add_epi32(base, idx), 4));
+                base = _mm256_add_epi32(base, step);
+            }
+            LutRowScalar(table + static_cast<size_t>(i)*tableStride, entries, tableStride, src + i, dst + i, n - i);
+        }
+#endif
+
+        template <typename In, typename Out>
+        inline void LutRow(const Out *table, int entries, int tableStride, const In *src, Out *dst, int n) {
+            LutRowScalar(table, entries, tableStride, src, dst, n);
+        }
+
+        // float 表：支持 AVX2 时以 gather 指令查表
+        template <typename In>
+        inline void LutRowFloat(const float *table, int entries, int tableStride, const In *src, float *dst, int n) {
+#if RSTOOL_X86_DISPATCH
+            if (ActiveIsaLevel() >= IsaLevel::AVX2) {
+                LutRowAVX2(table, entries, tableStride, src, dst, n);
+                return;
+            }
+#endif
+            LutRowScalar(table, entries, tableStride, src, dst, n);
+        }
+
+        inline void LutRow(const float *table, int entries, int tableStride,
+                const unsigned char *src, float *dst, int n) {
+            LutRowFloat(table, entries, tableStride, src, dst, n);
+        }
+
+        inline void LutRow(const float *table, int entries, int tableStride,
+                const unsigned short *src, float *dst, int n) {
+            LutRowFloat(table, entries, tableStride, src, dst, n);
+        }
+
+        inline void LutRow(const float *table, int entries, int tableStride,
+                const float *src, float *dst, int n) {
+            LutRowFloat(table, entries, tableStride, src, dst, n);
+        }
+
+    } // namespace Detail
+
+    /**
+     * 一组查找表（每个波段一张，或每个波段的每一列一张），表项类型为 Out
+     */
+    template <typename Out>
+    class PixelLut {
+    public:
+        /**
+         * @param entries   每张表的表项个数（LutEntries8 或 LutEntries12）
+         * @param tables    表的个数
+         */
+        PixelLut(int entries, int tables)
+                : entries_(entries), tables_(tables),
+                  data_(static_cast<size_t>(entries)*tables) {
+            if (entries <= 0 || tables <= 0) {
+                throw std::invalid_argument("PixelLut: entries and tables must be positive.");
+            }
+        }
+
+        /**
+         * 一组查找表占用的字节数，用于判断是否值得使用查找表（表过大时查表会频繁缓存缺失）
+         */
+        static size_t Bytes(int entries, int tables) {
+            return sizeof(Out)*entries*static_cast<size_t>(tables);
+        }
+
+        int entries() const { return entries_; }
+        int tables() const { return tables_; }
+
+        Out* table(int t) { return data_.data() + static_cast<size_t>(t)*entries_; }
+        const Out* table(int t) const { return data_.data() + static_cast<size_t>(t)*entries_; }
+
+        /**
+         * 计算第 t 张表：table(t)[v] = f(v)，v = 0..entries-1
+         */
+        template <typename F>
+        void build(int t, F f) {
+            Out *p = table(t);
+            for (int v = 0; v < entries_; v++) {
+                p[v] = static_cast<Out>(f(v));
+            }
+        }
+
+        /**
+         * 计算全部的表：table(t)[v] = f(t, v)
+         */
+        template <typename F>
+        void buildAll(F f) {
+            for (int t = 0; t < tables_; t++) {
+                Out *p = table(t);
+                for (int v = 0; v < entries_; v++) {
+                    p[v] = static_cast<Out>(f(t, v));
+                }
+            }
+        }
+
+        /**
+         * 以第 t 张表查表：dst[i] = table(t)[src[i]]，超出表项范围的输入取最近的表项
+         */
+        template <typename In>
+        void apply(int t, const In *src, Out *dst, size_t n) const {
+            const int maxRun = 1 << 30;
+            for (size_t i = 0; i < n; i += maxRun) {
+                int len = static_cast<int>(std::min<size_t>(maxRun, n - i));
+                Detail::LutRow(table(t), entries_, 0, src + i, dst + i, len);
+            }
+        }
+
+        /**
+         * 按列使用不同的表：dst[r*dstLd + c] = table(firstTable + c)[src[r*srcLd + c]]
+         * （如按列的增益；BIP 数据的每个像素即一行，每个波段即一列）
+         */
+        template <typename In>
+        void applyColumns(const In *src, size_t srcLd, Out *dst, size_t dstLd,
+                int rows, int cols, int firstTable = 0) const {
+            for (int r = 0; r < rows; r++) {
+                Detail::LutRow(table(firstTable), entries_, entries_,
+                        src + r*srcLd, dst + r*dstLd, cols);
+            }
+        }
+
+        /**
+         * 数据块的每个波段以对应的表查表（第 b 个波段使用第 b 张表），两个数据块的范围及组织方式相同
+         */
+        template <typename In>
+        void applyChunk(DataChunk<In> &src, DataChunk<Out> &dst) const {
+            const int bandCount = src.dims().bandCount();
+            const int xSize = src.dims().xSize();
+            const int ySize = src.dims().ySize();
+            const size_t pixels = static_cast<size_t>(xSize)*ySize;
+            const int tile = PixelTileWidth(src.interleave());
+
+            switch (src.interleave()) {
+                case Interleave::BSQ :
+                    for (int b = 0; b < bandCount; b++) {
+                        apply(b, src.data() + b*pixels, dst.data() + b*pixels, pixels);
+                    }
+                    break;
+
+                case Interleave::BIL :
+                    for (int y = 0; y < ySize; y++) {
+                        for (int b = 0; b < bandCount; b++) {
+                            size_t offset = (static_cast<size_t>(y)*bandCount + b)*xSize;
+                            apply(b, src.data() + offset, dst.data() + offset, xSize);
+                        }
+                    }
+                    break;
+
+                case Interleave::BIP :
+                    applyColumns(src.data(), src.stride(), dst.data(), dst.stride(),
+                            static_cast<int>(pixels), bandCount);
+                    break;
+
+                default :
+                    // 像素分组：每组内每个波段的 tile 个值连续
+                    for (size_t g = 0; g*tile < pixels; g++) {
+                        for (int b = 0; b < bandCount; b++) {
+                            size_t offset = (g*bandCount + b)*tile;
+                            apply(b, src.data() + offset, dst.data() + offset, tile);
+                        }
+                    }
+                    break;
+            }
+        }
+
+    private:
+        int entries_;
+        int tables_;
+        std::vector<Out> data_;
+    };
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_LUT_H
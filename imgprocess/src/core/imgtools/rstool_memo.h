@@ -0,0 +1,168 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 光谱记忆化：8 位、少波段影像以及分类结果、饱和区域中大量像素的光谱完全相同，
+// 对 RX、SAM、分类器等开销较大的逐像素函数，按光谱的哈希值缓存计算结果，相同的光谱只计算一次。
+// 缓存大小有上限（每个线程一个，不加锁）；命中率低时自动关闭，一段时间后再重新试探
+
+#ifndef IMGPROCESS_RSTOOL_MEMO_H
+#define IMGPROCESS_RSTOOL_MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace RSTool {
+
+    /**
+     * 记忆化的参数
+     */
+    struct MemoPolicy {
+        size_t maxBytes = 1 << 20;      // 缓存中光谱占用的字节数上限（约为 L2 缓存大小）
+        size_t maxEntries = 1 << 16;    // 缓存的最大项数
+        double minHitRate = 0.25;       // 一个统计窗口内命中率低于该值时关闭
+        size_t window = 4096;           // 统计窗口的查找次数
+        size_t retryAfter = 1 << 18;    // 关闭后经过多少个像素重新试探（影像中不同区域的重复程度不同）
+    };
+
+    /**
+     * 按光谱缓存逐像素函数的结果（非线程安全，每个线程使用一个）
+     * @tparam T    光谱的数据类型，按字节比较（浮点数据 +0/-0 视为不同的光谱）
+     * @tparam R    函数的结果类型
+     */
+    template <typename T, typename R>
+    class SpectrumMemo {
+    public:
+        /**
+         * @param bandCount 光谱的波段数（只比较前 bandCount 个值，不包括光谱补齐部分）
+         */
+        explicit SpectrumMemo(int bandCount, const MemoPolicy &policy = MemoPolicy())
+                : bandCount_(bandCount), policy_(policy) {
+            // 缓存项数取不超过上限的最大的 2 的幂（至少 8 项）
+            size_t byBytes = policy_.maxBytes / (sizeof(T)*std::max(bandCount_, 1));
+            size_t limit = std::min(byBytes, policy_.maxEntries);
+            size_t slots = 8;
+            while (slots*2 <= limit) slots <<= 1;
+            mask_ = slots - 1;
+
+            hashes_.assign(slots, 0);
+            results_.resize(slots);
+            keys_.resize(slots*bandCount_);
+        }
+
+        /**
+         * 计算 f(spectrum)：缓存中有相同的光谱时直接返回其结果
+         */
+        template <typename F>
+        R eval(const T *spectrum, F &&f) {
+            if (!enabled_) {
+                if (++skipped_ >= policy_.retryAfter) {
+                    enabled_ = true;
+                    skipped_ = 0;
+                }
+                return f(spectrum);
+            }
+
+            const size_t bytes = sizeof(T)*bandCount_;
+            const uint64_t h = hash(spectrum, bytes);
+            size_t slot = h & mask_;
+            size_t empty = npos;
+            for (int probe = 0; probe < MaxProbes; probe++, slot = (slot + 1) & mask_) {
+                if (hashes_[slot] == 0) {
+                    empty = slot;
+                    break;
+                }
+                if (hashes_[slot] == h && memcmp(&keys_[slot*bandCount_], spectrum, bytes) == 0) {
+                    count(true);
+                    return results_[slot];
+                }
+            }
+
+            // 未命中：插入到探测序列中的空位，没有空位时替换第一个位置
+            R r = f(spectrum);
+            size_t dst = empty != npos ? empty : (h & mask_);
+            hashes_[dst] = h;
+            memcpy(&keys_[dst*bandCount_], spectrum, bytes);
+            results_[dst] = r;
+            count(false);
+            return r;
+        }
+
+        // 当前是否使用缓存
+        bool enabled() const { return enabled_; }
+
+        // 累计的查找次数与命中次数（不包括关闭期间）
+        size_t lookups() const { return totalLookups_; }
+        size_t hits() const { return totalHits_; }
+
+        // 清空缓存（如更换了函数的参数）
+        void clear() {
+            std::fill(hashes_.begin(), hashes_.end(), 0);
+        }
+
+    private:
+        static const int MaxProbes = 8;
+        static const size_t npos = static_cast<size_t>(-1);
+
+        // 64 位乘法混合的哈希，结果不为 0（0 表示空位）
+        static uint64_t hash(const T *spectrum, size_t bytes) {
+            const unsigned char *p = reinterpret_cast<const unsigned char*>(spectrum);
+            const uint64_t k = 0x9e3779b97f4a7c15ULL;
+            uint64_t h = bytes*k;
+            size_t i = 0;
+            for (; i + 8 <= bytes; i += 8) {
+                uint64_t w;
+                memcpy(&w, p + i, 8);
+                h = (h ^ w)*k;
+                h ^= h >> 29;
+            }
+            if (i < bytes) {
+                uint64_t w = 0;
+                memcpy(&w, p + i, bytes - i);
+                h = (h ^ w)*k;
+                h ^= h >> 29;
+            }
+            h = (h ^ (h >> 32))*k;
+            return h | 1;
+        }
+
+        // 统计命中率，一个窗口内命中率过低时关闭并清空缓存
+        void count(bool hit) {
+            lookups_++;
+            totalLookups_++;
+            if (hit) {
+                hits_++;
+                totalHits_++;
+            }
+            if (lookups_ >= policy_.window) {
+                if (hits_ < policy_.minHitRate*lookups_) {
+                    enabled_ = false;
+                    clear();
+                }
+                lookups_ = 0;
+                hits_ = 0;
+            }
+        }
+
+    private:
+        int bandCount_;
+        MemoPolicy policy_;
+        size_t mask_;
+
+        std::vector<uint64_t> hashes_;  // 各位置光谱的哈希值，0 表示空位
+        std::vector<T> keys_;           // 各位置的光谱
+        std::vector<R> results_;        // 各位置的结果
+
+        bool enabled_ = true;
+        size_t skipped_ = 0;
+        size_t lookups_ = 0;
+        size_t hits_ = 0;
+        size_t totalLookups_ = 0;
+        size_t totalHits_ = 0;
+    };
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_MEMO_H
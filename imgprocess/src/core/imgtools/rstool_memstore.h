@@ -0,0 +1,241 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 内存中间结果：算法的输出不写到磁盘文件，而是写到 GDAL 的内存文件系统（/vsimem/）中的 ENVI 文件，
+// 下一个算法按路径直接打开（GDALOpen、句柄池、MgDatasetManager 均可），省去中间文件的写出与读回；
+// 所有内存结果共享一个内存预算，超出预算的结果落盘到临时目录，结果释放时删除对应的文件
+
+#ifndef IMGPROCESS_RSTOOL_MEMSTORE_H
+#define IMGPROCESS_RSTOOL_MEMSTORE_H
+
+#include "rstool_common.h"
+#include "rstool_datasetpool.h"
+#include "gdal/gdal_priv.h"
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdlib>
+#include <strings.h>
+#include <unistd.h>
+
+namespace RSTool {
+
+    namespace Mp {
+
+        // 输出格式为 MEM（与 GDAL MEM 驱动同名）时，算法将结果写到内存中间结果
+        inline bool IsMemoryFormat(const std::string &format) {
+            return strcasecmp(format.c_str(), "MEM") == 0;
+        }
+
+        class MemoryStore;
+
+        /**
+         * 一个中间结果（ENVI 格式，BSQ 组织），最后一个引用释放时删除文件并归还内存预算
+         */
+        class MemResult {
+        public:
+            ~MemResult() { release(); }
+
+            MemResult(const MemResult &) = delete;
+            MemResult& operator= (const MemResult &) = delete;
+
+            // 结果的路径及格式，可直接作为下一个算法的输入文件，或作为 MpRPWModel 的输出文件
+            const std::string& path() const { return path_; }
+            const char* format() const { return "ENVI"; }
+
+            // 是否位于内存中（否则已落盘）
+            bool inMemory() const { return inMemory_; }
+            size_t bytes() const { return bytes_; }
+
+            int xSize() const { return xSize_; }
+            int ySize() const { return ySize_; }
+            int bands() const { return bands_; }
+            GDALDataType dataType() const { return dataType_; }
+
+            /**
+             * 读出一个波段（按行存储，xSize*ySize 个元素），数据类型转换由 GDAL 完成
+             * @param band  波段索引（从 1 开始）
+             */
+            template <typename T>
+            bool read(int band, T *buf) const {
+                if (band < 1 || band > bands_ || buf == nullptr) return false;
+                DatasetLease ds = DatasetPool::instance().acquire(path_);
+                if (!ds) return false;
+                return ds->GetRasterBand(band)->RasterIO(GF_Read, 0, 0, xSize_, ySize_,
+                        buf, xSize_, ySize_, toGDALDataType<T>(), 0, 0) != CE_Failure;
+            }
+
+        private:
+            friend class MemoryStore;
+
+            MemResult(MemoryStore *store, const std::string &path, bool inMemory, size_t bytes,
+                    int xSize, int ySize, int bands, GDALDataType dataType)
+                    : store_(store), path_(path), inMemory_(inMemory), bytes_(bytes),
+                      xSize_(xSize), ySize_(ySize), bands_(bands), dataType_(dataType) {}
+
+            inline void release();
+
+        private:
+            MemoryStore *store_;
+            std::string path_;
+            bool inMemory_;
+            size_t bytes_;
+            int xSize_;
+            int ySize_;
+            int bands_;
+            GDALDataType dataType_;
+        };
+
+        using MemResultPtr = std::shared_ptr<MemResult>;
+
+        /**
+         * 中间结果的分配者（进程内唯一）：
+         *  1. 按结果的数据量预留内存预算，预算充足时结果位于 /vsimem/，否则落盘到临时目录；
+         *  2. 预算默认为物理内存的 1/4，落盘目录默认为 CPL_TMPDIR、TMPDIR 或 /tmp
+         */
+        class MemoryStore {
+        public:
+            static MemoryStore& instance() {
+                static MemoryStore *store = new MemoryStore();
+                return *store;
+            }
+
+            MemoryStore(const MemoryStore &) = delete;
+            MemoryStore& operator= (const MemoryStore &) = delete;
+
+            /**
+             * 创建一个中间结果（数据初始为 0）
+             * @param name      结果名称，仅用于生成文件名
+             * @param geoTrans  仿射变换参数，为空时不设置
+             * @param proj      空间参考，为空时不设置
+             * @return          创建失败时返回空指针
+             */
+            MemResultPtr create(const std::string &name, int xSize, int ySize, int bands,
+                    GDALDataType dataType, const double *geoTrans = nullptr, const char *proj = nullptr) {
+                if (xSize <= 0 || ySize <= 0 || bands <= 0) return nullptr;
+                size_t bytes = static_cast<size_t>(xSize)*ySize*bands*GDALGetDataTypeSizeBytes(dataType);
+
+                bool inMemory = false;
+                std::string dir;
+                {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    if (used_ + static_cast<long long>(bytes) <= budget_) {
+                        used_ += bytes;
+                        inMemory = true;
+                    }
+                    dir = inMemory ? std::string("/vsimem/rstool") : spillDir_;
+                }
+
+                std::string path = dir + "/rstool_" + std::to_string(getpid()) + "_" +
+                        std::to_string(++serial_) + "_" + fileName(name) + ".dat";
+                MemResultPtr result(new MemResult(this, path, inMemory, bytes, xSize, ySize, bands, dataType));
+
+                GDALAllRegister();
+                GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("ENVI");
+                char **options = CSLSetNameValue(nullptr, "INTERLEAVE", "BSQ");
+                GDALDataset *ds = driver ? driver->Create(path.c_str(), xSize, ySize, bands, dataType, options) : nullptr;
+                CSLDestroy(options);
+                if (ds == nullptr) return nullptr;
+
+                if (geoTrans) ds->SetGeoTransform(const_cast<double*>(geoTrans));
+                if (proj) ds->SetProjection(proj);
+                GDALClose((GDALDatasetH)ds);
+                return result;
+            }
+
+            /**
+             * 创建与已有影像大小及地理参考一致的中间结果
+             * @param like      参考影像
+             * @param bands     波段数
+             * @param dataType  数据类型
+             */
+            MemResultPtr createLike(const std::string &name, const std::string &like,
+                    int bands, GDALDataType dataType) {
+                DatasetLease ds = DatasetPool::instance().acquire(like);
+                if (!ds) return nullptr;
+                double geoTrans[6] = { 0 };
+                bool hasGeo = ds->GetGeoTransform(geoTrans) == CE_None;
+                std::string proj = ds->GetProjectionRef() ? ds->GetProjectionRef() : "";
+                return create(name, ds->GetRasterXSize(), ds->GetRasterYSize(), bands, dataType,
+                        hasGeo ? geoTrans : nullptr, proj.empty() ? nullptr : proj.c_str());
+            }
+
+            // 内存预算（字节），只影响之后创建的结果
+            void setBudget(long long bytes) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                budget_ = bytes;
+            }
+
+            long long budget() {
+                std::unique_lock<std::mutex> lk(mutex_);
+                return budget_;
+            }
+
+            // 内存中的结果占用的字节数
+            long long used() {
+                std::unique_lock<std::mutex> lk(mutex_);
+                return used_;
+            }
+
+            // 超出预算的结果的落盘目录
+            void setSpillDir(const std::string &dir) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                spillDir_ = dir;
+            }
+
+        private:
+            friend class MemResult;
+
+            MemoryStore() {
+                long pages = sysconf(_SC_PHYS_PAGES);
+                long pageSize = sysconf(_SC_PAGE_SIZE);
+                if (pages > 0 && pageSize > 0) {
+                    budget_ = static_cast<long long>(pages)*pageSize/4;
+                }
+
+                const char *dir = CPLGetConfigOption("CPL_TMPDIR", nullptr);
+                if (dir == nullptr) dir = getenv("TMPDIR");
+                if (dir != nullptr && *dir != '\0') spillDir_ = dir;
+            }
+
+            // 结果名称只保留文件名部分，避免生成的路径跨越目录
+            static std::string fileName(const std::string &name) {
+                std::string file = name.substr(name.find_last_of('/') + 1);
+                return file.empty() ? std::string("result") : file;
+            }
+
+            void giveBack(const std::string &path, bool inMemory, size_t bytes) {
+                // 关闭句柄池中的空闲句柄后再删除文件
+                DatasetPool::instance().invalidate(path);
+                std::string stem = path.substr(0, path.size() - 4);
+                VSIUnlink(path.c_str());
+                VSIUnlink((stem + ".hdr").c_str());
+                VSIUnlink((path + ".hdr").c_str());
+                VSIUnlink((path + ".aux.xml").c_str());
+
+                if (inMemory) {
+                    std::unique_lock<std::mutex> lk(mutex_);
+                    used_ -= bytes;
+                }
+            }
+
+        private:
+            std::mutex mutex_;
+            long long budget_ = 4LL << 30;
+            long long used_ = 0;
+            std::string spillDir_ = "/tmp";
+            std::atomic<long long> serial_{0};
+        };
+
+        inline void MemResult::release() {
+            if (store_ == nullptr) return;
+            store_->giveBack(path_, inMemory_, bytes_);
+            store_ = nullptr;
+        }
+
+    } // namespace Mp
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_MEMSTORE_H
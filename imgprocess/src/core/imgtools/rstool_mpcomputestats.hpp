@@ -6,6 +6,7 @@
 #define IMGPROCESS_RSTOOL_MPCOMPUTESTATS_HPP
 
 #include "rstool_rpmodel.hpp"
+#include "rstool_kernels.h"
 
 namespace RSTool {
 
@@ -16,6 +17,18 @@ namespace RSTool {
                   imgDataset_(nullptr) {
         }
 
+        /**
+         * 浮点影像是否按半精度存储数据块（默认为 None，按 float 存储），
+         * 读缓冲队列占用的内存与带宽减半，累加仍使用 double
+         */
+        enum class HalfStorage : char {
+            None,
+            Fp16,   /* RSTool::Half */
+            Bf16    /* RSTool::BFloat16 */
+        };
+
+        void setHalfStorage(HalfStorage storage) { halfStorage_ = storage; }
+
         virtual ~MpComputeStatistics() {
             for (auto &mean : means_) {
                 ReleaseArray(mean);
@@ -70,7 +83,13 @@ namespace RSTool {
                     exec<int>(mean, stdDev, covariance, correlation);
                     break;
                 case GDALDataType::GDT_Float32:
-                    exec<float>(mean, stdDev, covariance, correlation);
+                    if (halfStorage_ == HalfStorage::Fp16) {
+                        exec<Half>(mean, stdDev, covariance, correlation);
+                    } else if (halfStorage_ == HalfStorage::Bf16) {
+                        exec<BFloat16>(mean, stdDev, covariance, correlation);
+                    } else {
+                        exec<float>(mean, stdDev, covariance, correlation);
+                    }
                     break;
                 case GDALDataType::GDT_Float64:
                     exec<double>(mean, stdDev, covariance, correlation);
@@ -174,41 +193,110 @@ namespace RSTool {
                              double *mean,
                              double *stdDev,
                              double *covariance) {
+            RSToolSwitchBandCount(imgBandCount_, accumulateSpectra, data, mean, stdDev, covariance)
+        } // end processDataCore()
+
+        /**
+         * 累加数据块中各像素的一阶矩、二阶矩及协方差
+         * @tparam N    波段数，为 0 时按运行时的 imgBandCount_ 计算
+         */
+        template <int N, typename T>
+        void accumulateSpectra(DataChunk<T> &data,
+                               double *mean,
+                               double *stdDev,
+                               double *covariance) {
+            if (N == 0) {
+                accumulateSpectraDynamic(data, mean, stdDev, covariance);
+                return;
+            }
+
+            // 波段数为编译期常量：整个数据块在局部数组（寄存器）中累加，最后写回一次
+            // 半精度数据逐条光谱转换为 float 后计算
+            const int n = N > 0 ? N : 1;
+            using V = typename StorageTraits<T>::IOType;
+            V scratch[n];
+            double sum[n] = {}, sumSq[n] = {}, covar[n*n] = {};
+
             int size = data.dims().spatialSize();
-            T *pBuf1, *pBuf2;
-            T *buf = data.data();
+            const T *buf = data.cdata();
+            for (int i = 0; i < size; i++) {
+                const V *pBuf1 = WidenSpan(buf + static_cast<size_t>(i)*data.stride(), n, scratch);
+
+                for (int b = 0; b < n; b++) {
+                    double x = pBuf1[b];
+                    sum[b] += x;
+                    sumSq[b] += x*x;
+                    for (int b1 = b; b1 < n; b1++) {
+                        covar[b*n + b1] += pBuf1[b1]*x;
+                    }
+                }
+            }
+
+            for (int b = 0; b < n; b++) {
+                mean[b] += sum[b];
+                stdDev[b] += sumSq[b];
+                for (int b1 = b; b1 < n; b1++) {
+                    covariance[b*n + b1] += covar[b*n + b1];
+                }
+            }
+        }
+
+        template <typename T>
+        void accumulateSpectraDynamic(DataChunk<T> &data,
+                                      double *mean,
+                                      double *stdDev,
+                                      double *covariance) {
+            // 半精度数据逐条光谱转换为 float 后计算
+            using V = typename StorageTraits<T>::IOType;
+            static thread_local std::vector<V> scratch;
+            scratch.resize(IsHalfType<T>::value ? imgBandCount_ : 0);
+
+            int size = data.dims().spatialSize();
+            const V *pBuf1;
+            const T *buf = data.cdata();
             double *pCovar = nullptr;
+            const KernelTable &kernels = Kernels();
 
             for (int i = 0; i < size; i++) {
-                int index = i*imgBandCount_;
-                pBuf1 = buf + index;
+                pBuf1 = WidenSpan(buf + static_cast<size_t>(i)*data.stride(), imgBandCount_, scratch.data());
 
                 for (int b = 0; b < imgBandCount_; b++) {
-                    pBuf2 = buf + b;
+                    V x = pBuf1[b];
 
                     // sum of X: x1 + x2 + x3 + ...
-                    mean[b] += pBuf2[index];
+                    mean[b] += x;
 
                     // sum of X^2: x1^2 + x2^2 + x3^2 + ...
-                    stdDev[b] += pBuf2[index]*pBuf2[index];
+                    stdDev[b] += x*x;
 
                     // sum of X*Y: x1*y1 + x2*y2 + x3*y3 + ...
                     pCovar = covariance + b*imgBandCount_;
-                    for (int b1 = b; b1 < imgBandCount_; b1++) {
-                        pCovar[b1] += pBuf1[b1]*pBuf2[index];
-                    }
+                    accumulateRow(kernels, pCovar + b, pBuf1 + b, x, imgBandCount_ - b);
                 } // end for b
 
             } // end for elem
 
-        } // end processDataCore()
+        } // end accumulateSpectraDynamic()
     private:
+        // acc[i] += x[i]*s，float 数据使用按指令集分派的计算核心
+        template <typename V>
+        static void accumulateRow(const KernelTable &, double *acc, const V *x, V s, int n) {
+            for (int i = 0; i < n; i++) {
+                acc[i] += x[i]*s;
+            }
+        }
+
+        static void accumulateRow(const KernelTable &kernels, double *acc, const float *x, float s, int n) {
+            kernels.axpy(acc, x, s, n);
+        }
+
         std::string infile_;
         int blkSize_;
         int threadCount_;
 
         GDALDataset *imgDataset_;
         int imgBandCount_;
+        HalfStorage halfStorage_ = HalfStorage::None;
 
         std::vector<double *> means_;
         std::vector<double *> stdDevs_;
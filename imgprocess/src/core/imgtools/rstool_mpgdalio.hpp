@@ -7,6 +7,7 @@
 
 #include "rstool_common.h"
 #include "rstool_threadpool.h"
+#include "rstool_gridplan.h"
 
 namespace RSTool {
 
@@ -17,27 +18,31 @@ namespace RSTool {
         MpGdalIO(const std::string &infile, const std::string &outfile,
                 int blkSize = 128, int queueMaxSize = 16, int ioCount = 4)
                 : infile_(infile), outfile_(outfile), poolCount_(ioCount),
-                  pools_(poolCount_) {
+                  pools_(poolCount_), plan_(0, 0, 1, 1) {
 
             GDALAllRegister();
 
-            poInDS_ = (GDALDataset*)GDALOpen(infile_.c_str(), GA_ReadOnly);
+            poInDS_ = Mp::DatasetPool::instance().acquire(infile_);
             imgXSize_ = poInDS_->GetRasterXSize();
             imgYSize_ = poInDS_->GetRasterYSize();
             imgBandCount_ = poInDS_->GetRasterCount();
             blkSize_ = blkSize;
             queueMaxSize_ = queueMaxSize;
-            consumerCount_ = 4; // TODO 根据CPU核数确定
-            tasks_.resize(consumerCount_);
 
-            int xNUms = (imgXSize_ + blkSize_ - 1) / blkSize_;
-            int yNUms = (imgYSize_ + blkSize_ - 1) / blkSize_;
-            blkNums_ = xNUms*yNUms;
+            // 按原生块布局分块
+            size_t pixelBytes = sizeof(T)*imgBandCount_;
+            plan_ = PlanChunkGrid(poInDS_.get(), pixelBytes, TargetChunkBytes(blkSize_, pixelBytes));
+            blkNums_ = plan_.count();
+
+            // 根据CPU核数及块数确定
+            consumerCount_ = Mp::GetOptimalNumThreads(blkNums_);
+            tasks_.resize(consumerCount_);
 
-            // IO并行化
+            // IO并行化，句柄从共享句柄池中租借
+            size_t chunkBytes = static_cast<size_t>(plan_.xChunkSize())*plan_.yChunkSize()*pixelBytes;
             for (int i = 0; i < poolCount_; i++) {
-                GDALDataset * ds = (GDALDataset*)GDALOpen(infile.c_str(), GA_ReadOnly);
-                datasets_.push_back(ds);
+                datasets_.emplace_back(Mp::DatasetPool::instance().acquire(infile));
+                datasets_.back().cacheBudget(chunkBytes);
             }
 
         } // end MpGdalIO
@@ -46,24 +51,11 @@ namespace RSTool {
         void assignWorkload() {
 
             // 将文件分块
-            std::vector<RSTool::SpatialDims> dims;
-            for (int i = 0; i < imgYSize_; i += blkSize_) {
-                int yBlockSize = blkSize_;
-                if (i + blkSize_ > imgYSize_) // 最下面的剩余块
-                    yBlockSize = imgYSize_ - i;
-
-                for (int j = 0; j < imgXSize_; j += blkSize_) {
-                    int xBlockSize = blkSize_;
-                    if (j + blkSize_ > imgXSize_) // 最右侧的剩余块
-                        xBlockSize = imgXSize_ - j;
-
-                    dims.emplace_back(RSTool::SpatialDims(j, i, xBlockSize, yBlockSize));
-                } // end row
-            } // end col
+            std::vector<RSTool::SpatialDims> dims = plan_.chunks();
 
             // 分配工作量
-            int xNUms = (imgXSize_ + blkSize_ - 1) / blkSize_;
-            int yNUms = (imgYSize_ + blkSize_ - 1) / blkSize_;
+            int xNUms = plan_.xCount();
+            int yNUms = plan_.yCount();
             int perThreadYBlkNums = yNUms / poolCount_;
             int leftYNums = yNUms % poolCount_;
 
@@ -71,7 +63,7 @@ namespace RSTool {
             for (int i = 0; i < size; i++) {
 
                 for (int j = 0; j < poolCount_; j++) {
-                    GDALDataset *ds = datasets_[j];
+                    GDALDataset *ds = datasets_[j].get();
                     RSTool::SpatialDims &dim = dims[j*perThreadYBlkNums+i];
 
                     int xOff = dim.xOff();
@@ -111,7 +103,7 @@ namespace RSTool {
             // 将剩余的块交给最后一个线程池 IO 处理
             int leftNums = leftYNums*xNUms;
             for (int i = 0; i < leftNums; i++) {
-                GDALDataset *ds = datasets_[poolCount_-1];
+                GDALDataset *ds = datasets_[poolCount_-1].get();
                 RSTool::SpatialDims & dim = dims[poolCount_*size+i];
                 int xOff = dim.xOff();
                 int yOff = dim.yOff();
@@ -195,17 +187,23 @@ namespace RSTool {
 
             std::cout << "pools size: " << sizeof(pools_[poolCount_-1]) << std::endl;
 
+            // 消费者线程由共享执行器提供
             for (int i = 0; i < consumerCount_; i++) {
-                consumerThreads_.emplace_back(std::thread(&MpGdalIO<T>::consumeTask,
-                        this, consumerTasks_[i], tasks_[i]));
+                consumerThreads_.emplace_back(Mp::Executor::instance().submit([this, i] {
+                    consumeTask(std::function<void(DataChunk<T> &)>(consumerTasks_[i]), tasks_[i]);
+                }));
             }
 
-            // todo 如果不需要和主线程进行同步，是否可以分离线程？？？
             for (int i = 0; i < consumerCount_; i++) {
-                consumerThreads_[i].join();
+                consumerThreads_[i].get();
             }
         }
 
+        // 在共享执行器上异步运行，本对象需在返回的 future 就绪前保持有效
+        std::future<void> runAsync() {
+            return Mp::Executor::instance().submit([this] { run(); });
+        }
+
     private:
         std::queue<RSTool::DataChunk<T>> queue_;
         int queueMaxSize_;
@@ -215,12 +213,12 @@ namespace RSTool {
 
     private:
         int poolCount_; // IO线程 数量
-        std::vector< Mp::ThreadPool> pools_;
-        std::vector<GDALDataset*> datasets_;
+        std::vector<Mp::DatasetLease> datasets_; // 在 pools_ 之后析构，任务执行完后才归还句柄
+        std::vector< Mp::SerialQueue> pools_; // 每个 IO线程 的任务在共享执行器上串行执行
         std::vector<int> tasks_;
 
     private:
-        GDALDataset *poInDS_;
+        Mp::DatasetLease poInDS_;
         //GDALDataset *poOutDS_;
         int imgBandCount_;
         int imgXSize_;
@@ -228,13 +226,14 @@ namespace RSTool {
 
         int blkSize_;
         int blkNums_;
+        GridPlan plan_;     // 分块方案
 
         std::string infile_;
         std::string outfile_;
 
     private:
         int consumerCount_; // 消费者线程数量
-        std::vector<std::thread> consumerThreads_;   // 消费者线程（块数据处理线程）
+        std::vector<std::future<void>> consumerThreads_;   // 消费者线程（块数据处理线程）
 
         // 每个消费者线程所处理的核心函数对象
         // 可以从主线程中接收不同的参数（主要是为了将主线程的任务并行化）
@@ -0,0 +1,176 @@
+//
+// Created by penglei on 18-10-22.
+//
+// NUMA 拓扑信息及线程绑定，用于将读线程、消费者线程及其数据块放在同一个 NUMA 节点上
+
+#ifndef IMGPROCESS_RSTOOL_NUMA_H
+#define IMGPROCESS_RSTOOL_NUMA_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace RSTool {
+
+    namespace Mp {
+
+        // 线程的绑定策略
+        enum class AffinityPolicy : char {
+            None,       /* 不绑定，由操作系统调度 */
+            NumaPairs   /* 第 i 个读线程和第 i 个消费者线程绑定到第 (i % 节点数) 个 NUMA 节点上 */
+        };
+
+        /**
+         * NUMA 拓扑信息（从 /sys/devices/system/node 中读取），进程内只读取一次；
+         * 非 Linux 系统或单节点机器上 nodeCount() 为 1，所有绑定操作均不生效
+         */
+        class NumaTopology {
+        public:
+            static const NumaTopology& instance() {
+                static NumaTopology topo;
+                return topo;
+            }
+
+            int nodeCount() const { return static_cast<int>(nodeCpus_.size()); }
+
+            // 是否为多节点机器
+            bool isNuma() const { return nodeCount() > 1; }
+
+            // 第 node 个节点上的 CPU 编号
+            const std::vector<int>& cpus(int node) const { return nodeCpus_[node]; }
+
+            // 第 cpu 个 CPU 所在的节点，未知时返回 0
+            int nodeOfCpu(int cpu) const {
+                if (cpu < 0 || cpu >= static_cast<int>(cpuNode_.size())) return 0;
+                return cpuNode_[cpu];
+            }
+
+            // 当前线程所在的节点
+            int currentNode() const {
+#ifdef __linux__
+                if (isNuma()) return nodeOfCpu(sched_getcpu());
+#endif
+                return 0;
+            }
+
+            /**
+             * 解析形如 "0-3,8-11" 的 CPU 列表
+             * @param text  CPU 列表字符串
+             * @return      CPU 编号
+             */
+            static std::vector<int> ParseCpuList(const std::string &text) {
+                std::vector<int> cpus;
+                std::stringstream ss(text);
+                std::string item;
+                while (std::getline(ss, item, ',')) {
+                    if (item.empty() || item == "\n") continue;
+
+                    int first = 0, last = 0;
+                    size_t dash = item.find('-');
+                    try {
+                        first = std::stoi(item.substr(0, dash));
+                        last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+                    } catch (...) {
+                        continue;
+                    }
+                    for (int c = first; c <= last; c++) {
+                        cpus.push_back(c);
+                    }
+                }
+                return cpus;
+            }
+
+        private:
+            NumaTopology() {
+#ifdef __linux__
+                std::string online;
+                std::ifstream in("/sys/devices/system/node/online");
+                if (in) std::getline(in, online);
+
+                for (int node : ParseCpuList(online)) {
+                    std::ifstream cpuList("/sys/devices/system/node/node"
+                            + std::to_string(node) + "/cpulist");
+                    std::string text;
+                    if (!cpuList || !std::getline(cpuList, text)) continue;
+
+                    std::vector<int> cpus = ParseCpuList(text);
+                    if (cpus.empty()) continue; // 只有内存没有 CPU 的节点
+
+                    for (int c : cpus) {
+                        if (c >= static_cast<int>(cpuNode_.size())) cpuNode_.resize(c + 1, 0);
+                        cpuNode_[c] = static_cast<int>(nodeCpus_.size());
+                    }
+                    nodeCpus_.emplace_back(std::move(cpus));
+                }
+#endif
+                // 无法获取拓扑信息时按单节点处理
+                if (nodeCpus_.empty()) nodeCpus_.emplace_back();
+            }
+
+        private:
+            std::vector<std::vector<int>> nodeCpus_;
+            std::vector<int> cpuNode_;
+        };
+
+        /**
+         * 在作用域内将当前线程绑定到指定 NUMA 节点的 CPU 上，离开作用域时恢复原来的绑定，
+         * 这样线程池中的线程在任务结束后不会一直被绑定在某个节点上。
+         * 单节点机器、策略为 None 或节点 CPU 与进程允许的 CPU 无交集时不做任何操作
+         */
+        class ScopedNumaBinding {
+        public:
+            /**
+             * @param index     线程编号，绑定到第 (index % 节点数) 个节点
+             * @param policy    绑定策略
+             */
+            ScopedNumaBinding(int index, AffinityPolicy policy) {
+                const NumaTopology &topo = NumaTopology::instance();
+                if (policy == AffinityPolicy::None || !topo.isNuma()) return;
+
+                node_ = index % topo.nodeCount();
+#ifdef __linux__
+                pthread_t self = pthread_self();
+                if (pthread_getaffinity_np(self, sizeof(saved_), &saved_) != 0) return;
+
+                cpu_set_t mask;
+                CPU_ZERO(&mask);
+                for (int c : topo.cpus(node_)) {
+                    if (c < CPU_SETSIZE && CPU_ISSET(c, &saved_)) CPU_SET(c, &mask);
+                }
+                if (CPU_COUNT(&mask) == 0) return;
+
+                bound_ = pthread_setaffinity_np(self, sizeof(mask), &mask) == 0;
+#endif
+            }
+
+            ~ScopedNumaBinding() {
+#ifdef __linux__
+                if (bound_) pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+#endif
+            }
+
+            ScopedNumaBinding(const ScopedNumaBinding &) = delete;
+            ScopedNumaBinding& operator= (const ScopedNumaBinding &) = delete;
+
+            // 绑定的节点，未绑定时返回 -1
+            int node() const { return bound_ ? node_ : -1; }
+
+        private:
+            int node_ = -1;
+            bool bound_ = false;
+#ifdef __linux__
+            cpu_set_t saved_;
+#endif
+        };
+
+    } // namespace Mp
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_NUMA_H
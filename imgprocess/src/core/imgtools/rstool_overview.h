@@ -0,0 +1,355 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 写出过程中生成金字塔（概视图）：每个写出的数据块在经过写出环节时即被归约到 2× 概视图，
+// 每一级凑齐的概视图行再级联归约到下一级（与 gdaladdo 相同，各级由上一级生成），
+// 各级只在内存中缓存尚未凑齐的概视图行（按波段分别缓存，逐波段写出时每个波段的行各自凑齐），
+// 凑齐的行以输出的数据类型写到临时文件中，
+// 全部写出后再一次性写入输出文件的概视图，省去事后 gdaladdo 对整个输出文件的再次读取
+
+#ifndef IMGPROCESS_RSTOOL_OVERVIEW_H
+#define IMGPROCESS_RSTOOL_OVERVIEW_H
+
+#include "rstool_rawio.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+namespace RSTool {
+
+    // 概视图的重采样方式
+    enum class OverviewResampling : char {
+        Average,    /* 均值（忽略 NoData） */
+        Nearest     /* 最邻近（取每个窗口左上角的像元） */
+    };
+
+    /**
+     * 流式生成概视图：第 1 级概视图的每个像元由原始影像 2 × 2 的窗口归约得到，
+     * 第 k 级由第 k - 1 级（归约结果取整之前的值）的 2 × 2 窗口归约得到，
+     * 数据块可以按任意顺序、在多个线程中同时加入（各数据块互不重叠）
+     */
+    class OverviewBuilder {
+    public:
+        /**
+         * @param tmpPrefix     各级概视图临时文件的前缀（ENVI 格式，tmpPrefix + "_ovN.dat"）
+         * @param levels        概视图级数，为 0 时一直生成到概视图的宽、高均不大于 256
+         * @param resampling    重采样方式
+         */
+        OverviewBuilder(int xSize, int ySize, int bands, GDALDataType dataType, const std::string &tmpPrefix,
+                int levels = 0, OverviewResampling resampling = OverviewResampling::Average)
+                : xSize_(xSize), ySize_(ySize), bands_(bands), dataType_(dataType),
+                resampling_(resampling), noData_(bands, std::make_pair(false, 0.0)) {
+            // 临时文件使用输出的数据类型（RawWriter 不支持的类型使用 Float64）
+            GDALDataType tmpType = GDT_Float64;
+            switch (dataType) {
+                case GDT_Byte: case GDT_Int16: case GDT_UInt16: case GDT_Int32:
+                case GDT_UInt32: case GDT_Float32:
+                    tmpType = dataType;
+                    break;
+                default:
+                    break;
+            }
+
+            for (int factor = 2; ; factor *= 2) {
+                std::unique_ptr<Level> level(new Level());
+                level->factor = factor;
+                level->srcXSize = levels_.empty() ? xSize : levels_.back()->xSize;
+                level->srcYSize = levels_.empty() ? ySize : levels_.back()->ySize;
+                level->xSize = (level->srcXSize + 1) / 2;
+                level->ySize = (level->srcYSize + 1) / 2;
+                level->file = tmpPrefix + "_ov" + std::to_string(factor) + ".dat";
+                level->tmp = RawWriter::Create(level->file, level->xSize, level->ySize, bands, tmpType);
+                valid_ = valid_ && level->tmp != nullptr;
+                levels_.push_back(std::move(level));
+
+                bool small = levels_.back()->xSize <= 256 && levels_.back()->ySize <= 256;
+                if (levels > 0 ? static_cast<int>(levels_.size()) >= levels : small || factor >= (1 << 20)) {
+                    break;
+                }
+            }
+        }
+
+        ~OverviewBuilder() { removeTemp(); }
+
+        OverviewBuilder(const OverviewBuilder &) = delete;
+        OverviewBuilder& operator= (const OverviewBuilder &) = delete;
+
+        // 临时文件是否全部创建成功
+        bool valid() const { return valid_; }
+
+        // 各级概视图的缩小倍数
+        std::vector<int> factors() const {
+            std::vector<int> values;
+            for (auto &level : levels_) values.push_back(level->factor);
+            return values;
+        }
+
+        /**
+         * 设置波段的 NoData 值：均值时忽略该值，窗口内全部为 NoData 时结果为 NoData
+         * @param band  波段索引（从 1 开始）
+         */
+        void setNoData(int band, double value) {
+            noData_[band - 1] = std::make_pair(true, value);
+        }
+
+        /**
+         * 加入一个写出的数据块（可在多个线程中同时调用）
+         * @param bandMap   波段索引（从 1 开始）
+         * @param intl      数据在内存中的组织方式
+         * @param stride    BIP 数据中相邻两个像素的间隔（见 DataChunk::stride()），0 表示等于波段数
+         * @return          越界或临时文件写入失败时返回 false
+         */
+        template <typename T>
+        bool add(int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, Interleave intl, const T *data, int stride = 0) {
+            if (xOff < 0 || yOff < 0 || xOff + xSize > xSize_ || yOff + ySize > ySize_) return false;
+            for (int b = 0; b < bandCount; b++) {
+                if (bandMap[b] < 1 || bandMap[b] > bands_) return false;
+            }
+
+            // 像素分组（BIP-N）及光谱补齐的数据先转换为紧凑的 BIP
+            data = UntilePixels(data, intl, xSize, ySize, bandCount, stride);
+
+            return reduce(0, xOff, yOff, xSize, ySize, bandCount, bandMap, intl, data);
+        }
+
+        template <typename T>
+        bool add(DataChunk<T> &data) {
+            DataDims &dims = data.dims();
+            return add(dims.xOff(), dims.yOff(), dims.xSize(), dims.ySize(),
+                    dims.bandCount(), dims.bandMap(), data.interleave(), data.data(), data.stride());
+        }
+
+        /**
+         * 写出尚未凑齐的概视图行（如有数据块没有写出），所有数据块加入后调用，
+         * 按级别从高分辨率到低分辨率处理，各级剩余的行仍会级联到下一级
+         * @return  临时文件写入失败时返回 false
+         */
+        bool finish() {
+            bool ok = true;
+            for (size_t k = 0; k < levels_.size(); k++) {
+                std::map<RowKey, Row> pending;
+                {
+                    std::unique_lock<std::mutex> lk(levels_[k]->mutex);
+                    pending.swap(levels_[k]->pending);
+                }
+                for (auto &item : pending) {
+                    ok = completeRow(k, item.first.first, item.first.second, item.second) && ok;
+                }
+            }
+            return ok;
+        }
+
+        /**
+         * 在数据集中创建各级概视图（不计算）并写入归约结果，完成后删除临时文件
+         * @param ds    以更新方式打开的输出数据集（不支持内部概视图的格式生成外部 .ovr 文件）
+         * @return      创建概视图或写入失败时返回 false
+         */
+        bool apply(GDALDataset *ds) {
+            if (!valid_ || ds == nullptr) return false;
+
+            for (auto &level : levels_) level->tmp.reset();
+
+            std::vector<int> factorList = factors();
+            if (GDALBuildOverviews((GDALDatasetH)ds, "NONE", static_cast<int>(factorList.size()),
+                    factorList.data(), 0, nullptr, nullptr, nullptr) != CE_None) {
+                return false;
+            }
+
+            bool ok = true;
+            for (auto &level : levels_) {
+                ok = copyLevel(ds, *level) && ok;
+            }
+            removeTemp();
+            return ok;
+        }
+
+    private:
+        // 一个波段的一个概视图行的累加结果
+        struct Row {
+            std::vector<double> sum;
+            std::vector<uint32_t> count;
+            size_t covered = 0;             // 已加入的上一级像元数
+        };
+
+        using RowKey = std::pair<int, int>; // (概视图行号, 波段索引（从 0 开始）)
+
+        struct Level {
+            int factor;         // 相对原始影像的缩小倍数
+            int srcXSize;       // 上一级（第 1 级为原始影像）的大小
+            int srcYSize;
+            int xSize;
+            int ySize;
+            std::string file;
+            std::shared_ptr<RawWriter> tmp;
+
+            std::mutex mutex;
+            std::map<RowKey, Row> pending;  // 尚未凑齐的概视图行（按波段）
+        };
+
+        /**
+         * 将上一级的数据块归约到第 k 级概视图：逐个概视图行先在本线程中归约，再累加到对应波段的概视图行，
+         * 凑齐的行（该波段对应的上一级的行已全部加入）写到临时文件并级联到下一级
+         */
+        template <typename T>
+        bool reduce(size_t k, int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, Interleave intl, const T *data) {
+            Level &level = *levels_[k];
+            const int f = 2;
+            int ox0 = xOff / f, ox1 = (xOff + xSize - 1) / f;
+            int oy0 = yOff / f, oy1 = (yOff + ySize - 1) / f;
+            size_t ow = ox1 - ox0 + 1;
+            bool nearest = resampling_ == OverviewResampling::Nearest;
+
+            std::vector<double> sum(ow*bandCount);
+            std::vector<uint32_t> count(ow*bandCount);
+            size_t stride = intl == Interleave::BIP ? bandCount : 1;
+
+            bool ok = true;
+            for (int oy = oy0; oy <= oy1; oy++) {
+                // 该概视图行对应的上一级的行中属于本数据块的行
+                int y0 = std::max(yOff, oy*f);
+                int y1 = std::min(yOff + ySize, (oy + 1)*f);
+
+                std::fill(sum.begin(), sum.end(), 0);
+                std::fill(count.begin(), count.end(), 0);
+                for (int b = 0; b < bandCount; b++) {
+                    bool hasNoData = noData_[bandMap[b] - 1].first;
+                    double noData = noData_[bandMap[b] - 1].second;
+                    for (int y = y0; y < y1; y++) {
+                        if (nearest && y % f != 0) continue;
+                        const T *s = data + InterleaveOffset(intl, xSize, ySize, bandCount, 0, y - yOff, b);
+                        for (int x = 0; x < xSize; x++) {
+                            if (nearest && (xOff + x) % f != 0) continue;
+                            double v = static_cast<double>(s[x*stride]);
+                            if (hasNoData && v == noData) continue;
+                            size_t i = static_cast<size_t>(b)*ow + (xOff + x) / f - ox0;
+                            sum[i] += v;
+                            count[i]++;
+                        }
+                    }
+                }
+
+                std::vector<std::pair<int, Row>> ready;   // (波段索引, 凑齐的行)
+                {
+                    std::unique_lock<std::mutex> lk(level.mutex);
+                    size_t expected = static_cast<size_t>(std::min(f, level.srcYSize - oy*f))*level.srcXSize;
+                    for (int b = 0; b < bandCount; b++) {
+                        RowKey key(oy, bandMap[b] - 1);
+                        Row &row = level.pending[key];
+                        if (row.sum.empty()) {
+                            row.sum.assign(level.xSize, 0);
+                            row.count.assign(level.xSize, 0);
+                        }
+
+                        const double *srcSum = sum.data() + static_cast<size_t>(b)*ow;
+                        const uint32_t *srcCount = count.data() + static_cast<size_t>(b)*ow;
+                        for (size_t x = 0; x < ow; x++) {
+                            row.sum[ox0 + x] += srcSum[x];
+                            row.count[ox0 + x] += srcCount[x];
+                        }
+
+                        row.covered += static_cast<size_t>(y1 - y0)*xSize;
+                        if (row.covered >= expected) {
+                            ready.emplace_back(key.second, std::move(row));
+                            level.pending.erase(key);
+                        }
+                    }
+                }
+
+                for (auto &item : ready) {
+                    ok = completeRow(k, oy, item.first, item.second) && ok;
+                }
+            }
+            return ok;
+        }
+
+        /**
+         * 计算第 k 级第 b 个波段（从 0 开始）的一个概视图行：取整后写到临时文件，取整前的值作为一行数据加入下一级
+         * （全部为 NoData 的像元取 NoData，在下一级中同样被忽略）
+         */
+        bool completeRow(size_t k, int oy, int b, const Row &row) {
+            Level &level = *levels_[k];
+            bool integer = dataType_ != GDT_Float32 && dataType_ != GDT_Float64;
+            std::vector<double> values(row.sum.size());
+            std::vector<double> rounded(row.sum.size());
+            for (size_t i = 0; i < values.size(); i++) {
+                if (row.count[i] == 0) {
+                    values[i] = rounded[i] = noData_[b].first ? noData_[b].second : 0;
+                    continue;
+                }
+                values[i] = row.sum[i] / row.count[i];
+                rounded[i] = integer ? std::floor(values[i] + 0.5) : values[i];
+            }
+
+            int band = b + 1;
+            bool ok = level.tmp && level.tmp->write(0, oy, level.xSize, 1, 1, &band,
+                    Interleave::BSQ, rounded.data());
+            if (k + 1 < levels_.size()) {
+                ok = reduce(k + 1, 0, oy, level.xSize, 1, 1, &band,
+                        Interleave::BSQ, values.data()) && ok;
+            }
+            return ok;
+        }
+
+        // 将一级概视图的临时文件写入各波段对应大小的概视图
+        bool copyLevel(GDALDataset *ds, Level &level) {
+            std::shared_ptr<RawMappedImage> tmp = RawMappedImage::Open(level.file);
+            if (!tmp) return false;
+
+            int rows = std::max(1, (4 << 20) / std::max(1, level.xSize));
+            std::vector<double> buf(static_cast<size_t>(level.xSize)*rows);
+            for (int b = 1; b <= bands_; b++) {
+                GDALRasterBand *band = ds->GetRasterBand(b);
+                GDALRasterBand *ov = nullptr;
+                for (int i = 0; band && i < band->GetOverviewCount(); i++) {
+                    GDALRasterBand *candidate = band->GetOverview(i);
+                    if (candidate && candidate->GetXSize() == level.xSize &&
+                            candidate->GetYSize() == level.ySize) {
+                        ov = candidate;
+                        break;
+                    }
+                }
+                if (ov == nullptr) return false;
+
+                for (int y = 0; y < level.ySize; y += rows) {
+                    int ySize = std::min(rows, level.ySize - y);
+                    if (!tmp->read(0, y, level.xSize, ySize, 1, &b, Interleave::BSQ, buf.data()) ||
+                            ov->RasterIO(GF_Write, 0, y, level.xSize, ySize, buf.data(),
+                                    level.xSize, ySize, GDT_Float64, 0, 0) != CE_None) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        void removeTemp() {
+            for (auto &level : levels_) {
+                level->tmp.reset();
+                std::remove(level->file.c_str());
+                std::remove(EnviHeaderFile(level->file).c_str());
+            }
+        }
+
+    private:
+        int xSize_;
+        int ySize_;
+        int bands_;
+        GDALDataType dataType_;
+        OverviewResampling resampling_;
+        std::vector<std::pair<bool, double>> noData_;
+
+        std::vector<std::unique_ptr<Level>> levels_;
+        bool valid_ = true;
+    };
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_OVERVIEW_H
@@ -0,0 +1,702 @@
+//
+// Created by penglei on 18-10-28.
+//
+// 未压缩 ENVI（raw）文件的内存映射读取：解析 ENVI 头文件，将数据文件映射到内存，
+// 数据块在内存中的组织方式与文件一致时直接返回文件中的地址（零拷贝），否则按步长复制（并转换数据类型），
+// 绕过 GDALDataset::RasterIO 的调用开销、块缓存复制以及数据类型转换
+
+#ifndef IMGPROCESS_RSTOOL_RAWIO_H
+#define IMGPROCESS_RSTOOL_RAWIO_H
+
+#include "rstool_common.h"
+#include "rstool_convert.h"
+#include <string>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace RSTool {
+
+    // ENVI 头文件中与读取数据相关的信息
+    struct EnviHeader {
+        int samples = 0;            // 列数
+        int lines = 0;              // 行数
+        int bands = 0;              // 波段数
+        size_t headerOffset = 0;    // 数据文件中数据的起始位置（字节）
+        GDALDataType dataType = GDT_Unknown;
+        int byteOrder = 0;          // 0 为小端，1 为大端
+        Interleave intl = Interleave::BSQ;
+
+        // 每个元素所占字节数
+        int elemBytes() const { return GDALGetDataTypeSizeBytes(dataType); }
+
+        /**
+         * 解析 ENVI 头文件
+         * @param hdrFile   头文件路径
+         * @param hdr       解析结果
+         * @return          不是 ENVI 头文件或缺少必要的项时返回 false
+         */
+        static bool Read(const std::string &hdrFile, EnviHeader &hdr) {
+            std::ifstream in(hdrFile);
+            std::string line;
+            if (!in || !std::getline(in, line) || line.compare(0, 4, "ENVI") != 0) {
+                return false;
+            }
+
+            int enviType = 0;
+            std::string intl;
+            while (std::getline(in, line)) {
+                size_t eq = line.find('=');
+                if (eq == std::string::npos) continue;
+
+                std::string key = Trim(line.substr(0, eq));
+                std::string value = Trim(line.substr(eq + 1));
+                if (!value.empty() && value[0] == '{') {
+                    // 跨行的值，如 description、band names，跳过直到 '}'
+                    while (value.find('}') == std::string::npos && std::getline(in, line)) {
+                        value += line;
+                    }
+                    continue;
+                }
+
+                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                try {
+                    if (key == "samples") hdr.samples = std::stoi(value);
+                    else if (key == "lines") hdr.lines = std::stoi(value);
+                    else if (key == "bands") hdr.bands = std::stoi(value);
+                    else if (key == "header offset") hdr.headerOffset = std::stoul(value);
+                    else if (key == "data type") enviType = std::stoi(value);
+                    else if (key == "byte order") hdr.byteOrder = std::stoi(value);
+                    else if (key == "interleave") intl = value;
+                } catch (...) {
+                    return false;
+                }
+            }
+
+            switch (enviType) {
+                case 1:  hdr.dataType = GDT_Byte; break;
+                case 2:  hdr.dataType = GDT_Int16; break;
+                case 3:  hdr.dataType = GDT_Int32; break;
+                case 4:  hdr.dataType = GDT_Float32; break;
+                case 5:  hdr.dataType = GDT_Float64; break;
+                case 12: hdr.dataType = GDT_UInt16; break;
+                case 13: hdr.dataType = GDT_UInt32; break;
+                default: return false; // 复数及 64 位整型不支持
+            }
+
+            std::transform(intl.begin(), intl.end(), intl.begin(), ::tolower);
+            if (intl == "bip") hdr.intl = Interleave::BIP;
+            else if (intl == "bil") hdr.intl = Interleave::BIL;
+            else if (intl == "bsq" || intl.empty()) hdr.intl = Interleave::BSQ;
+            else return false;
+
+            return hdr.samples > 0 && hdr.lines > 0 && hdr.bands > 0;
+        }
+
+        /**
+         * 写出 ENVI 头文件
+         * @param hdrFile   头文件路径
+         * @return          数据类型不支持或写入失败时返回 false
+         */
+        bool write(const std::string &hdrFile) const {
+            int enviType = 0;
+            switch (dataType) {
+                case GDT_Byte:    enviType = 1; break;
+                case GDT_Int16:   enviType = 2; break;
+                case GDT_Int32:   enviType = 3; break;
+                case GDT_Float32: enviType = 4; break;
+                case GDT_Float64: enviType = 5; break;
+                case GDT_UInt16:  enviType = 12; break;
+                case GDT_UInt32:  enviType = 13; break;
+                default: return false;
+            }
+
+            const char *intlName = intl == Interleave::BIP ? "bip" : (intl == Interleave::BIL ? "bil" : "bsq");
+            std::ofstream out(hdrFile);
+            out << "ENVI\n"
+                << "samples = " << samples << "\n"
+                << "lines = " << lines << "\n"
+                << "bands = " << bands << "\n"
+                << "header offset = " << headerOffset << "\n"
+                << "file type = ENVI Standard\n"
+                << "data type = " << enviType << "\n"
+                << "interleave = " << intlName << "\n"
+                << "byte order = " << byteOrder << "\n";
+            return static_cast<bool>(out);
+        }
+
+    private:
+        static std::string Trim(const std::string &s) {
+            size_t first = s.find_first_not_of(" \t\r\n");
+            if (first == std::string::npos) return std::string();
+            size_t last = s.find_last_not_of(" \t\r\n");
+            return s.substr(first, last - first + 1);
+        }
+    };
+
+    // 数据文件对应的 ENVI 头文件名：有扩展名时将其替换为 .hdr，否则为 file.hdr（与 GDAL 创建的头文件一致）
+    inline std::string EnviHeaderFile(const std::string &dataFile) {
+        size_t dot = dataFile.find_last_of('.');
+        size_t slash = dataFile.find_last_of('/');
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+            return dataFile.substr(0, dot) + ".hdr";
+        }
+        return dataFile + ".hdr";
+    }
+
+    // 查找数据文件对应的 ENVI 头文件（与 GDAL 的顺序相同：先将扩展名替换为 .hdr，再 file.hdr），找不到时返回空字符串
+    inline std::string FindEnviHeader(const std::string &dataFile) {
+        std::vector<std::string> candidates{EnviHeaderFile(dataFile)};
+        if (candidates[0] != dataFile + ".hdr") candidates.push_back(dataFile + ".hdr");
+
+        for (auto &hdr : candidates) {
+            std::ifstream in(hdr);
+            if (in) return hdr;
+        }
+        return std::string();
+    }
+
+    /**
+     * 从按 srcIntl 方式存放的 srcXSize*srcYSize*srcBands 的数据中按步长复制一个子区域，
+     * 并转换为要求的组织方式（数据类型不同时饱和转换，与 GDAL 一致）
+     * @param bandMap   波段索引（从 1 开始）
+     * @param intl      目标的组织方式
+     * @param dst       目标缓冲区
+     */
+    template <typename S, typename T>
+    inline void CopyRawRegion(const S *src, Interleave srcIntl, int srcXSize, int srcYSize, int srcBands,
+            int xOff, int yOff, int xSize, int ySize, int bandCount, const int *bandMap,
+            Interleave intl, T *dst) {
+        size_t srcStride = srcIntl == Interleave::BIP ? srcBands : 1;
+        size_t dstStride = intl == Interleave::BIP ? bandCount : 1;
+
+        // 源与目标均为 BIP 且包含全部波段时，每行都是一段连续的数据
+        bool allBands = bandCount == srcBands;
+        for (int b = 0; allBands && b < bandCount; b++) {
+            allBands = bandMap[b] == b + 1;
+        }
+        if (std::is_same<S, T>::value && allBands &&
+                srcIntl == Interleave::BIP && intl == Interleave::BIP) {
+            for (int y = 0; y < ySize; y++) {
+                memcpy(dst + static_cast<size_t>(y)*xSize*bandCount,
+                       src + InterleaveOffset(srcIntl, srcXSize, srcYSize, srcBands, xOff, yOff + y, 0),
+                       sizeof(T)*xSize*bandCount);
+            }
+            return;
+        }
+
+        // 数据类型相同、波段连续且只有一方为 BIP 时，每行为一次矩阵转置（波段 x 像素 <-> 像素 x 波段）
+        bool consecutive = true;
+        for (int b = 1; consecutive && b < bandCount; b++) {
+            consecutive = bandMap[b] == bandMap[0] + b;
+        }
+        if (std::is_same<S, T>::value && consecutive &&
+                (srcIntl == Interleave::BIP) != (intl == Interleave::BIP)) {
+            size_t srcBandStride = srcIntl == Interleave::BSQ ? static_cast<size_t>(srcXSize)*srcYSize : srcXSize;
+            size_t dstBandStride = intl == Interleave::BSQ ? static_cast<size_t>(xSize)*ySize : xSize;
+            for (int y = 0; y < ySize; y++) {
+                const T *s = reinterpret_cast<const T*>(src) + InterleaveOffset(srcIntl, srcXSize, srcYSize, srcBands,
+                        xOff, yOff + y, bandMap[0] - 1);
+                T *d = dst + InterleaveOffset(intl, xSize, ySize, bandCount, 0, y, 0);
+                if (intl == Interleave::BIP) {
+                    Transpose(s, srcBandStride, d, bandCount, bandCount, xSize);
+                } else {
+                    Transpose(s, srcBands, d, dstBandStride, xSize, bandCount);
+                }
+            }
+            return;
+        }
+
+        // 目标为像素分组（BIP-N）时，每组内同一波段的像素连续，按行内不跨组的一段转换
+        const int tile = PixelTileWidth(intl);
+        if (tile > 0) {
+            for (int y = 0; y < ySize; y++) {
+                for (int b = 0; b < bandCount; b++) {
+                    const S *s = src + InterleaveOffset(srcIntl, srcXSize, srcYSize, srcBands,
+                            xOff, yOff + y, bandMap[b] - 1);
+                    for (int x = 0; x < xSize; ) {
+                        const size_t p = static_cast<size_t>(y)*xSize + x;
+                        const int len = std::min(static_cast<int>(tile - p%tile), xSize - x);
+                        T *d = dst + InterleaveOffset(intl, xSize, ySize, bandCount, x, y, b);
+                        if (srcStride == 1) {
+                            ConvertSaturate(s + x, d, len);
+                        } else {
+                            for (int k = 0; k < len; k++) {
+                                d[k] = SaturateCast<T>(s[(x + k)*srcStride]);
+                            }
+                        }
+                        x += len;
+                    }
+                }
+            }
+
+            // 最后一组的补齐部分置 0
+            const size_t pixels = static_cast<size_t>(xSize)*ySize;
+            const size_t rest = pixels % tile;
+            if (rest != 0) {
+                T *last = dst + (pixels/tile)*tile*bandCount;
+                for (int b = 0; b < bandCount; b++) {
+                    memset(last + static_cast<size_t>(b)*tile + rest, 0, sizeof(T)*(tile - rest));
+                }
+            }
+            return;
+        }
+
+        // 逐行、逐波段复制
+        for (int y = 0; y < ySize; y++) {
+            for (int b = 0; b < bandCount; b++) {
+                const S *s = src + InterleaveOffset(srcIntl, srcXSize, srcYSize, srcBands,
+                        xOff, yOff + y, bandMap[b] - 1);
+                T *d = dst + InterleaveOffset(intl, xSize, ySize, bandCount, 0, y, b);
+
+                if (srcStride == 1 && dstStride == 1) {
+                    ConvertSaturate(s, d, xSize);
+                } else {
+                    for (int x = 0; x < xSize; x++) {
+                        d[x*dstStride] = SaturateCast<T>(s[x*srcStride]);
+                    }
+                }
+            }
+        }
+    }
+
+    // 源数据类型由 srcType 指定，其余同上；波段索引越界或数据类型不支持时返回 false
+    template <typename T>
+    inline bool CopyRawRegion(GDALDataType srcType, const void *src,
+            Interleave srcIntl, int srcXSize, int srcYSize, int srcBands,
+            int xOff, int yOff, int xSize, int ySize, int bandCount, const int *bandMap,
+            Interleave intl, T *dst) {
+        for (int b = 0; b < bandCount; b++) {
+            if (bandMap[b] < 1 || bandMap[b] > srcBands) return false;
+        }
+
+#define RSTOOL_COPY_RAW(S) CopyRawRegion(static_cast<const S*>(src), srcIntl, srcXSize, srcYSize, srcBands, \
+            xOff, yOff, xSize, ySize, bandCount, bandMap, intl, dst)
+        switch (srcType) {
+            case GDT_Byte:    RSTOOL_COPY_RAW(unsigned char); break;
+            case GDT_Int16:   RSTOOL_COPY_RAW(short); break;
+            case GDT_UInt16:  RSTOOL_COPY_RAW(unsigned short); break;
+            case GDT_Int32:   RSTOOL_COPY_RAW(int); break;
+            case GDT_UInt32:  RSTOOL_COPY_RAW(unsigned int); break;
+            case GDT_Float32: RSTOOL_COPY_RAW(float); break;
+            case GDT_Float64: RSTOOL_COPY_RAW(double); break;
+            default: return false;
+        }
+#undef RSTOOL_COPY_RAW
+        return true;
+    }
+
+    /**
+     * 内存映射的 ENVI 数据文件（只读，多线程共享）。
+     * 以只读方式映射（不计入提交内存，大文件在启发式 overcommit 下也能映射成功），
+     * 零拷贝的数据块为只读视图，需要修改时由 DataChunk 复制为自己的内存
+     */
+    class RawMappedImage {
+    public:
+        /**
+         * 映射 ENVI 数据文件
+         * @param dataFile  数据文件路径
+         * @return          不是未压缩的 ENVI 文件、字节序与本机不同或映射失败时返回空指针
+         */
+        static std::shared_ptr<RawMappedImage> Open(const std::string &dataFile) {
+#if defined(__linux__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            std::string hdrFile = FindEnviHeader(dataFile);
+            EnviHeader hdr;
+            if (hdrFile.empty() || !EnviHeader::Read(hdrFile, hdr) || hdr.byteOrder != 0) {
+                return nullptr;
+            }
+
+            int fd = open(dataFile.c_str(), O_RDONLY);
+            if (fd < 0) return nullptr;
+
+            struct stat st;
+            size_t dataBytes = static_cast<size_t>(hdr.samples)*hdr.lines*hdr.bands*hdr.elemBytes();
+            if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < hdr.headerOffset + dataBytes) {
+                close(fd);
+                return nullptr;
+            }
+
+            size_t length = static_cast<size_t>(st.st_size);
+            void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                close(fd);
+                return nullptr;
+            }
+
+            return std::shared_ptr<RawMappedImage>(new RawMappedImage(hdr, fd, addr, length));
+#else
+            return nullptr;
+#endif
+        }
+
+        /**
+         * 映射数据集对应的 ENVI 数据文件，并检查其尺寸与数据集一致
+         * @param dataset   已打开的数据集
+         */
+        static std::shared_ptr<RawMappedImage> Open(GDALDataset *dataset) {
+            if (dataset == nullptr || dataset->GetDescription() == nullptr) return nullptr;
+
+            auto raw = Open(std::string(dataset->GetDescription()));
+            if (raw && (raw->hdr_.samples != dataset->GetRasterXSize() ||
+                        raw->hdr_.lines != dataset->GetRasterYSize() ||
+                        raw->hdr_.bands != dataset->GetRasterCount())) {
+                return nullptr;
+            }
+            return raw;
+        }
+
+        ~RawMappedImage() {
+#ifdef __linux__
+            munmap(addr_, length_);
+            close(fd_);
+#endif
+        }
+
+        RawMappedImage(const RawMappedImage &) = delete;
+        RawMappedImage& operator= (const RawMappedImage &) = delete;
+
+        const EnviHeader& header() const { return hdr_; }
+
+        /**
+         * 若请求的数据块在文件中是一段连续的数据，且数据类型、组织方式均与文件一致，
+         * 则直接返回其在映射内存中的地址（零拷贝）
+         * @param bandCount 波段数
+         * @param bandMap   波段索引（从 1 开始）
+         * @param intl      要求的组织方式
+         * @return          不满足条件时返回空指针，映射内存只读
+         */
+        template <typename T>
+        const T* view(int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, Interleave intl) const {
+            if (toGDALDataType<T>() != hdr_.dataType || intl != hdr_.intl) return nullptr;
+
+            // 波段必须连续且递增
+            for (int i = 1; i < bandCount; i++) {
+                if (bandMap[i] != bandMap[0] + i) return nullptr;
+            }
+
+            bool fullWidth = xOff == 0 && xSize == hdr_.samples;
+            bool contiguous = false;
+            switch (intl) {
+                case Interleave::BIP :
+                    contiguous = bandCount == hdr_.bands && (fullWidth || ySize == 1);
+                    break;
+                case Interleave::BIL :
+                    contiguous = (fullWidth || (bandCount == 1 && ySize == 1)) &&
+                                 (bandCount == hdr_.bands || ySize == 1);
+                    break;
+                case Interleave::BSQ :
+                    contiguous = (fullWidth || ySize == 1) &&
+                                 (bandCount == 1 || (yOff == 0 && ySize == hdr_.lines));
+                    break;
+                default :
+                    break;
+            }
+            if (!contiguous) return nullptr;
+
+            const unsigned char *p = data() + offset(xOff, yOff, bandMap[0] - 1)*sizeof(T);
+            if (reinterpret_cast<uintptr_t>(p) % alignof(T) != 0) return nullptr;
+            return reinterpret_cast<const T*>(p);
+        }
+
+        /**
+         * 按步长从映射内存中复制一个数据块，并转换为要求的数据类型及组织方式
+         * @param bandCount 波段数
+         * @param bandMap   波段索引（从 1 开始）
+         * @param intl      要求的组织方式
+         * @param dst       目标缓冲区
+         */
+        template <typename T>
+        bool read(int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, Interleave intl, T *dst) const {
+            if (xOff < 0 || yOff < 0 || xOff + xSize > hdr_.samples || yOff + ySize > hdr_.lines) {
+                return false;
+            }
+            return CopyRawRegion(hdr_.dataType, data(), hdr_.intl, hdr_.samples, hdr_.lines, hdr_.bands,
+                    xOff, yOff, xSize, ySize, bandCount, bandMap, intl, dst);
+        }
+
+    private:
+        RawMappedImage(const EnviHeader &hdr, int fd, void *addr, size_t length)
+                : hdr_(hdr), fd_(fd), addr_(addr), length_(length) {
+#ifdef __linux__
+            madvise(addr_, length_, MADV_SEQUENTIAL);
+#endif
+        }
+
+        const unsigned char* data() const {
+            return static_cast<const unsigned char*>(addr_) + hdr_.headerOffset;
+        }
+
+        // 像素 (x, y) 第 b 个波段（从 0 开始）在文件中的偏移量（元素个数）
+        size_t offset(int x, int y, int b) const {
+            return InterleaveOffset(hdr_.intl, hdr_.samples, hdr_.lines, hdr_.bands, x, y, b);
+        }
+
+    private:
+        EnviHeader hdr_;
+        int fd_;
+        void *addr_;
+        size_t length_;
+    };
+
+    // 读取分块数据（内存映射方式），与 ReadDataChunk 的用法一致
+    template <typename T>
+    class RawReadDataChunk {
+    public:
+        RawReadDataChunk(std::shared_ptr<RawMappedImage> raw, const SpectralDimes &specDims,
+                Interleave intl = Interleave::BIP)
+                : raw_(std::move(raw)), specDims_(specDims), intl_(intl) {}
+
+        bool operator() (int xOff, int yOff, int xSize, int ySize, T *data) {
+            return raw_->read(xOff, yOff, xSize, ySize,
+                    specDims_.bandCount(), specDims_.bandMap(), intl_, data);
+        }
+
+        // 零拷贝地址（只读），不满足条件时返回空指针
+        const T* view(int xOff, int yOff, int xSize, int ySize) {
+            return raw_->view<T>(xOff, yOff, xSize, ySize,
+                    specDims_.bandCount(), specDims_.bandMap(), intl_);
+        }
+
+    private:
+        std::shared_ptr<RawMappedImage> raw_;
+        SpectralDimes specDims_;
+        Interleave intl_;
+    };
+
+    /**
+     * ENVI 文件的并行写出：文件布局在打开时即已确定，每个数据块的每一行（每个波段）在文件中的位置
+     * 都可以直接算出，任意线程均可用 pwrite 将数据块写到最终位置，无需加锁，也无需按顺序写出
+     */
+    class RawWriter {
+    public:
+        /**
+         * 创建 ENVI 文件：写出头文件（只写一次）并预分配数据文件
+         * @param dataFile  数据文件路径，头文件见 EnviHeaderFile()
+         * @return          失败时返回空指针
+         */
+        static std::shared_ptr<RawWriter> Create(const std::string &dataFile,
+                int samples, int lines, int bands, GDALDataType dataType,
+                Interleave intl = Interleave::BSQ) {
+            EnviHeader hdr;
+            hdr.samples = samples;
+            hdr.lines = lines;
+            hdr.bands = bands;
+            hdr.dataType = dataType;
+            hdr.intl = intl;
+            if (!hdr.write(EnviHeaderFile(dataFile))) return nullptr;
+            return Open(dataFile, hdr, true);
+        }
+
+        /**
+         * 打开已存在的 ENVI 文件（如已由 GDAL 创建），不修改头文件
+         * @return  不是本机字节序的 ENVI 文件或打开失败时返回空指针
+         */
+        static std::shared_ptr<RawWriter> Open(const std::string &dataFile) {
+            std::string hdrFile = FindEnviHeader(dataFile);
+            EnviHeader hdr;
+            if (hdrFile.empty() || !EnviHeader::Read(hdrFile, hdr)) return nullptr;
+            return Open(dataFile, hdr, false);
+        }
+
+        ~RawWriter() {
+#ifdef __linux__
+            close(fd_);
+#endif
+        }
+
+        RawWriter(const RawWriter &) = delete;
+        RawWriter& operator= (const RawWriter &) = delete;
+
+        const EnviHeader& header() const { return hdr_; }
+
+        /**
+         * 写出一个数据块（可在多个线程中同时调用）
+         * @param bandMap   波段索引（从 1 开始）
+         * @param intl      数据在内存中的组织方式
+         * @param stride    BIP 数据中相邻两个像素的间隔（见 DataChunk::stride()），0 表示等于波段数
+         * @return          越界或写入失败时返回 false
+         */
+        template <typename T>
+        bool write(int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, Interleave intl, const T *data, int stride = 0) {
+            if (xOff < 0 || yOff < 0 || xOff + xSize > hdr_.samples || yOff + ySize > hdr_.lines) {
+                return false;
+            }
+            for (int b = 0; b < bandCount; b++) {
+                if (bandMap[b] < 1 || bandMap[b] > hdr_.bands) return false;
+            }
+
+            // 像素分组（BIP-N）及光谱补齐的数据先转换为紧凑的 BIP
+            data = UntilePixels(data, intl, xSize, ySize, bandCount, stride);
+
+            // 转换为文件的数据类型及组织方式（二者均一致时直接写出）
+            const unsigned char *src = reinterpret_cast<const unsigned char*>(data);
+            if (toGDALDataType<T>() != hdr_.dataType || intl != hdr_.intl) {
+                static thread_local std::vector<unsigned char> staging;
+                staging.resize(static_cast<size_t>(xSize)*ySize*bandCount*hdr_.elemBytes());
+                if (!convert(data, intl, xSize, ySize, bandCount, staging.data())) return false;
+                src = staging.data();
+            }
+
+            return writeSegments(xOff, yOff, xSize, ySize, bandCount, bandMap, src);
+        }
+
+        template <typename T>
+        bool write(DataChunk<T> &data) {
+            DataDims &dims = data.dims();
+            return write(dims.xOff(), dims.yOff(), dims.xSize(), dims.ySize(),
+                    dims.bandCount(), dims.bandMap(), data.interleave(), data.data(), data.stride());
+        }
+
+    private:
+        static std::shared_ptr<RawWriter> Open(const std::string &dataFile, const EnviHeader &hdr, bool create) {
+#if defined(__linux__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (hdr.byteOrder != 0) return nullptr;
+
+            int fd = open(dataFile.c_str(), O_WRONLY | (create ? O_CREAT | O_TRUNC : 0), 0644);
+            if (fd < 0) return nullptr;
+
+            // 预分配整个文件，避免并行写出时文件系统反复扩展文件
+            off_t bytes = static_cast<off_t>(hdr.headerOffset +
+                    static_cast<size_t>(hdr.samples)*hdr.lines*hdr.bands*hdr.elemBytes());
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (st.st_size < bytes &&
+                    fallocate(fd, 0, 0, bytes) != 0 && ftruncate(fd, bytes) != 0)) {
+                close(fd);
+                return nullptr;
+            }
+
+            return std::shared_ptr<RawWriter>(new RawWriter(hdr, fd));
+#else
+            (void)dataFile;
+            (void)hdr;
+            (void)create;
+            return nullptr;
+#endif
+        }
+
+        RawWriter(const EnviHeader &hdr, int fd) : hdr_(hdr), fd_(fd) {}
+
+        template <typename T>
+        bool convert(const T *data, Interleave intl, int xSize, int ySize, int bandCount, unsigned char *dst) {
+            std::vector<int> bandMap(bandCount);
+            for (int b = 0; b < bandCount; b++) bandMap[b] = b + 1;
+
+#define RSTOOL_CONVERT_RAW(S) CopyRawRegion(data, intl, xSize, ySize, bandCount, \
+            0, 0, xSize, ySize, bandCount, bandMap.data(), hdr_.intl, reinterpret_cast<S*>(dst))
+            switch (hdr_.dataType) {
+                case GDT_Byte:    RSTOOL_CONVERT_RAW(unsigned char); break;
+                case GDT_Int16:   RSTOOL_CONVERT_RAW(short); break;
+                case GDT_UInt16:  RSTOOL_CONVERT_RAW(unsigned short); break;
+                case GDT_Int32:   RSTOOL_CONVERT_RAW(int); break;
+                case GDT_UInt32:  RSTOOL_CONVERT_RAW(unsigned int); break;
+                case GDT_Float32: RSTOOL_CONVERT_RAW(float); break;
+                case GDT_Float64: RSTOOL_CONVERT_RAW(double); break;
+                default: return false;
+            }
+#undef RSTOOL_CONVERT_RAW
+            return true;
+        }
+
+        /**
+         * 将按文件组织方式存放的数据块写到文件中的对应位置，
+         * 文件中及内存中均相邻的数据段合并为一次写出（如整行的数据块）
+         */
+        bool writeSegments(int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, const unsigned char *src) {
+            size_t elem = hdr_.elemBytes();
+
+            // BIP 文件只有包含全部波段的数据块才能整行写出，否则逐个元素写出
+            bool allBands = bandCount == hdr_.bands;
+            for (int b = 0; allBands && b < bandCount; b++) {
+                allBands = bandMap[b] == b + 1;
+            }
+            bool pixelWise = hdr_.intl == Interleave::BIP && !allBands;
+
+            const unsigned char *segSrc = nullptr;
+            off_t segOff = 0;
+            size_t segLen = 0;
+            auto emit = [&](const unsigned char *p, off_t off, size_t len) {
+                if (segLen > 0 && off == segOff + static_cast<off_t>(segLen) && p == segSrc + segLen) {
+                    segLen += len;
+                    return true;
+                }
+                bool ok = flush(segSrc, segOff, segLen);
+                segSrc = p;
+                segOff = off;
+                segLen = len;
+                return ok;
+            };
+
+            // 按内存中的顺序遍历各个数据段
+            int outer = hdr_.intl == Interleave::BSQ ? bandCount : ySize;
+            int inner = hdr_.intl == Interleave::BSQ ? ySize : (hdr_.intl == Interleave::BIL ? bandCount : 1);
+            for (int i = 0; i < outer; i++) {
+                for (int j = 0; j < inner; j++) {
+                    int y = hdr_.intl == Interleave::BSQ ? j : i;
+                    int b = hdr_.intl == Interleave::BSQ ? i : j;
+                    size_t fileElem = InterleaveOffset(hdr_.intl, hdr_.samples, hdr_.lines, hdr_.bands,
+                            xOff, yOff + y, bandMap[b] - 1);
+                    const unsigned char *p = src + InterleaveOffset(hdr_.intl, xSize, ySize, bandCount, 0, y, b)*elem;
+                    off_t off = static_cast<off_t>(hdr_.headerOffset + fileElem*elem);
+
+                    if (!pixelWise) {
+                        size_t len = static_cast<size_t>(xSize)*elem*(hdr_.intl == Interleave::BIP ? bandCount : 1);
+                        if (!emit(p, off, len)) return false;
+                        continue;
+                    }
+
+                    for (int x = 0; x < xSize; x++) {
+                        for (int k = 0; k < bandCount; k++) {
+                            size_t e = InterleaveOffset(hdr_.intl, hdr_.samples, hdr_.lines, hdr_.bands,
+                                    xOff + x, yOff + y, bandMap[k] - 1);
+                            if (!emit(p + (static_cast<size_t>(x)*bandCount + k)*elem,
+                                    static_cast<off_t>(hdr_.headerOffset + e*elem), elem)) {
+                                return false;
+                            }
+                        }
+                    }
+                }
+            }
+            return flush(segSrc, segOff, segLen);
+        }
+
+        // 写出一段数据，处理被信号中断等写入不完整的情况
+        bool flush(const unsigned char *p, off_t off, size_t len) {
+#ifdef __linux__
+            while (len > 0) {
+                ssize_t n = pwrite(fd_, p, len, off);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                p += n;
+                off += n;
+                len -= static_cast<size_t>(n);
+            }
+            return true;
+#else
+            return len == 0;
+#endif
+        }
+
+    private:
+        EnviHeader hdr_;
+        int fd_;
+    };
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_RAWIO_H
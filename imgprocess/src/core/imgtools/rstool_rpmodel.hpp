@@ -7,11 +7,19 @@
 #define IMGPROCESS_RSTOOL_RPMODEL_HPP
 
 #include "rstool_threadpool.h"
+#include "rstool_gridplan.h"
 
 namespace RSTool {
 
     namespace Mp {
 
+        // 读数据与处理数据的执行方式
+        enum class ExecMode : char {
+            Queued, /* 读线程读取数据块后放入读缓冲队列，由消费者线程取出处理，适用于计算量大的算法 */
+            Fused   /* 每个工作线程用自己的数据集句柄读取数据块后立即处理，无队列交接，
+                       数据仍在本核的缓存中，适用于波段运算、类型转换、简单统计等计算量小的算法 */
+        };
+
         template <typename InDataType>
         class MpRPModel {
         public:
@@ -21,27 +29,86 @@ namespace RSTool {
              * @param infile            输入待处理的文件
              * @param specDims          指定待处理的光谱范围
              * @param intl              指定在内存中以何种方式组织数据
-             * @param blkSize           指定分块大小，默认 128
-             * @param readThreadsCount  指定并行读取文件时的线程个数，默认 1
+             * @param blkSize           指定分块大小，默认 128，实际分块按影像的原生块（瓦片或条带）对齐，
+             *                          数据块占用的内存与 blkSize*blkSize 的方形块相当；
+             *                          为 0 时数据块大小为 DEFAULT_CHUNK_BYTES
+             * @param readThreadsCount  指定并行读取文件时的线程个数，默认 0，
+             *                          表示在运行时根据读取速度自动确定（上限为 DefaultMaxReadThreads()）
              */
             MpRPModel(const std::string &infile, const SpectralDimes &specDims,
                     Interleave intl = Interleave::BIP, int blkSize = 128,
-                    int readThreadsCount = 1)
+                    int readThreadsCount = 0)
 
                     : infile_(infile), specDims_(specDims), intl_(intl),
-                    blkSize_(blkSize), readThreadsCount_(readThreadsCount),
-                    mpRead_(infile, specDims, intl, readThreadsCount) {
+                    blkSize_(blkSize), autoReadThreads_(readThreadsCount <= 0),
+                    readThreadsCount_(autoReadThreads_ ? DefaultMaxReadThreads() : readThreadsCount) {
 
                 assignWorkload();
 
-                // TODO 读缓冲区队列Size的确定
-                // 以 2倍 的消费者线程数为缓冲区队列大小
-                mpRead_.readQueueMaxSize_ = 2*consumerCount_;
+                // 以 2倍 的消费者线程数为缓冲区队列的初始大小，运行时再自动调整
+                readQueueMaxSize_ = 2*consumerCount_;
+            }
+
+            // 指定读缓冲区队列大小（同时关闭对队列大小的自动调整）
+            void setReadQueueMaxSize(int value) {
+                readQueueMaxSize_ = value;
+                fixedQueueSize_ = true;
             }
 
-            void setReadQueueMaxSize(int value) { mpRead_.readQueueMaxSize_ = value; }
+            /**
+             * 是否在运行时根据读线程和消费者线程的等待时间，自动调整激活的读线程数、
+             * 消费者线程数以及读缓冲队列大小，默认开启
+             */
+            void setAutoTune(bool on) { autoTune_ = on; }
+
+            // 读缓冲队列占用内存的上限（字节），用于限制自动调整时队列的最大大小，默认 1GB
+            void setQueueMemoryBudget(size_t bytes) { queueMemoryBudget_ = bytes; }
+
+            /**
+             * 读线程和消费者线程的绑定策略，默认按 NUMA 节点成对绑定，
+             * 消费者线程优先处理同一节点上的读线程读取的数据块；单节点机器上不生效
+             */
+            void setAffinityPolicy(AffinityPolicy policy) { affinity_ = policy; }
+
+            /**
+             * 读数据与处理数据的执行方式，默认为 Queued。
+             * 注意：Fused 方式下每个工作线程复用同一个数据块，入口函数中不要移走该数据块的数据
+             */
+            void setExecMode(ExecMode mode) { execMode_ = mode; }
+
+            /**
+             * 输入为未压缩的 ENVI 文件时，是否使用内存映射方式读取，默认使用。
+             * 数据块在文件中连续存放时，入口函数得到的数据块直接指向映射内存（写时复制，不会修改文件）
+             */
+            void setRawIO(bool enable) { rawIO_ = enable; }
+
+            /**
+             * 输入为未压缩的 ENVI 文件时，是否使用 io_uring 异步读取（Queued 方式），默认不使用，
+             * 适合 SSD 上的大文件；不支持 io_uring 时仍使用多个读线程读取
+             * @param depth     同时读取的数据块个数
+             * @param direct    是否使用 O_DIRECT 读取，不经过页缓存
+             */
+            void setAsyncIO(bool enable, int depth = 16, bool direct = false) {
+                asyncIO_ = enable;
+                asyncDepth_ = depth;
+                directIO_ = direct;
+            }
+
+            /**
+             * 输入为 BSQ 文件且数据块为整行时（Queued 方式），每个读线程一次按波段读取若干个相邻数据块的大小（字节），
+             * 使每个波段的读取为一段连续的数据，默认为 BSQ_PASS_BYTES，为 0 时逐块读取
+             */
+            void setBandMajorPass(size_t bytes) { passBytes_ = bytes; }
+
+            /**
+             * 输入数据块的内存分配策略，默认按缓存行对齐、大块内存使用透明大页、不补齐光谱。
+             * 开启光谱补齐（policy.padSpectra）时，入口函数须按 DataChunk::stride() 访问每个像素的光谱
+             * （零拷贝的映射数据块不补齐，其 stride() 等于波段数）
+             */
+            void setAllocPolicy(const AllocPolicy &policy) { policy_ = policy; }
 
         public:
+            // 消费者线程数量（上限），需为每个消费者线程指定一个入口函数
             int consumerCount() const { return consumerCount_; }
 
             // 为每个消费者线程指定入口函数（因为每个线程所需要的参数可能不一样）
@@ -52,17 +119,90 @@ namespace RSTool {
                         std::forward<Args>(args)...));
             }
 
+            virtual ~MpRPModel() = default;
+
             // 启动所有消费者线程，会阻塞调用者线程，直到所有消费者线程处理完成
-            void run() {
+            virtual void run() {
+                remainingBlocks_ = static_cast<int>(blocks_.size());
+
+                if (execMode_ == ExecMode::Fused) {
+                    runFused();
+                    return;
+                }
+
+                createReader();
+                MpGDALRead<InDataType> &mpRead = *mpRead_;
+
+                int queueInit = static_cast<int>(readQueueMaxSize_);
+                int queueMax = queueInit;
+                if (autoTune_ && !fixedQueueSize_) {
+                    // 队列最大大小受内存上限约束
+                    size_t chunkBytes = sizeof(InDataType)*chunkXSize_*chunkYSize_*specDims_.bandCount();
+                    int budgetItems = static_cast<int>(queueMemoryBudget_ / std::max<size_t>(chunkBytes, 1));
+                    queueMax = std::max(queueInit, std::min(8*consumerCount_, budgetItems));
+                }
+
+                int readersMin = (autoTune_ && autoReadThreads_) ? 1 : readThreadsCount_;
+                int consumersMin = autoTune_ ? 1 : consumerCount_;
+                tuner_.reset(new AutoTuner(
+                        TuneRange(readersMin, readThreadsCount_, readersMin),
+                        TuneRange(consumersMin, consumerCount_, consumerCount_),
+                        TuneRange(2, queueMax, queueInit)));
+
+                mpRead.start(tuner_.get(), affinity_);
+                if (autoTune_) {
+                    tuner_->start([&mpRead] {
+                        std::unique_lock<std::mutex> lk(mpRead.mutexReadQueue_);
+                        return static_cast<int>(mpRead.readQueue_.size());
+                    }, [&mpRead] (int value) {
+                        {
+                            std::unique_lock<std::mutex> lk(mpRead.mutexReadQueue_);
+                            mpRead.readQueueMaxSize_ = static_cast<size_t>(value);
+                        }
+                        mpRead.condReadQueueNotFull_.notify_all();
+                    });
+                }
+
+                // 消费者线程由共享执行器提供
                 for (int i = 0; i < consumerCount_; i++) {
-                    consumerThreads_.emplace_back(std::thread(&MpRPModel<InDataType>::consumerTask,
-                            this, consumerTasks_[i], tasks_[i]));
+                    consumerThreads_.emplace_back(Executor::instance().submit([this, i] {
+                        consumerTask(std::function<void(DataChunk<InDataType> &)>(consumerTasks_[i]), i);
+                    }));
                 }
 
-                // TODO 如果不需要和主线程进行同步，是否可以分离线程？？？
+                // 等待所有消费者线程完成，并将消费者线程中抛出的异常传递给调用者
+                std::exception_ptr error;
                 for (auto &consumer : consumerThreads_) {
-                    consumer.join();
+                    try {
+                        consumer.get();
+                    } catch (...) {
+                        if (!error) error = std::current_exception();
+                    }
+                }
+                consumerThreads_.clear();
+
+                tuner_->stop();
+
+                // 读线程可能仍在访问调优器，等待其退出后调优器才能被释放；
+                // 消费者线程没有出错时，传递读线程中抛出的异常
+                try {
+                    mpRead.wait();
+                } catch (...) {
+                    if (!error) error = std::current_exception();
                 }
+
+                // 归还读句柄，供后续作业复用
+                mpRead_.reset();
+                if (error) std::rethrow_exception(error);
+            }
+
+            /**
+             * 在共享执行器上异步运行，不阻塞调用者线程，可同时运行多个作业，
+             * 所有作业共享同一组线程及计算槽（总的计算并行度不超过 CPU 核数）
+             * @return  作业完成（或抛出异常）时就绪的 future，本对象需在其就绪前保持有效
+             */
+            std::future<void> runAsync() {
+                return Executor::instance().submit([this] { run(); });
             }
 
         protected:
@@ -71,93 +211,206 @@ namespace RSTool {
             void assignWorkload() {
                 GDALAllRegister();
 
-                GDALDataset *ds = (GDALDataset*)GDALOpen(infile_.c_str(), GA_ReadOnly);
-                if (ds == nullptr) {
+                DatasetLease ds = DatasetPool::instance().acquire(infile_);
+                if (!ds) {
                     throw std::runtime_error("GDALDataset open faild.");
                 }
 
-                int imgXSize = ds->GetRasterXSize();
-                int imgYSize = ds->GetRasterYSize();
-                int imgBandCount = ds->GetRasterCount();
-
-                int xNUms = (imgXSize + blkSize_ - 1) / blkSize_;
-                int yNUms = (imgYSize + blkSize_ - 1) / blkSize_;
-                int blkNums = xNUms*yNUms;
-
-                consumerCount_ = GetOptimalNumThreads(blkNums);
-
-                // 分割文件(以方形块为单位)
-                std::vector<SpatialDims> spatDims;
-                for (int i = 0; i < imgYSize; i += blkSize_) {
-                    int yBlockSize = blkSize_;
-                    if (i + blkSize_ > imgYSize) // 最下面的剩余块
-                        yBlockSize = imgYSize - i;
-
-                    for (int j = 0; j < imgXSize; j += blkSize_) {
-                        int xBlockSize = blkSize_;
-                        if (j + blkSize_ > imgXSize) // 最右侧的剩余块
-                            xBlockSize = imgXSize - j;
-
-                        spatDims.emplace_back(SpatialDims(j, i, xBlockSize, yBlockSize));
-                    } // end row
-                } // end col
-
-                // 为每个读数据线程分配工作量
-                int perThreadYBlkNums = yNUms / readThreadsCount_;
-                int leftYNums = yNUms % readThreadsCount_;
-                int size = perThreadYBlkNums*xNUms; // 每一个线程需处理的任务量（块数）
-                for (int i = 0; i < size; i++) {
-                    for (int j = 0; j < readThreadsCount_; j++) {
-                        mpRead_.enqueue(j, spatDims[j*size+i]);
+                // 按原生块布局分割文件，按文件顺序排列
+                size_t pixelBytes = sizeof(InDataType)*specDims_.bandCount();
+                GridPlan plan = PlanChunkGrid(ds.get(), pixelBytes, TargetChunkBytes(blkSize_, pixelBytes));
+                chunkXSize_ = plan.xChunkSize();
+                chunkYSize_ = plan.yChunkSize();
+                blocks_ = plan.chunks();
+
+                // 每个读句柄的块缓存需求：一个数据块在文件中所占的大小
+                GDALRasterBand *band = ds->GetRasterBand(1);
+                int fileTypeBytes = band ? GDALGetDataTypeSizeBytes(band->GetRasterDataType()) : sizeof(InDataType);
+                chunkCacheBytes_ = static_cast<size_t>(chunkXSize_)*chunkYSize_*specDims_.bandCount()*fileTypeBytes;
+
+                consumerCount_ = GetOptimalNumThreads(static_cast<int>(blocks_.size()));
+            } // end assignWorkload()
+
+            /**
+             * Queued 方式：创建读线程所用的句柄及读缓冲队列（Fused 方式不需要，
+             * 不占用句柄池中的句柄及 GDAL 块缓存），各读线程按文件顺序依次领取数据块，
+             * 消费者线程依次领取读好的数据块
+             */
+            void createReader() {
+                mpRead_.reset(new MpGDALRead<InDataType>(infile_, specDims_, intl_, readThreadsCount_));
+                mpRead_->readQueueMaxSize_ = readQueueMaxSize_;
+                mpRead_->setCacheBudget(chunkCacheBytes_);
+                mpRead_->setRawIO(rawIO_);
+                mpRead_->setAsyncIO(asyncIO_, asyncDepth_, directIO_);
+                mpRead_->setBandMajorPass(passBytes_);
+                mpRead_->setAllocPolicy(policy_);
+                mpRead_->assign(blocks_);
+            }
+
+            // 领取一个待处理的数据块，所有数据块均已被领取时返回 false
+            bool claimBlock() {
+                return remainingBlocks_.fetch_sub(1) > 0;
+            }
+
+            // 同上，index 为领取的数据块在 blocks_ 中的索引（按文件顺序领取）
+            bool claimBlock(int &index) {
+                int remaining = remainingBlocks_.fetch_sub(1);
+                index = static_cast<int>(blocks_.size()) - remaining;
+                return remaining > 0;
+            }
+
+            // 以 Fused 方式运行：不启动读线程，每个工作线程自己读取并处理数据块
+            void runFused() {
+                // 未压缩的 ENVI 文件由所有工作线程共享同一个内存映射
+                fusedRaw_.reset();
+                if (rawIO_) {
+                    DatasetLease ds = DatasetPool::instance().acquire(infile_);
+                    if (ds) fusedRaw_ = RawMappedImage::Open(ds.get());
+                }
+
+                for (int i = 0; i < consumerCount_; i++) {
+                    consumerThreads_.emplace_back(Executor::instance().submit([this, i] {
+                        fusedTask(std::function<void(DataChunk<InDataType> &)>(consumerTasks_[i]), i);
+                    }));
+                }
+
+                std::exception_ptr error;
+                for (auto &consumer : consumerThreads_) {
+                    try {
+                        consumer.get();
+                    } catch (...) {
+                        if (!error) error = std::current_exception();
                     }
                 }
+                consumerThreads_.clear();
+                fusedRaw_.reset();
 
-                // 将剩余的数据块交给最后一个读线程处理
-                int leftNums = leftYNums*xNUms;
-                for (int i = 0; i < leftNums; i++) {
-                    mpRead_.enqueue(readThreadsCount_-1,
-                            spatDims[readThreadsCount_*size+i]);
+                if (error) std::rethrow_exception(error);
+            }
+
+            /**
+             * Fused 方式的工作线程
+             * @param funcCore  每个工作线程的入口函数
+             * @param index     工作线程的编号
+             */
+            void fusedTask(std::function<void(DataChunk<InDataType> &)> &&funcCore, int index) {
+                try {
+                    fused(std::forward<std::function<void(DataChunk<InDataType> &)>>(funcCore), index);
+                } catch (...) {
+                    // 其他工作线程不再领取新的数据块
+                    remainingBlocks_ = 0;
+                    throw;
                 }
+            }
 
-                // 每个消费者线程需要处理的任务量（块数）
-                int perNums = blkNums / consumerCount_;
-                int leftsNums = blkNums % consumerCount_;
+            void fused(std::function<void(DataChunk<InDataType> &)> &&funcCore, int index) {
 
-                tasks_.resize(consumerCount_);
-                for (auto &tasks : tasks_) {
-                    tasks = perNums;
+                auto func = std::forward<std::function<void(DataChunk<InDataType> &)>>(funcCore);
+                ScopedNumaBinding binding(index, affinity_);
+
+                // 每个工作线程独占一个（从句柄池租借的）数据集句柄
+                DatasetLease ds = DatasetPool::instance().acquire(infile_);
+                if (!ds) {
+                    throw std::runtime_error("GDALDataset open faild.");
                 }
-                tasks_[consumerCount_-1] += leftsNums; // 剩余的任务全部交给最后一个消费者去做
-                GDALClose((GDALDatasetH)ds);
-            } // end assignWorkload()
+                ds.cacheBudget(chunkCacheBytes_);
+                ReadDataChunk<InDataType> read(ds.get(), specDims_, intl_);
+                std::shared_ptr<RawMappedImage> raw = fusedRaw_;
+
+                // 按最大块分配一次，之后所有数据块都复用这块内存（由本线程首次写入）
+                auto makeChunk = [this, &binding] {
+                    DataChunk<InDataType> chunk(SpatialDims(0, 0, chunkXSize_, chunkYSize_), specDims_, intl_, policy_);
+                    chunk.numaNode(binding.node());
+                    return chunk;
+                };
+                DataChunk<InDataType> data = makeChunk();
+
+                int k = 0;
+                while (claimBlock(k)) {
+                    const SpatialDims &blk = blocks_[k];
+
+                    ComputeSlot slot;
+                    if (raw) {
+                        // 数据块在文件中连续存放时直接使用映射内存
+                        const InDataType *view = raw->view<InDataType>(blk.xOff(), blk.yOff(),
+                                blk.xSize(), blk.ySize(), specDims_.bandCount(), specDims_.bandMap(), intl_);
+                        if (view) {
+                            DataChunk<InDataType> mapped(DataDims(blk, specDims_), intl_, view, raw);
+                            func(mapped);
+                            continue;
+                        }
+                    }
+
+                    if (data.data() == nullptr) { // 入口函数移走了数据
+                        data = makeChunk();
+                    }
+                    data.dims().updateSpatial(blk.xOff(), blk.yOff(), blk.xSize(), blk.ySize());
+                    if (raw && raw->read(blk.xOff(), blk.yOff(), blk.xSize(), blk.ySize(),
+                                specDims_.bandCount(), specDims_.bandMap(), intl_, data.data())) {
+                        data.padSpectra();
+                    } else if (!read(blk.xOff(), blk.yOff(), blk.xSize(), blk.ySize(), data.data(), data.stride())) {
+                        throw std::runtime_error("Reading data chunk is faild.");
+                    }
+
+                    func(data);
+                }
+            }
 
             /**
              * 消费者启动线程
              * @param funcCore  每个消费者线程的入口函数
-             * @param tasks     每个消费者线程的工作量
+             * @param index     消费者线程的编号，编号不小于当前激活数的线程会被挂起
              */
-            void consumerTask(std::function<void(DataChunk<InDataType> &)> &&funcCore, int tasks) {
+            void consumerTask(std::function<void(DataChunk<InDataType> &)> &&funcCore, int index) {
+                try {
+                    consume(std::forward<std::function<void(DataChunk<InDataType> &)>>(funcCore), index);
+                } catch (...) {
+                    // 中止读取并唤醒被挂起的线程，使其他消费者线程及读线程尽快退出，由 run() 重新抛出异常
+                    mpRead_->abort();
+                    tuner_->finish();
+                    throw;
+                }
+
+                // 所有数据块均已被领取（或读取已中止），唤醒被挂起的线程使其退出
+                tuner_->finish();
+            }
+
+            void consume(std::function<void(DataChunk<InDataType> &)> &&funcCore, int index) {
 
                 auto func = std::forward<std::function<void(DataChunk<InDataType> &)>>(funcCore);
+                PipelineStats &stats = tuner_->stats();
+
+                // 与第 index 个读线程绑定到同一个 NUMA 节点上
+                ScopedNumaBinding binding(index, affinity_);
 
                 DataChunk<InDataType> data(0,0,1,1,1); // 临时构造一个数据块
-                for (int i = 0; i < tasks; ++i) {
+                for (;;) {
+                    if (!tuner_->waitConsumerActive(index) || mpRead_->aborted_ || !claimBlock()) {
+                        break;
+                    }
 
                     {
-                        // 如果缓冲区中没有数据,则等待数据的到来
-                        std::unique_lock<std::mutex> lk(mpRead_.mutexReadQueue_);
-                        while (mpRead_.readQueue_.empty()) {
-                            mpRead_.condReadQueueNotEmpty_.wait(lk);
+                        // 如果缓冲区中没有数据,则等待数据的到来（读取中止时不再等待）
+                        std::unique_lock<std::mutex> lk(mpRead_->mutexReadQueue_);
+                        if (mpRead_->readQueue_.empty()) {
+                            ScopedNs wait(stats.consumerWaitNs);
+                            while (mpRead_->readQueue_.empty() && !mpRead_->aborted_) {
+                                mpRead_->condReadQueueNotEmpty_.wait(lk);
+                            }
+                        }
+                        if (mpRead_->aborted_) {
+                            break;
                         }
 
-                        // 直接移走缓冲区中的数据，避免复制数据
-                        data = std::move(mpRead_.readQueue_.front());
-                        mpRead_.readQueue_.pop();
+                        // 优先取同一节点上的数据块
+                        data = mpRead_->takeReadQueue(binding.node());
                     }
-                    mpRead_.condReadQueueNotFull_.notify_all();
+                    mpRead_->condReadQueueNotFull_.notify_all();
 
                     // TODO 核心操作，由用户实现
                     // 对于“读-处理”模型算法，函数内部不涉及写数据
+                    ComputeSlot slot;
+                    ScopedNs busy(stats.consumerBusyNs);
                     func(data);
                 }
             }
@@ -168,15 +421,37 @@ namespace RSTool {
             Interleave intl_;
 
             int blkSize_;
-            int readThreadsCount_;
-
-            MpGDALRead<InDataType> mpRead_;
+            size_t chunkCacheBytes_ = 0;    // 每个读句柄的块缓存需求
+            int chunkXSize_ = 0;    // 实际分块的最大尺寸
+            int chunkYSize_ = 0;
+            bool autoReadThreads_;  // 是否自动确定读线程数
+            int readThreadsCount_;  // 读线程数（上限）
+
+            // Queued 方式的读线程及读缓冲队列，在 run() 中创建
+            std::unique_ptr<MpGDALRead<InDataType>> mpRead_;
+            size_t readQueueMaxSize_ = 8;
+            bool rawIO_ = true;
+            bool asyncIO_ = false;
+            int asyncDepth_ = 16;
+            bool directIO_ = false;
+            size_t passBytes_ = BSQ_PASS_BYTES;
+            std::shared_ptr<RawMappedImage> fusedRaw_;  // Fused 方式共享的内存映射
 
         protected:
-            std::vector<int> tasks_;
+            std::vector<SpatialDims> blocks_;       // 所有数据块，按文件顺序排列
+            std::atomic<int> remainingBlocks_{0};   // 尚未被消费者领取的数据块数
+
+            bool autoTune_ = true;
+            bool fixedQueueSize_ = false;
+            size_t queueMemoryBudget_ = size_t(1) << 30;
+            AffinityPolicy affinity_ = AffinityPolicy::NumaPairs;
+            ExecMode execMode_ = ExecMode::Queued;
+            AllocPolicy policy_;                // 输入数据块的内存分配策略
+            std::unique_ptr<AutoTuner> tuner_;
+
         protected:
             int consumerCount_; // 消费者线程数量
-            std::vector<std::thread> consumerThreads_;   // 消费者线程（块数据处理线程）
+            std::vector<std::future<void>> consumerThreads_;   // 消费者线程（块数据处理线程）
 
             // 每个消费者线程所处理的核心函数对象
             // 可以从主线程中接收不同的参数（主要是为了将主线程的任务并行化）
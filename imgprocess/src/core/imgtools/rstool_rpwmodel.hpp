@@ -18,19 +18,27 @@ namespace RSTool {
             /**
              *
              * @param infile                输入文件
-             * @param outfile               输出文件
+             * @param outfile               输出文件（已创建），也可以是内存中间结果的路径（MemoryStore::create），
+             *                              位于内存中时 Raw、Compressed、Sharded 方式不可用，自动回退为 GDAL 写出
              * @param inSpecDims            输入文件的光谱范围
              * @param inIntl                输入文件数据在内存的组织方式
              * @param blkSize               指定处理的块大小
-             * @param readThreadsCount      读线程数，默认为 1
+             * @param readThreadsCount      读线程数，默认为 0，表示运行时自动确定
              * @param writeThreadsCount     写线程数，默认为 1
+             * @param writeMode             写线程的工作方式，默认为“随机”写出；
+             *                              对于 NFS 的输出，建议按顺序写出；
+             *                              对于 ENVI 格式的输出，建议直接写出（WriteMode::Raw）；
+             *                              对于 DEFLATE/LZW 压缩的 GTiff 输出，建议并行压缩（WriteMode::Compressed），
+             *                              blkSize 取输出分块大小的整数倍时分块无需等待拼接；
+             *                              对于特别大的输出，可分片写出（WriteMode::Sharded），生成 outfile + ".vrt"
              */
             MpRPWModel(const std::string &infile, const std::string &outfile,
                        const SpectralDimes &inSpecDims, Interleave inIntl = Interleave::BIP,
-                       int blkSize = 128, int readThreadsCount = 1, int writeThreadsCount = 1)
+                       int blkSize = 128, int readThreadsCount = 0, int writeThreadsCount = 1,
+                       WriteMode writeMode = WriteMode::Random)
 
                     : MpRPModel<InDataType>(infile, inSpecDims, inIntl, blkSize, readThreadsCount),
-                    outfile_(outfile), mpWrite_(outfile, writeThreadsCount) {
+                    outfile_(outfile), mpWrite_(outfile, writeThreadsCount, writeMode) {
 
                 // TODO 确定读写缓冲区队列大小
                 mpWrite_.writeQueueMaxSize_ = 2*MpRPModel<InDataType>::consumerCount_;
@@ -38,33 +46,29 @@ namespace RSTool {
 
             void setWriteQueueMaxSize(int value) { mpWrite_.writeQueueMaxSize_ = value; }
 
+            // 分片写出时，是否在结束时将各分片并行合并为单个输出文件
+            void setMergeShards(bool value) { mpWrite_.setMergeShards(value); }
+
+            /**
+             * 写出过程中生成概视图（在 run() 之前调用），省去事后 gdaladdo 对输出文件的再次读取
+             * @param levels        概视图级数，为 0 时自动确定
+             * @param resampling    重采样方式，默认为均值
+             */
+            bool setOverviews(int levels = 0, OverviewResampling resampling = OverviewResampling::Average) {
+                return mpWrite_.setOverviews(levels, resampling);
+            }
+
             // 支持多线程写数据
             void writeDataChunk(DataChunk<OutDataType> &&data) {
-                {
-                    // 等待队列中有空闲位置
-                    std::unique_lock<std::mutex> lk(mpWrite_.mutexWriteQueue_);
-                    while (mpWrite_.writeQueue_.size() == mpWrite_.writeQueueMaxSize_
-                        /*&& !MpGDALWrite<T>::stop*/) {
-                        mpWrite_.condWriteQueueNotFull_.wait(lk);
-                    }
-
-                    /*if (MpGDALWrite<T>::stop) return;*/
-
-                    // 将准备输出的块数据移动到写缓冲队列中
-                    mpWrite_.writeQueue_.emplace(std::move(data));
-                }
-                mpWrite_.condWriteQueueNotEmpty_.notify_all();
+                mpWrite_.write(std::move(data));
             }
 
-            void run() {
+            // 启动所有消费者线程，阻塞至所有数据块处理完成且全部写出
+            void run() override {
                 MpRPModel<InDataType>::run();
 
-                {
-                    // 停止写线程
-                    std::unique_lock<std::mutex> lk(mpWrite_.mutexWriteQueue_);
-                    mpWrite_.stop = true;
-                }
-                mpWrite_.condWriteQueueNotEmpty_.notify_all();
+                // 停止写线程，并等待写缓冲队列中的数据全部写出
+                mpWrite_.finish();
             }
 
         private:
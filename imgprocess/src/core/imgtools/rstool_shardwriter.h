@@ -0,0 +1,323 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 分片输出：将输出影像按行划分为若干连续的区域，每个区域写到一个独立的 ENVI 分片文件，
+// 各线程（或各进程）写出时互不协调，最后生成一个 VRT 文件将各分片拼接为一个逻辑上完整的数据集；
+// 需要单个文件时再并行合并到原输出文件
+
+#ifndef IMGPROCESS_RSTOOL_SHARDWRITER_H
+#define IMGPROCESS_RSTOOL_SHARDWRITER_H
+
+#include "rstool_rawio.h"
+#include "rstool_tiffwriter.h"
+#include "rstool_executor.h"
+#include "rstool_datasetpool.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+
+namespace RSTool {
+
+    namespace Mp {
+
+        /**
+         * 分片写出：分片 i 覆盖输出影像的第 [i*shardRows, (i+1)*shardRows) 行，
+         * 文件名为去掉扩展名的 outfile + "_shardNNN.dat"（ENVI 格式，头文件为同名的 .hdr，
+         * 不会被 GDAL 误认为输出文件的头文件），数据块跨越分片边界时拆开写到各自的分片中。
+         * 分片文件用 pwrite 写出，任意线程均可直接写出数据块，无需加锁；
+         * 分片布局只由输出影像的大小及分片数决定，多个进程可以各自创建并写出自己负责的分片，再由其中一个生成 VRT
+         */
+        class ShardedWriter {
+        public:
+            /**
+             * @param outfile       已创建的输出文件，提供影像大小、波段数、数据类型及地理参考
+             * @param shardCount    分片数
+             * @param intl          分片文件的组织方式
+             * @return              输出文件打开失败时返回空指针
+             */
+            static std::shared_ptr<ShardedWriter> Open(const std::string &outfile, int shardCount,
+                    Interleave intl = Interleave::BSQ) {
+                DatasetLease ds = DatasetPool::instance().acquire(outfile);
+                if (!ds || ds->GetRasterCount() < 1) return nullptr;
+
+                std::shared_ptr<ShardedWriter> writer(new ShardedWriter());
+                writer->outfile_ = outfile;
+                writer->intl_ = intl;
+                writer->xSize_ = ds->GetRasterXSize();
+                writer->ySize_ = ds->GetRasterYSize();
+                writer->bands_ = ds->GetRasterCount();
+                writer->dataType_ = ds->GetRasterBand(1)->GetRasterDataType();
+                writer->hasGeoTransform_ = ds->GetGeoTransform(writer->geoTransform_) == CE_None;
+                const char *proj = ds->GetProjectionRef();
+                writer->projection_ = proj ? proj : "";
+                for (int b = 1; b <= writer->bands_; b++) {
+                    int ok = 0;
+                    double value = ds->GetRasterBand(b)->GetNoDataValue(&ok);
+                    writer->noData_.emplace_back(ok != 0, value);
+                }
+
+                int count = std::max(1, std::min(shardCount, writer->ySize_));
+                writer->shardRows_ = (writer->ySize_ + count - 1) / count;
+                writer->shards_.resize((writer->ySize_ + writer->shardRows_ - 1) / writer->shardRows_);
+                return writer;
+            }
+
+            int shardCount() const { return static_cast<int>(shards_.size()); }
+
+            // 分片 i 的起始行号及行数
+            int shardYOff(int i) const { return i*shardRows_; }
+            int shardYSize(int i) const { return std::min(shardRows_, ySize_ - i*shardRows_); }
+
+            std::string shardFile(int i) const {
+                std::string stem = outfile_;
+                size_t dot = stem.find_last_of('.');
+                size_t slash = stem.find_last_of('/');
+                if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) stem.erase(dot);
+
+                std::ostringstream name;
+                name << stem << "_shard" << std::setw(3) << std::setfill('0') << i << ".dat";
+                return name.str();
+            }
+
+            std::string vrtFile() const { return outfile_ + ".vrt"; }
+
+            /**
+             * 创建分片文件（预分配空间）
+             * @param i     分片序号，为 -1 时创建全部分片（多进程写出时每个进程只创建自己的分片）
+             */
+            bool create(int i = -1) {
+                for (int k = 0; k < shardCount(); k++) {
+                    if (i >= 0 && k != i) continue;
+                    shards_[k] = RawWriter::Create(shardFile(k), xSize_, shardYSize(k), bands_, dataType_, intl_);
+                    if (!shards_[k]) return false;
+                }
+                return true;
+            }
+
+            /**
+             * 写出一个数据块（可在多个线程中同时调用），所在分片需已创建
+             * @return  越界或写入失败时返回 false
+             */
+            template <typename T>
+            bool write(DataChunk<T> &data) {
+                DataDims &dims = data.dims();
+                if (dims.yOff() < 0 || dims.yOff() + dims.ySize() > ySize_) return false;
+
+                // 像素分组（BIP-N）及光谱补齐的数据先转换为紧凑的 BIP，使连续若干行在内存中连续
+                Interleave intl = data.interleave();
+                const T *chunkData = UntilePixels(static_cast<const T*>(data.data()), intl,
+                        dims.xSize(), dims.ySize(), dims.bandCount(), data.stride());
+
+                int first = dims.yOff() / shardRows_;
+                int last = (dims.yOff() + dims.ySize() - 1) / shardRows_;
+                for (int i = first; i <= last; i++) {
+                    if (!shards_[i]) return false;
+
+                    // 数据块在该分片中的行范围
+                    int y0 = std::max(dims.yOff(), shardYOff(i));
+                    int y1 = std::min(dims.yOff() + dims.ySize(), shardYOff(i) + shardYSize(i));
+                    int rows = y1 - y0;
+                    size_t rowElems = static_cast<size_t>(dims.xSize())*dims.bandCount();
+
+                    const T *src = chunkData;
+                    if (first != last) {
+                        if (intl != Interleave::BSQ) {
+                            // BIP/BIL 的连续若干行在内存中是连续的
+                            src += static_cast<size_t>(y0 - dims.yOff())*rowElems;
+                        } else {
+                            static thread_local std::vector<T> staging;
+                            staging.resize(rowElems*rows);
+                            CopyRawRegion(chunkData, Interleave::BSQ, dims.xSize(), dims.ySize(), dims.bandCount(),
+                                    0, y0 - dims.yOff(), dims.xSize(), rows, dims.bandCount(), allBands(dims.bandCount()),
+                                    Interleave::BSQ, staging.data());
+                            src = staging.data();
+                        }
+                    }
+
+                    if (!shards_[i]->write(dims.xOff(), y0 - shardYOff(i), dims.xSize(), rows,
+                            dims.bandCount(), dims.bandMap(), intl, src)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /**
+             * 生成拼接各分片的 VRT 文件（包含输出文件的地理参考及 NoData）
+             * @return  写入失败时返回 false
+             */
+            bool writeVrt() const {
+                std::ofstream out(vrtFile().c_str());
+                if (!out) return false;
+
+                std::string dir = directoryOf(vrtFile());
+                out << "<VRTDataset rasterXSize=\"" << xSize_ << "\" rasterYSize=\"" << ySize_ << "\">\n";
+                if (!projection_.empty()) {
+                    out << "  <SRS>" << escape(projection_) << "</SRS>\n";
+                }
+                if (hasGeoTransform_) {
+                    out << "  <GeoTransform>" << std::setprecision(17);
+                    for (int i = 0; i < 6; i++) {
+                        out << (i ? ", " : "") << geoTransform_[i];
+                    }
+                    out << "</GeoTransform>\n";
+                }
+
+                for (int b = 1; b <= bands_; b++) {
+                    out << "  <VRTRasterBand dataType=\"" << GDALGetDataTypeName(dataType_)
+                        << "\" band=\"" << b << "\">\n";
+                    if (noData_[b - 1].first) {
+                        out << "    <NoDataValue>" << std::setprecision(17) << noData_[b - 1].second
+                            << "</NoDataValue>\n";
+                    }
+                    for (int i = 0; i < shardCount(); i++) {
+                        std::string file = shardFile(i);
+                        out << "    <SimpleSource>\n"
+                            << "      <SourceFilename relativeToVRT=\"1\">"
+                            << escape(file.substr(dir.size())) << "</SourceFilename>\n"
+                            << "      <SourceBand>" << b << "</SourceBand>\n"
+                            << "      <SrcRect xOff=\"0\" yOff=\"0\" xSize=\"" << xSize_
+                            << "\" ySize=\"" << shardYSize(i) << "\"/>\n"
+                            << "      <DstRect xOff=\"0\" yOff=\"" << shardYOff(i) << "\" xSize=\"" << xSize_
+                            << "\" ySize=\"" << shardYSize(i) << "\"/>\n"
+                            << "    </SimpleSource>\n";
+                    }
+                    out << "  </VRTRasterBand>\n";
+                }
+                out << "</VRTDataset>\n";
+                return static_cast<bool>(out);
+            }
+
+            /**
+             * 将各分片并行合并到输出文件，成功后删除分片文件及 VRT 文件。
+             * 输出为 ENVI 文件或 DEFLATE/LZW 压缩的 GTiff 文件时各分片由各自的线程读取并写出（压缩），
+             * 其他格式并行读取、由 GDAL 依次写出
+             * @return  分片读取或写出失败时返回 false
+             */
+            template <typename T>
+            bool merge() {
+                // 关闭各分片的写句柄，并关闭输出文件的空闲只读句柄（文件将被改写）
+                for (auto &shard : shards_) shard.reset();
+                DatasetPool::instance().invalidate(outfile_);
+
+                std::shared_ptr<RawWriter> raw = RawWriter::Open(outfile_);
+                std::shared_ptr<TiledTiffWriter> tiff = raw ? nullptr : TiledTiffWriter::Open(outfile_);
+                DatasetLease ds;
+                if (!raw && !tiff) {
+                    ds = DatasetPool::instance().acquire(outfile_, GA_Update);
+                    if (!ds) return false;
+                }
+
+                std::mutex mutexWrite;
+                auto sink = [&](DataChunk<T> &chunk) {
+                    if (raw) return raw->write(chunk);
+                    if (tiff) return tiff->write(chunk);
+                    std::unique_lock<std::mutex> lk(mutexWrite);
+                    WriteDataChunk<T> write(ds.get());
+                    return write(chunk);
+                };
+
+                std::vector<std::future<bool>> futures;
+                for (int i = 0; i < shardCount(); i++) {
+                    futures.emplace_back(Executor::instance().submit([this, i, &sink] {
+                        return mergeShard<T>(i, sink);
+                    }));
+                }
+                bool ok = true;
+                for (auto &fut : futures) {
+                    ok = fut.get() && ok;
+                }
+                if (tiff) ok = tiff->finish() && ok;
+                ds.release();
+                raw.reset();
+                tiff.reset();
+                if (!ok) return false;
+
+                for (int i = 0; i < shardCount(); i++) {
+                    std::remove(shardFile(i).c_str());
+                    std::remove(EnviHeaderFile(shardFile(i)).c_str());
+                }
+                std::remove(vrtFile().c_str());
+                return true;
+            }
+
+        private:
+            ShardedWriter() = default;
+
+            // 按条带读取一个分片（内存映射）并交给 sink 写出
+            template <typename T, typename Sink>
+            bool mergeShard(int i, Sink &sink) {
+                std::shared_ptr<RawMappedImage> shard = RawMappedImage::Open(shardFile(i));
+                if (!shard) return false;
+
+                size_t rowBytes = static_cast<size_t>(xSize_)*bands_*sizeof(T);
+                int rows = static_cast<int>(std::max<size_t>(1, (16u << 20)/rowBytes));
+                std::vector<int> bands(bands_);
+                for (int b = 0; b < bands_; b++) bands[b] = b + 1;
+
+                for (int y = 0; y < shardYSize(i); y += rows) {
+                    int ySize = std::min(rows, shardYSize(i) - y);
+                    DataChunk<T> chunk(SpatialDims(0, shardYOff(i) + y, xSize_, ySize), bands, intl_);
+                    if (!shard->read(0, y, xSize_, ySize, bands_, chunk.dims().bandMap(), intl_, chunk.data()) ||
+                            !sink(chunk)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // 全部波段的索引（从 1 开始）
+            static const int* allBands(int count) {
+                static thread_local std::vector<int> map;
+                for (int b = static_cast<int>(map.size()); b < count; b++) map.push_back(b + 1);
+                return map.data();
+            }
+
+            static std::string directoryOf(const std::string &file) {
+                size_t pos = file.find_last_of('/');
+                return pos == std::string::npos ? std::string() : file.substr(0, pos + 1);
+            }
+
+            static std::string escape(const std::string &s) {
+                std::string out;
+                for (char c : s) {
+                    switch (c) {
+                        case '&': out += "&amp;"; break;
+                        case '<': out += "&lt;"; break;
+                        case '>': out += "&gt;"; break;
+                        case '"': out += "&quot;"; break;
+                        default: out += c;
+                    }
+                }
+                return out;
+            }
+
+        private:
+            std::string outfile_;
+            Interleave intl_ = Interleave::BSQ;
+            int xSize_ = 0;
+            int ySize_ = 0;
+            int bands_ = 0;
+            GDALDataType dataType_ = GDT_Unknown;
+
+            bool hasGeoTransform_ = false;
+            double geoTransform_[6] = {0, 1, 0, 0, 0, 1};
+            std::string projection_;
+            std::vector<std::pair<bool, double>> noData_;
+
+            int shardRows_ = 1;
+            std::vector<std::shared_ptr<RawWriter>> shards_;
+        };
+
+    } // namespace Mp
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_SHARDWRITER_H
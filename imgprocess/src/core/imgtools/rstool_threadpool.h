@@ -6,8 +6,23 @@
 #define IMGPROCESS_RSTOOL_THREADPOOL_H
 
 #include "rstool_common.h"
+#include "rstool_autotune.h"
+#include "rstool_numa.h"
+#include "rstool_executor.h"
+#include "rstool_rawio.h"
+#include "rstool_uring.h"
+#include "rstool_tiffwriter.h"
+#include "rstool_shardwriter.h"
+#include "rstool_overview.h"
+#include "rstool_memstore.h"
+#include "rstool_datasetpool.h"
+#include "rstool_gridplan.h"
 #include <vector>
 #include <queue>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <atomic>
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -16,6 +31,7 @@
 #include <functional>
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 
 namespace RSTool {
 
@@ -147,11 +163,12 @@ namespace RSTool {
         class MpGDALRead {
         public:
             // 线程间同步
-            std::queue<DataChunk<InDataType>> readQueue_; // 用于缓存从磁盘读取的数据
-            int readQueueMaxSize_ = 8; // 读缓冲区最大Size
+            std::deque<DataChunk<InDataType>> readQueue_; // 用于缓存从磁盘读取的数据
+            size_t readQueueMaxSize_ = 8; // 读缓冲区最大Size
             std::mutex mutexReadQueue_;
             std::condition_variable condReadQueueNotEmpty_;
             std::condition_variable condReadQueueNotFull_;
+            std::atomic<bool> aborted_{false};  // 读线程或消费者线程出错后置位，队列两端的等待均不再继续
 
         public:
             // 一般来说，进行读文件时，需要读的波段范围和数据在内存中的组织方式是已知的，
@@ -165,19 +182,27 @@ namespace RSTool {
              * @param readThreadsCount  指定需要读线程的数量，默认为1
              */
             MpGDALRead(const std::string &infile, const SpectralDimes &specDims,
-                    Interleave &intl = Interleave::BIP, int readThreadsCount = 1)
+                    Interleave intl = Interleave::BIP, int readThreadsCount = 1)
                 : infile_(infile), specDims_(specDims), intl_(intl),
                 pools_(readThreadsCount), datasets_(readThreadsCount) {
 
+                // 句柄从共享句柄池中租借，析构时归还，供后续作业复用
                 for (auto &ds : datasets_) {
-                    ds = (GDALDataset*)GDALOpen(infile.c_str(), GA_ReadOnly);
+                    ds = DatasetPool::instance().acquire(infile);
+                }
+
+                // 未压缩的 ENVI 文件使用内存映射方式读取
+                if (!datasets_.empty()) {
+                    raw_ = RawMappedImage::Open(datasets_.front().get());
                 }
             }
 
             virtual ~MpGDALRead() {
-                for (auto &ds : datasets_) {
-                    GDALClose((GDALDatasetH)ds);
+                // 等待读线程退出后再归还数据集
+                for (auto &fut : futures_) {
+                    fut.wait();
                 }
+                datasets_.clear();
             }
 
             /**
@@ -186,38 +211,336 @@ namespace RSTool {
              * @param spatDims  数据块的空间范围
              */
             void enqueue(int i, const SpatialDims &spatDims) {
-                GDALDataset *ds = datasets_[i];
+                GDALDataset *ds = datasets_[i].get();
                 pools_[i].enqueue([this, ds, spatDims] {
+                    pushReadQueue(readChunk(ds, spatDims));
+                }); // end lambad
+            } // end enqueue()
+
+            /**
+             * 指定需要读取的全部数据块（按读取的先后顺序），与 start() 配合使用，
+             * 各读线程按顺序依次领取下一个数据块，而不是预先为每个读线程分配任务
+             * @param blocks    数据块的空间范围
+             */
+            void assign(const std::vector<SpatialDims> &blocks) {
+                blocks_ = blocks;
+                nextBlock_ = 0;
+            }
 
-                    //auto start = std::chrono::high_resolution_clock::now();
+            /**
+             * 启动所有读线程，读取 assign() 指定的数据块
+             * @param tuner     用于挂起/激活读线程以及统计等待时间，为空时所有读线程一直处于激活状态
+             * @param affinity  读线程的绑定策略，默认不绑定
+             */
+            void start(AutoTuner *tuner = nullptr, AffinityPolicy affinity = AffinityPolicy::None) {
+                tuner_ = tuner;
+                affinity_ = affinity;
+                aborted_ = false;
 
-                    DataChunk<InDataType> data(spatDims, specDims_, intl_);
-                    ReadDataChunk<InDataType> read(ds, specDims_, intl_);
-                    if ( !read(spatDims.xOff(), spatDims.yOff(),
-                               spatDims.xSize(), spatDims.ySize(), data.data())) {
-                        throw std::runtime_error("Reading data chunk is faild.");
+                if (asyncIO_ && !pools_.empty()) {
+                    asyncRead_.reset(new AsyncRawRead<InDataType>(infile_, specDims_, intl_, asyncDepth_, directIO_));
+                    asyncRead_->setAllocPolicy(policy_);
+                    if (asyncRead_->valid()) {
+                        // 由一个线程异步提交所有读请求，代替多个阻塞的读线程
+                        futures_.emplace_back(pools_[0].enqueue(&MpGDALRead<InDataType>::asyncTask, this));
+                        return;
                     }
+                    asyncRead_.reset();
+                }
 
-                    //auto end = std::chrono::high_resolution_clock::now();
-                    //std::chrono::duration<double, std::milli> elapsed = end-start;
-                    //std::cout<< "read: " << elapsed.count() << std::endl;
+                passChunks_ = planBandMajorPass();
+                for (size_t i = 0; i < pools_.size(); i++) {
+                    futures_.emplace_back(pools_[i].enqueue(
+                            &MpGDALRead<InDataType>::readTask, this, static_cast<int>(i)));
+                }
+            }
 
-                    {
-                        // 等待读缓冲队列中有空闲位置
-                        std::unique_lock<std::mutex> lk(mutexReadQueue_);
-                        while (readQueue_.size() == readQueueMaxSize_) {
-                            condReadQueueNotFull_.wait(lk);
-                        }
+            int threadsCount() const { return pools_.size(); }
+
+            /**
+             * 设置每个读线程的数据集句柄的块缓存需求（字节），一般为一个数据块的大小
+             * @param bytes 每个句柄的缓存需求
+             */
+            void setCacheBudget(size_t bytes) {
+                for (auto &ds : datasets_) {
+                    ds.cacheBudget(bytes);
+                }
+            }
 
-                        // 移动数据块，避免数据间的复制
-                        readQueue_.emplace(std::move(data));
+            /**
+             * 等待所有读线程退出（被挂起的读线程需先由调优器唤醒），
+             * 并将读线程中抛出的第一个异常传递给调用者
+             */
+            void wait() {
+                std::vector<std::future<void>> futures;
+                futures.swap(futures_);
+                std::exception_ptr error;
+                for (auto &fut : futures) {
+                    try {
+                        fut.get();
+                    } catch (...) {
+                        if (!error) error = std::current_exception();
                     }
-                    condReadQueueNotEmpty_.notify_all();
+                }
+                if (error) std::rethrow_exception(error);
+            }
 
-                }); // end lambad
-            } // end enqueue()
+            /**
+             * 中止读取（读线程或消费者线程出错时调用）：唤醒在读缓冲队列两端等待的线程，
+             * 读线程不再放入及读取数据块，消费者线程不再等待数据块
+             */
+            void abort() {
+                {
+                    std::unique_lock<std::mutex> lk(mutexReadQueue_);
+                    aborted_ = true;
+                }
+                condReadQueueNotFull_.notify_all();
+                condReadQueueNotEmpty_.notify_all();
+            }
 
-            int threadsCount() const { return pools_.size(); }
+            /**
+             * 是否使用内存映射方式读取（仅对未压缩的 ENVI 文件有效），默认使用，需在 start() 之前设置
+             * @param enable    为 false 时总是通过 GDAL 读取
+             */
+            void setRawIO(bool enable) { rawIO_ = enable; }
+
+            // 内存映射的数据文件，不是未压缩的 ENVI 文件或禁用了内存映射时为空
+            std::shared_ptr<RawMappedImage> raw() const { return rawIO_ ? raw_ : nullptr; }
+
+            /**
+             * 是否使用 io_uring 异步读取（仅对未压缩的 ENVI 文件有效），默认不使用，需在 start() 之前设置；
+             * 不支持时仍使用多个读线程读取
+             * @param enable    是否启用
+             * @param depth     同时读取的数据块个数
+             * @param direct    是否使用 O_DIRECT 读取，不经过页缓存，适合只扫描一遍的大文件
+             */
+            void setAsyncIO(bool enable, int depth = 16, bool direct = false) {
+                asyncIO_ = enable;
+                asyncDepth_ = depth;
+                directIO_ = direct;
+            }
+
+            /**
+             * BSQ 文件按波段读取的轮次大小，需在 start() 之前设置：数据块为整行时，每个读线程一次领取
+             * 不超过 bytes 字节的若干个相邻数据块，整个轮次以一次读取按波段读出（每个波段为文件中的一段连续数据），
+             * 再拆分为各个数据块；默认为 BSQ_PASS_BYTES，为 0 时逐块读取
+             */
+            void setBandMajorPass(size_t bytes) { passBytes_ = bytes; }
+
+            // 读取的数据块的内存分配策略（对齐、大页、光谱补齐），需在 start() 之前设置
+            void setAllocPolicy(const AllocPolicy &policy) { policy_ = policy; }
+
+            // 当前是否正在使用 io_uring 异步读取（start() 之后有效）
+            bool asyncActive() const { return asyncRead_ != nullptr; }
+
+            /**
+             * 从读缓冲队列中取出一个数据块，调用者需持有 mutexReadQueue_ 且队列不为空
+             * @param node  调用线程所在的 NUMA 节点，优先取出位于该节点上的数据块，
+             *              为 -1 时按先进先出的顺序取出
+             * @return      取出的数据块
+             */
+            DataChunk<InDataType> takeReadQueue(int node = -1) {
+                auto it = readQueue_.begin();
+                if (node >= 0) {
+                    auto same = std::find_if(readQueue_.begin(), readQueue_.end(),
+                            [node](const DataChunk<InDataType> &chunk) {
+                                return chunk.numaNode() == node; });
+                    if (same != readQueue_.end()) it = same;
+                }
+
+                // 直接移走缓冲区中的数据，避免复制数据
+                DataChunk<InDataType> data(std::move(*it));
+                readQueue_.erase(it);
+                return data;
+            }
+
+        private:
+            // 第 i 个读线程：依次领取并读取数据块，直至全部读完；出错时中止读取并将异常传递给 wait()
+            void readTask(int i) {
+                try {
+                    readBlocks(i);
+                } catch (...) {
+                    abort();
+                    throw;
+                }
+            }
+
+            void readBlocks(int i) {
+                // 数据块由读线程分配并首次写入，其内存落在读线程所在的节点上，
+                // 与同一节点上的消费者线程配对，避免跨节点访问内存
+                ScopedNumaBinding binding(i, affinity_);
+
+                GDALDataset *ds = datasets_[i].get();
+                for (;;) {
+                    if (tuner_ && !tuner_->waitReaderActive(i)) return;
+                    if (aborted_) return;
+
+                    size_t k = nextBlock_.fetch_add(passChunks_);
+                    if (k >= blocks_.size()) return;
+
+                    if (passChunks_ > 1) {
+                        readPass(ds, k, std::min(k + passChunks_, blocks_.size()), binding.node());
+                        continue;
+                    }
+
+                    DataChunk<InDataType> data = readChunk(ds, blocks_[k]);
+                    data.numaNode(binding.node());
+                    pushReadQueue(std::move(data));
+                }
+            }
+
+            /**
+             * 按波段读取的轮次包含的数据块个数：BSQ 文件（多个波段）且数据块均为整行时，
+             * 为 passBytes_ 能容纳的数据块个数，否则为 1（逐块读取）
+             */
+            size_t planBandMajorPass() {
+                if (passBytes_ == 0 || blocks_.empty() || datasets_.empty() || specDims_.bandCount() < 2) return 1;
+
+                GDALDataset *ds = datasets_.front().get();
+                if (!ds || DetectInterleave(ds) != Interleave::BSQ) return 1;
+                for (auto &blk : blocks_) {
+                    if (blk.xOff() != 0 || blk.xSize() != ds->GetRasterXSize()) return 1;
+                }
+
+                size_t chunkBytes = sizeof(InDataType)*blocks_.front().xSize()*blocks_.front().ySize()*
+                        specDims_.bandCount();
+                return std::max<size_t>(1, passBytes_ / std::max<size_t>(1, chunkBytes));
+            }
+
+            /**
+             * 读取一个轮次 blocks_[first, last)：其中上下相邻的数据块合并为一次 BSQ 方式的读取，
+             * 文件中每个波段只有一段连续的数据，再拆分为各个数据块（转换为要求的组织方式）
+             */
+            void readPass(GDALDataset *ds, size_t first, size_t last, int node) {
+                while (first < last) {
+                    // 上下相邻的数据块
+                    size_t end = first + 1;
+                    int ySize = blocks_[first].ySize();
+                    while (end < last && blocks_[end].yOff() == blocks_[first].yOff() + ySize) {
+                        ySize += blocks_[end].ySize();
+                        end++;
+                    }
+
+                    const SpatialDims &top = blocks_[first];
+                    DataChunk<InDataType> pass = readChunk(ds,
+                            SpatialDims(top.xOff(), top.yOff(), top.xSize(), ySize), Interleave::BSQ);
+
+                    for (int row = 0; first < end; first++) {
+                        DataChunk<InDataType> data(blocks_[first], specDims_, intl_, policy_);
+                        copyPassRows(pass.data(), ySize, row, data);
+                        row += data.dims().ySize();
+                        data.numaNode(node);
+                        pushReadQueue(std::move(data));
+                    }
+                }
+            }
+
+            // 从轮次的 BSQ 数据（高 passYSize 行）中取出自第 row 行开始的数据块
+            static void copyPassRows(const InDataType *pass, int passYSize, int row, DataChunk<InDataType> &data) {
+                const int xSize = data.dims().xSize();
+                const int ySize = data.dims().ySize();
+                const int bands = data.dims().bandCount();
+                const size_t plane = static_cast<size_t>(xSize)*ySize;
+                const size_t passPlane = static_cast<size_t>(xSize)*passYSize;
+                const InDataType *src = pass + static_cast<size_t>(row)*xSize;
+
+                if (data.interleave() == Interleave::BSQ) {
+                    for (int b = 0; b < bands; b++) {
+                        memcpy(data.data() + b*plane, src + b*passPlane, sizeof(InDataType)*plane);
+                    }
+                    return;
+                }
+
+                static thread_local std::vector<InDataType> staging;
+                staging.resize(plane*bands);
+                for (int b = 0; b < bands; b++) {
+                    memcpy(staging.data() + b*plane, src + b*passPlane, sizeof(InDataType)*plane);
+                }
+                ConvertInterleave(staging.data(), Interleave::BSQ, data.data(), data.interleave(),
+                        xSize, ySize, bands, data.stride());
+            }
+
+            // 异步读取：领取数据块并提交读请求，读好的数据块放入读缓冲队列，读取失败的数据块改为同步读取
+            void asyncTask() {
+                try {
+                    asyncBlocks();
+                } catch (...) {
+                    abort();
+                    throw;
+                }
+            }
+
+            void asyncBlocks() {
+                GDALDataset *ds = datasets_[0].get();
+                asyncRead_->run([this](SpatialDims &blk) {
+                    if (aborted_) return false;
+                    size_t k = nextBlock_++;
+                    if (k >= blocks_.size()) return false;
+                    blk = blocks_[k];
+                    return true;
+                }, [this](DataChunk<InDataType> &&data) {
+                    pushReadQueue(std::move(data));
+                }, [this, ds](const SpatialDims &blk) {
+                    pushReadQueue(readChunk(ds, blk));
+                });
+            }
+
+            DataChunk<InDataType> readChunk(GDALDataset *ds, const SpatialDims &spatDims) {
+                return readChunk(ds, spatDims, intl_);
+            }
+
+            // 按指定的组织方式读取数据块
+            DataChunk<InDataType> readChunk(GDALDataset *ds, const SpatialDims &spatDims, Interleave intl) {
+                if (rawIO_ && raw_) {
+                    // 数据块在文件中连续存放时直接使用映射内存，否则从映射内存中复制
+                    const InDataType *view = raw_->view<InDataType>(spatDims.xOff(), spatDims.yOff(),
+                            spatDims.xSize(), spatDims.ySize(),
+                            specDims_.bandCount(), specDims_.bandMap(), intl);
+                    if (view) {
+                        return DataChunk<InDataType>(DataDims(spatDims, specDims_), intl, view, raw_);
+                    }
+
+                    DataChunk<InDataType> data(spatDims, specDims_, intl, policy_);
+                    if (raw_->read(spatDims.xOff(), spatDims.yOff(),
+                            spatDims.xSize(), spatDims.ySize(),
+                            specDims_.bandCount(), specDims_.bandMap(), intl, data.data())) {
+                        data.padSpectra();
+                        return data;
+                    }
+                }
+
+                DataChunk<InDataType> data(spatDims, specDims_, intl, policy_);
+                ReadDataChunk<InDataType> read(ds, specDims_, intl);
+                if ( !read(spatDims.xOff(), spatDims.yOff(),
+                           spatDims.xSize(), spatDims.ySize(), data.data(), data.stride())) {
+                    throw std::runtime_error("Reading data chunk is faild.");
+                }
+                return data;
+            }
+
+            void pushReadQueue(DataChunk<InDataType> &&data) {
+                {
+                    // 等待读缓冲队列中有空闲位置（队列大小可能在运行时被调小），中止后丢弃数据块
+                    std::unique_lock<std::mutex> lk(mutexReadQueue_);
+                    if (readQueue_.size() >= readQueueMaxSize_) {
+                        if (tuner_) {
+                            ScopedNs wait(tuner_->stats().readerWaitNs);
+                            while (readQueue_.size() >= readQueueMaxSize_ && !aborted_) {
+                                condReadQueueNotFull_.wait(lk);
+                            }
+                        } else {
+                            while (readQueue_.size() >= readQueueMaxSize_ && !aborted_) {
+                                condReadQueueNotFull_.wait(lk);
+                            }
+                        }
+                    }
+                    if (aborted_) return;
+
+                    // 移动数据块，避免数据间的复制
+                    readQueue_.emplace_back(std::move(data));
+                }
+                condReadQueueNotEmpty_.notify_all();
+            }
 
         private:
             std::string infile_;
@@ -225,8 +548,38 @@ namespace RSTool {
             Interleave intl_;
 
         private:
-            std::vector<ThreadPool> pools_;
-            std::vector<GDALDataset*> datasets_;
+            // 每个读线程独占一个数据集句柄，其任务在共享执行器上串行执行
+            std::vector<SerialQueue> pools_;
+            std::vector<DatasetLease> datasets_;
+            std::vector<std::future<void>> futures_;
+
+            std::vector<SpatialDims> blocks_;   // 需要读取的数据块
+            std::atomic<size_t> nextBlock_{0};  // 下一个待领取的数据块
+            AutoTuner *tuner_ = nullptr;
+            AffinityPolicy affinity_ = AffinityPolicy::None;
+
+            std::shared_ptr<RawMappedImage> raw_;   // 内存映射的数据文件
+            bool rawIO_ = true;
+            AllocPolicy policy_;                    // 数据块的内存分配策略
+
+            std::unique_ptr<AsyncRawRead<InDataType>> asyncRead_;  // io_uring 异步读取
+            bool asyncIO_ = false;
+            int asyncDepth_ = 16;
+            size_t passBytes_ = BSQ_PASS_BYTES;     // BSQ 文件按波段读取的轮次大小
+            size_t passChunks_ = 1;                 // 一个轮次包含的数据块个数
+            bool directIO_ = false;
+        };
+
+        // 写线程的工作方式
+        enum class WriteMode : char {
+            Random,     /* 多个写线程按数据块到达的先后“随机”写出 */
+            Ordered,    /* 单个写线程按文件顺序写出，并将同一行的数据块合并为整行条带后写出 */
+            Raw,        /* 输出为 ENVI 文件时，没有写线程，各消费者线程直接将数据块写到文件中的最终位置；
+                           输出不是 ENVI 文件时按 Random 方式写出 */
+            Compressed, /* 输出为 DEFLATE/LZW 压缩的 GTiff 文件时，没有写线程，各消费者线程按输出文件的分块布局
+                           自行压缩，压缩后的分块追加到文件末尾；压缩方式等不支持时按 Ordered 方式写出 */
+            Sharded     /* 没有写线程，各消费者线程将数据块写到按行划分的分片文件（ENVI）中，结束时生成
+                           拼接各分片的 VRT 文件（outfile + ".vrt"），可选择再并行合并到输出文件 */
         };
 
         // 多线程写数据，以块为基本单位
@@ -234,73 +587,452 @@ namespace RSTool {
         class MpGDALWrite {
         public:
             std::queue<DataChunk<OutDataType>> writeQueue_; // 用于缓存输出至磁盘的数据
-            int writeQueueMaxSize_ = 8;  // 写缓冲队列最大Size
+            size_t writeQueueMaxSize_ = 8;  // 写缓冲队列最大Size
             std::mutex mutexWriteQueue_;
             std::condition_variable condWriteQueueNotEmpty_;
             std::condition_variable condWriteQueueNotFull_;
             bool stop = false;
+            bool writeFailed_ = false;  // 写线程出错退出后置位，等待队列空闲位置的调用者不再等待
+
+            // 顺序写出时，重排缓冲区中最多暂存的数据块数量，
+            // 超出后将最靠前的一行数据块直接写出，以限制内存占用
+            int reorderMaxSize_ = 256;
 
         public:
             /**
              *
              * @param outfile           输出文件
-             * @param writeThreadsCount 写线程数量，默认为 1
+             * @param writeThreadsCount 写线程数量，默认为 1（顺序写出时固定为 1，直接写出及并行压缩时为 0）；
+             *                          分片写出时为分片数，不大于 1 时取 CPU 核数
+             * @param mode              写线程的工作方式，默认为“随机”写出
              */
-            MpGDALWrite(const std::string &outfile, int writeThreadsCount = 1)
-                    : outfile_(outfile), pools_(writeThreadsCount),
-                    datasets_(writeThreadsCount) {
+            MpGDALWrite(const std::string &outfile, int writeThreadsCount = 1,
+                    WriteMode mode = WriteMode::Random)
+                    : outfile_(outfile), mode_(mode),
+                    raw_(mode == WriteMode::Raw ? RawWriter::Open(outfile) : nullptr),
+                    tiff_(mode == WriteMode::Compressed ? OpenTiff(outfile) : nullptr),
+                    shards_(mode == WriteMode::Sharded ? OpenShards(outfile, writeThreadsCount) : nullptr),
+                    pools_((raw_ || tiff_ || shards_) ? 0 :
+                           ((mode == WriteMode::Ordered || mode == WriteMode::Compressed) ? 1 : writeThreadsCount)),
+                    datasets_(pools_.size()) {
 
-                for (int i = 0; i < writeThreadsCount; i++) {
-                    GDALDataset *ds = (GDALDataset*)GDALOpen(outfile_.c_str(), GA_Update);
-                    datasets_[i] = ds;
-                    pools_[i].enqueue([this, ds] {
+                if (mode_ == WriteMode::Raw && !raw_) {
+                    mode_ = WriteMode::Random;
+                }
+                if (mode_ == WriteMode::Compressed && !tiff_) {
+                    mode_ = WriteMode::Ordered;
+                }
+                if (mode_ == WriteMode::Sharded && !shards_) {
+                    mode_ = WriteMode::Random;
+                }
 
-                        DataChunk<OutDataType> data(0, 0, 1, 1, 1); // 临时数据块
-                        for (;;) {
-                            {
-                                // 如果缓冲区中没有数据,则等待数据的到来
-                                std::unique_lock<std::mutex> lk(mutexWriteQueue_);
-                                while (writeQueue_.empty() && !stop) {
-                                    condWriteQueueNotEmpty_.wait(lk);
-                                }
+                for (size_t i = 0; i < pools_.size(); i++) {
+                    datasets_[i] = DatasetPool::instance().acquire(outfile_, GA_Update);
+                    if (!datasets_[i]) {
+                        throw std::runtime_error("GDALDataset open faild.");
+                    }
+                    GDALDataset *ds = datasets_[i].get();
 
-                                if (stop) return;
+                    if (mode_ == WriteMode::Ordered) {
+                        futures_.emplace_back(pools_[i].enqueue(
+                                &MpGDALWrite<OutDataType>::orderedWriteTask, this, ds));
+                    } else {
+                        futures_.emplace_back(pools_[i].enqueue(
+                                &MpGDALWrite<OutDataType>::randomWriteTask, this, ds));
+                    }
+                }
+            } // end MpGDALWrite()
 
-                                data = std::move(writeQueue_.front());
-                                writeQueue_.pop();
-                            }
-                            condWriteQueueNotFull_.notify_all();
+            virtual ~MpGDALWrite() {
+                try {
+                    finish();
+                } catch (...) {
+                    // 析构函数中不再向外抛出异常
+                }
 
-                            //auto start = std::chrono::high_resolution_clock::now();
+                // 归还时关闭更新句柄，并使该文件的空闲只读句柄失效
+                datasets_.clear();
+                if (raw_ || tiff_) {
+                    raw_.reset();
+                    tiff_.reset();
+                    DatasetPool::instance().invalidate(outfile_);
+                }
+            }
 
-                            // 各个写线程“随机”写数据块
-                            WriteDataChunk<OutDataType> write(ds);
-                            if ( !write(data) ) {
-                                throw std::runtime_error("Writing data chunk is faild.");
-                            }
+            /**
+             * 通知写线程不会再有新的数据块，并阻塞等待写缓冲队列（以及重排缓冲区）
+             * 中的数据全部写出后返回；写线程中抛出的异常会在此处重新抛出。
+             * 并行压缩时写出未填满的分块及文件目录，分片写出时生成 VRT 文件（并合并各分片），
+             * 生成概视图时最后写入输出文件（或 VRT 文件）的概视图
+             */
+            void finish() {
+                {
+                    std::unique_lock<std::mutex> lk(mutexWriteQueue_);
+                    stop = true;
+                }
+                condWriteQueueNotEmpty_.notify_all();
 
-                            //auto end = std::chrono::high_resolution_clock::now();
-                            //std::chrono::duration<double, std::milli> elapsed = end-start;
-                            //std::cout<< "write: " << elapsed.count() << std::endl;
-                        }
-                    }); // end lambad
+                // 等待所有写线程退出（其他写线程可能仍在使用数据集），再将第一个异常传递给调用者
+                std::vector<std::future<void>> futures;
+                futures.swap(futures_);
+                std::exception_ptr error;
+                for (auto &fut : futures) {
+                    try {
+                        fut.get();
+                    } catch (...) {
+                        if (!error) error = std::current_exception();
+                    }
                 }
-            } // end MpGDALWrite()
+                if (error) std::rethrow_exception(error);
 
-            virtual ~MpGDALWrite() {
-                for (auto &ds : datasets_) {
-                    GDALClose((GDALDatasetH)ds);
+                if (tiff_ && !tiff_->finish()) {
+                    throw std::runtime_error("Writing TIFF directory is faild.");
+                }
+
+                // 只处理一次（析构时会再次调用 finish()）
+                std::shared_ptr<ShardedWriter> shards;
+                shards.swap(shards_);
+                if (shards && !shards->writeVrt()) {
+                    throw std::runtime_error("Writing VRT file is faild.");
+                }
+                if (shards && mergeShards_ && !shards->merge<OutDataType>()) {
+                    throw std::runtime_error("Merging shards is faild.");
+                }
+
+                std::unique_ptr<OverviewBuilder> overviews;
+                overviews.swap(overviews_);
+                if (overviews) {
+                    // 写线程已退出，归还更新句柄后重新以更新方式打开最终的输出文件
+                    datasets_.clear();
+                    std::string target = (shards && !mergeShards_) ? shards->vrtFile() : outfile_;
+                    DatasetLease ds = DatasetPool::instance().acquire(target, GA_Update);
+                    if (!overviews->finish() || !ds || !overviews->apply(ds.get())) {
+                        throw std::runtime_error("Building overviews is faild.");
+                    }
                 }
             }
 
             int threadsCount() const { return pools_.size(); }
+            WriteMode mode() const { return mode_; }
+
+            // 分片写出时，是否在结束时将各分片合并到输出文件（合并后删除分片及 VRT 文件），默认不合并
+            void setMergeShards(bool value) { mergeShards_ = value; }
+
+            /**
+             * 写出数据块的同时生成概视图，需在写出数据块之前调用
+             * @param levels        概视图级数，为 0 时一直生成到概视图的宽、高均不大于 256
+             * @param resampling    重采样方式
+             * @return              输出文件无法打开或临时文件创建失败时返回 false
+             */
+            bool setOverviews(int levels = 0, OverviewResampling resampling = OverviewResampling::Average) {
+                std::unique_ptr<OverviewBuilder> builder;
+                if (tiff_) {
+                    // 压缩输出已被截断，只能从原有的目录中获取影像信息
+                    builder.reset(new OverviewBuilder(tiff_->xSize(), tiff_->ySize(), tiff_->bands(),
+                            tiff_->dataType(), outfile_, levels, resampling));
+                    double value;
+                    for (int b = 1; tiff_->noData(value) && b <= tiff_->bands(); b++) {
+                        builder->setNoData(b, value);
+                    }
+                } else {
+                    DatasetLease ds = DatasetPool::instance().acquire(outfile_);
+                    if (!ds || ds->GetRasterCount() < 1) return false;
+                    builder.reset(new OverviewBuilder(ds->GetRasterXSize(), ds->GetRasterYSize(),
+                            ds->GetRasterCount(), ds->GetRasterBand(1)->GetRasterDataType(),
+                            outfile_, levels, resampling));
+                    for (int b = 1; b <= ds->GetRasterCount(); b++) {
+                        int ok = 0;
+                        double value = ds->GetRasterBand(b)->GetNoDataValue(&ok);
+                        if (ok) builder->setNoData(b, value);
+                    }
+                }
+
+                if (!builder->valid()) return false;
+                overviews_ = std::move(builder);
+                return true;
+            }
+
+            /**
+             * 写出一个数据块（可在多个线程中同时调用）：生成概视图时先归约到各级概视图，
+             * 然后直接写出，或放入写缓冲队列（队列已满时等待）；写线程出错后抛出异常
+             */
+            void write(DataChunk<OutDataType> &&data) {
+                if (overviews_ && !overviews_->add(data)) {
+                    throw std::runtime_error("Building overviews is faild.");
+                }
+
+                // 直接写到文件中的最终位置（或压缩后追加到文件末尾），不经过写缓冲队列
+                if (writeDirect(data)) return;
+
+                {
+                    // 等待队列中有空闲位置
+                    std::unique_lock<std::mutex> lk(mutexWriteQueue_);
+                    while (writeQueue_.size() >= writeQueueMaxSize_ && !writeFailed_) {
+                        condWriteQueueNotFull_.wait(lk);
+                    }
+                    if (writeFailed_) {
+                        throw std::runtime_error("Writing data chunk is faild.");
+                    }
+
+                    // 将准备输出的块数据移动到写缓冲队列中
+                    writeQueue_.emplace(std::move(data));
+                }
+                condWriteQueueNotEmpty_.notify_all();
+            }
+
+            /**
+             * Raw 方式下在调用者线程中直接写出数据块，Compressed 方式下在调用者线程中压缩并写出填满的分块，
+             * Sharded 方式下在调用者线程中写到所在的分片（可在多个线程中同时调用）
+             * @return  不是以上方式时返回 false，由调用者放入写缓冲队列
+             */
+            bool writeDirect(DataChunk<OutDataType> &data) {
+                if (!raw_ && !tiff_ && !shards_) return false;
+                if ( !(raw_ ? raw_->write(data) : (tiff_ ? tiff_->write(data) : shards_->write(data))) ) {
+                    throw std::runtime_error("Writing data chunk is faild.");
+                }
+                return true;
+            }
+
+        private:
+            // 打开压缩 GTiff 输出前关闭该文件的空闲只读句柄，文件将被重写
+            static std::shared_ptr<TiledTiffWriter> OpenTiff(const std::string &outfile) {
+                DatasetPool::instance().invalidate(outfile);
+                return TiledTiffWriter::Open(outfile);
+            }
+
+            static std::shared_ptr<ShardedWriter> OpenShards(const std::string &outfile, int shardCount) {
+                std::shared_ptr<ShardedWriter> shards = ShardedWriter::Open(outfile,
+                        shardCount > 1 ? shardCount : Executor::instance().computeSlots());
+                if (shards && !shards->create()) return nullptr;
+                return shards;
+            }
+
+            /**
+             * 从写缓冲队列中取出一个数据块，队列为空时等待
+             * @return 停止写出且队列已排空时返回 false
+             */
+            bool popWriteQueue(DataChunk<OutDataType> &data) {
+                {
+                    // 如果缓冲区中没有数据,则等待数据的到来
+                    std::unique_lock<std::mutex> lk(mutexWriteQueue_);
+                    while (writeQueue_.empty() && !stop) {
+                        condWriteQueueNotEmpty_.wait(lk);
+                    }
+
+                    // 即使已停止，也要先将队列中剩余的数据写完
+                    if (writeQueue_.empty()) return false;
+
+                    data = std::move(writeQueue_.front());
+                    writeQueue_.pop();
+                }
+                condWriteQueueNotFull_.notify_all();
+                return true;
+            }
+
+            void writeChunk(GDALDataset *ds, DataChunk<OutDataType> &data) {
+                WriteDataChunk<OutDataType> write(ds);
+                if ( !write(data) ) {
+                    throw std::runtime_error("Writing data chunk is faild.");
+                }
+            }
+
+            // 写线程出错退出前调用：唤醒等待队列空闲位置的调用者，使其抛出异常而不是一直等待
+            void setWriteFailed() {
+                {
+                    std::unique_lock<std::mutex> lk(mutexWriteQueue_);
+                    writeFailed_ = true;
+                }
+                condWriteQueueNotFull_.notify_all();
+            }
+
+            // 各个写线程“随机”写数据块
+            void randomWriteTask(GDALDataset *ds) {
+                try {
+                    DataChunk<OutDataType> data(0, 0, 1, 1, 1); // 临时数据块
+                    while (popWriteQueue(data)) {
+                        writeChunk(ds, data);
+                    }
+                } catch (...) {
+                    setWriteFailed();
+                    throw;
+                }
+            }
+
+            // 按文件顺序写出数据块（出错时处理同 randomWriteTask）
+            void orderedWriteTask(GDALDataset *ds) {
+                try {
+                    orderedWrite(ds);
+                } catch (...) {
+                    setWriteFailed();
+                    throw;
+                }
+            }
+
+            // 按文件顺序（自上而下）写出数据块，同一行的数据块拼接成整行条带后一次写出
+            void orderedWrite(GDALDataset *ds) {
+                using Key = std::pair<int, int>; // (yOff, xOff)
+                std::map<Key, DataChunk<OutDataType>> pending; // 重排缓冲区
+
+                int imgXSize = ds->GetRasterXSize();
+                int nextY = 0; // 下一行待写出数据块的起始行号
+
+                DataChunk<OutDataType> data(0, 0, 1, 1, 1); // 临时数据块
+                while (popWriteQueue(data)) {
+
+                    // 所在行已被提前写出的迟到数据块，直接写出
+                    if (data.dims().yOff() < nextY) {
+                        writeChunk(ds, data);
+                        continue;
+                    }
+
+                    Key key(data.dims().yOff(), data.dims().xOff());
+                    pending.emplace(key, std::move(data));
+
+                    // 依次写出已经到齐的整行条带
+                    while (writeReadyStrip(ds, pending, imgXSize, nextY)) {}
+
+                    // 重排缓冲区过大，将最靠前的一行数据块直接写出
+                    if (pending.size() > static_cast<size_t>(reorderMaxSize_)) {
+                        int y = pending.begin()->first.first;
+                        int ySize = pending.begin()->second.dims().ySize();
+                        auto it = pending.begin();
+                        while (it != pending.end() && it->first.first == y) {
+                            writeChunk(ds, it->second);
+                            it = pending.erase(it);
+                        }
+                        nextY = std::max(nextY, y + ySize);
+                    }
+                }
+
+                // 排空：剩余的数据块（如不能拼成整行）按文件顺序逐块写出
+                for (auto &item : pending) {
+                    writeChunk(ds, item.second);
+                }
+            } // end orderedWrite()
+
+            /**
+             * 若起始行为 nextY 的一整行数据块均已到达，则拼接为整行条带并写出
+             * @return 写出了一行则返回 true
+             */
+            bool writeReadyStrip(GDALDataset *ds,
+                    std::map<std::pair<int, int>, DataChunk<OutDataType>> &pending,
+                    int imgXSize, int &nextY) {
+                auto first = pending.find(std::make_pair(nextY, 0));
+                if (first == pending.end()) return false;
+
+                // 检查该行的数据块是否到齐
+                int ySize = first->second.dims().ySize();
+                int x = 0;
+                auto it = first;
+                while (it != pending.end() && it->first.first == nextY && it->first.second == x
+                       && it->second.dims().ySize() == ySize) {
+                    x += it->second.dims().xSize();
+                    ++it;
+                }
+                if (x < imgXSize) return false;
+
+                if (std::next(first) == it) {
+                    // 数据块本身就是整行，无需拼接
+                    writeChunk(ds, first->second);
+                } else {
+                    DataChunk<OutDataType> strip(SpatialDims(0, nextY, imgXSize, ySize),
+                            first->second.dims().bands(), first->second.interleave());
+                    for (auto blk = first; blk != it; ++blk) {
+                        copyToStrip(blk->second, strip);
+                    }
+                    writeChunk(ds, strip);
+                }
+
+                pending.erase(first, it);
+                nextY += ySize;
+                return true;
+            }
+
+            // 将数据块复制到整行条带中的对应位置（两者的波段范围及组织方式相同）
+            static void copyToStrip(DataChunk<OutDataType> &blk, DataChunk<OutDataType> &strip) {
+                int bands = blk.dims().bandCount();
+                int xOff = blk.dims().xOff();
+                int xSize = blk.dims().xSize();
+                int ySize = blk.dims().ySize();
+                int stripXSize = strip.dims().xSize();
+                OutDataType *src = blk.data();
+                OutDataType *dst = strip.data();
+
+                switch (blk.interleave()) {
+                    case Interleave::BIP :
+                    {
+                        // 光谱补齐时像素间隔为 stride()，两者的间隔不同时逐像素复制
+                        size_t srcStride = blk.stride();
+                        size_t dstStride = strip.stride();
+                        for (int r = 0; r < ySize; r++) {
+                            OutDataType *d = dst + (static_cast<size_t>(r)*stripXSize + xOff)*dstStride;
+                            const OutDataType *s = src + static_cast<size_t>(r)*xSize*srcStride;
+                            if (srcStride == dstStride) {
+                                memcpy(d, s, sizeof(OutDataType)*xSize*srcStride);
+                                continue;
+                            }
+                            for (int c = 0; c < xSize; c++) {
+                                memcpy(d + c*dstStride, s + c*srcStride, sizeof(OutDataType)*bands);
+                            }
+                        }
+                        break;
+                    }
+
+                    case Interleave::BIL :
+                    {
+                        for (int r = 0; r < ySize; r++) {
+                            for (int b = 0; b < bands; b++) {
+                                memcpy(dst + (static_cast<size_t>(r)*bands + b)*stripXSize + xOff,
+                                       src + (static_cast<size_t>(r)*bands + b)*xSize,
+                                       sizeof(OutDataType)*xSize);
+                            }
+                        }
+                        break;
+                    }
+
+                    case Interleave::BSQ :
+                    {
+                        for (int b = 0; b < bands; b++) {
+                            for (int r = 0; r < ySize; r++) {
+                                memcpy(dst + (static_cast<size_t>(b)*ySize + r)*stripXSize + xOff,
+                                       src + (static_cast<size_t>(b)*ySize + r)*xSize,
+                                       sizeof(OutDataType)*xSize);
+                            }
+                        }
+                        break;
+                    }
+
+                    default :
+                    {
+                        // 像素分组：一组像素可能跨越数据块的多行，逐元素复制
+                        Interleave intl = blk.interleave();
+                        int stripYSize = strip.dims().ySize();
+                        for (int r = 0; r < ySize; r++) {
+                            for (int c = 0; c < xSize; c++) {
+                                for (int b = 0; b < bands; b++) {
+                                    dst[InterleaveOffset(intl, stripXSize, stripYSize, bands, xOff + c, r, b)] =
+                                            src[InterleaveOffset(intl, xSize, ySize, bands, c, r, b)];
+                                }
+                            }
+                        }
+                        break;
+                    }
+                } // end switch
+            }
 
         private:
             std::string outfile_;
+            WriteMode mode_;
+            std::shared_ptr<RawWriter> raw_;    // Raw 方式的输出文件
+            std::shared_ptr<TiledTiffWriter> tiff_; // Compressed 方式的输出文件
+            std::shared_ptr<ShardedWriter> shards_; // Sharded 方式的分片文件
+            bool mergeShards_ = false;
+            std::unique_ptr<OverviewBuilder> overviews_;    // 写出过程中生成的概视图
 
         private:
-            std::vector<ThreadPool> pools_;
-            std::vector<GDALDataset*> datasets_;
+            std::vector<SerialQueue> pools_;
+            std::vector<DatasetLease> datasets_;
+            std::vector<std::future<void>> futures_;
         };
 
     } // namespace Mp
@@ -0,0 +1,762 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 压缩 GTiff 文件的并行写出：由 GDAL 写出压缩 GTiff 时，压缩在写线程中串行进行，往往成为整个流水线的瓶颈。
+// 这里由各消费者线程按输出文件的分块（或条带）布局自行拼接、压缩数据块，压缩后的数据只需追加到文件末尾，
+// 全部写出后再按原有的 TIFF 目录（IFD）重写目录并填入各分块的偏移量及长度。
+// 支持 DEFLATE（需要 zlib）和 LZW 压缩以及水平差分预测（PREDICTOR=2），其他情况由调用者回退到 GDAL 写出
+
+#ifndef IMGPROCESS_RSTOOL_TIFFWRITER_H
+#define IMGPROCESS_RSTOOL_TIFFWRITER_H
+
+#include "rstool_rawio.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cstdlib>
+
+// 由构建系统定义（CMakeLists.txt 中的 RSTOOL_WITH_ZLIB 选项），同时链接 zlib；未定义时不支持 DEFLATE
+#ifndef RSTOOL_HAVE_ZLIB
+#define RSTOOL_HAVE_ZLIB 0
+#endif
+
+#if RSTOOL_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace RSTool {
+
+    /**
+     * TIFF 的 LZW 压缩（与 libtiff 兼容：MSB 优先、提前一个码字增加码长）
+     * @param src   待压缩的数据
+     * @param len   数据长度（字节）
+     * @param out   压缩结果
+     */
+    inline void CompressLzw(const unsigned char *src, size_t len, std::vector<unsigned char> &out) {
+        const int CODE_CLEAR = 256, CODE_EOI = 257, CODE_FIRST = 258, CODE_MAX = 4095;
+        const int HASH_SIZE = 9001; // 大于 4096 的素数，开放寻址
+
+        out.clear();
+        out.reserve(len/2 + 16);
+
+        uint32_t acc = 0;
+        int accBits = 0;
+        int nbits = 9;
+        auto put = [&](int code) {
+            acc = (acc << nbits) | static_cast<uint32_t>(code);
+            accBits += nbits;
+            while (accBits >= 8) {
+                out.push_back(static_cast<unsigned char>(acc >> (accBits - 8)));
+                accBits -= 8;
+            }
+        };
+
+        std::vector<int32_t> keys(HASH_SIZE);
+        std::vector<int16_t> codes(HASH_SIZE);
+        auto reset = [&]() {
+            std::fill(keys.begin(), keys.end(), -1);
+            nbits = 9;
+        };
+
+        // 分配新码字后检查码长，码表满时输出清除码并重建码表
+        int next = CODE_FIRST;
+        auto grow = [&]() {
+            if (++next == CODE_MAX - 1) {
+                put(CODE_CLEAR);
+                reset();
+                next = CODE_FIRST;
+            } else if (next > (1 << nbits) - 1) {
+                nbits++;
+            }
+        };
+
+        reset();
+        put(CODE_CLEAR);
+        if (len > 0) {
+            int w = src[0];
+            for (size_t i = 1; i < len; i++) {
+                int32_t key = (w << 8) | src[i];
+                int h = static_cast<int>(static_cast<uint32_t>(key*2654435761u) % HASH_SIZE);
+                while (keys[h] != -1 && keys[h] != key) {
+                    if (++h == HASH_SIZE) h = 0;
+                }
+                if (keys[h] == key) {
+                    w = codes[h];
+                    continue;
+                }
+
+                put(w);
+                keys[h] = key;
+                codes[h] = static_cast<int16_t>(next);
+                grow();
+                w = src[i];
+            }
+            put(w);
+            grow();
+        }
+        put(CODE_EOI);
+        if (accBits > 0) {
+            out.push_back(static_cast<unsigned char>(acc << (8 - accBits)));
+        }
+    }
+
+    /**
+     * DEFLATE 压缩（zlib 格式，即 TIFF 的 Adobe Deflate）
+     * @return  没有 zlib 或压缩失败时返回 false
+     */
+    inline bool CompressDeflate(const unsigned char *src, size_t len, int level,
+            std::vector<unsigned char> &out) {
+#if RSTOOL_HAVE_ZLIB
+        uLongf bound = compressBound(static_cast<uLong>(len));
+        out.resize(bound);
+        if (compress2(out.data(), &bound, src, static_cast<uLong>(len), level) != Z_OK) {
+            return false;
+        }
+        out.resize(bound);
+        return true;
+#else
+        (void)src;
+        (void)len;
+        (void)level;
+        (void)out;
+        return false;
+#endif
+    }
+
+    /**
+     * 按分块（或条带）并行写出压缩的 GTiff 文件。
+     * 输出文件需先由 GDAL 创建（如 GTiff 驱动的 COMPRESS=DEFLATE、TILED=YES），
+     * 打开时读取其第一个目录确定分块布局、压缩方式等，其余标签（地理参考、NoData、元数据等）原样保留。
+     *
+     * 任意线程均可写出数据块（互不重叠）：数据块先复制到所覆盖的分块中，分块的有效区域填满后
+     * 由填满它的线程压缩，并在文件末尾原子地预留空间后直接写出（pwrite），因此没有写线程，
+     * 也不需要按顺序写出；finish() 压缩未填满的分块（其余部分填 NoData 值，没有时填 0），最后写出目录
+     */
+    class TiledTiffWriter {
+    public:
+        /**
+         * 打开由 GDAL 创建的压缩 GTiff 文件，文件原有的数据将被丢弃
+         * @return  不是小端 TIFF、压缩方式或预测方式不支持、包含多个目录等情况返回空指针
+         */
+        static std::shared_ptr<TiledTiffWriter> Open(const std::string &file) {
+#if defined(__linux__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            int fd = open(file.c_str(), O_RDWR);
+            if (fd < 0) return nullptr;
+
+            std::shared_ptr<TiledTiffWriter> writer(new TiledTiffWriter(fd));
+            if (!writer->parse() || ftruncate(fd, HEADER_BYTES) != 0) {
+                return nullptr;
+            }
+            return writer;
+#else
+            (void)file;
+            return nullptr;
+#endif
+        }
+
+        ~TiledTiffWriter() {
+#ifdef __linux__
+            close(fd_);
+#endif
+        }
+
+        TiledTiffWriter(const TiledTiffWriter &) = delete;
+        TiledTiffWriter& operator= (const TiledTiffWriter &) = delete;
+
+        int xSize() const { return xSize_; }
+        int ySize() const { return ySize_; }
+        int bands() const { return bands_; }
+        GDALDataType dataType() const { return dataType_; }
+        int tileXSize() const { return tileXSize_; }
+        int tileYSize() const { return tileYSize_; }
+
+        /**
+         * 读取 GDAL 写入的 NoData 值（GDAL_NODATA 标签）
+         * @return  没有设置 NoData 时返回 false
+         */
+        bool noData(double &value) const {
+            const Entry *e = find(42113);
+            if (!e || e->value.empty()) return false;
+            std::string text(e->value.begin(), e->value.end());
+            value = atof(text.c_str());
+            return true;
+        }
+
+        // DEFLATE 的压缩级别（1-9），默认为 6
+        void setLevel(int level) { level_ = std::min(9, std::max(1, level)); }
+
+        /**
+         * 写出一个数据块（可在多个线程中同时调用，各数据块互不重叠）
+         * @param bandMap   波段索引（从 1 开始）
+         * @param intl      数据在内存中的组织方式
+         * @param stride    BIP 数据中相邻两个像素的间隔（见 DataChunk::stride()），0 表示等于波段数
+         * @return          越界、压缩或写入失败时返回 false
+         */
+        template <typename T>
+        bool write(int xOff, int yOff, int xSize, int ySize,
+                int bandCount, const int *bandMap, Interleave intl, const T *data, int stride = 0) {
+            if (xOff < 0 || yOff < 0 || xOff + xSize > xSize_ || yOff + ySize > ySize_) {
+                return false;
+            }
+            for (int b = 0; b < bandCount; b++) {
+                if (bandMap[b] < 1 || bandMap[b] > bands_) return false;
+            }
+
+            // 像素分组（BIP-N）及光谱补齐的数据先转换为紧凑的 BIP
+            data = UntilePixels(data, intl, xSize, ySize, bandCount, stride);
+
+            int tx0 = xOff / tileXSize_, tx1 = (xOff + xSize - 1) / tileXSize_;
+            int ty0 = yOff / tileYSize_, ty1 = (yOff + ySize - 1) / tileYSize_;
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    // 数据块与分块的交集
+                    int x0 = std::max(xOff, tx*tileXSize_);
+                    int x1 = std::min(xOff + xSize, (tx + 1)*tileXSize_);
+                    int y0 = std::max(yOff, ty*tileYSize_);
+                    int y1 = std::min(yOff + ySize, (ty + 1)*tileYSize_);
+                    int tile = ty*tilesAcross_ + tx;
+
+                    if (!separate_) {
+                        if (!fill(tile, tile, x0, x1, y0, y1, xOff, yOff, xSize, ySize,
+                                bandCount, bandMap, 0, bandCount, intl, data)) {
+                            return false;
+                        }
+                        continue;
+                    }
+
+                    // 按波段存放时每个波段是独立的分块
+                    for (int b = 0; b < bandCount; b++) {
+                        int index = (bandMap[b] - 1)*tilesPerBand_ + tile;
+                        if (!fill(index, tile, x0, x1, y0, y1, xOff, yOff, xSize, ySize,
+                                bandCount, bandMap, b, b + 1, intl, data)) {
+                            return false;
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+
+        template <typename T>
+        bool write(DataChunk<T> &data) {
+            DataDims &dims = data.dims();
+            return write(dims.xOff(), dims.yOff(), dims.xSize(), dims.ySize(),
+                    dims.bandCount(), dims.bandMap(), data.interleave(), data.data(), data.stride());
+        }
+
+        /**
+         * 压缩并写出未填满的分块，然后写出目录；所有线程的写出完成后调用，重复调用时直接返回
+         * @return  写入失败时返回 false
+         */
+        bool finish() {
+            if (finished_) return ok_;
+            finished_ = true;
+
+            std::map<int, std::shared_ptr<Pending>> pending;
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                pending.swap(pending_);
+            }
+            for (auto &item : pending) {
+                if (!encode(item.first, item.second->buf)) ok_ = false;
+            }
+
+            ok_ = ok_ && writeDirectory();
+            return ok_;
+        }
+
+    private:
+        static const int HEADER_BYTES = 16;  // 为 BigTIFF 的文件头预留
+
+        // 等待填满的分块
+        struct Pending {
+            std::mutex mutex;
+            std::vector<unsigned char> buf;
+            size_t filled = 0;  // 已填入的元素数
+        };
+
+        // 目录项，值按文件中的字节保存
+        struct Entry {
+            uint16_t tag;
+            uint16_t type;
+            uint64_t count;
+            std::vector<unsigned char> value;
+        };
+
+        explicit TiledTiffWriter(int fd) : fd_(fd) {}
+
+        static int typeBytes(uint16_t type) {
+            switch (type) {
+                case 1: case 2: case 6: case 7: return 1;   // BYTE ASCII SBYTE UNDEFINED
+                case 3: case 8: return 2;                   // SHORT SSHORT
+                case 4: case 9: case 11: case 13: return 4; // LONG SLONG FLOAT IFD
+                case 5: case 10: case 12: case 16: case 17: case 18: return 8;
+                default: return 0;
+            }
+        }
+
+        static uint64_t valueAt(const Entry &e, uint64_t i) {
+            const unsigned char *p = e.value.data();
+            switch (e.type) {
+                case 3: { uint16_t v; memcpy(&v, p + i*2, 2); return v; }
+                case 4: { uint32_t v; memcpy(&v, p + i*4, 4); return v; }
+                case 16: { uint64_t v; memcpy(&v, p + i*8, 8); return v; }
+                default: return 0;
+            }
+        }
+
+        const Entry* find(uint16_t tag) const {
+            for (auto &e : entries_) {
+                if (e.tag == tag) return &e;
+            }
+            return nullptr;
+        }
+
+        uint64_t tagValue(uint16_t tag, uint64_t def) const {
+            const Entry *e = find(tag);
+            return (e && e->count > 0) ? valueAt(*e, 0) : def;
+        }
+
+        bool readAt(void *dst, size_t len, uint64_t off) const {
+            unsigned char *p = static_cast<unsigned char*>(dst);
+            while (len > 0) {
+                ssize_t n = pread(fd_, p, len, static_cast<off_t>(off));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                p += n;
+                off += n;
+                len -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        bool writeAt(const void *src, size_t len, uint64_t off) const {
+            const unsigned char *p = static_cast<const unsigned char*>(src);
+            while (len > 0) {
+                ssize_t n = pwrite(fd_, p, len, static_cast<off_t>(off));
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                p += n;
+                off += n;
+                len -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        // 读取第一个目录，确定分块布局、数据类型及压缩方式
+        bool parse() {
+            unsigned char head[HEADER_BYTES];
+            if (!readAt(head, sizeof(head), 0) || head[0] != 'I' || head[1] != 'I') return false;
+
+            uint16_t magic;
+            memcpy(&magic, head + 2, 2);
+            uint64_t ifdOff = 0;
+            if (magic == 42) {
+                uint32_t v;
+                memcpy(&v, head + 4, 4);
+                ifdOff = v;
+            } else if (magic == 43) {
+                bigTiff_ = true;
+                memcpy(&ifdOff, head + 8, 8);
+            } else {
+                return false;
+            }
+
+            uint64_t n = 0;
+            if (bigTiff_) {
+                if (!readAt(&n, 8, ifdOff)) return false;
+            } else {
+                uint16_t v;
+                if (!readAt(&v, 2, ifdOff)) return false;
+                n = v;
+            }
+
+            size_t entryBytes = bigTiff_ ? 20 : 12;
+            size_t inlineBytes = bigTiff_ ? 8 : 4;
+            std::vector<unsigned char> raw(n*entryBytes + inlineBytes);
+            if (!readAt(raw.data(), raw.size(), ifdOff + (bigTiff_ ? 8 : 2))) return false;
+
+            // 只处理单个目录，其后还有目录（如掩膜、缩略图）时不支持
+            uint64_t nextIfd = 0;
+            memcpy(&nextIfd, raw.data() + n*entryBytes, inlineBytes);
+            if (nextIfd != 0) return false;
+
+            for (uint64_t i = 0; i < n; i++) {
+                const unsigned char *p = raw.data() + i*entryBytes;
+                Entry e;
+                memcpy(&e.tag, p, 2);
+                memcpy(&e.type, p + 2, 2);
+                if (bigTiff_) {
+                    memcpy(&e.count, p + 4, 8);
+                } else {
+                    uint32_t c;
+                    memcpy(&c, p + 4, 4);
+                    e.count = c;
+                }
+
+                // 指向其他目录的标签无法原样保留
+                if (typeBytes(e.type) == 0 || e.type == 13 || e.type == 18 ||
+                        e.tag == 330 || e.tag == 34665 || e.tag == 34853) {
+                    return false;
+                }
+
+                e.value.resize(e.count*typeBytes(e.type));
+                const unsigned char *field = p + (bigTiff_ ? 12 : 8);
+                if (e.value.size() <= inlineBytes) {
+                    memcpy(e.value.data(), field, e.value.size());
+                } else {
+                    uint64_t off = 0;
+                    memcpy(&off, field, inlineBytes);
+                    if (!readAt(e.value.data(), e.value.size(), off)) return false;
+                }
+                entries_.push_back(std::move(e));
+            }
+
+            xSize_ = static_cast<int>(tagValue(256, 0));
+            ySize_ = static_cast<int>(tagValue(257, 0));
+            bands_ = static_cast<int>(tagValue(277, 1));
+            separate_ = tagValue(284, 1) == 2;
+            compression_ = static_cast<int>(tagValue(259, 1));
+            predictor_ = static_cast<int>(tagValue(317, 1));
+            if (xSize_ <= 0 || ySize_ <= 0 || bands_ <= 0) return false;
+
+            // 各波段的数据类型需相同
+            const Entry *bits = find(258);
+            int bitsPerSample = static_cast<int>(tagValue(258, 1));
+            for (uint64_t i = 0; bits && i < bits->count; i++) {
+                if (static_cast<int>(valueAt(*bits, i)) != bitsPerSample) return false;
+            }
+            int sampleFormat = static_cast<int>(tagValue(339, 1));
+            dataType_ = GDT_Unknown;
+            if (sampleFormat == 1 && bitsPerSample == 8) dataType_ = GDT_Byte;
+            if (sampleFormat == 1 && bitsPerSample == 16) dataType_ = GDT_UInt16;
+            if (sampleFormat == 2 && bitsPerSample == 16) dataType_ = GDT_Int16;
+            if (sampleFormat == 1 && bitsPerSample == 32) dataType_ = GDT_UInt32;
+            if (sampleFormat == 2 && bitsPerSample == 32) dataType_ = GDT_Int32;
+            if (sampleFormat == 3 && bitsPerSample == 32) dataType_ = GDT_Float32;
+            if (sampleFormat == 3 && bitsPerSample == 64) dataType_ = GDT_Float64;
+            if (dataType_ == GDT_Unknown) return false;
+            hasNoData_ = noData(noData_);
+
+#if RSTOOL_HAVE_ZLIB
+            bool deflate = compression_ == 8 || compression_ == 32946;
+#else
+            bool deflate = false;
+#endif
+            if (!deflate && compression_ != 5) return false;
+            if (predictor_ != 1 && !(predictor_ == 2 && sampleFormat != 3)) return false;
+
+            // 分块存放，或按条带存放（最后一个条带不补齐）
+            if (find(322) && find(323)) {
+                tileXSize_ = static_cast<int>(tagValue(322, 0));
+                tileYSize_ = static_cast<int>(tagValue(323, 0));
+                offsetsTag_ = 324;
+                countsTag_ = 325;
+            } else {
+                tileXSize_ = xSize_;
+                tileYSize_ = static_cast<int>(std::min<uint64_t>(tagValue(278, ySize_), ySize_));
+                offsetsTag_ = 273;
+                countsTag_ = 279;
+                strips_ = true;
+            }
+            if (tileXSize_ <= 0 || tileYSize_ <= 0) return false;
+
+            tilesAcross_ = (xSize_ + tileXSize_ - 1) / tileXSize_;
+            tilesPerBand_ = tilesAcross_*((ySize_ + tileYSize_ - 1) / tileYSize_);
+            size_t tiles = static_cast<size_t>(tilesPerBand_)*(separate_ ? bands_ : 1);
+            // 没有写入过数据的文件（如 libtiff 创建的空文件）可能缺少偏移量及长度标签，补上空的标签
+            for (uint16_t tag : {offsetsTag_, countsTag_}) {
+                const Entry *e = find(tag);
+                if (e && e->count != tiles) return false;
+                if (!e) {
+                    auto pos = std::find_if(entries_.begin(), entries_.end(),
+                            [tag](const Entry &item) { return item.tag > tag; });
+                    entries_.insert(pos, Entry{tag, 4, 0, std::vector<unsigned char>()});
+                }
+            }
+
+            offsets_.assign(tiles, 0);
+            counts_.assign(tiles, 0);
+            end_ = HEADER_BYTES;
+            return true;
+        }
+
+        // 分块中的有效行数（条带存放时最后一个条带不补齐）
+        int tileRows(int tile) const {
+            int ty = tile / tilesAcross_;
+            return strips_ ? std::min(tileYSize_, ySize_ - ty*tileYSize_) : tileYSize_;
+        }
+
+        // 分块中需要填入的元素数（不含超出影像的补齐部分）
+        size_t tileElems(int tile) const {
+            int tx = tile % tilesAcross_;
+            int ty = tile / tilesAcross_;
+            size_t w = std::min(tileXSize_, xSize_ - tx*tileXSize_);
+            size_t h = std::min(tileYSize_, ySize_ - ty*tileYSize_);
+            return w*h*(separate_ ? 1 : bands_);
+        }
+
+        /**
+         * 将数据块中 [x0, x1) × [y0, y1) 范围内第 b0 至 b1 个波段的数据复制到分块中，
+         * 分块填满时压缩并写出
+         * @param index 分块在文件中的序号（按波段存放时包含波段）
+         * @param tile  分块在波段内的序号
+         */
+        template <typename T>
+        bool fill(int index, int tile, int x0, int x1, int y0, int y1,
+                int xOff, int yOff, int xSize, int ySize, int bandCount, const int *bandMap,
+                int b0, int b1, Interleave intl, const T *data) {
+            std::shared_ptr<Pending> pending;
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                auto &slot = pending_[index];
+                if (!slot) {
+                    slot = std::make_shared<Pending>();
+                    slot->buf.assign(static_cast<size_t>(tileXSize_)*tileRows(tile)*
+                            (separate_ ? 1 : bands_)*GDALGetDataTypeSizeBytes(dataType_), 0);
+                    if (hasNoData_) fillNoData(slot->buf);
+                }
+                pending = slot;
+            }
+
+            bool full = false;
+            {
+                std::unique_lock<std::mutex> lk(pending->mutex);
+#define RSTOOL_FILL_TILE(S) copyToTile(tile, x0, x1, y0, y1, xOff, yOff, xSize, ySize, \
+                bandCount, bandMap, b0, b1, intl, data, reinterpret_cast<S*>(pending->buf.data()))
+                switch (dataType_) {
+                    case GDT_Byte:    RSTOOL_FILL_TILE(unsigned char); break;
+                    case GDT_Int16:   RSTOOL_FILL_TILE(short); break;
+                    case GDT_UInt16:  RSTOOL_FILL_TILE(unsigned short); break;
+                    case GDT_Int32:   RSTOOL_FILL_TILE(int); break;
+                    case GDT_UInt32:  RSTOOL_FILL_TILE(unsigned int); break;
+                    case GDT_Float32: RSTOOL_FILL_TILE(float); break;
+                    case GDT_Float64: RSTOOL_FILL_TILE(double); break;
+                    default: return false;
+                }
+#undef RSTOOL_FILL_TILE
+                pending->filled += static_cast<size_t>(x1 - x0)*(y1 - y0)*(b1 - b0);
+                full = pending->filled >= tileElems(tile);
+            }
+            if (!full) return true;
+
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                pending_.erase(index);
+            }
+            return encode(index, pending->buf);
+        }
+
+        // 分块中超出影像的部分以及没有写出过数据的部分取 NoData 值
+        void fillNoData(std::vector<unsigned char> &buf) const {
+#define RSTOOL_FILL_NODATA(S) { S *p = reinterpret_cast<S*>(buf.data()); \
+                std::fill(p, p + buf.size()/sizeof(S), SaturateCast<S>(noData_)); } break
+            switch (dataType_) {
+                case GDT_Byte:    RSTOOL_FILL_NODATA(unsigned char);
+                case GDT_Int16:   RSTOOL_FILL_NODATA(short);
+                case GDT_UInt16:  RSTOOL_FILL_NODATA(unsigned short);
+                case GDT_Int32:   RSTOOL_FILL_NODATA(int);
+                case GDT_UInt32:  RSTOOL_FILL_NODATA(unsigned int);
+                case GDT_Float32: RSTOOL_FILL_NODATA(float);
+                case GDT_Float64: RSTOOL_FILL_NODATA(double);
+                default: break;
+            }
+#undef RSTOOL_FILL_NODATA
+        }
+
+        template <typename T, typename S>
+        void copyToTile(int tile, int x0, int x1, int y0, int y1,
+                int xOff, int yOff, int xSize, int ySize, int bandCount, const int *bandMap,
+                int b0, int b1, Interleave intl, const T *data, S *dst) const {
+            int tileX = (tile % tilesAcross_)*tileXSize_;
+            int tileY = (tile / tilesAcross_)*tileYSize_;
+            size_t srcStride = intl == Interleave::BIP ? bandCount : 1;
+            size_t dstStride = separate_ ? 1 : bands_;
+            int w = x1 - x0;
+
+            for (int y = y0; y < y1; y++) {
+                for (int b = b0; b < b1; b++) {
+                    const T *s = data + InterleaveOffset(intl, xSize, ySize, bandCount,
+                            x0 - xOff, y - yOff, b);
+                    S *d = dst + (static_cast<size_t>(y - tileY)*tileXSize_ + (x0 - tileX))*dstStride +
+                           (separate_ ? 0 : bandMap[b] - 1);
+
+                    if (srcStride == 1 && dstStride == 1) {
+                        ConvertSaturate(s, d, w);
+                    } else {
+                        for (int x = 0; x < w; x++) {
+                            d[x*dstStride] = SaturateCast<S>(s[x*srcStride]);
+                        }
+                    }
+                }
+            }
+        }
+
+        // 水平差分预测：每行从后向前减去同一波段的前一个像元（按无符号整数回绕）
+        template <typename U>
+        void predict(unsigned char *buf, int rows) const {
+            int stride = separate_ ? 1 : bands_;
+            size_t rowElems = static_cast<size_t>(tileXSize_)*stride;
+            U *p = reinterpret_cast<U*>(buf);
+            for (int r = 0; r < rows; r++, p += rowElems) {
+                for (size_t i = rowElems - 1; i >= static_cast<size_t>(stride); i--) {
+                    p[i] = static_cast<U>(p[i] - p[i - stride]);
+                }
+            }
+        }
+
+        // 压缩一个分块并追加到文件末尾，记录其偏移量及长度
+        bool encode(int index, std::vector<unsigned char> &buf) {
+            int rows = tileRows(index % tilesPerBand_);
+            if (predictor_ == 2) {
+                switch (GDALGetDataTypeSizeBytes(dataType_)) {
+                    case 1: predict<uint8_t>(buf.data(), rows); break;
+                    case 2: predict<uint16_t>(buf.data(), rows); break;
+                    case 4: predict<uint32_t>(buf.data(), rows); break;
+                    default: return false;
+                }
+            }
+
+            static thread_local std::vector<unsigned char> packed;
+            if (compression_ == 5) {
+                CompressLzw(buf.data(), buf.size(), packed);
+            } else if (!CompressDeflate(buf.data(), buf.size(), level_, packed)) {
+                return false;
+            }
+
+            // 预留空间后直接写出，多个线程互不等待
+            uint64_t off = end_.fetch_add(packed.size());
+            if (!writeAt(packed.data(), packed.size(), off)) return false;
+            offsets_[index] = off;
+            counts_[index] = packed.size();
+            return true;
+        }
+
+        // 在文件末尾写出目录（分块的偏移量及长度替换为实际值），最后更新文件头
+        bool writeDirectory() {
+            uint64_t ifdOff = (end_.load() + 7) & ~static_cast<uint64_t>(7);
+
+            // 目录及其后的数据超出 4GB 时改为 BigTIFF
+            bool big = bigTiff_;
+            for (int pass = 0; pass < 2; pass++) {
+                std::vector<unsigned char> ifd = buildDirectory(ifdOff, big);
+                if (!big && ifdOff + ifd.size() > 0xFFFFFFFFull) {
+                    big = true;
+                    continue;
+                }
+
+                unsigned char head[HEADER_BYTES] = {'I', 'I'};
+                if (big) {
+                    uint16_t magic = 43, offBytes = 8, zero = 0;
+                    memcpy(head + 2, &magic, 2);
+                    memcpy(head + 4, &offBytes, 2);
+                    memcpy(head + 6, &zero, 2);
+                    memcpy(head + 8, &ifdOff, 8);
+                } else {
+                    uint16_t magic = 42;
+                    uint32_t off = static_cast<uint32_t>(ifdOff);
+                    memcpy(head + 2, &magic, 2);
+                    memcpy(head + 4, &off, 4);
+                }
+                return writeAt(ifd.data(), ifd.size(), ifdOff) && writeAt(head, sizeof(head), 0);
+            }
+            return false;
+        }
+
+        std::vector<unsigned char> buildDirectory(uint64_t ifdOff, bool big) const {
+            size_t entryBytes = big ? 20 : 12;
+            size_t inlineBytes = big ? 8 : 4;
+            size_t countBytes = big ? 8 : 2;
+
+            // 偏移量及长度：BigTIFF 用 LONG8，否则用 LONG
+            std::vector<Entry> entries = entries_;
+            for (auto &e : entries) {
+                if (e.tag != offsetsTag_ && e.tag != countsTag_) continue;
+                const std::vector<uint64_t> &values = e.tag == offsetsTag_ ? offsets_ : counts_;
+                e.type = big ? 16 : 4;
+                e.count = values.size();
+                e.value.resize(values.size()*(big ? 8 : 4));
+                for (size_t i = 0; i < values.size(); i++) {
+                    if (big) {
+                        memcpy(e.value.data() + i*8, &values[i], 8);
+                    } else {
+                        uint32_t v = static_cast<uint32_t>(values[i]);
+                        memcpy(e.value.data() + i*4, &v, 4);
+                    }
+                }
+            }
+
+            size_t dirBytes = countBytes + entries.size()*entryBytes + inlineBytes;
+            std::vector<unsigned char> out(dirBytes, 0);
+            uint64_t n = entries.size();
+            memcpy(out.data(), &n, countBytes);
+
+            for (size_t i = 0; i < entries.size(); i++) {
+                const Entry &e = entries[i];
+                unsigned char *p = out.data() + countBytes + i*entryBytes;
+                memcpy(p, &e.tag, 2);
+                memcpy(p + 2, &e.type, 2);
+                memcpy(p + 4, &e.count, big ? 8 : 4);
+                unsigned char *field = p + (big ? 12 : 8);
+
+                if (e.value.size() <= inlineBytes) {
+                    memcpy(field, e.value.data(), e.value.size());
+                    continue;
+                }
+
+                // 放不下的值依次存放在目录之后（按字对齐）
+                if (out.size() % 2) out.push_back(0);
+                uint64_t off = ifdOff + out.size();
+                memcpy(out.data() + countBytes + i*entryBytes + (big ? 12 : 8), &off, inlineBytes);
+                out.insert(out.end(), e.value.begin(), e.value.end());
+            }
+            return out;
+        }
+
+    private:
+        int fd_;
+        std::vector<Entry> entries_;    // 原有目录中的全部标签（按标签号排列）
+        bool bigTiff_ = false;
+
+        int xSize_ = 0;
+        int ySize_ = 0;
+        int bands_ = 0;
+        GDALDataType dataType_ = GDT_Unknown;
+        bool separate_ = false;     // 按波段存放（PlanarConfiguration = 2）
+        int compression_ = 1;
+        int predictor_ = 1;
+        int level_ = 6;
+        bool hasNoData_ = false;    // 是否设置了 NoData 值（GDAL_NODATA 标签）
+        double noData_ = 0;
+
+        int tileXSize_ = 0;
+        int tileYSize_ = 0;
+        int tilesAcross_ = 0;
+        int tilesPerBand_ = 0;
+        bool strips_ = false;
+        uint16_t offsetsTag_ = 324;
+        uint16_t countsTag_ = 325;
+
+        std::mutex mutex_;
+        std::map<int, std::shared_ptr<Pending>> pending_;
+
+        std::atomic<uint64_t> end_{HEADER_BYTES};   // 文件当前的末尾
+        std::vector<uint64_t> offsets_;
+        std::vector<uint64_t> counts_;
+        bool finished_ = false;
+        bool ok_ = true;
+    };
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_TIFFWRITER_H
@@ -0,0 +1,196 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 分块转置：数据组织方式（BSQ/BIL/BIP）之间的转换本质上是矩阵转置，
+// 按 L1 缓存大小分块，块内以 SSE 寄存器转置 8x8（1、2 字节）、4x4（4 字节）、2x2（8 字节）的小块，
+// 避免逐元素的跨步读写
+
+#ifndef IMGPROCESS_RSTOOL_TRANSPOSE_H
+#define IMGPROCESS_RSTOOL_TRANSPOSE_H
+
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RSTOOL_TRANSPOSE_SSE2 1
+#else
+#define RSTOOL_TRANSPOSE_SSE2 0
+#endif
+
+namespace RSTool {
+
+    namespace Detail {
+
+        /**
+         * 寄存器转置的小块：按元素字节数特化，N 为小块的行数（= 列数），
+         * run() 转置 src 处 N 行 N 列的元素到 dst（行跨度均以字节计）
+         */
+        template <size_t Bytes>
+        struct TransposeKernel {
+            static const int N = 1;
+            static void run(const char *, size_t, char *, size_t) {}
+        };
+
+#if RSTOOL_TRANSPOSE_SSE2
+        template <>
+        struct TransposeKernel<1> {
+            static const int N = 8;
+            static void run(const char *src, size_t srcStride, char *dst, size_t dstStride) {
+                __m128i t0 = _mm_unpacklo_epi8(load(src), load(src + srcStride));
+                __m128i t1 = _mm_unpacklo_epi8(load(src + 2*srcStride), load(src + 3*srcStride));
+                __m128i t2 = _mm_unpacklo_epi8(load(src + 4*srcStride), load(src + 5*srcStride));
+                __m128i t3 = _mm_unpacklo_epi8(load(src + 6*srcStride), load(src + 7*srcStride));
+
+                __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+                __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+                __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+                __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+
+                // 每个寄存器包含转置后的两行
+                store2(_mm_unpacklo_epi32(u0, u2), dst, dstStride);
+                store2(_mm_unpackhi_epi32(u0, u2), dst + 2*dstStride, dstStride);
+                store2(_mm_unpacklo_epi32(u1, u3), dst + 4*dstStride, dstStride);
+                store2(_mm_unpackhi_epi32(u1, u3), dst + 6*dstStride, dstStride);
+            }
+
+        private:
+            static __m128i load(const char *p) {
+                return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+            }
+
+            static void store2(__m128i v, char *dst, size_t dstStride) {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), v);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + dstStride), _mm_unpackhi_epi64(v, v));
+            }
+        };
+
+        template <>
+        struct TransposeKernel<2> {
+            static const int N = 8;
+            static void run(const char *src, size_t srcStride, char *dst, size_t dstStride) {
+                __m128i r[8];
+                for (int i = 0; i < 8; i++) {
+                    r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i*srcStride));
+                }
+
+                __m128i t0 = _mm_unpacklo_epi16(r[0], r[1]);
+                __m128i t1 = _mm_unpackhi_epi16(r[0], r[1]);
+                __m128i t2 = _mm_unpacklo_epi16(r[2], r[3]);
+                __m128i t3 = _mm_unpackhi_epi16(r[2], r[3]);
+                __m128i t4 = _mm_unpacklo_epi16(r[4], r[5]);
+                __m128i t5 = _mm_unpackhi_epi16(r[4], r[5]);
+                __m128i t6 = _mm_unpacklo_epi16(r[6], r[7]);
+                __m128i t7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+                __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+                __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+                __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+                __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+                __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+                __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+                __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+                __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+                store(_mm_unpacklo_epi64(u0, u4), dst);
+                store(_mm_unpackhi_epi64(u0, u4), dst + dstStride);
+                store(_mm_unpacklo_epi64(u1, u5), dst + 2*dstStride);
+                store(_mm_unpackhi_epi64(u1, u5), dst + 3*dstStride);
+                store(_mm_unpacklo_epi64(u2, u6), dst + 4*dstStride);
+                store(_mm_unpackhi_epi64(u2, u6), dst + 5*dstStride);
+                store(_mm_unpacklo_epi64(u3, u7), dst + 6*dstStride);
+                store(_mm_unpackhi_epi64(u3, u7), dst + 7*dstStride);
+            }
+
+        private:
+            static void store(__m128i v, char *dst) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+            }
+        };
+
+        template <>
+        struct TransposeKernel<4> {
+            static const int N = 4;
+            static void run(const char *src, size_t srcStride, char *dst, size_t dstStride) {
+                __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + srcStride));
+                __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*srcStride));
+                __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3*srcStride));
+
+                __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+                __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+                __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+                __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(t0, t1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dstStride), _mm_unpackhi_epi64(t0, t1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*dstStride), _mm_unpacklo_epi64(t2, t3));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*dstStride), _mm_unpackhi_epi64(t2, t3));
+            }
+        };
+
+        template <>
+        struct TransposeKernel<8> {
+            static const int N = 2;
+            static void run(const char *src, size_t srcStride, char *dst, size_t dstStride) {
+                __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + srcStride));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(r0, r1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dstStride), _mm_unpackhi_epi64(r0, r1));
+            }
+        };
+#endif
+
+    } // namespace Detail
+
+    /**
+     * 转置一个 rows 行 cols 列的矩阵：dst[c*dstStride + r] = src[r*srcStride + c]
+     * @param srcStride     源数据的行跨度（元素个数）
+     * @param dstStride     目标数据的行跨度（元素个数）
+     * 源与目标不能重叠
+     */
+    template <typename T>
+    inline void Transpose(const T *src, size_t srcStride, T *dst, size_t dstStride, int rows, int cols) {
+        using Kernel = Detail::TransposeKernel<sizeof(T)>;
+        const int N = Kernel::N;
+
+        // 分块大小：块的每行为 128 字节（两个缓存行），源与目标的块可同时驻留在 L1 缓存中
+        const int BLOCK = std::max(N, static_cast<int>(128/sizeof(T)) / N * N);
+
+        const char *s = reinterpret_cast<const char*>(src);
+        char *d = reinterpret_cast<char*>(dst);
+        const size_t sStride = srcStride*sizeof(T);
+        const size_t dStride = dstStride*sizeof(T);
+
+        for (int r0 = 0; r0 < rows; r0 += BLOCK) {
+            int r1 = std::min(rows, r0 + BLOCK);
+            for (int c0 = 0; c0 < cols; c0 += BLOCK) {
+                int c1 = std::min(cols, c0 + BLOCK);
+
+                int r = r0;
+                if (N > 1) {
+                    for (; r + N <= r1; r += N) {
+                        int c = c0;
+                        for (; c + N <= c1; c += N) {
+                            Kernel::run(s + r*sStride + c*sizeof(T), sStride,
+                                        d + c*dStride + r*sizeof(T), dStride);
+                        }
+                        for (; c < c1; c++) {
+                            for (int k = r; k < r + N; k++) {
+                                dst[c*dstStride + k] = src[k*srcStride + c];
+                            }
+                        }
+                    }
+                }
+                for (; r < r1; r++) {
+                    for (int c = c0; c < c1; c++) {
+                        dst[c*dstStride + r] = src[r*srcStride + c];
+                    }
+                }
+            }
+        }
+    }
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_TRANSPOSE_H
@@ -0,0 +1,571 @@
+//
+// Created by penglei on 18-10-29.
+//
+// 基于 Linux io_uring 的异步读取：一个线程同时提交多个数据块的读请求，使 SSD 的请求队列保持饱和，
+// 适用于未压缩的 ENVI（raw）文件。直接使用系统调用，不依赖 liburing；
+// 编译环境没有 <linux/io_uring.h> 或运行时内核不支持（或被禁止）时 valid() 返回 false，由调用者回退到多线程读取
+
+#ifndef IMGPROCESS_RSTOOL_URING_H
+#define IMGPROCESS_RSTOOL_URING_H
+
+#include "rstool_rawio.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifndef RSTOOL_HAVE_IO_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define RSTOOL_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#if RSTOOL_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace RSTool {
+
+    // O_DIRECT 读取时缓冲区地址、文件偏移及长度的对齐要求（字节），兼容 512B 和 4KB 扇区
+    const size_t DIRECT_IO_ALIGN = 4096;
+
+#if RSTOOL_HAVE_IO_URING
+
+    // io_uring 的最小封装：提交读请求、等待并取出完成事件，只在一个线程中使用
+    class IoUring {
+    public:
+        explicit IoUring(unsigned entries) {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if (fd_ < 0) return;
+
+            size_t sqBytes = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+            size_t cqBytes = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                sqBytes = cqBytes = std::max(sqBytes, cqBytes);
+            }
+
+            sqRing_ = map(sqBytes, IORING_OFF_SQ_RING);
+            cqRing_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing_ : map(cqBytes, IORING_OFF_CQ_RING);
+            sqes_ = static_cast<io_uring_sqe*>(map(params.sq_entries*sizeof(io_uring_sqe), IORING_OFF_SQES));
+            sqBytes_ = sqBytes;
+            cqBytes_ = cqBytes;
+            if (sqRing_ == nullptr || cqRing_ == nullptr || sqes_ == nullptr) {
+                release();
+                return;
+            }
+
+            char *sq = static_cast<char*>(sqRing_);
+            sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            sqEntries_ = params.sq_entries;
+
+            char *cq = static_cast<char*>(cqRing_);
+            cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            cqEntries_ = params.cq_entries;
+        }
+
+        ~IoUring() { release(); }
+
+        IoUring(const IoUring &) = delete;
+        IoUring& operator= (const IoUring &) = delete;
+
+        bool valid() const { return fd_ >= 0; }
+
+        // 可同时排队的提交请求数以及完成事件数
+        unsigned sqEntries() const { return sqEntries_; }
+        unsigned cqEntries() const { return cqEntries_; }
+
+        /**
+         * 准备一个读请求（调用 submit() 后才真正提交）
+         * @param iov       读取的目标缓冲区，完成前需保持有效
+         * @param userData  完成事件中返回的用户数据
+         * @return          提交队列已满时返回 false
+         */
+        bool prepRead(int fd, const iovec *iov, off_t offset, uint64_t userData) {
+            unsigned tail = *sqTail_;
+            if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) return false;
+
+            unsigned index = tail & sqMask_;
+            io_uring_sqe &sqe = sqes_[index];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READV;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(iov);
+            sqe.len = 1;
+            sqe.off = static_cast<uint64_t>(offset);
+            sqe.user_data = userData;
+
+            sqArray_[index] = index;
+            __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+            ++pending_;
+            return true;
+        }
+
+        /**
+         * 提交已准备的请求，并等待至少 waitNr 个完成事件
+         * @return  系统调用失败时返回 false
+         */
+        bool submit(unsigned waitNr = 0) {
+            unsigned flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+            for (;;) {
+                long ret = syscall(__NR_io_uring_enter, fd_, pending_, waitNr, flags, nullptr, 0);
+                if (ret >= 0) {
+                    pending_ -= static_cast<unsigned>(ret);
+                    return true;
+                }
+                if (errno != EINTR) return false;
+            }
+        }
+
+        /**
+         * 只等待（不提交已准备的请求）至少 waitNr 个完成事件
+         * @return  系统调用失败时返回 false
+         */
+        bool wait(unsigned waitNr) {
+            for (;;) {
+                long ret = syscall(__NR_io_uring_enter, fd_, 0, waitNr, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (ret >= 0) return true;
+                if (errno != EINTR) return false;
+            }
+        }
+
+        // 已准备但尚未被内核取走的请求数
+        unsigned unsubmitted() const { return pending_; }
+
+        /**
+         * 取出一个完成事件
+         * @param userData  请求的用户数据
+         * @param res       读取的字节数，出错时为 -errno
+         * @return          没有完成事件时返回 false
+         */
+        bool peek(uint64_t &userData, int &res) {
+            unsigned head = *cqHead_;
+            if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) return false;
+
+            const io_uring_cqe &cqe = cqes_[head & cqMask_];
+            userData = cqe.user_data;
+            res = cqe.res;
+            __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+    private:
+        void* map(size_t bytes, off_t offset) {
+            void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+
+        void release() {
+            if (sqes_) munmap(sqes_, sqEntries_*sizeof(io_uring_sqe));
+            if (cqRing_ && cqRing_ != sqRing_) munmap(cqRing_, cqBytes_);
+            if (sqRing_) munmap(sqRing_, sqBytes_);
+            if (fd_ >= 0) close(fd_);
+            sqes_ = nullptr;
+            sqRing_ = cqRing_ = nullptr;
+            fd_ = -1;
+        }
+
+    private:
+        int fd_ = -1;
+        void *sqRing_ = nullptr;
+        void *cqRing_ = nullptr;
+        size_t sqBytes_ = 0;
+        size_t cqBytes_ = 0;
+
+        unsigned *sqHead_ = nullptr;
+        unsigned *sqTail_ = nullptr;
+        unsigned *sqArray_ = nullptr;
+        unsigned sqMask_ = 0;
+        unsigned sqEntries_ = 0;
+        io_uring_sqe *sqes_ = nullptr;
+        unsigned pending_ = 0;
+
+        unsigned *cqHead_ = nullptr;
+        unsigned *cqTail_ = nullptr;
+        unsigned cqMask_ = 0;
+        unsigned cqEntries_ = 0;
+        io_uring_cqe *cqes_ = nullptr;
+    };
+
+#endif // RSTOOL_HAVE_IO_URING
+
+    /**
+     * ENVI 文件的异步分块读取：同时提交最多 depth 个数据块的读请求，
+     * 每个数据块读入一块对齐的暂存缓冲区（循环复用），读完后转换为要求的数据类型及组织方式。
+     * 每个数据块只读取其所在的整行：BIL/BIP 文件为一段连续的数据，BSQ 文件每个波段一段
+     */
+    template <typename T>
+    class AsyncRawRead {
+    public:
+        /**
+         * @param dataFile  ENVI 数据文件
+         * @param specDims  读取的波段
+         * @param intl      数据在内存中的组织方式
+         * @param depth     同时读取的数据块个数
+         * @param direct    是否使用 O_DIRECT 读取（不经过页缓存，适合只扫描一遍的大文件），
+         *                  文件系统不支持时自动改为普通读取
+         */
+        AsyncRawRead(const std::string &dataFile, const SpectralDimes &specDims,
+                Interleave intl = Interleave::BIP, int depth = 16, bool direct = false)
+                : specDims_(specDims), intl_(intl), depth_(std::max(1, depth)) {
+#if RSTOOL_HAVE_IO_URING && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            std::string hdrFile = FindEnviHeader(dataFile);
+            if (hdrFile.empty() || !EnviHeader::Read(hdrFile, hdr_) || hdr_.byteOrder != 0) {
+                return;
+            }
+
+            if (direct) {
+                fd_ = open(dataFile.c_str(), O_RDONLY | O_DIRECT);
+                direct_ = fd_ >= 0;
+            }
+            if (fd_ < 0) {
+                fd_ = open(dataFile.c_str(), O_RDONLY);
+            }
+            if (fd_ < 0) return;
+
+            for (int b = 0; b < specDims_.bandCount(); b++) {
+                if (specDims_.bandMap()[b] < 1 || specDims_.bandMap()[b] > hdr_.bands) return;
+            }
+
+            // 每个数据块的读请求数：BSQ 文件每个波段一个
+            runsPerChunk_ = hdr_.intl == Interleave::BSQ ? specDims_.bandCount() : 1;
+            unsigned entries = 1;
+            while (entries < static_cast<unsigned>(depth_*runsPerChunk_) && entries < 4096) {
+                entries <<= 1;
+            }
+            ring_.reset(new IoUring(entries));
+            if (!ring_->valid()) {
+                ring_.reset();
+                return;
+            }
+
+            // 提交队列放不下时减少同时读取的数据块个数
+            depth_ = std::max(1, std::min(depth_, static_cast<int>(ring_->sqEntries()) / runsPerChunk_));
+            if (runsPerChunk_ > static_cast<int>(ring_->sqEntries())) {
+                ring_.reset();
+            }
+#else
+            (void)dataFile;
+            (void)direct;
+#endif
+        }
+
+        ~AsyncRawRead() {
+#if RSTOOL_HAVE_IO_URING
+            ring_.reset();
+            if (fd_ >= 0) close(fd_);
+#endif
+        }
+
+        AsyncRawRead(const AsyncRawRead &) = delete;
+        AsyncRawRead& operator= (const AsyncRawRead &) = delete;
+
+        // 是否可用（ENVI 文件、编译及运行环境均支持 io_uring）
+        bool valid() const {
+#if RSTOOL_HAVE_IO_URING
+            return ring_ != nullptr;
+#else
+            return false;
+#endif
+        }
+
+        bool direct() const { return direct_; }
+
+        // 数据块的内存分配策略，需在 run() 之前设置
+        void setAllocPolicy(const AllocPolicy &policy) { policy_ = policy; }
+
+        /**
+         * 依次领取并读取数据块，直至 claim 返回 false 且所有读请求都已完成
+         * @param claim     领取下一个数据块，没有数据块时返回 false
+         * @param sink      接收读好的数据块（按完成的先后顺序），可以阻塞（反压）
+         * @param failed    某个数据块读取失败时调用，由调用者以其他方式读取
+         */
+        void run(const std::function<bool(SpatialDims &)> &claim,
+                const std::function<void(DataChunk<T> &&)> &sink,
+                const std::function<void(const SpatialDims &)> &failed) {
+#if RSTOOL_HAVE_IO_URING
+            if (!ring_) {
+                SpatialDims blk(0, 0, 0, 0);
+                while (claim(blk)) failed(blk);
+                return;
+            }
+
+            std::vector<Request> slots(depth_);
+            std::vector<int> freeSlots;
+            for (int i = depth_ - 1; i >= 0; i--) freeSlots.push_back(i);
+
+            bool more = true;
+            int inflight = 0;
+            while (more || inflight > 0) {
+                // 尽量填满请求队列
+                while (more && !freeSlots.empty()) {
+                    SpatialDims blk(0, 0, 0, 0);
+                    if (!claim(blk)) {
+                        more = false;
+                        break;
+                    }
+
+                    int slot = freeSlots.back();
+                    freeSlots.pop_back();
+                    ++inflight;
+                    if (!prepare(slots[slot], blk, slot)) {
+                        abort(slots, claim, failed);
+                        return;
+                    }
+                }
+
+                if (inflight == 0) break;
+                if (!ring_->submit(1)) {
+                    abort(slots, claim, failed);
+                    return;
+                }
+
+                uint64_t userData;
+                int res;
+                while (ring_->peek(userData, res)) {
+                    int slot = static_cast<int>(userData >> 32);
+                    int run = static_cast<int>(userData & 0xffffffff);
+                    Request &req = slots[slot];
+                    if (!complete(req, run, slot, res)) continue;
+
+                    if (req.error) {
+                        failed(req.blk);
+                    } else {
+                        sink(convert(req));
+                    }
+                    freeSlots.push_back(slot);
+                    --inflight;
+                }
+                if (ringFailed_) {
+                    abort(slots, claim, failed);
+                    return;
+                }
+            }
+#else
+            SpatialDims blk(0, 0, 0, 0);
+            while (claim(blk)) failed(blk);
+            (void)sink;
+#endif
+        }
+
+    private:
+        // 一段连续的读取
+        struct Run {
+            off_t offset;       // 文件偏移（已对齐）
+            size_t length;      // 需读取的字节数（已对齐）
+            size_t minLength;   // 至少需读取的字节数（文件末尾处 O_DIRECT 读取的长度可能不足对齐长度）
+            size_t done;        // 已读取的字节数
+            size_t skip;        // 数据相对于读取起点的偏移
+            unsigned char *buf; // 读取的起点
+            bool queued;        // 是否已放入提交队列且尚未取出其完成事件
+#if RSTOOL_HAVE_IO_URING
+            iovec iov;
+#endif
+        };
+
+        // 一个数据块的读请求
+        struct Request {
+            SpatialDims blk{0, 0, 0, 0};
+            std::vector<Run> runs;
+            int pending = 0;
+            bool error = false;
+            std::unique_ptr<unsigned char, decltype(&free)> staging{nullptr, &free};
+            size_t capacity = 0;
+        };
+
+#if RSTOOL_HAVE_IO_URING
+        /**
+         * 计算数据块对应的文件区域，分配暂存缓冲区并提交读请求
+         * @return  系统调用失败时返回 false（已放入提交队列的请求仍可能在读取）
+         */
+        bool prepare(Request &req, const SpatialDims &blk, int slot) {
+            size_t elem = hdr_.elemBytes();
+            size_t rowBytes = static_cast<size_t>(hdr_.samples)*elem;
+            size_t align = direct_ ? DIRECT_IO_ALIGN : 1;
+
+            req.blk = blk;
+            req.error = false;
+            req.runs.clear();
+
+            std::vector<std::pair<off_t, size_t>> extents;
+            if (hdr_.intl == Interleave::BSQ) {
+                for (int b = 0; b < specDims_.bandCount(); b++) {
+                    size_t line = static_cast<size_t>(specDims_.bandMap()[b] - 1)*hdr_.lines + blk.yOff();
+                    extents.emplace_back(hdr_.headerOffset + line*rowBytes, blk.ySize()*rowBytes);
+                }
+            } else {
+                size_t bytes = blk.ySize()*rowBytes*hdr_.bands;
+                extents.emplace_back(hdr_.headerOffset + blk.yOff()*rowBytes*hdr_.bands, bytes);
+            }
+
+            // 各段在暂存缓冲区中依次存放，起点按对齐要求对齐
+            size_t total = 0;
+            for (auto &ext : extents) {
+                Run run;
+                run.offset = ext.first / align*align;
+                run.skip = ext.first - run.offset;
+                run.minLength = run.skip + ext.second;
+                run.length = (run.minLength + align - 1) / align*align;
+                run.done = 0;
+                run.queued = false;
+                run.buf = reinterpret_cast<unsigned char*>(total);
+                total += (run.length + align - 1) / align*align;
+                req.runs.push_back(run);
+            }
+
+            if (req.capacity < total) {
+                void *p = nullptr;
+                if (posix_memalign(&p, DIRECT_IO_ALIGN, total) != 0) {
+                    throw std::bad_alloc();
+                }
+                req.staging.reset(static_cast<unsigned char*>(p));
+                req.capacity = total;
+            }
+
+            req.pending = static_cast<int>(req.runs.size());
+            for (size_t i = 0; i < req.runs.size(); i++) {
+                Run &run = req.runs[i];
+                run.buf = req.staging.get() + reinterpret_cast<size_t>(run.buf);
+            }
+            for (size_t i = 0; i < req.runs.size(); i++) {
+                if (!submitRun(req.runs[i], slot, static_cast<int>(i))) return false;
+            }
+            return true;
+        }
+
+        bool submitRun(Run &run, int slot, int index) {
+            run.iov.iov_base = run.buf + run.done;
+            run.iov.iov_len = run.length - run.done;
+            uint64_t userData = (static_cast<uint64_t>(slot) << 32) | static_cast<uint32_t>(index);
+            while (!ring_->prepRead(fd_, &run.iov, run.offset + run.done, userData)) {
+                // 提交队列已满，先提交已准备的请求
+                if (!ring_->submit()) return false;
+            }
+            run.queued = true;
+            return true;
+        }
+
+        // 处理一个完成事件，数据块的所有读请求都已完成时返回 true
+        bool complete(Request &req, int index, int slot, int res) {
+            Run &run = req.runs[index];
+            run.queued = false;
+            if (res < 0) {
+                req.error = true;
+            } else {
+                run.done += res;
+                if (run.done < run.minLength) {
+                    if (res > 0) {
+                        // 读取不完整，继续读取剩余部分
+                        if (!submitRun(run, slot, index)) ringFailed_ = true;
+                        return false;
+                    }
+                    req.error = true; // 文件比头文件描述的小
+                }
+            }
+            return --req.pending == 0;
+        }
+
+        /**
+         * 系统调用失败后放弃异步读取：先等待内核中尚未完成的读请求全部结束（它们仍在写入暂存缓冲区，
+         * 缓冲区随 slots 释放），再将未完成的数据块及剩余的数据块全部交由调用者读取；之后不再使用该 io_uring
+         */
+        void abort(std::vector<Request> &slots,
+                const std::function<bool(SpatialDims &)> &claim,
+                const std::function<void(const SpatialDims &)> &failed) {
+            // 内核中的请求数 = 已放入提交队列的请求数 - 尚未被内核取走的请求数
+            long inKernel = -static_cast<long>(ring_->unsubmitted());
+            for (auto &req : slots) {
+                for (auto &run : req.runs) {
+                    if (run.queued) inKernel++;
+                }
+            }
+
+            uint64_t userData;
+            int res;
+            while (inKernel > 0) {
+                if (ring_->peek(userData, res)) {
+                    slots[userData >> 32].runs[userData & 0xffffffff].queued = false;
+                    inKernel--;
+                } else if (!ring_->wait(1)) {
+                    // 无法确认读请求已结束：不释放暂存缓冲区，避免内核写入已释放的内存
+                    for (auto &req : slots) req.staging.release();
+                    break;
+                }
+            }
+            ring_.reset();
+
+            for (auto &req : slots) {
+                if (req.pending > 0) failed(req.blk);
+                req.pending = 0;
+            }
+            SpatialDims blk(0, 0, 0, 0);
+            while (claim(blk)) failed(blk);
+        }
+#endif
+
+        // 将暂存缓冲区中的数据转换为数据块
+        DataChunk<T> convert(Request &req) {
+            const SpatialDims &blk = req.blk;
+            DataChunk<T> data(blk, specDims_, intl_, policy_);
+            int bandCount = specDims_.bandCount();
+
+            if (hdr_.intl == Interleave::BSQ) {
+                // 将各波段的数据移到一起，构成 samples*ySize*bandCount 的 BSQ 数据
+                size_t bandBytes = static_cast<size_t>(hdr_.samples)*blk.ySize()*hdr_.elemBytes();
+                unsigned char *base = req.staging.get();
+                for (int b = 0; b < bandCount; b++) {
+                    unsigned char *src = req.runs[b].buf + req.runs[b].skip;
+                    if (src != base + b*bandBytes) {
+                        memmove(base + b*bandBytes, src, bandBytes);
+                    }
+                }
+
+                std::vector<int> bandMap(bandCount);
+                for (int b = 0; b < bandCount; b++) bandMap[b] = b + 1;
+                CopyRawRegion(hdr_.dataType, base, Interleave::BSQ, hdr_.samples, blk.ySize(), bandCount,
+                        blk.xOff(), 0, blk.xSize(), blk.ySize(), bandCount, bandMap.data(), intl_, data.data());
+            } else {
+                const Run &run = req.runs.front();
+                CopyRawRegion(hdr_.dataType, run.buf + run.skip, hdr_.intl, hdr_.samples, blk.ySize(), hdr_.bands,
+                        blk.xOff(), 0, blk.xSize(), blk.ySize(), bandCount, specDims_.bandMap(), intl_, data.data());
+            }
+            data.padSpectra();
+            return data;
+        }
+
+    private:
+        EnviHeader hdr_;
+        SpectralDimes specDims_;
+        Interleave intl_;
+        AllocPolicy policy_;
+        int depth_;
+        int runsPerChunk_ = 1;
+        int fd_ = -1;
+        bool direct_ = false;
+        bool ringFailed_ = false;   // 重新提交读请求时系统调用失败
+#if RSTOOL_HAVE_IO_URING
+        std::unique_ptr<IoUring> ring_;
+#endif
+    };
+
+} // namespace RSTool
+
+#endif //IMGPROCESS_RSTOOL_URING_H
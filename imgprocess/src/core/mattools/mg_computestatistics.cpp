@@ -4,6 +4,7 @@
 
 #include <future>
 #include "mg_computestatistics.h"
+#include "rstool_executor.h"
 
 namespace Mg {
 
@@ -49,11 +50,11 @@ namespace Mg {
                 return false;
             }
 
-            // 异步执行
+            // 异步执行（由共享执行器提供线程，避免每个数据块都创建线程）
             for (int i = 0; i < threads; ++i) {
                 int start = point[i];
                 int end = point[i+1];
-                fut[i] = std::async(std::launch::async, [this, &cube, start, end, bandCount]() {
+                fut[i] = RSTool::Mp::Executor::instance().submit([this, &cube, start, end, bandCount]() {
                     for (int b1 = start; b1 < end; ++b1) {
                         for (int b2 = b1+1; b2 < bandCount; ++b2) {
                             matCova_(b1, b2) += cube.data().row(b1)*cube.data().row(b2).transpose();
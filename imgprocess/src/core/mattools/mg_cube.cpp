@@ -4,54 +4,38 @@
 
 #include "mg_cube.h"
 #include <cassert>
+#include <cstring>
 #include <iostream>
 
 namespace Mg {
 
-    MgCube::MgCube()
+    template <typename Scalar>
+    MgCubeT<Scalar>::MgCubeT()
         : height_(0), width_(0), bands_(0),
         dataPtr_(nullptr) {
     }
 
-    MgCube::MgCube(int height, int width, int bands)
+    template <typename Scalar>
+    MgCubeT<Scalar>::MgCubeT(int height, int width, int bands)
         : height_(height), width_(width), bands_(bands),
-        dataPtr_(new float[height_*width_*bands]{},
-                [](float*p){delete []p; p = nullptr;}) {
-
-        for (int i = 0; i < bands_; ++i) {
-            cube_.emplace_back(Mat::ExtMatrixf(
-                    dataPtr_.get()+i*height_*width_,
-                    height_, width_));
-        }
-
-        // 最后一个表示全部数据
-        cube_.emplace_back(Mat::ExtMatrixf(
-                dataPtr_.get(), bands_, height_*width_));
+        dataPtr_(allocate(height_, width_, bands_), RSTool::AlignedFree) {
+        bind();
     }
 
-    MgCube::MgCube(const Mg::MgCube &other)
+    template <typename Scalar>
+    MgCubeT<Scalar>::MgCubeT(const MgCubeT &other)
         : height_(other.height_), width_(other.width_), bands_(other.bands_) {
 
-        dataPtr_.reset(new float[height_*width_*bands_]{},
-                       [](float*p){delete []p; p = nullptr;});
+        dataPtr_.reset(allocate(height_, width_, bands_), RSTool::AlignedFree);
 
-        mempcpy(dataPtr_.get(), other.dataPtr_.get(),
-                sizeof(float)*height_*width_*bands_);
-
-        cube_.clear();
-        for (int i = 0; i < bands_; ++i) {
-            cube_.emplace_back(Mat::ExtMatrixf(
-                    dataPtr_.get()+i*height_*width_,
-                    height_, width_));
-        }
-
-        // 最后一个表示全部数据
-        cube_.emplace_back(Mat::ExtMatrixf(
-                dataPtr_.get(), bands_, height_*width_));
+        memcpy(dataPtr_.get(), other.dataPtr_.get(),
+                sizeof(Scalar)*height_*width_*bands_);
 
+        bind();
     }
 
-    MgCube::MgCube(MgCube &&other)
+    template <typename Scalar>
+    MgCubeT<Scalar>::MgCubeT(MgCubeT &&other)
             : height_(other.height_), width_(other.width_), bands_(other.bands_),
               dataPtr_(std::move(other.dataPtr_)), cube_(std::move(other.cube_)) {
 
@@ -59,45 +43,29 @@ namespace Mg {
         other.height_ = 0;
         other.width_ = 0;
         other.bands_ = 0;
-
-        /*
-        cube_.clear();
-        for (int i = 0; i < bands_; ++i) {
-            cube_.emplace_back(Mat::ExtMatrixd(
-                    dataPtr_.get()+i*height_*width_,
-                    height_, width_));
-        }
-
-        // 最后一个表示全部数据
-        cube_.emplace_back(Mat::ExtMatrixd(
-                dataPtr_.get(), bands_, height_*width_));
-        */
     }
 
-    MgCube& MgCube::operator = (const MgCube& other) {
+    template <typename Scalar>
+    MgCubeT<Scalar>& MgCubeT<Scalar>::operator = (const MgCubeT& other) {
+        if (this == &other) return *this;
+
         height_ = other.height_;
         width_ = other.width_;
         bands_ = other.bands_;
 
-        dataPtr_.reset(new float[height_*width_*bands_]{},
-                       [](float*p){delete []p; p = nullptr;});
-
-        mempcpy(dataPtr_.get(), other.dataPtr_.get(),
-                sizeof(float)*height_*width_*bands_);
+        dataPtr_.reset(allocate(height_, width_, bands_), RSTool::AlignedFree);
 
-        cube_.clear();
-        for (int i = 0; i < bands_; ++i) {
-            cube_.emplace_back(Mat::ExtMatrixf(
-                    dataPtr_.get()+i*height_*width_,
-                    height_, width_));
-        }
+        memcpy(dataPtr_.get(), other.dataPtr_.get(),
+                sizeof(Scalar)*height_*width_*bands_);
 
-        // 最后一个表示全部数据
-        cube_.emplace_back(Mat::ExtMatrixf(
-                dataPtr_.get(), bands_, height_*width_));
+        bind();
+        return *this;
     }
 
-    MgCube& MgCube::operator = (MgCube&& other) {
+    template <typename Scalar>
+    MgCubeT<Scalar>& MgCubeT<Scalar>::operator = (MgCubeT&& other) {
+        if (this == &other) return *this;
+
         height_ = other.height_;
         width_ = other.width_;
         bands_ = other.bands_;
@@ -108,56 +76,71 @@ namespace Mg {
         other.width_ = 0;
         other.bands_ = 0;
 
-        cube_.clear();
-        for (int i = 0; i < bands_; ++i) {
-            cube_.emplace_back(Mat::ExtMatrixf(
-                    dataPtr_.get()+i*height_*width_,
-                    height_, width_));
-        }
-
-        // 最后一个表示全部数据
-        cube_.emplace_back(Mat::ExtMatrixf
-        (
-                dataPtr_.get(), bands_, height_*width_));
+        bind();
+        return *this;
     }
 
-
-    Mat::Matrixf MgCube::spectrum(int i, int j) {
+    template <typename Scalar>
+    Mat::Matrix<Scalar> MgCubeT<Scalar>::spectrum(int i, int j) {
         assert(i >= 0 && i < height_ && j >= 0 && j < width_);
         return cube_.back().col(i*width_+j);
     }
 
-    void MgCube::spectrum(int i, int j, const Mat::Matrixf &spec) {
+    template <typename Scalar>
+    void MgCubeT<Scalar>::spectrum(int i, int j, const Mat::Matrix<Scalar> &spec) {
         assert(i >= 0 && i < height_ && j >= 0 && j < width_);
         cube_.back().col(i*width_+j) = spec;
     }
 
-    Mat::ExtMatrixf& MgCube::band(int i) {
+    template <typename Scalar>
+    Mat::ExtMatrix<Scalar>& MgCubeT<Scalar>::band(int i) {
         assert(i >= 0 && i < bands_);
         return cube_[i];
     }
 
-    Mat::ExtMatrixf& MgCube::data() {
+    template <typename Scalar>
+    Mat::ExtMatrix<Scalar>& MgCubeT<Scalar>::data() {
         return cube_.back();
     }
 
-    void MgCube::resize(int height, int width, int bands) {
+    template <typename Scalar>
+    void MgCubeT<Scalar>::resize(int height, int width, int bands) {
         height_ = height;
         width_ = width;
         bands_ = bands;
-        dataPtr_.reset(new float[height_*width_*bands]{},
-                [](float*p){delete []p; p = nullptr;});
+        dataPtr_.reset(allocate(height_, width_, bands_), RSTool::AlignedFree);
+
+        bind();
+    }
+
+    template <typename Scalar>
+    Scalar* MgCubeT<Scalar>::allocate(int height, int width, int bands) {
+        // 按缓存行对齐，大块内存使用透明大页
+        return RSTool::AlignedAllocZero<Scalar>(static_cast<size_t>(height)*width*bands);
+    }
 
+    template <typename Scalar>
+    void MgCubeT<Scalar>::bind() {
         cube_.clear();
         for (int i = 0; i < bands_; ++i) {
-            cube_.emplace_back(Mat::ExtMatrixf(
+            cube_.emplace_back(Mat::ExtMatrix<Scalar>(
                     dataPtr_.get()+i*height_*width_,
                     height_, width_));
         }
 
         // 最后一个表示全部数据
-        cube_.emplace_back(Mat::ExtMatrixf(
+        cube_.emplace_back(Mat::ExtMatrix<Scalar>(
                 dataPtr_.get(), bands_, height_*width_));
     }
 
-} // namespace Mg
\ No newline at end of file
+    template class MgCubeT<unsigned char>;
+    template class MgCubeT<unsigned short>;
+    template class MgCubeT<short>;
+    template class MgCubeT<unsigned int>;
+    template class MgCubeT<int>;
+    template class MgCubeT<float>;
+    template class MgCubeT<double>;
+    template class MgCubeT<RSTool::Half>;
+    template class MgCubeT<RSTool::BFloat16>;
+
+} // namespace Mg
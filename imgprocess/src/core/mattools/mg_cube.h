@@ -6,42 +6,101 @@
 #define IMGPROCESS_MG_CUBE_H
 
 #include "mg_matcommon.h"
+#include "rstool_convert.h"
+#include "rstool_alloc.h"
+#include <utility>
+
+namespace Eigen {
+
+    // 半精度存储类型只用于存储（按块复制、转换为 float 的视图），不参与矩阵运算
+    template <> struct NumTraits<RSTool::Half> : GenericNumTraits<RSTool::Half> {};
+    template <> struct NumTraits<RSTool::BFloat16> : GenericNumTraits<RSTool::BFloat16> {};
+
+} // namespace Eigen
 
 namespace Mg {
 
-    class MgCube {
+    /**
+     * 数据立方体（按 BSQ 存储），Scalar 为样本类型：
+     * 按影像的原生类型读取时（如 UInt16），不必经过 GDAL 的类型转换，内存占用也小于 float；
+     * 需要浮点运算时可使用 bandAs/dataAs 转换视图（惰性求值，不分配内存），或用 convert 一次性转换。
+     * 浮点数据可按 RSTool::Half/BFloat16 存储（MgHalfCube），内存与带宽减半，通过 bandAs<float> 参与计算
+     */
+    template <typename Scalar>
+    class MgCubeT {
     public:
-        MgCube();
-        MgCube(int height, int width, int bands);
+        using ScalarType = Scalar;
 
-        MgCube(const MgCube &other);
-        MgCube(MgCube &&other);
+        MgCubeT();
+        MgCubeT(int height, int width, int bands);
 
-        MgCube& operator = (const MgCube& other);
-        MgCube& operator = (MgCube&& other);
+        MgCubeT(const MgCubeT &other);
+        MgCubeT(MgCubeT &&other);
 
-        Mat::Matrixf spectrum(int i, int j);
-        void spectrum(int i, int j, const Mat::Matrixf &spec);
+        MgCubeT& operator = (const MgCubeT& other);
+        MgCubeT& operator = (MgCubeT&& other);
 
-        Mat::ExtMatrixf& band(int i);
+        Mat::Matrix<Scalar> spectrum(int i, int j);
+        void spectrum(int i, int j, const Mat::Matrix<Scalar> &spec);
 
-        Mat::ExtMatrixf& data();
+        Mat::ExtMatrix<Scalar>& band(int i);
+
+        Mat::ExtMatrix<Scalar>& data();
         int width() const { return width_; }
         int height() const { return height_; }
         int bands() const { return bands_; }
 
         void resize(int height, int width, int bands);
 
+        // 第 i 个波段按 To 类型访问的视图，如 cube.bandAs<float>(0).colwise().mean()
+        template <typename To>
+        auto bandAs(int i) -> decltype(std::declval<Mat::ExtMatrix<Scalar>&>().template cast<To>()) {
+            return band(i).template cast<To>();
+        }
+
+        template <typename To>
+        auto dataAs() -> decltype(std::declval<Mat::ExtMatrix<Scalar>&>().template cast<To>()) {
+            return data().template cast<To>();
+        }
+
+        // 转换为 To 类型的数据立方体（浮点转换为整数时饱和转换）
+        template <typename To>
+        MgCubeT<To> convert() {
+            MgCubeT<To> out(height_, width_, bands_);
+            if (bands_ > 0) {
+                RSTool::ConvertSaturate(dataPtr_.get(), out.data().data(),
+                        static_cast<size_t>(height_)*width_*bands_);
+            }
+            return out;
+        }
+
+    private:
+        static Scalar* allocate(int height, int width, int bands);
+        void bind();
+
     private:
         int height_;
         int width_;
         int bands_;
-        std::shared_ptr<float> dataPtr_;
+        std::shared_ptr<Scalar> dataPtr_;
 
         // 数据矩阵，按 BSQ 存储
-        std::vector<Mat::ExtMatrixf> cube_;
+        std::vector<Mat::ExtMatrix<Scalar>> cube_;
     };
 
+    using MgCube = MgCubeT<float>;
+    using MgHalfCube = MgCubeT<RSTool::Half>;
+
+    extern template class MgCubeT<unsigned char>;
+    extern template class MgCubeT<unsigned short>;
+    extern template class MgCubeT<short>;
+    extern template class MgCubeT<unsigned int>;
+    extern template class MgCubeT<int>;
+    extern template class MgCubeT<float>;
+    extern template class MgCubeT<double>;
+    extern template class MgCubeT<RSTool::Half>;
+    extern template class MgCubeT<RSTool::BFloat16>;
+
 } // namespace Mg
 
 #endif //IMGPROCESS_MG_CUBE_H
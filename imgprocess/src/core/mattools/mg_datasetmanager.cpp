@@ -3,6 +3,7 @@
 //
 
 #include "mg_datasetmanager.h"
+#include "rstool_gridplan.h"
 //#include "gdal_priv.h"
 #include <cassert>
 #include <type_traits>
@@ -15,11 +16,16 @@ namespace Mg {
     }
 
     MgDatasetManager::MgDatasetManager()
-        : xBlkSize_(128), yBlkSize_(128),
-         blkType_(MgBlockType::SQUARE), ds_(nullptr){
+        : ds_(nullptr), blkSize_(128), blkType_(MgBlockType::SQUARE),
+         scalarBytes_(sizeof(float)), xBlkSize_(128), yBlkSize_(128) {
     }
 
     MgDatasetManager::~MgDatasetManager() {
+        // 关闭数据集前写入写出过程中生成的概视图
+        if (overviews_ && ds_) {
+            overviews_->finish();
+            overviews_->apply(ds_);
+        }
         GDALClose((GDALDatasetH)ds_);
     }
 
@@ -39,10 +45,8 @@ namespace Mg {
         xImgSize_ = ds_->GetRasterXSize();
         yImgSize_ = ds_->GetRasterYSize();
         bandCount_ = ds_->GetRasterCount();
-        if (blkType_ == MgBlockType::LINE)
-            xBlkSize_ = xImgSize_;
 
-        block();
+        planBlock();
         return true;
     }
 
@@ -55,7 +59,17 @@ namespace Mg {
         if (poDriver == nullptr)
             return false;
 
-        ds_ = poDriver->Create(pszFile, xSize, ySize, bands, eType, papszOptions);
+        // 压缩输出时由 GDAL 在多个线程中并行压缩（GDAL 3.2 以上的 GTiff 驱动支持），
+        // 避免压缩在写出线程中串行进行；调用者已指定 NUM_THREADS 时不覆盖
+        char **options = CSLDuplicate(papszOptions);
+        const char *compress = CSLFetchNameValue(options, "COMPRESS");
+        if (compress != nullptr && !EQUAL(compress, "NONE") &&
+                CSLFetchNameValue(options, "NUM_THREADS") == nullptr) {
+            options = CSLSetNameValue(options, "NUM_THREADS", "ALL_CPUS");
+        }
+
+        ds_ = poDriver->Create(pszFile, xSize, ySize, bands, eType, options);
+        CSLDestroy(options);
         if (ds_ == nullptr) {
             return false;
         }
@@ -64,83 +78,61 @@ namespace Mg {
         xImgSize_ = xSize;
         yImgSize_ = ySize;
         bandCount_ = bands;
-        if (blkType_ == MgBlockType::LINE)
-            xBlkSize_ = xImgSize_;
 
-        block();
+        planBlock();
         return true;
     }
 
-    void MgDatasetManager::block() {
-        xBlkNum_ = (xImgSize_ + xBlkSize_ - 1) / xBlkSize_;
-        yBlkNum_ = (yImgSize_ + yBlkSize_ - 1) / yBlkSize_;
-    }
-
-    void MgDatasetManager::resetBlock(int newBlkSize, const Mg::MgBlockType &newBlkType) {
-        yBlkSize_ = newBlkSize;
-        newBlkType == MgBlockType::LINE ?
-                xBlkSize_ = xImgSize_ : xBlkSize_ = newBlkSize;
-        block();
-    }
+    bool MgDatasetManager::setOverviews(int levels, RSTool::OverviewResampling resampling) {
+        if (ds_ == nullptr) {
+            return false;
+        }
 
-    bool MgDatasetManager::readDataChunk(bool isBlock, int xBlkOff, int yBlkOff,
-            const Mg::MgBandMap &bands, Mg::MgCube &cube) {
-        int xImgOff, yImgOff, xBlkSize, yBlkSize;
-        if (isBlock) {
-            yImgOff = yBlkOff*yBlkSize_;
-            yBlkSize = yBlkSize_;
-            if (yImgOff + yBlkSize_ > yImgSize_)
-                yBlkSize = yImgSize_ - yImgOff;
-
-            xImgOff = xBlkOff*xBlkSize_;
-            xBlkSize = xBlkSize_;
-            if (xImgOff + xBlkSize_ > xImgSize_)
-                xBlkSize = xImgSize_ - xImgOff;
-        } else {
-            xImgOff = 0;
-            yImgOff = 0;
-            xBlkSize = xImgSize_;
-            yBlkSize = yImgSize_;
+        std::string file = ds_->GetDescription();
+        overviews_.reset(new RSTool::OverviewBuilder(xImgSize_, yImgSize_, bandCount_, gdt_,
+                file, levels, resampling));
+        for (int b = 1; b <= bandCount_; b++) {
+            int ok = 0;
+            double value = ds_->GetRasterBand(b)->GetNoDataValue(&ok);
+            if (ok) overviews_->setNoData(b, value);
         }
 
-        cube.resize(yBlkSize, xBlkSize, bands.size());
-        if (CPLErr::CE_Failure == ds_->RasterIO(GF_Read, xImgOff, yImgOff,
-                xBlkSize, yBlkSize,
-                cube.data().data(), xBlkSize, yBlkSize, GDT_Float32,
-                bands.size(), const_cast<int*>(bands.data()),
-                0, 0, 0)) {
+        if (!overviews_->valid()) {
+            overviews_.reset();
             return false;
         }
-
         return true;
     }
 
-    bool MgDatasetManager::readDataChunk(bool isBlock, int blkIndex,
-            const Mg::MgBandMap &bands, Mg::MgCube &cube) {
-        if (isBlock) {
-            assert(blkIndex >= 0 && blkIndex < xBlkNum_*yBlkNum_);
-            int xBlkOff = blkIndex % xBlkNum_;
-            int yBlkOff = blkIndex / xBlkNum_;
-            return readDataChunk(isBlock, xBlkOff, yBlkOff, bands, cube);
-        } else {
-            assert(blkIndex == 0);
-            return readDataChunk(isBlock, 0, 0, bands, cube);
-        }
+    void MgDatasetManager::block() {
+        xBlkNum_ = (xImgSize_ + xBlkSize_ - 1) / xBlkSize_;
+        yBlkNum_ = (yImgSize_ + yBlkSize_ - 1) / yBlkSize_;
     }
 
-    bool MgDatasetManager::readDataChunk(int xOff, int yOff, int xSize, int ySize,
-            const Mg::MgBandMap &bands, Mg::MgCube &cube) {
-        cube.resize(ySize, xSize, bands.size());
-        if (CPLErr::CE_Failure == ds_->RasterIO(GF_Read,
-                xOff, yOff, xSize, ySize,
-                cube.data().data(), xSize, ySize, GDT_Float32,
-                bands.size(), const_cast<int*>(bands.data()),
-                0, 0, 0)) {
-            return false;
+    void MgDatasetManager::planBlock() {
+        if (ds_ == nullptr) {
+            return;
         }
 
-        return true;
+        // 数据块以数据立方体的样本类型读入内存
+        size_t pixelBytes = scalarBytes_*bandCount_;
+        size_t targetBytes = blkType_ == MgBlockType::LINE ?
+                static_cast<size_t>(xImgSize_)*blkSize_*pixelBytes :
+                RSTool::TargetChunkBytes(blkSize_, pixelBytes);
+
+        RSTool::GridPlan plan = RSTool::PlanChunkGrid(ds_, pixelBytes, targetBytes,
+                blkType_ == MgBlockType::LINE);
+        xBlkSize_ = plan.xChunkSize();
+        yBlkSize_ = plan.yChunkSize();
+        block();
     }
+
+    void MgDatasetManager::resetBlock(int xBlkSize, int yBlkSize) {
+        xBlkSize_ = std::max(1, xBlkSize);
+        yBlkSize_ = std::max(1, yBlkSize);
+        block();
+    }
+
 //
 //    template <typename OutScalar>
 //    bool MgDatasetManager::writeDataChunk(bool isBlock, int xBlkOff, int yBlkOff,
@@ -204,35 +196,6 @@ namespace Mg {
 //        }
 //    }
 
-    template <typename OutScalar>
-    bool MgDatasetManager::writeDataChunk(int xOff, int yOff,
-            const MgBandMap &bands, MgCube &cube) {
-
-        if (!std::is_same<OutScalar, double>::value) {
-            // 将 double 类型数据转换为指定数据类型
-            Mat::Matrix<OutScalar> &&tmp = (cube.data()).cast<OutScalar>();
-            if (CPLErr::CE_Failure == ds_->RasterIO(GF_Read,
-                    xOff, yOff, cube.width(), cube.height(),
-                    tmp.data(), cube.width(), cube.height(), gdt_,
-                    bands.size(), const_cast<int*>(bands.data()),
-                    0, 0, 0)) {
-                return false;
-            }
-
-            return true;
-        }
-
-        if (CPLErr::CE_Failure == ds_->RasterIO(GF_Read,
-                xOff, yOff, cube.width(), cube.height(),
-                cube.data().data(), cube.width(), cube.height(), gdt_,
-                bands.size(), const_cast<int*>(bands.data()),
-                0, 0, 0)) {
-            return false;
-        }
-
-        return true;
-    }
-
     const char* MgDatasetManager::getProjectionRef() {
         assert(ds_ != nullptr);
         return ds_->GetProjectionRef();
@@ -265,4 +228,10 @@ namespace Mg {
         ds_->SetGeoTransform(geoTrans.get());
     }
 
+    bool ReadMemResult(const RSTool::Mp::MemResultPtr &result, const MgBandMap &bands, MgCube &cube) {
+        if (!result) return false;
+        MgDatasetManagerPtr ds = makeMgDatasetManager();
+        return ds->openDataset(result->path().c_str()) && ds->readDataChunk(false, 0, bands, cube);
+    }
+
 }// namespace Mg
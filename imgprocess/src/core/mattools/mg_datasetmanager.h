@@ -10,6 +10,9 @@
 #include "gdal_priv.h"
 #include "mg_matcommon.h"
 #include "mg_cube.h"
+#include "rstool_overview.h"
+#include "rstool_memstore.h"
+#include "rstool_convert.h"
 #include <string>
 #include <memory>
 #include <future>
@@ -39,20 +42,56 @@ namespace Mg {
                 int xSize, int ySize, int bands,
                 GDALDataType eType, char ** papszOptions);
 
-        void resetBlock(int newBlkSize, const MgBlockType &newBlkType = MgBlockType::SQUARE);
-        bool readDataChunk(bool isBlock, int blkIndex, const MgBandMap &bands, MgCube &cube);
+        /**
+         * 写出数据块的同时生成概视图（打开或创建数据集之后、写出数据块之前调用），析构时写入数据集的概视图
+         * @param levels        概视图级数，为 0 时一直生成到概视图的宽、高均不大于 256
+         * @param resampling    重采样方式
+         */
+        bool setOverviews(int levels = 0,
+                RSTool::OverviewResampling resampling = RSTool::OverviewResampling::Average);
+
+        /**
+         * 重新分块，分块按影像的原生块（瓦片或条带）对齐，数据块占用的内存与原来的方形块（或行块）相当
+         * @tparam Scalar       读入的数据立方体的样本类型（按其大小计算数据块占用的内存）
+         * @param newBlkSize    块大小（块高，块宽度由 newBlkType 类型决定）
+         * @param newBlkType    块类型（行或方形）
+         */
+        template <typename Scalar = float>
+        void resetBlock(int newBlkSize, const MgBlockType &newBlkType = MgBlockType::SQUARE) {
+            blkSize_ = newBlkSize;
+            blkType_ = newBlkType;
+            scalarBytes_ = sizeof(Scalar);
+            planBlock();
+        }
+
+        // 按指定的块尺寸分块（不对齐原生块），用于与另一个数据集的分块保持一致
+        void resetBlock(int xBlkSize, int yBlkSize);
+
+        /**
+         * 读取数据块，按数据立方体的样本类型读取（MgCube 为 float，
+         * MgCubeT<unsigned short> 等与影像类型一致时不经过类型转换）
+         */
+        template <typename Scalar>
+        bool readDataChunk(bool isBlock, int blkIndex, const MgBandMap &bands, MgCubeT<Scalar> &cube);
+
+        template <typename Scalar>
         bool readDataChunk(int xOff, int yOff, int xSize, int ySize,
-                const MgBandMap &bands, MgCube &cube);
+                const MgBandMap &bands, MgCubeT<Scalar> &cube);
 
-        template <typename OutScalar>
-        bool writeDataChunk(bool isBlock, int blkIndex, const MgBandMap &bands, MgCube &cube);
+        /**
+         * 写出数据块，样本类型与 OutScalar 不同时先饱和转换为 OutScalar
+         */
+        template <typename OutScalar, typename Scalar>
+        bool writeDataChunk(bool isBlock, int blkIndex, const MgBandMap &bands, MgCubeT<Scalar> &cube);
 
-        template <typename OutScalar>
-        bool writeDataChunk(int xOff, int yOff, const MgBandMap &bands, MgCube &cube);
+        template <typename OutScalar, typename Scalar>
+        bool writeDataChunk(int xOff, int yOff, const MgBandMap &bands, MgCubeT<Scalar> &cube);
 
         int blkNum() const { return xBlkNum_*yBlkNum_; }
         int xBlkNum() const { return xBlkNum_; }
         int yBlkNum() const { return yBlkNum_; }
+        int xBlkSize() const { return xBlkSize_; }
+        int yBlkSize() const { return yBlkSize_; }
 
         GDALDataType& getGdalDataType() { return gdt_; }
         int getRasterCount() const { return bandCount_; }
@@ -69,14 +108,16 @@ namespace Mg {
         void setGeoTransform(std::unique_ptr<double[]> geoTrans);
 
     protected:
+        template <typename Scalar>
         bool readDataChunk(bool isBlock,
-                int xBlkOff, int yBlkOff, const MgBandMap &bands, MgCube &cube);
+                int xBlkOff, int yBlkOff, const MgBandMap &bands, MgCubeT<Scalar> &cube);
 
-        template <typename OutScalar>
+        template <typename OutScalar, typename Scalar>
         bool writeDataChunk(bool isBlock, int xBlkOff, int yBlkOff,
-                const MgBandMap &bands, MgCube &cube);
+                const MgBandMap &bands, MgCubeT<Scalar> &cube);
     private:
         void block();
+        void planBlock();
 
     private:
         // 影像相关信息
@@ -88,66 +129,141 @@ namespace Mg {
         int bandCount_;
 
         // 分块信息
+        int blkSize_;           // 块大小（块高，块宽度由 blkType_ 类型决定），实际分块按原生块对齐
         MgBlockType blkType_;
+        size_t scalarBytes_;    // 读入的数据立方体的样本大小（默认为 MgCube 的 float）
         int xBlkSize_;
         int yBlkSize_;
         int xBlkNum_;
         int yBlkNum_;
+
+        // 写出过程中生成的概视图
+        std::unique_ptr<RSTool::OverviewBuilder> overviews_;
     };
 
+    /**
+     * 将中间结果读为矩阵，每个波段为 height*width 的矩阵（cube.band(i)）
+     * @param result    中间结果（如 MgStripeRemove::result()）
+     * @param bands     波段索引（从 1 开始）
+     */
+    bool ReadMemResult(const RSTool::Mp::MemResultPtr &result, const MgBandMap &bands, MgCube &cube);
+
+
+    template <typename Scalar>
+    bool MgDatasetManager::readDataChunk(bool isBlock, int xBlkOff, int yBlkOff,
+            const Mg::MgBandMap &bands, Mg::MgCubeT<Scalar> &cube) {
+        int xImgOff, yImgOff, xBlkSize, yBlkSize;
+        if (isBlock) {
+            yImgOff = yBlkOff*yBlkSize_;
+            yBlkSize = yBlkSize_;
+            if (yImgOff + yBlkSize_ > yImgSize_)
+                yBlkSize = yImgSize_ - yImgOff;
+
+            xImgOff = xBlkOff*xBlkSize_;
+            xBlkSize = xBlkSize_;
+            if (xImgOff + xBlkSize_ > xImgSize_)
+                xBlkSize = xImgSize_ - xImgOff;
+        } else {
+            xImgOff = 0;
+            yImgOff = 0;
+            xBlkSize = xImgSize_;
+            yBlkSize = yImgSize_;
+        }
+
+        return readDataChunk(xImgOff, yImgOff, xBlkSize, yBlkSize, bands, cube);
+    }
+
+    template <typename Scalar>
+    bool MgDatasetManager::readDataChunk(bool isBlock, int blkIndex,
+            const Mg::MgBandMap &bands, Mg::MgCubeT<Scalar> &cube) {
+        if (isBlock) {
+            assert(blkIndex >= 0 && blkIndex < xBlkNum_*yBlkNum_);
+            int xBlkOff = blkIndex % xBlkNum_;
+            int yBlkOff = blkIndex / xBlkNum_;
+            return readDataChunk(isBlock, xBlkOff, yBlkOff, bands, cube);
+        } else {
+            assert(blkIndex == 0);
+            return readDataChunk(isBlock, 0, 0, bands, cube);
+        }
+    }
+
+    template <typename Scalar>
+    bool MgDatasetManager::readDataChunk(int xOff, int yOff, int xSize, int ySize,
+            const Mg::MgBandMap &bands, Mg::MgCubeT<Scalar> &cube) {
+        cube.resize(ySize, xSize, bands.size());
+        if (RSTool::IsHalfType<Scalar>::value) {
+            // 半精度：按 float 读取后转换，转换缓冲区在线程内重复使用
+            static thread_local std::vector<float> tmp;
+            tmp.resize(static_cast<size_t>(cube.data().size()));
+            if (CPLErr::CE_Failure == ds_->RasterIO(GF_Read,
+                    xOff, yOff, xSize, ySize,
+                    tmp.data(), xSize, ySize, GDT_Float32,
+                    bands.size(), const_cast<int*>(bands.data()),
+                    0, 0, 0)) {
+                return false;
+            }
+            RSTool::ConvertSaturate(tmp.data(), cube.data().data(), tmp.size());
+            return true;
+        }
+
+        if (CPLErr::CE_Failure == ds_->RasterIO(GF_Read,
+                xOff, yOff, xSize, ySize,
+                cube.data().data(), xSize, ySize, RSTool::toGDALDataType<Scalar>(),
+                bands.size(), const_cast<int*>(bands.data()),
+                0, 0, 0)) {
+            return false;
+        }
+
+        return true;
+    }
 
-    template <typename OutScalar>
+    template <typename OutScalar, typename Scalar>
     bool MgDatasetManager::writeDataChunk(bool isBlock, int xBlkOff, int yBlkOff,
-                                          const Mg::MgBandMap &bands, Mg::MgCube &cube) {
-            int xImgOff, yImgOff, xBlkSize, yBlkSize;
+                                          const Mg::MgBandMap &bands, Mg::MgCubeT<Scalar> &cube) {
+            // 块的实际大小由 cube 决定（边缘块小于 xBlkSize_*yBlkSize_）
             if (isBlock) {
-//            if (0 > xBlkOff || xBlkOff >= xBlkNum_ ||
-//                0 > yBlkOff || yBlkOff >= yBlkNum_)
-//                return false;
-
-                    yImgOff = yBlkOff*yBlkSize_;
-                    yBlkSize = cube.height();
-//            if (yImgOff + yBlkSize_ > yImgSize_)
-//                yBlkSize = yImgSize_ - yImgOff;
-
-                    xImgOff = xBlkOff*xBlkSize_;
-                    xBlkSize = cube.width();
-//            if (xImgOff + xBlkSize_ > xImgSize_)
-//                xBlkSize = xImgSize_ - xImgOff;
-            } else {
-                    xImgOff = 0;
-                    yImgOff = 0;
-                    xBlkSize = cube.width();
-                    yBlkSize = cube.height();
+                    return writeDataChunk<OutScalar>(xBlkOff*xBlkSize_, yBlkOff*yBlkSize_, bands, cube);
             }
+            return writeDataChunk<OutScalar>(0, 0, bands, cube);
+    }
+
+    template <typename OutScalar, typename Scalar>
+    bool MgDatasetManager::writeDataChunk(int xImgOff, int yImgOff,
+            const Mg::MgBandMap &bands, Mg::MgCubeT<Scalar> &cube) {
+            int xBlkSize = cube.width();
+            int yBlkSize = cube.height();
 
-            if (!std::is_same<OutScalar, float>::value) {
-                    // 将 double 类型数据转换为指定数据类型
-                    Mat::Matrix<OutScalar> &&tmp = (cube.data()).cast<OutScalar>();
+            if (!std::is_same<OutScalar, Scalar>::value) {
+                    // 饱和转换（四舍五入）为指定数据类型，转换缓冲区在线程内重复使用
+                    static thread_local std::vector<OutScalar> tmp;
+                    tmp.resize(static_cast<size_t>(cube.data().size()));
+                    RSTool::ConvertSaturate(cube.data().data(), tmp.data(), tmp.size());
 
                     if (CPLErr::CE_Failure == ds_->RasterIO(GF_Write, xImgOff, yImgOff,
                             xBlkSize, yBlkSize,
-                            tmp.data(), xBlkSize, yBlkSize, gdt_,
+                            tmp.data(), xBlkSize, yBlkSize, RSTool::toGDALDataType<OutScalar>(),
                             bands.size(), const_cast<int*>(bands.data()), 0, 0, 0)) {
                             return false;
                     }
 
-                    return true;
+                    return !overviews_ || overviews_->add(xImgOff, yImgOff, xBlkSize, yBlkSize,
+                            static_cast<int>(bands.size()), bands.data(), RSTool::Interleave::BSQ, tmp.data());
             }
 
             if (CPLErr::CE_Failure == ds_->RasterIO(GF_Write, xImgOff, yImgOff,
                     xBlkSize, yBlkSize,
-                    cube.data().data(), xBlkSize, yBlkSize, gdt_,
+                    cube.data().data(), xBlkSize, yBlkSize, RSTool::toGDALDataType<OutScalar>(),
                     bands.size(), const_cast<int*>(bands.data()), 0, 0, 0)) {
                     return false;
             }
 
-            return true;
+            return !overviews_ || overviews_->add(xImgOff, yImgOff, xBlkSize, yBlkSize,
+                    static_cast<int>(bands.size()), bands.data(), RSTool::Interleave::BSQ, cube.data().data());
     }
 
-    template <typename OutScalar>
+    template <typename OutScalar, typename Scalar>
     bool MgDatasetManager::writeDataChunk(bool isBlock, int blkIndex,
-            const Mg::MgBandMap &bands, Mg::MgCube &cube) {
+            const Mg::MgBandMap &bands, Mg::MgCubeT<Scalar> &cube) {
             if (isBlock) {
                 assert(blkIndex >= 0 && blkIndex < xBlkNum_*yBlkNum_);
                 int xBlkOff = blkIndex % xBlkNum_;
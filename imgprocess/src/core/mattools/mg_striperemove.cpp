@@ -3,11 +3,36 @@
 //
 
 #include "mg_striperemove.h"
+#include "rstool_kernels.h"
+#include "rstool_lut.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 namespace Mg {
 
+    namespace {
+
+        // 按行条带转换为 float 时每个条带的行数（条带常驻缓存，且不必为整个波段分配 float 副本）
+        const int StripRows = 256;
+
+        /**
+         * 将第 0 个波段按行条带转换为 float 后依次处理
+         * @param strip     条带缓冲区，StripRows x 波段宽度（最后一个条带只使用前 rows 行）
+         * @param f         f(row, rows)：条带的首行在波段中的行号及条带的行数
+         */
+        template <typename Scalar, typename F>
+        void ForEachFloatStrip(MgCubeT<Scalar> &cube, Mat::Matrixf &strip, F f) {
+            const int height = cube.height();
+            for (int row = 0; row < height; row += StripRows) {
+                int rows = std::min(StripRows, height - row);
+                strip.topRows(rows) = cube.template bandAs<float>(0).middleRows(row, rows);
+                f(row, rows);
+            }
+        }
+
+    } // namespace
+
     MgStripeRemove::MgStripeRemove(const std::string &fileIn,
             const std::string &fileOut,
             const std::string &format,
@@ -31,15 +56,29 @@ namespace Mg {
         int ySize = mgDatasetInPtr_->getRasterYSize();
         auto gdt = mgDatasetInPtr_->getGdalDataType();
 
-        // 创建输出文件
+        // 创建输出文件（输出格式为 MEM 时写到内存中间结果，超出内存预算时由中间结果落盘）
         mgDatasetOutPtr_ = makeMgDatasetManager();
-        if (!mgDatasetOutPtr_->createDataset(fileOut_.c_str(), format_.c_str(),
+        if (RSTool::Mp::IsMemoryFormat(format_)) {
+            result_ = RSTool::Mp::MemoryStore::instance().create(fileOut_, xSize, ySize, bandCount, gdt);
+            if (!result_ || !mgDatasetOutPtr_->openDataset(result_->path().c_str(), GA_Update)) {
+                return false;
+            }
+        } else if (!mgDatasetOutPtr_->createDataset(fileOut_.c_str(), format_.c_str(),
                 xSize, ySize, bandCount, gdt, nullptr)) {
             return false;
         }
         mgDatasetOutPtr_->setGeoTransform(mgDatasetInPtr_->getGeoTransform());
         mgDatasetOutPtr_->setProjection(mgDatasetInPtr_->getProjectionRef());
 
+        bool ret = process(gdt);
+
+        // 关闭数据集，使输出（尤其是内存中间结果）对下一个算法完整可见
+        mgDatasetOutPtr_.reset();
+        mgDatasetInPtr_.reset();
+        return ret;
+    }
+
+    bool MgStripeRemove::process(GDALDataType gdt) {
         if (method_ == MgStripeRemove::PloyFit) {
             MgSwitchGDALTypeProcess(gdt, ployFit);
         } else if (method_ == MgStripeRemove::MoveWindowWeight) {
@@ -47,6 +86,7 @@ namespace Mg {
         } else if (method_ == MgStripeRemove::SecondaryGamma) {
             MgSwitchGDALTypeProcess(gdt, secondaryGamma);
         }
+        return false;
     }
 
     template <typename OutScalar>
@@ -65,25 +105,30 @@ namespace Mg {
         int bandCount = mgDatasetInPtr_->getRasterCount();
         int height = mgDatasetInPtr_->getRasterYSize();
         int width = mgDatasetInPtr_->getRasterXSize();
+        const RSTool::KernelTable &kernels = RSTool::Kernels();
+        Mat::Matrixf strip(std::min(StripRows, height), width);
         for (int i = 0; i < bandCount; ++i) {
-            // 获取原始波段数据
-            MgCube cube;
+            // 按原生类型获取原始波段数据，计算时按行条带转换为 float
+            MgCubeT<OutScalar> cube;
             if (!mgDatasetInPtr_->readDataChunk(false, 0, MgBandMap({i+1}), cube)) {
                 return false;
             }
 
-            // 计算原始列均值和列标准差
-            Mat::Matrixf srcColMean = cube.band(0).colwise().mean().transpose();
-
-            Mat::Matrixf srcColStdDev(srcColMean.rows(), 1);
-            for (int col = 0; col < width; ++ col) {        // 按列处理
-                auto &&vec = cube.band(0).col(col);
-
-                for (int row = 0; row < height; ++ row) {
-                    vec(row) -= srcColMean(col);            // 将原始数据的每一列减去原始列均值
-                }
-                srcColStdDev(col) = std::sqrt(vec.cwiseProduct(vec).sum()/height);
-            }
+            // 计算原始列均值和列标准差（按行连续访问，由按指令集分派的计算核心完成；
+            // 列和及平方和按 double 累加，列很高时也不丢失精度）
+            Mat::Matrixd colSum = Mat::Matrixd::Zero(width, 1);
+            ForEachFloatStrip(cube, strip, [&](int row, int rows) {
+                kernels.columnSum(strip.data(), width, rows, width, colSum.data());
+            });
+            Mat::Matrixf srcColMean = (colSum/height).cast<float>();
+
+            // 每一列减去原始列均值后的平方和
+            Mat::Matrixd colSumSq = Mat::Matrixd::Zero(width, 1);
+            ForEachFloatStrip(cube, strip, [&](int row, int rows) {
+                kernels.columnCenter(strip.data(), width, rows, width,
+                        srcColMean.data(), colSumSq.data());
+            });
+            Mat::Matrixf srcColStdDev = (colSumSq/height).cwiseSqrt().cast<float>();
 
             // 计算多项式拟合后的列均值和列标准差
             Mat::Matrixf &&newColMean = U*(matU*srcColMean);
@@ -91,32 +136,16 @@ namespace Mg {
 
             // 基于多项式拟合滤波的改进矩匹配法
             MgCube cubeOut(cube.height(), cube.width(), 1);
-            auto &&coeff = newColStdDev.cwiseQuotient(srcColStdDev);
+            Mat::Matrixf coeff = newColStdDev.cwiseQuotient(srcColStdDev);
 
-            if (std::is_floating_point<OutScalar>::value) {
-                for (int col = 0; col < urows; ++ col) {        // 按列处理
-                    auto &&vec = cube.band(0).col(col);
-                    auto &&vecOut = cubeOut.band(0).col(col);
-
-                    for (int row = 0; row < height; ++ row) {
-                        // 改进的矩匹配法
-                        cubeOut.band(i).col(col)(row) = (coeff(col)) * (vec(row)/* - srcColMean(col)*/) + newColMean(col);
-                    }
-                }
-            } else {
-                double tmpValue = 0;
-                for (int col = 0; col < urows; ++ col) {        // 按列处理
-                    auto &&vec = cube.band(0).col(col);
-                    auto &&vecOut = cubeOut.band(0).col(col);
-
-                    for (int row = 0; row < height; ++ row) {
-                        // 改进的矩匹配法
-                        tmpValue = (coeff(col)) * (vec(row)/* - srcColMean(col)*/) + newColMean(col);
-                        tmpValue < 0 ? cubeOut.band(i).col(col)(row) = 0 :
-                                cubeOut.band(i).col(col)(row) = tmpValue+0.5;
-                    }
-                }
-            }
+            // 改进的矩匹配法：out = coeff(col)*(src - srcColMean(col)) + newColMean(col)
+            // 整数输出的四舍五入及饱和由 writeDataChunk 的转换完成
+            ForEachFloatStrip(cube, strip, [&](int row, int rows) {
+                strip.topRows(rows).rowwise() -= srcColMean.col(0).transpose();
+                kernels.columnAffine(strip.data(), width, cubeOut.band(0).data() + static_cast<size_t>(row)*width, width,
+                        rows, urows, coeff.data(), newColMean.data());
+            });
+            clampNegative<OutScalar>(cubeOut);
 
             if (!mgDatasetOutPtr_->writeDataChunk<OutScalar>(false, 0, MgBandMap({i+1}), cubeOut)) {
                 return false;
@@ -150,8 +179,11 @@ namespace Mg {
         int end = 2529;    // 2529需要处理的列结束位置（最大为width-1） clip2-1900
         int proWidth = end - start + 1; // 实际需要处理的列数
 
+        const RSTool::KernelTable &kernels = RSTool::Kernels();
+        Mat::Matrixf strip(std::min(StripRows, height), width);
         for (int i = 0; i < bandCount; ++i) {
-            MgCube cube;
+            // 按原生类型获取原始波段数据，计算时按行条带转换为 float
+            MgCubeT<OutScalar> cube;
             if (!mgDatasetInPtr_->readDataChunk(false, 0, MgBandMap({i+1}), cube)) {
                 return false;
             }
@@ -160,18 +192,20 @@ namespace Mg {
             Mat::Matrixf srcColStdDevExt(1, proWidth+2*halfWinSize);
 
             {
-                // 计算原始列均值和列标准差
-                Mat::Matrixf srcColMean = (cube.band(0).colwise().mean()).block(0, start, 1, proWidth);
-                Mat::Matrixf srcColStdDev(1, srcColMean.cols());
-
-                for (int col = start, k = 0; col <= end; ++col, ++k) {    // 按列处理
-                    auto &&vec = cube.band(0).col(col);
-
-                    for (int row = 0; row < height; ++row) {
-                        vec(row) -= srcColMean(k);                        // 将原始数据的每一列减去原始列均值
-                    }
-                    srcColStdDev(k) = std::sqrt(vec.cwiseProduct(vec).sum()/height);
-                }
+                // 计算原始列均值和列标准差（列和及平方和按 double 累加）
+                Mat::Matrixd colSum = Mat::Matrixd::Zero(1, proWidth);
+                ForEachFloatStrip(cube, strip, [&](int row, int rows) {
+                    kernels.columnSum(strip.data() + start, width, rows, proWidth, colSum.data());
+                });
+                Mat::Matrixf srcColMean = (colSum/height).cast<float>();
+
+                // 每一列减去原始列均值后的平方和
+                Mat::Matrixd colSumSq = Mat::Matrixd::Zero(1, proWidth);
+                ForEachFloatStrip(cube, strip, [&](int row, int rows) {
+                    kernels.columnCenter(strip.data() + start, width, rows, proWidth,
+                            srcColMean.data(), colSumSq.data());
+                });
+                Mat::Matrixf srcColStdDev = (colSumSq/height).cwiseSqrt().cast<float>();
 
                 // 进行拓展
                 for (int i = 0; i < halfWinSize; ++i) {
@@ -232,7 +266,7 @@ namespace Mg {
             // 基于移动窗口(加权)滤波的改进矩匹配法
             MgCube cubeOut(heightOut, widthOut, 1);
             Mat::Matrixf &&tmpSrcColStdDev = srcColStdDevExt.block(0,halfWinSize, 1, proWidth);
-            auto &&coeff = newColStdDev.cwiseQuotient(tmpSrcColStdDev);
+            Mat::Matrixf coeff = newColStdDev.cwiseQuotient(tmpSrcColStdDev);
 
             // 用于调试
             ///////////////////////////////////////////////////////////////////////////////
@@ -264,55 +298,45 @@ namespace Mg {
 
             double tmpValue = 0;
             Mat::Matrixf &&tmpSrcColMean = srcColMeanExt.block(0,halfWinSize, 1, proWidth);
-            if (std::is_floating_point<OutScalar>::value) {
-                for (int col = start, k = 0; col <= end; ++col, ++k) { // 列
-                    auto &&vec = cube.band(0).col(col);
-                    auto &&vecOut = cubeOut.band(0).col(col);
-
-                    for (int row = 0; row < height; ++row) {
-                        tmpValue = coeff(k) * vec(row) + newColMean(k);
-                        tmpValue += ( (vec(row)+tmpSrcColMean(k))/tmpSrcColMean(k)
-                                - tmpValue/newColMean(k) )*tmpSrcColMean(k);
-
-                        cubeOut.band(0).col(col)(row) = tmpValue;
-                    }
-                }
-            } else {
-                for (int col = start, k = 0; col <= end; ++ col, ++k) { // 列
-                    auto &&vec = cube.band(0).col(col);
-                    auto &&vecOut = cubeOut.band(0).col(col); // TODO 有可能会剔除那些坏列，直接输出有效的数据，这里就应该从0开始
-
-                    for (int row = 0; row < height; ++row) {
-                        tmpValue = coeff(k) * vec(row) + newColMean(k);
-
-                        // TODO 对于影像中存在大面积的水域，可能会在水域有明显的条纹，因为补偿过度
-                        // 对均匀地物进行补偿
-                        // 对于欧比特来说，适应于后面的波段
-//                        tmpValue += ( (vec(row)+tmpSrcColMean(k))/tmpSrcColMean(k)
-//                         - tmpValue/newColMean(k) )*tmpSrcColMean(k);
-
-                        tmpValue < 0 ? cubeOut.band(0).col(col)(row) = 0 :
-                                cubeOut.band(0).col(col)(row) = tmpValue+0.5;
+            ForEachFloatStrip(cube, strip, [&](int row, int rows) {
+                // 将原始数据的每一列减去原始列均值
+                strip.block(0, start, rows, proWidth).rowwise() -= tmpSrcColMean.row(0);
+                float *stripOut = cubeOut.band(0).data() + static_cast<size_t>(row)*widthOut;
+
+                if (std::is_floating_point<OutScalar>::value) {
+                    for (int r = 0; r < rows; ++r) { // 行
+                        const float *vec = strip.data() + static_cast<size_t>(r)*width;
+                        float *vecOut = stripOut + static_cast<size_t>(r)*widthOut;
+
+                        for (int col = start, k = 0; col <= end; ++col, ++k) {
+                            tmpValue = coeff(k) * vec[col] + newColMean(k);
+                            tmpValue += ( (vec[col]+tmpSrcColMean(k))/tmpSrcColMean(k)
+                                    - tmpValue/newColMean(k) )*tmpSrcColMean(k);
+
+                            vecOut[col] = tmpValue;
+                        }
                     }
+                } else {
+                    // TODO 有可能会剔除那些坏列，直接输出有效的数据，这里就应该从0开始
+                    // TODO 对于影像中存在大面积的水域，可能会在水域有明显的条纹，因为补偿过度
+                    // 对均匀地物进行补偿
+                    // 对于欧比特来说，适应于后面的波段
+//                    tmpValue += ( (vec(row)+tmpSrcColMean(k))/tmpSrcColMean(k)
+//                     - tmpValue/newColMean(k) )*tmpSrcColMean(k);
+                    kernels.columnAffine(strip.data() + start, width, stripOut + start, widthOut,
+                            rows, proWidth, coeff.data(), newColMean.data());
                 }
-
-//            if (start > 0) // 左边界
-//                cubeOut.band(0).block(0, 0, height, start) =
-//                        cube.band(0).block(0, 0, height, start);
-//
-//            if (end < width-1) // 右边界
-//                cubeOut.band(0).block(0, end+1, height, width-proWidth-2) =
-//                        cube.band(0).block(0, end+1, height, width-proWidth-2);
-            }
+            });
+            clampNegative<OutScalar>(cubeOut);
 
             // 如果左右边界存在问题，则按原始值输出
             if (start > 0) // 左边界
                 cubeOut.band(0).block(0, 0, height, start) =
-                        cube.band(0).block(0, 0, height, start);
+                        cube.template bandAs<float>(0).block(0, 0, height, start);
 
             if (end < width-1) // 右边界
                 cubeOut.band(0).block(0, end+1, height, width-proWidth-2) =
-                        cube.band(0).block(0, end+1, height, width-proWidth-2);
+                        cube.template bandAs<float>(0).block(0, end+1, height, width-proWidth-2);
 
             if (!mgDatasetOutPtr_->writeDataChunk<OutScalar>(false, 0, MgBandMap({i+1}), cubeOut)) {
                 return false;
@@ -337,7 +361,8 @@ namespace Mg {
 
         int hightValue = 2000;
         for (int i = 0; i < bandCount; ++i) {
-            MgCube cube;
+            // 按原生类型获取原始波段数据：Byte 及 12 位数据直接以原始值查表，其他情况逐像素转换
+            MgCubeT<OutScalar> cube;
             if (!mgDatasetInPtr_->readDataChunk(false, 0, MgBandMap({i + 1}), cube)) {
                 return false;
             }
@@ -356,16 +381,28 @@ namespace Mg {
 
             // 基于移动窗口(加权)滤波的改进矩匹配法
             MgCube cubeOut(heightOut, widthOut, 1);
-            for (int col = start, k = 0; col <= end; ++ col, ++k) { // 列
-                auto &&vec = cube.band(0).col(col);
-                auto &&vecOut = cubeOut.band(0).col(col); // TODO 有可能会剔除那些坏列，直接输出有效的数据，这里就应该从0开始
 
-                for (int row = 0; row < height; ++row) {
-                    if (vec(row) < hightValue) {
-                        cubeOut.band(0).col(col)(row) = vec(row) * (meanAll / meanCols(k));
+            // Byte 及 12 位数据：按列的增益只与像素值有关，每列预先计算一张查找表（表的总大小不超过 LutMaxBytes 时）
+            int lutEntries = RSTool::LutEntries<OutScalar>(cube.band(0).maxCoeff());
+            if (lutEntries > 0 && RSTool::PixelLut<float>::Bytes(lutEntries, proWidth) <= RSTool::LutMaxBytes) {
+                RSTool::PixelLut<float> lut(lutEntries, proWidth);
+                lut.buildAll([&](int k, int v) {
+                    return v < hightValue ? v * (meanAll / meanCols(k)) : static_cast<float>(v);
+                });
+                lut.applyColumns(cube.band(0).data() + start, width,
+                        cubeOut.band(0).data() + start, widthOut, height, proWidth);
+            } else {
+                for (int col = start, k = 0; col <= end; ++ col, ++k) { // 列
+                    auto &&vec = cube.band(0).col(col);
+                    auto &&vecOut = cubeOut.band(0).col(col); // TODO 有可能会剔除那些坏列，直接输出有效的数据，这里就应该从0开始
+
+                    for (int row = 0; row < height; ++row) {
+                        if (vec(row) < hightValue) {
+                            cubeOut.band(0).col(col)(row) = vec(row) * (meanAll / meanCols(k));
 
-                    } else {
-                        cubeOut.band(0).col(col)(row) = vec(row);
+                        } else {
+                            cubeOut.band(0).col(col)(row) = vec(row);
+                        }
                     }
                 }
             }
@@ -373,11 +410,11 @@ namespace Mg {
             // 如果左右边界存在问题，则按原始值输出
             if (start > 0) // 左边界
                 cubeOut.band(0).block(0, 0, height, start) =
-                        cube.band(0).block(0, 0, height, start);
+                        cube.template bandAs<float>(0).block(0, 0, height, start);
 
             if (end < width-1) // 右边界
                 cubeOut.band(0).block(0, end+1, height, width-proWidth-2) =
-                        cube.band(0).block(0, end+1, height, width-proWidth-2);
+                        cube.template bandAs<float>(0).block(0, end+1, height, width-proWidth-2);
 
             // 输出文件
             if (!mgDatasetOutPtr_->writeDataChunk<OutScalar>(false, 0, MgBandMap({i+1}), cubeOut)) {
@@ -388,7 +425,8 @@ namespace Mg {
         return true;
     }
 
-    float MgStripeRemove::meanExceptHightValue(const Mg::Mat::Matrixf &data, int hightValue) {
+    template <typename Derived>
+    float MgStripeRemove::meanExceptHightValue(const Eigen::MatrixBase<Derived> &data, int hightValue) {
         int rows = data.rows();
         int cols = data.cols();
 
@@ -11,6 +11,7 @@
 
 #include "mg_datasetmanager.h"
 #include "mg_progress.hpp"
+#include "rstool_memstore.h"
 #include <string>
 
 namespace Mg {
@@ -28,7 +29,8 @@ namespace Mg {
          *
          * @param fileIn    输入文件
          * @param fileOut   输出文件
-         * @param format    输出文件格式，如 ENVI、GTiff等
+         * @param format    输出文件格式，如 ENVI、GTiff等；为 MEM 时结果写到内存中间结果（fileOut 仅作为名称），
+         *                  由 result() 获取，可直接作为下一个算法的输入
          * @param method    条带噪声去除方法
          * @param n         如果选择“多项式拟合”，表示拟合的最高次数，推荐默认为5；
          *                  如果选择“移动窗口(加权)”，则表示窗口大小（奇数），推荐默认为41；
@@ -40,7 +42,13 @@ namespace Mg {
                                 int n);
 
         bool run();
+
+        // 输出格式为 MEM 时的中间结果（run() 之后有效）
+        RSTool::Mp::MemResultPtr result() const { return result_; }
+
     private:
+        bool process(GDALDataType gdt);
+
         // 基于多项式拟合滤波
         // 此方法可使变化较缓和变化剧烈的数据，都获得良好的平滑效果。
         // 较好地恢复和保持地物真实反射率空间分布情况，明显改善了矩匹配方法产生的“带状效应”。
@@ -58,7 +66,17 @@ namespace Mg {
         template <typename OutScalar>
         bool secondaryGamma();
 
-        float meanExceptHightValue(const Mat::Matrixf &data, int hightValue);
+        // 小于 hightValue 的值的均值，data 可以是按原生类型存储的波段或其中的一列
+        template <typename Derived>
+        float meanExceptHightValue(const Eigen::MatrixBase<Derived> &data, int hightValue);
+
+        // 整数输出时负值按 0 输出（无符号类型由饱和转换处理，有符号类型在此截断）
+        template <typename OutScalar>
+        static void clampNegative(MgCube &cube) {
+            if (std::is_integral<OutScalar>::value && std::is_signed<OutScalar>::value) {
+                cube.data() = cube.data().cwiseMax(0.0f);
+            }
+        }
         //float meanExceptHightValue(const Mat::ExtMatrixf &data, int hightValue);
 
     private:
@@ -74,6 +92,8 @@ namespace Mg {
 
         MgDatasetManagerPtr mgDatasetInPtr_;
         MgDatasetManagerPtr mgDatasetOutPtr_;
+
+        RSTool::Mp::MemResultPtr result_;
     };
 
 } // namespace Mg
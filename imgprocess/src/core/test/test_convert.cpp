@@ -0,0 +1,114 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_convert.h"
+#include "rstool_convert.h"
+#include <iostream>
+#include <vector>
+#include <limits>
+#include <cmath>
+
+using namespace RSTool;
+
+namespace {
+
+    const float Inf = std::numeric_limits<float>::infinity();
+    const float NaN = std::numeric_limits<float>::quiet_NaN();
+
+    // 边界值及其期望的转换结果（四舍五入远离零，超出范围时取最近的边界，NaN 为 0）
+    template <typename D>
+    struct Case {
+        float in;
+        D out;
+    };
+
+    template <typename D>
+    bool checkCases(const char *name, const std::vector<Case<D>> &cases) {
+        // 每个边界值放在不同的位置上重复多次，使其分别经过 SIMD 主循环及尾部
+        std::vector<float> src;
+        std::vector<D> expected;
+        for (int rep = 0; rep < 17; rep++) {
+            for (auto &c : cases) {
+                src.push_back(c.in);
+                expected.push_back(c.out);
+            }
+            src.push_back(static_cast<float>(rep));
+            expected.push_back(static_cast<D>(rep));
+        }
+
+        for (size_t n = 0; n <= src.size(); n += (n < 40 ? 1 : 13)) {
+            std::vector<D> dst(n + 1, D(7));
+            ConvertSaturate(src.data(), dst.data(), n);
+            for (size_t i = 0; i < n; i++) {
+                if (dst[i] != expected[i] || dst[i] != SaturateCast<D>(src[i])) {
+                    std::cerr << "ConvertSaturate<" << name << "> " << src[i] << " -> " << +dst[i]
+                              << ", expected " << +expected[i] << " (n = " << n << ")" << std::endl;
+                    return false;
+                }
+            }
+            if (dst[n] != D(7)) {
+                std::cerr << "ConvertSaturate<" << name << "> writes past n = " << n << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 随机值：批量转换与逐元素转换一致（源数据不对齐）
+    template <typename D>
+    bool checkRandom(const char *name, float scale) {
+        std::vector<float> src(1001);
+        unsigned int seed = 12345;
+        for (auto &v : src) {
+            seed = seed*1103515245u + 12345u;
+            v = (static_cast<float>(seed >> 8) / (1 << 24) - 0.25f)*scale;
+        }
+        std::vector<D> dst(src.size());
+        ConvertSaturate(src.data() + 1, dst.data(), src.size() - 1);
+        for (size_t i = 0; i + 1 < src.size(); i++) {
+            if (dst[i] != SaturateCast<D>(src[i + 1])) {
+                std::cerr << "ConvertSaturate<" << name << "> random " << src[i + 1] << " -> " << +dst[i] << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testConvertSaturate() {
+    bool ok = checkCases<unsigned char>("uint8", {
+            {NaN, 0}, {-Inf, 0}, {Inf, 255}, {-0.0f, 0}, {-0.5f, 0}, {-1e30f, 0},
+            {0.49f, 0}, {0.5f, 1}, {1.5f, 2}, {2.5f, 3}, {254.5f, 255}, {255.4f, 255}, {256.0f, 255}, {1e30f, 255}});
+    ok = checkCases<unsigned short>("uint16", {
+            {NaN, 0}, {-Inf, 0}, {Inf, 65535}, {-1.0f, 0}, {0.5f, 1}, {32767.5f, 32768}, {32768.0f, 32768},
+            {65534.5f, 65535}, {65535.0f, 65535}, {65536.0f, 65535}, {1e30f, 65535}}) && ok;
+    ok = checkCases<short>("int16", {
+            {NaN, 0}, {-Inf, -32768}, {Inf, 32767}, {-0.5f, -1}, {-1.5f, -2}, {0.5f, 1},
+            {-32767.5f, -32768}, {-32769.0f, -32768}, {32766.5f, 32767}, {32768.0f, 32767}, {-1e30f, -32768}}) && ok;
+    ok = checkCases<int>("int32", {
+            {NaN, 0}, {-Inf, std::numeric_limits<int>::min()}, {Inf, std::numeric_limits<int>::max()},
+            {-2.5f, -3}, {2.5f, 3}, {16777216.0f, 16777216}, {-2147483648.0f, std::numeric_limits<int>::min()},
+            {2147483520.0f, 2147483520}, {2147483648.0f, std::numeric_limits<int>::max()},
+            {-3e9f, std::numeric_limits<int>::min()}, {3e9f, std::numeric_limits<int>::max()}}) && ok;
+
+    ok = checkRandom<unsigned char>("uint8", 400.0f) && checkRandom<unsigned short>("uint16", 1e5f) &&
+         checkRandom<short>("int16", 1e5f) && checkRandom<int>("int32", 1e10f) && ok;
+
+    // 整数之间的通用实现
+    const int ints[] = {-70000, -32769, -1, 0, 255, 256, 65535, 65536};
+    unsigned char u8[8];
+    short s16[8];
+    ConvertSaturate(ints, u8, 8);
+    ConvertSaturate(ints, s16, 8);
+    const unsigned char u8Expected[] = {0, 0, 0, 0, 255, 255, 255, 255};
+    const short s16Expected[] = {-32768, -32768, -1, 0, 255, 256, 32767, 32767};
+    for (int i = 0; i < 8; i++) {
+        if (u8[i] != u8Expected[i] || s16[i] != s16Expected[i]) {
+            std::cerr << "ConvertSaturate<int> " << ints[i] << " -> " << +u8[i] << ", " << s16[i] << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
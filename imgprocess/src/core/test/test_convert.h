@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 饱和类型转换（rstool_convert.h）的测试
+
+#ifndef IMGPROCESS_TEST_CONVERT_H
+#define IMGPROCESS_TEST_CONVERT_H
+
+// float 到各整数类型的批量转换（SSE 实现及尾部）与逐元素的 SaturateCast 一致，边界值的结果正确时返回 true
+bool testConvertSaturate();
+
+#endif //IMGPROCESS_TEST_CONVERT_H
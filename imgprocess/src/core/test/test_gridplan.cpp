@@ -0,0 +1,92 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_gridplan.h"
+#include "rstool_gridplan.h"
+#include <iostream>
+#include <vector>
+
+using namespace RSTool;
+
+namespace {
+
+    // 各数据块互不重叠且恰好覆盖整幅影像
+    bool covers(const GridPlan &plan, int imgXSize, int imgYSize) {
+        std::vector<int> hits(static_cast<size_t>(imgXSize)*imgYSize, 0);
+        for (const SpatialDims &c : plan.chunks()) {
+            if (c.xOff() < 0 || c.yOff() < 0 || c.xSize() <= 0 || c.ySize() <= 0 ||
+                    c.xOff() + c.xSize() > imgXSize || c.yOff() + c.ySize() > imgYSize) {
+                return false;
+            }
+            for (int y = c.yOff(); y < c.yOff() + c.ySize(); y++) {
+                for (int x = c.xOff(); x < c.xOff() + c.xSize(); x++) {
+                    hits[static_cast<size_t>(y)*imgXSize + x]++;
+                }
+            }
+        }
+        for (int h : hits) {
+            if (h != 1) return false;
+        }
+        return true;
+    }
+
+    bool checkPlan(const char *name, int imgXSize, int imgYSize, int xBlockSize, int yBlockSize,
+            size_t pixelBytes, size_t targetBytes, bool fullWidth) {
+        GridPlan plan = PlanChunkGrid(imgXSize, imgYSize, xBlockSize, yBlockSize,
+                pixelBytes, targetBytes, fullWidth);
+        const int bx = std::min(xBlockSize, imgXSize);
+        const int by = std::min(yBlockSize, imgYSize);
+        const int xc = plan.xChunkSize();
+        const int yc = plan.yChunkSize();
+
+        if (!covers(plan, imgXSize, imgYSize)) {
+            std::cerr << name << ": chunks do not tile the image exactly" << std::endl;
+            return false;
+        }
+        // 由整数个原生块组成（数据块尺寸被截断到影像尺寸时除外）
+        if ((xc % bx != 0 && xc != imgXSize) || (yc % by != 0 && yc != imgYSize)) {
+            std::cerr << name << ": chunk " << xc << "x" << yc << " is not aligned to blocks "
+                      << bx << "x" << by << std::endl;
+            return false;
+        }
+        if ((fullWidth || bx >= imgXSize) && xc != imgXSize) {
+            std::cerr << name << ": chunk is not full width" << std::endl;
+            return false;
+        }
+        // 不超过期望大小，除非一个原生块（或一个条带）已超过
+        size_t bytes = static_cast<size_t>(xc)*yc*pixelBytes;
+        size_t minBytes = static_cast<size_t>(fullWidth ? imgXSize : bx)*by*pixelBytes;
+        if (bytes > std::max(targetBytes, minBytes)) {
+            std::cerr << name << ": chunk " << xc << "x" << yc << " exceeds " << targetBytes
+                      << " bytes" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testPlanChunkGrid() {
+    bool ok = true;
+    // 条带：整行，高度为条带高度的整数倍
+    ok = checkPlan("strip", 1000, 777, 1000, 1, 4, 64 << 10, false) && ok;
+    ok = checkPlan("strip16", 1000, 777, 1000, 16, 12, 256 << 10, false) && ok;
+    // 期望大小小于一个条带时取一个条带
+    ok = checkPlan("tiny", 1000, 777, 1000, 16, 12, 100, false) && ok;
+    // 瓦片，影像尺寸不是瓦片尺寸的整数倍
+    ok = checkPlan("tile", 1001, 777, 64, 64, 4, 1 << 20, false) && ok;
+    ok = checkPlan("tileWide", 3000, 500, 256, 128, 2, 2 << 20, false) && ok;
+    // 期望大小超过整幅影像
+    ok = checkPlan("whole", 300, 200, 64, 64, 8, 64 << 20, false) && ok;
+    // 瓦片影像强制整行
+    ok = checkPlan("fullWidth", 1001, 777, 64, 64, 4, 1 << 20, true) && ok;
+
+    // 方形瓦片的数据块接近方形
+    GridPlan plan = PlanChunkGrid(4096, 4096, 256, 256, 4, 16 << 20);
+    if (plan.xChunkSize() != 2048 || plan.yChunkSize() != 2048) {
+        std::cerr << "square tiles: chunk " << plan.xChunkSize() << "x" << plan.yChunkSize() << std::endl;
+        ok = false;
+    }
+    return ok;
+}
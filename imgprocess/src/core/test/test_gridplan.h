@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 分块方案（rstool_gridplan.h）的测试
+
+#ifndef IMGPROCESS_TEST_GRIDPLAN_H
+#define IMGPROCESS_TEST_GRIDPLAN_H
+
+// PlanChunkGrid 的数据块恰好覆盖影像、由整数个原生块组成且不超过期望大小时返回 true
+bool testPlanChunkGrid();
+
+#endif //IMGPROCESS_TEST_GRIDPLAN_H
@@ -0,0 +1,136 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_half.h"
+#include "rstool_half.h"
+#include <iostream>
+#include <vector>
+#include <limits>
+#include <cmath>
+
+using namespace RSTool;
+
+namespace {
+
+    float bitsFloat(uint32_t x) {
+        float v;
+        memcpy(&v, &x, sizeof(v));
+        return v;
+    }
+
+    // 两个 float 相同（NaN 与任意 NaN 视为相同）
+    bool same(float a, float b) {
+        return (std::isnan(a) && std::isnan(b)) || memcmp(&a, &b, sizeof(float)) == 0;
+    }
+
+    template <typename H>
+    bool sameBits(H a, H b) {
+        return same(static_cast<float>(a), static_cast<float>(b));
+    }
+
+    // 全部 fp16 编码转换为 float 再转换回来不变（NaN 仍为 NaN）
+    bool checkHalfRoundTrip() {
+        for (uint32_t bits = 0; bits < 65536; bits++) {
+            Half h;
+            h.bits = static_cast<uint16_t>(bits);
+            float f = static_cast<float>(h);
+            Half back(f);
+            if (std::isnan(f) ? !std::isnan(static_cast<float>(back)) : back.bits != h.bits) {
+                std::cerr << "Half round trip 0x" << std::hex << bits << " -> 0x" << back.bits << std::dec << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct HalfCase {
+        float in;
+        uint16_t half;
+        uint16_t bf16;
+    };
+
+    // 舍入到偶数、溢出为无穷大、非规格化数及下溢
+    bool checkCases() {
+        const float inf = std::numeric_limits<float>::infinity();
+        const HalfCase cases[] = {
+                {0.0f, 0x0000, 0x0000}, {-0.0f, 0x8000, 0x8000}, {1.0f, 0x3c00, 0x3f80}, {-2.0f, 0xc000, 0xc000},
+                {65504.0f, 0x7bff, 0x4780}, {65519.0f, 0x7bff, 0x4780}, {65520.0f, 0x7c00, 0x4780},
+                {inf, 0x7c00, 0x7f80}, {-inf, 0xfc00, 0xff80},
+                {bitsFloat(0x33800000u), 0x0001, 0x3380},   // 2^-24：最小的 fp16 非规格化数
+                {bitsFloat(0x33000000u), 0x0000, 0x3300},   // 2^-25：恰在中间，舍入到偶数（0）
+                {bitsFloat(0x33c00000u), 0x0002, 0x33c0},   // 1.5 * 2^-24：舍入到偶数（2）
+                {bitsFloat(0x3f808000u), 0x3c04, 0x3f80},   // bf16 恰在中间，舍入到偶数
+                {bitsFloat(0x3f818000u), 0x3c0c, 0x3f82},
+                {bitsFloat(0x7f7fffffu), 0x7c00, 0x7f80},   // 最大的 float，bf16 舍入为无穷大
+        };
+        bool ok = true;
+        for (const HalfCase &c : cases) {
+            if (Half(c.in).bits != c.half || BFloat16(c.in).bits != c.bf16) {
+                std::cerr << "Half/BFloat16 " << c.in << " -> 0x" << std::hex << Half(c.in).bits
+                          << "/0x" << BFloat16(c.in).bits << ", expected 0x" << c.half << "/0x" << c.bf16
+                          << std::dec << std::endl;
+                ok = false;
+            }
+        }
+
+        const float nans[] = {std::numeric_limits<float>::quiet_NaN(), bitsFloat(0x7f800001u), bitsFloat(0xffffffffu)};
+        for (float v : nans) {
+            if (!std::isnan(static_cast<float>(Half(v))) || !std::isnan(static_cast<float>(BFloat16(v)))) {
+                std::cerr << "Half/BFloat16 NaN is not kept" << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // 批量转换与逐元素转换一致，长度覆盖 SIMD 主循环及尾部
+    template <typename H>
+    bool checkBulk(const char *name, const std::vector<float> &src) {
+        for (size_t n = 0; n <= src.size(); n += (n < 40 ? 1 : 97)) {
+            std::vector<H> narrow(n + 1);
+            std::vector<float> wide(n + 1, 7.0f);
+            narrow[n].bits = 0x1234;
+            ConvertHalf(src.data(), narrow.data(), n);
+            ConvertHalf(narrow.data(), wide.data(), n);
+            for (size_t i = 0; i < n; i++) {
+                if (!sameBits(narrow[i], H(src[i])) || !same(wide[i], static_cast<float>(narrow[i]))) {
+                    std::cerr << "ConvertHalf<" << name << "> (" << IsaName(ActiveIsaLevel()) << ") "
+                              << src[i] << " at " << i << " of " << n << std::endl;
+                    return false;
+                }
+            }
+            if (narrow[n].bits != 0x1234 || wide[n] != 7.0f) {
+                std::cerr << "ConvertHalf<" << name << "> writes past n = " << n << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testHalf() {
+    bool ok = checkHalfRoundTrip() && checkCases();
+
+    std::vector<float> src(1000);
+    unsigned int seed = 4321;
+    for (size_t i = 0; i < src.size(); i++) {
+        seed = seed*1103515245u + 12345u;
+        src[i] = (static_cast<float>(seed >> 8) / (1 << 24) - 0.5f)*std::pow(10.0f, static_cast<float>(i % 13) - 6);
+    }
+    src[3] = std::numeric_limits<float>::quiet_NaN();
+    src[10] = std::numeric_limits<float>::infinity();
+    src[17] = 1e6f;
+    src[29] = -0.0f;
+
+    // 依次使用标量及 CPU 支持的各级指令集
+    IsaLevel active = ActiveIsaLevel();
+    for (IsaLevel isa : {IsaLevel::Scalar, IsaLevel::SSE2, IsaLevel::AVX2, IsaLevel::AVX512}) {
+        if (isa > DetectIsaLevel()) break;
+        SetIsaLevel(isa);
+        ok = checkBulk<Half>("Half", src) && checkBulk<BFloat16>("BFloat16", src) && ok;
+    }
+    SetIsaLevel(active);
+    return ok;
+}
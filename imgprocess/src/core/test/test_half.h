@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 半精度存储类型（rstool_half.h）的测试
+
+#ifndef IMGPROCESS_TEST_HALF_H
+#define IMGPROCESS_TEST_HALF_H
+
+// Half/BFloat16 与 float 的相互转换（舍入、溢出、非规格化数、NaN），以及各指令集的批量转换与逐元素转换一致时返回 true
+bool testHalf();
+
+#endif //IMGPROCESS_TEST_HALF_H
@@ -0,0 +1,118 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_interleave.h"
+#include "rstool_common.h"
+#include "rstool_transpose.h"
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+using namespace RSTool;
+
+namespace {
+
+    // 转置与逐元素结果比较：行列数覆盖小于、等于、不是寄存器小块及缓存分块整数倍的情况，跨度大于行长
+    template <typename T>
+    bool checkTranspose() {
+        const int sizes[] = {1, 2, 3, 7, 8, 9, 16, 17, 63, 64, 65, 130};
+        for (int rows : sizes) {
+            for (int cols : sizes) {
+                size_t srcStride = cols + 3;
+                size_t dstStride = rows + 5;
+                std::vector<T> src(rows*srcStride), dst(cols*dstStride, T(0)), guard(dst);
+                for (size_t i = 0; i < src.size(); i++) src[i] = static_cast<T>(i*7 + 1);
+
+                Transpose(src.data(), srcStride, dst.data(), dstStride, rows, cols);
+                for (int c = 0; c < cols; c++) {
+                    for (size_t r = 0; r < dstStride; r++) {
+                        T expected = r < static_cast<size_t>(rows) ? src[r*srcStride + c] : guard[c*dstStride + r];
+                        if (dst[c*dstStride + r] != expected) {
+                            std::cerr << "Transpose<" << sizeof(T) << "> " << rows << "x" << cols
+                                      << " mismatch at (" << c << ", " << r << ")" << std::endl;
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // 像素 (x, y) 第 b 个波段的偏移量，BIP 方式时相邻两个像素的间隔为 stride
+    size_t offsetOf(Interleave intl, int xSize, int ySize, int bandCount, int stride, int x, int y, int b) {
+        if (intl == Interleave::BIP) return (static_cast<size_t>(y)*xSize + x)*stride + b;
+        return InterleaveOffset(intl, xSize, ySize, bandCount, x, y, b);
+    }
+
+    template <typename T>
+    T valueOf(int x, int y, int b) {
+        return static_cast<T>((b*1000 + y*37 + x) % 251 + 1);
+    }
+
+    /**
+     * 所有组织方式两两转换，每个元素与逐元素计算的结果一致；
+     * 目标的光谱补齐部分不被改写（由 DataChunk 分配时置 0），组织方式相同时整体复制
+     */
+    template <typename T>
+    bool checkConvert(int xSize, int ySize, int bandCount, bool padded) {
+        const Interleave all[] = {Interleave::BSQ, Interleave::BIL, Interleave::BIP,
+                                  Interleave::BIP8, Interleave::BIP16};
+        const T untouched = static_cast<T>(255);
+        int stride = padded ? bandCount + 5 : bandCount;
+        size_t pixels = static_cast<size_t>(xSize)*ySize;
+        for (Interleave from : all) {
+            for (Interleave to : all) {
+                std::vector<T> src(InterleaveSize(from, pixels, bandCount, stride), T(0));
+                std::vector<T> dst(InterleaveSize(to, pixels, bandCount, stride), untouched);
+                for (int y = 0; y < ySize; y++) {
+                    for (int x = 0; x < xSize; x++) {
+                        for (int b = 0; b < bandCount; b++) {
+                            src[offsetOf(from, xSize, ySize, bandCount, stride, x, y, b)] = valueOf<T>(x, y, b);
+                        }
+                    }
+                }
+
+                ConvertInterleave(src.data(), from, dst.data(), to, xSize, ySize, bandCount, stride);
+                bool ok = true;
+                for (int y = 0; y < ySize; y++) {
+                    for (int x = 0; x < xSize; x++) {
+                        for (int b = 0; b < bandCount; b++) {
+                            ok = ok && dst[offsetOf(to, xSize, ySize, bandCount, stride, x, y, b)] == valueOf<T>(x, y, b);
+                        }
+                        for (int b = bandCount; to == Interleave::BIP && b < stride; b++) {
+                            ok = ok && dst[offsetOf(to, xSize, ySize, bandCount, stride, x, y, b)] ==
+                                    (from == to ? T(0) : untouched);
+                        }
+                    }
+                }
+                if (!ok) {
+                    std::cerr << "ConvertInterleave<" << sizeof(T) << "> " << static_cast<int>(from) << " -> "
+                              << static_cast<int>(to) << " (" << xSize << "x" << ySize << "x" << bandCount
+                              << (padded ? ", padded" : "") << ") mismatch" << std::endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testInterleave() {
+    bool ok = checkTranspose<uint8_t>() && checkTranspose<uint16_t>() &&
+              checkTranspose<float>() && checkTranspose<double>();
+
+    // 单个像素、单个波段、像素数不是分组宽度的整数倍、多波段
+    const int shapes[][3] = {{1, 1, 1}, {1, 1, 5}, {9, 1, 1}, {13, 7, 3}, {16, 2, 8}, {33, 5, 17}};
+    for (auto &s : shapes) {
+        for (bool padded : {false, true}) {
+            ok = ok && checkConvert<uint8_t>(s[0], s[1], s[2], padded) &&
+                 checkConvert<uint16_t>(s[0], s[1], s[2], padded) &&
+                 checkConvert<float>(s[0], s[1], s[2], padded) &&
+                 checkConvert<double>(s[0], s[1], s[2], padded);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 分块转置（rstool_transpose.h）及数据组织方式转换（ConvertInterleave）的测试
+
+#ifndef IMGPROCESS_TEST_INTERLEAVE_H
+#define IMGPROCESS_TEST_INTERLEAVE_H
+
+// 各种矩阵大小、元素大小的转置，以及 BSQ/BIL/BIP/BIP-N 之间（含光谱补齐）的相互转换，结果与逐元素计算一致时返回 true
+bool testInterleave();
+
+#endif //IMGPROCESS_TEST_INTERLEAVE_H
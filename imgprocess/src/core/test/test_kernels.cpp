@@ -0,0 +1,91 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_kernels.h"
+#include "rstool_kernels.h"
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+using namespace RSTool;
+
+namespace {
+
+    // 列数覆盖各指令集一次处理的列数（4、8、16）及尾部，ld 大于列数
+    const int Rows = 300000;
+    const int Cols = 19;
+    const size_t Ld = 21;
+
+    // 均值较大、偏差较小的数据：float 累加时列和及平方和的相对误差远大于 1e-6
+    float valueOf(int i, int j) {
+        return 1000.0f + j + 0.1f*((i*7 + j*3) % 11) - 0.5f;
+    }
+
+    bool close(double v, double expected, double relTol) {
+        return std::fabs(v - expected) <= relTol*std::fabs(expected);
+    }
+
+    bool checkColumnCenter(const KernelTable &kernels) {
+        std::vector<float> data(Rows*Ld);
+        for (int i = 0; i < Rows; i++) {
+            for (int j = 0; j < Cols; j++) data[i*Ld + j] = valueOf(i, j);
+        }
+
+        // 基准：按 double 逐列计算列和、列均值及去均值后的平方和
+        std::vector<double> sum(Cols), sumSq(Cols);
+        std::vector<float> mean(Cols);
+        for (int j = 0; j < Cols; j++) {
+            double s = 0;
+            for (int i = 0; i < Rows; i++) s += valueOf(i, j);
+            sum[j] = s;
+            mean[j] = static_cast<float>(s/Rows);
+
+            double sq = 0;
+            for (int i = 0; i < Rows; i++) {
+                double d = valueOf(i, j) - mean[j];
+                sq += d*d;
+            }
+            sumSq[j] = sq;
+        }
+
+        // 分两段累加，与按行条带处理时相同
+        std::vector<double> colSum(Cols, 0.0), colSumSq(Cols, 0.0);
+        kernels.columnSum(data.data(), Ld, Rows/3, Cols, colSum.data());
+        kernels.columnSum(data.data() + Rows/3*Ld, Ld, Rows - Rows/3, Cols, colSum.data());
+        kernels.columnCenter(data.data(), Ld, Rows/3, Cols, mean.data(), colSumSq.data());
+        kernels.columnCenter(data.data() + Rows/3*Ld, Ld, Rows - Rows/3, Cols, mean.data(), colSumSq.data());
+
+        for (int j = 0; j < Cols; j++) {
+            if (!close(colSum[j], sum[j], 1e-12) || !close(colSumSq[j], sumSq[j], 1e-9)) {
+                std::cerr << "columnSum/columnCenter (" << IsaName(kernels.isa) << ") column " << j
+                          << ": " << colSum[j] << "/" << colSumSq[j]
+                          << ", expected " << sum[j] << "/" << sumSq[j] << std::endl;
+                return false;
+            }
+        }
+
+        // 去均值后的数据，ld 之外的元素不变
+        for (int i = 0; i < Rows; i += 997) {
+            for (int j = 0; j < Cols; j++) {
+                if (data[i*Ld + j] != valueOf(i, j) - mean[j]) {
+                    std::cerr << "columnCenter (" << IsaName(kernels.isa) << ") data(" << i << ", " << j
+                              << ") = " << data[i*Ld + j] << ", expected " << valueOf(i, j) - mean[j] << std::endl;
+                    return false;
+                }
+            }
+            if (data[i*Ld + Cols] != 0.0f) return false;
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testColumnCenter() {
+    bool ok = true;
+    for (IsaLevel isa : {IsaLevel::Scalar, IsaLevel::SSE2, IsaLevel::AVX2, IsaLevel::AVX512}) {
+        if (isa > DetectIsaLevel()) break;
+        ok = checkColumnCenter(Detail::KernelTableOf(isa)) && ok;
+    }
+    return ok;
+}
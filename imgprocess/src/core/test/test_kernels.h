@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 计算核心（rstool_kernels.h）的测试
+
+#ifndef IMGPROCESS_TEST_KERNELS_H
+#define IMGPROCESS_TEST_KERNELS_H
+
+// 很高的列（数十万行）上，各指令集的 columnSum/columnCenter 与按 double 逐列计算的列和、去均值后的平方和一致时返回 true
+bool testColumnCenter();
+
+#endif //IMGPROCESS_TEST_KERNELS_H
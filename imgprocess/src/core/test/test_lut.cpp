@@ -0,0 +1,97 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_lut.h"
+#include "rstool_lut.h"
+#include <iostream>
+#include <vector>
+#include <limits>
+#include <stdexcept>
+
+using namespace RSTool;
+
+namespace {
+
+    // 表 t 的第 v 项
+    float entryOf(int t, int v) {
+        return t*10000.0f + v;
+    }
+
+    // 输入值对应的表项：超出范围时取最近的表项，NaN 取第 0 项，浮点输入截断小数部分
+    template <typename In>
+    int expectedIndex(In v, int entries) {
+        double d = static_cast<double>(v);
+        if (!(d > 0)) return 0;
+        return d >= entries - 1 ? entries - 1 : static_cast<int>(d);
+    }
+
+    template <typename In>
+    bool checkApply(const char *name, const PixelLut<float> &lut, const std::vector<In> &src) {
+        // 单张表及按列使用不同的表，长度覆盖 8 个一组的 gather 及尾部
+        for (size_t n : {src.size(), src.size() - 5, static_cast<size_t>(7)}) {
+            std::vector<float> dst(n), cols(n);
+            lut.apply(1, src.data(), dst.data(), n);
+            int width = std::min(static_cast<int>(n), lut.tables());
+            lut.applyColumns(src.data(), width, cols.data(), width, static_cast<int>(n) / width, width);
+            for (size_t i = 0; i < n; i++) {
+                float expected = entryOf(1, expectedIndex(src[i], lut.entries()));
+                float expectedCol = entryOf(static_cast<int>(i) % width, expectedIndex(src[i], lut.entries()));
+                bool inColumns = i < n / width * width;
+                if (dst[i] != expected || (inColumns && cols[i] != expectedCol)) {
+                    std::cerr << "PixelLut<" << name << "> (" << IsaName(ActiveIsaLevel()) << ") input "
+                              << static_cast<double>(src[i]) << " -> " << dst[i] << "/" << cols[i]
+                              << ", expected " << expected << "/" << expectedCol << std::endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool checkLut(int entries) {
+        PixelLut<float> lut(entries, 16);
+        lut.buildAll(entryOf);
+
+        std::vector<unsigned char> u8(301);
+        for (size_t i = 0; i < u8.size(); i++) u8[i] = static_cast<unsigned char>(i*37);
+
+        // 12 位数据中混入超过 4095 的值
+        std::vector<unsigned short> u16(301);
+        for (size_t i = 0; i < u16.size(); i++) u16[i] = static_cast<unsigned short>(i*997);
+
+        // 浮点输入：负数、小数、恰为最后一项、超出范围、不小于 2^31、无穷大及 NaN
+        const float inf = std::numeric_limits<float>::infinity();
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        const float specials[] = {-1e30f, -5.0f, -0.0f, 0.0f, 0.7f, 1.0f, 254.9f, 255.0f, 256.0f,
+                                  4094.5f, 4095.0f, 4096.0f, 2147483648.0f, 3e9f, 1e30f, inf, -inf, nan, -nan};
+        std::vector<float> f32;
+        for (int rep = 0; rep < 9; rep++) {
+            for (float v : specials) f32.push_back(v);
+            f32.push_back(static_cast<float>(rep*13));
+        }
+
+        return (entries != LutEntries8 || checkApply("uint8", lut, u8)) &&
+               checkApply("uint16", lut, u16) && checkApply("float", lut, f32);
+    }
+
+} // namespace
+
+bool testPixelLut() {
+    bool ok = true;
+    IsaLevel active = ActiveIsaLevel();
+    for (IsaLevel isa : {IsaLevel::Scalar, IsaLevel::AVX2}) {
+        if (isa > DetectIsaLevel()) break;
+        SetIsaLevel(isa);
+        ok = checkLut(LutEntries8) && checkLut(LutEntries12) && ok;
+    }
+    SetIsaLevel(active);
+
+    try {
+        PixelLut<float> invalid(0, 1);
+        std::cerr << "PixelLut accepts 0 entries" << std::endl;
+        ok = false;
+    } catch (const std::invalid_argument &) {
+    }
+    return ok;
+}
@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 查找表（rstool_lut.h）的测试
+
+#ifndef IMGPROCESS_TEST_LUT_H
+#define IMGPROCESS_TEST_LUT_H
+
+// 标量与 AVX2 查表的结果一致（包括超出表项范围、无穷大及 NaN 的浮点输入），且与逐元素计算一致时返回 true
+bool testPixelLut();
+
+#endif //IMGPROCESS_TEST_LUT_H
@@ -0,0 +1,124 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_lzw.h"
+#include "rstool_tiffwriter.h"
+#include <iostream>
+#include <vector>
+#include <random>
+
+using namespace RSTool;
+
+namespace {
+
+    /**
+     * TIFF LZW 解码（MSB 优先，码长比码表大小提前一个码字增加，与 libtiff 相同）
+     * @return  码流合法且以结束码结尾时返回 true
+     */
+    bool decodeLzw(const std::vector<unsigned char> &src, std::vector<unsigned char> &out, int &clears) {
+        const int CODE_CLEAR = 256, CODE_EOI = 257, CODE_FIRST = 258;
+        std::vector<std::vector<unsigned char>> table(4096);
+        for (int i = 0; i < 256; i++) table[i].assign(1, static_cast<unsigned char>(i));
+
+        out.clear();
+        clears = 0;
+        size_t bitPos = 0;
+        int nbits = 9;
+        auto get = [&](int &code) {
+            if (bitPos + nbits > src.size()*8) return false;
+            code = 0;
+            for (int k = 0; k < nbits; k++, bitPos++) {
+                code = (code << 1) | ((src[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+            }
+            return true;
+        };
+
+        int next = CODE_FIRST;
+        int prev = -1;
+        int code;
+        while (get(code)) {
+            if (code == CODE_EOI) return true;
+            if (code == CODE_CLEAR) {
+                clears++;
+                next = CODE_FIRST;
+                nbits = 9;
+                prev = -1;
+                continue;
+            }
+            if (prev < 0) {
+                if (code > 255) return false;
+                out.insert(out.end(), table[code].begin(), table[code].end());
+                prev = code;
+                continue;
+            }
+            if (code > next || next > 4095) return false;
+
+            std::vector<unsigned char> entry = table[prev];
+            entry.push_back(code < next ? table[code][0] : table[prev][0]);
+            table[next] = entry;
+            out.insert(out.end(), table[code].begin(), table[code].end());
+            if (++next >= (1 << nbits) - 1 && nbits < 12) nbits++;
+            prev = code;
+        }
+        return false;
+    }
+
+    bool roundTrip(const char *name, const std::vector<unsigned char> &data, int minClears) {
+        std::vector<unsigned char> packed, unpacked;
+        CompressLzw(data.data(), data.size(), packed);
+
+        // 码流以 9 位的清除码开始
+        if (packed.size() < 2 || packed[0] != 0x80) {
+            std::cerr << name << ": LZW stream does not start with a clear code" << std::endl;
+            return false;
+        }
+        int clears = 0;
+        if (!decodeLzw(packed, unpacked, clears)) {
+            std::cerr << name << ": invalid LZW stream" << std::endl;
+            return false;
+        }
+        if (unpacked != data) {
+            std::cerr << name << ": LZW round trip mismatch (" << data.size() << " -> "
+                      << unpacked.size() << " bytes)" << std::endl;
+            return false;
+        }
+        if (clears < minClears) {
+            std::cerr << name << ": expected at least " << minClears << " clear codes, got "
+                      << clears << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testCompressLzw() {
+    bool ok = true;
+    std::mt19937 rng(37);
+
+    ok = roundTrip("empty", std::vector<unsigned char>(), 1) && ok;
+    ok = roundTrip("single", std::vector<unsigned char>(1, 200), 1) && ok;
+
+    // 随机数据：几乎没有重复的串，码表约每 3800 个码字写满一次
+    std::vector<unsigned char> noise(200000);
+    for (unsigned char &v : noise) v = static_cast<unsigned char>(rng());
+    ok = roundTrip("random", noise, 10) && ok;
+
+    // 长游程：码字越来越长（包括 KwKwK 的情形：码字在定义前即被使用）
+    ok = roundTrip("zeros", std::vector<unsigned char>(1 << 20, 0), 1) && ok;
+
+    // 影像式的数据：小幅度的随机变化叠加在平缓的梯度上，码表多次写满
+    std::vector<unsigned char> image(300000);
+    for (size_t i = 0; i < image.size(); i++) {
+        image[i] = static_cast<unsigned char>((i / 512) % 200 + rng() % 4);
+    }
+    ok = roundTrip("image", image, 2) && ok;
+
+    // 码表恰好写满前后的长度
+    for (size_t len = 3830; len < 3850; len++) {
+        std::vector<unsigned char> data(noise.begin(), noise.begin() + len);
+        ok = roundTrip("boundary", data, 1) && ok;
+    }
+    return ok;
+}
@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// TIFF LZW 压缩（rstool_tiffwriter.h 中的 CompressLzw）的测试
+
+#ifndef IMGPROCESS_TEST_LZW_H
+#define IMGPROCESS_TEST_LZW_H
+
+// 空数据、随机数据（码表多次写满、输出清除码）及重复数据压缩后按 TIFF LZW 解码均与原数据一致时返回 true
+bool testCompressLzw();
+
+#endif //IMGPROCESS_TEST_LZW_H
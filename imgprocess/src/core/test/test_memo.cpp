@@ -0,0 +1,114 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_memo.h"
+#include "rstool_memo.h"
+#include <iostream>
+#include <vector>
+
+using namespace RSTool;
+
+namespace {
+
+    const int Bands = 5;
+
+    double score(const unsigned short *s) {
+        double v = 0;
+        for (int b = 0; b < Bands; b++) v = v*31 + s[b];
+        return v;
+    }
+
+    // 少量不同的光谱反复出现：每种光谱只计算一次，其余均命中；只比较前 Bands 个值（不包括补齐部分）
+    bool checkRepeated() {
+        SpectrumMemo<unsigned short, double> memo(Bands);
+        const int stride = 8;
+        std::vector<unsigned short> pixels(1000*stride);
+        for (int i = 0; i < 1000; i++) {
+            for (int b = 0; b < stride; b++) {
+                pixels[i*stride + b] = static_cast<unsigned short>(b < Bands ? (i % 10)*100 + b : i);
+            }
+        }
+
+        int calls = 0;
+        for (int i = 0; i < 1000; i++) {
+            const unsigned short *s = &pixels[i*stride];
+            double r = memo.eval(s, [&](const unsigned short *p) { calls++; return score(p); });
+            if (r != score(s)) {
+                std::cerr << "SpectrumMemo returns a wrong result for pixel " << i << std::endl;
+                return false;
+            }
+        }
+        if (calls != 10 || memo.lookups() != 1000 || memo.hits() != 990 || !memo.enabled()) {
+            std::cerr << "SpectrumMemo: " << calls << " calls, " << memo.hits() << "/" << memo.lookups()
+                      << " hits" << std::endl;
+            return false;
+        }
+
+        // 清空后重新计算
+        memo.clear();
+        memo.eval(&pixels[0], [&](const unsigned short *p) { calls++; return score(p); });
+        if (calls != 11) {
+            std::cerr << "SpectrumMemo::clear() keeps cached results" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // 不同的光谱远多于缓存项数：替换缓存项后结果仍然正确；窗口内命中率过低时关闭，retryAfter 个像素后重新开启
+    bool checkUniqueAndRetry() {
+        MemoPolicy policy;
+        policy.maxEntries = 64;
+        policy.window = 256;
+        policy.retryAfter = 1000;
+        SpectrumMemo<unsigned short, double> memo(Bands, policy);
+
+        unsigned short s[Bands];
+        for (int i = 0; i < 256; i++) {
+            for (int b = 0; b < Bands; b++) s[b] = static_cast<unsigned short>(i*7 + b*3);
+            if (memo.eval(s, score) != score(s)) {
+                std::cerr << "SpectrumMemo returns a wrong result after eviction" << std::endl;
+                return false;
+            }
+        }
+        if (memo.enabled()) {
+            std::cerr << "SpectrumMemo stays enabled without hits" << std::endl;
+            return false;
+        }
+
+        // 关闭期间直接计算，不统计
+        size_t lookups = memo.lookups();
+        for (int i = 0; i < 999; i++) {
+            if (memo.eval(s, score) != score(s)) return false;
+        }
+        if (memo.lookups() != lookups || memo.enabled()) {
+            std::cerr << "SpectrumMemo counts lookups while disabled" << std::endl;
+            return false;
+        }
+        memo.eval(s, score);
+        if (!memo.enabled()) {
+            std::cerr << "SpectrumMemo is not re-enabled after retryAfter pixels" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // 浮点光谱按字节比较：+0 与 -0 视为不同的光谱
+    bool checkFloatKeys() {
+        SpectrumMemo<float, int> memo(2);
+        const float pos[2] = {0.0f, 1.0f};
+        const float neg[2] = {-0.0f, 1.0f};
+        int a = memo.eval(pos, [](const float *) { return 1; });
+        int b = memo.eval(neg, [](const float *) { return 2; });
+        if (a != 1 || b != 2 || memo.hits() != 0) {
+            std::cerr << "SpectrumMemo treats -0 as +0" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+} // namespace
+
+bool testSpectrumMemo() {
+    return checkRepeated() && checkUniqueAndRetry() && checkFloatKeys();
+}
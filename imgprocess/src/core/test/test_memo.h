@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 光谱记忆化（rstool_memo.h）的测试
+
+#ifndef IMGPROCESS_TEST_MEMO_H
+#define IMGPROCESS_TEST_MEMO_H
+
+// SpectrumMemo 的结果始终与直接计算一致，相同的光谱只计算一次，命中率低时关闭并按时重新试探时返回 true
+bool testSpectrumMemo();
+
+#endif //IMGPROCESS_TEST_MEMO_H
@@ -0,0 +1,106 @@
+//
+// Created by penglei on 18-10-30.
+//
+
+#include "test_paddedwrite.h"
+#include "rstool_rawio.h"
+#include <iostream>
+#include <vector>
+#include <cstdio>
+
+using namespace RSTool;
+
+namespace {
+
+    const int ImgXSize = 20;
+    const int ImgYSize = 9;
+    const int Bands = 330;
+
+    float valueOf(int x, int y, int b) {
+        return static_cast<float>(b*1000 + y*ImgXSize + x);
+    }
+
+    bool checkFile(Interleave fileIntl, DataChunk<float> &chunk) {
+        const std::string file = "unit_tests_padded.dat";
+        bool ok = true;
+        {
+            std::shared_ptr<RawWriter> writer = RawWriter::Create(file, ImgXSize, ImgYSize, Bands, GDT_Float32, fileIntl);
+            ok = writer && writer->write(chunk);
+        }
+
+        std::shared_ptr<RawMappedImage> image = ok ? RawMappedImage::Open(file) : nullptr;
+        if (!image) {
+            std::cerr << "PaddedWrite: creating or writing " << file << " failed" << std::endl;
+            ok = false;
+        }
+
+        // 读回整幅影像：数据块范围内与原数据一致，范围外仍为 0
+        std::vector<int> bandMap(Bands);
+        for (int b = 0; b < Bands; b++) bandMap[b] = b + 1;
+        std::vector<float> all(static_cast<size_t>(ImgXSize)*ImgYSize*Bands, -1.0f);
+        if (ok && !image->read(0, 0, ImgXSize, ImgYSize, Bands, bandMap.data(), Interleave::BIP, all.data())) {
+            std::cerr << "PaddedWrite: reading " << file << " failed" << std::endl;
+            ok = false;
+        }
+
+        const DataDims &dims = chunk.dims();
+        for (int y = 0; ok && y < ImgYSize; y++) {
+            for (int x = 0; ok && x < ImgXSize; x++) {
+                bool inside = x >= dims.xOff() && x < dims.xOff() + dims.xSize() &&
+                              y >= dims.yOff() && y < dims.yOff() + dims.ySize();
+                for (int b = 0; b < Bands; b++) {
+                    float v = all[(static_cast<size_t>(y)*ImgXSize + x)*Bands + b];
+                    if (v != (inside ? valueOf(x, y, b) : 0.0f)) {
+                        std::cerr << "PaddedWrite: file interleave " << static_cast<int>(fileIntl)
+                                  << " mismatch at (" << x << ", " << y << ", " << b << "): " << v << std::endl;
+                        ok = false;
+                        break;
+                    }
+                }
+            }
+        }
+
+        image.reset();
+        std::remove(file.c_str());
+        std::remove(EnviHeaderFile(file).c_str());
+        return ok;
+    }
+
+} // namespace
+
+bool testPaddedWrite() {
+    DataChunk<float> chunk(SpatialDims(3, 2, 13, 5), SpectralDimes(Bands), Interleave::BIP, AllocPolicy(true));
+    if (!chunk.padded()) {
+        std::cerr << "PaddedWrite: " << Bands << " bands are not padded (stride " << chunk.stride() << ")" << std::endl;
+        return false;
+    }
+
+    // 补齐部分填充无效值，写出时不应出现在文件中
+    const DataDims &dims = chunk.dims();
+    std::fill(chunk.data(), chunk.data() + chunk.size(), -1.0f);
+    for (int y = 0; y < dims.ySize(); y++) {
+        for (int x = 0; x < dims.xSize(); x++) {
+            float *p = chunk.data() + (static_cast<size_t>(y)*dims.xSize() + x)*chunk.stride();
+            for (int b = 0; b < Bands; b++) {
+                p[b] = valueOf(dims.xOff() + x, dims.yOff() + y, b);
+            }
+        }
+    }
+
+    // UntilePixels 将补齐的数据转换为紧凑的 BIP
+    Interleave intl = Interleave::BIP;
+    const float *compact = UntilePixels(static_cast<const float*>(chunk.data()), intl,
+            dims.xSize(), dims.ySize(), Bands, chunk.stride());
+    bool ok = true;
+    for (int i = 0; ok && i < dims.xSize()*dims.ySize(); i++) {
+        for (int b = 0; b < Bands; b++) {
+            if (compact[static_cast<size_t>(i)*Bands + b] != chunk.data()[static_cast<size_t>(i)*chunk.stride() + b]) {
+                std::cerr << "PaddedWrite: UntilePixels mismatch at pixel " << i << ", band " << b << std::endl;
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    return checkFile(Interleave::BIP, chunk) && checkFile(Interleave::BSQ, chunk) && ok;
+}
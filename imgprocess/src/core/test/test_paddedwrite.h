@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 光谱补齐的 BIP 数据块（AllocPolicy(true)）写出的测试
+
+#ifndef IMGPROCESS_TEST_PADDEDWRITE_H
+#define IMGPROCESS_TEST_PADDEDWRITE_H
+
+// 330 个波段的补齐 BIP 数据块写到 BIP/BSQ 方式的 ENVI 文件后读回，与原数据一致（补齐部分不写出）时返回 true
+bool testPaddedWrite();
+
+#endif //IMGPROCESS_TEST_PADDEDWRITE_H
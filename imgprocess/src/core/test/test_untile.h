@@ -0,0 +1,12 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 像素分组（BIP8/BIP16）数据转换为 BIP（UntilePixels）的测试
+
+#ifndef IMGPROCESS_TEST_UNTILE_H
+#define IMGPROCESS_TEST_UNTILE_H
+
+// BIP8/BIP16（像素数不是分组宽度的整数倍）转换为紧凑的 BIP 后与逐元素的结果一致，其他组织方式原样返回时返回 true
+bool testUntilePixels();
+
+#endif //IMGPROCESS_TEST_UNTILE_H
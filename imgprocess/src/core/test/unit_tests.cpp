@@ -0,0 +1,41 @@
+//
+// Created by penglei on 18-10-30.
+//
+// 纯计算单元（不需要影像文件）的测试，由 make check 运行：任一测试失败时返回非 0
+
+#include "test_interleave.h"
+#include "test_convert.h"
+#include "test_paddedwrite.h"
+#include "test_half.h"
+#include "test_untile.h"
+#include "test_lut.h"
+#include "test_memo.h"
+#include "test_gridplan.h"
+#include "test_lzw.h"
+#include "test_kernels.h"
+#include <iostream>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const char *name, bool ok) {
+        std::cout << (ok ? "[  OK  ] " : "[FAILED] ") << name << std::endl;
+        if (!ok) failed++;
+    }
+
+} // namespace
+
+int main() {
+    check("interleave", testInterleave());
+    check("convert saturate", testConvertSaturate());
+    check("padded write", testPaddedWrite());
+    check("half", testHalf());
+    check("untile pixels", testUntilePixels());
+    check("pixel lut", testPixelLut());
+    check("spectrum memo", testSpectrumMemo());
+    check("plan chunk grid", testPlanChunkGrid());
+    check("lzw", testCompressLzw());
+    check("column center", testColumnCenter());
+    return failed == 0 ? 0 : 1;
+}